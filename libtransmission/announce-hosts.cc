@@ -0,0 +1,94 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <algorithm> // std::max, std::min
+#include <cstddef> // size_t
+#include <cstdint> // int64_t, uint64_t
+
+#include "libtransmission/announce-hosts.h"
+#include "libtransmission/interned-string.h"
+#include "libtransmission/tr-assert.h"
+
+bool tr_announce_hosts::try_start_request(tr_interned_string host_and_port, uint64_t now_msec)
+{
+    auto& host = hosts_[host_and_port];
+    if (host.in_flight >= static_cast<size_t>(host.max_in_flight))
+    {
+        ++host.queue_depth;
+        return false;
+    }
+
+    ++host.in_flight;
+    host.last_active_msec = now_msec;
+    return true;
+}
+
+void tr_announce_hosts::on_request_done(
+    tr_interned_string host_and_port,
+    uint64_t started_msec,
+    uint64_t now_msec,
+    bool succeeded)
+{
+    auto& host = hosts_[host_and_port];
+    TR_ASSERT(host.in_flight > 0U);
+    if (host.in_flight > 0U)
+    {
+        --host.in_flight;
+    }
+
+    host.last_active_msec = now_msec;
+
+    auto const latency = static_cast<int64_t>(now_msec - std::min(now_msec, started_msec));
+    if (succeeded)
+    {
+        host.latency_msec = host.latency_msec ? *host.latency_msec + (latency - *host.latency_msec) / 8 : latency;
+        host.min_latency_msec = std::min(host.min_latency_msec.value_or(latency), latency);
+    }
+
+    auto const slow_msec = std::max(SlowLatencyFloorMsec, host.min_latency_msec.value_or(0) * SlowLatencyFactor);
+    if (!succeeded || latency > slow_msec)
+    {
+        // Back off, but only once per round trip: the requests that were
+        // already in flight when we backed off will probably be slow too.
+        if (started_msec >= host.last_backoff_msec)
+        {
+            host.slow_start_threshold = std::max(1.0, host.max_in_flight / 2);
+            host.max_in_flight = host.slow_start_threshold;
+            host.last_backoff_msec = now_msec;
+        }
+    }
+    else if (host.max_in_flight < host.slow_start_threshold)
+    {
+        // Slow start: until the host first has trouble keeping up,
+        // double the limit each round trip so that a big backlog,
+        // e.g. after a restart, gets worked through quickly.
+        host.max_in_flight += 1.0;
+    }
+    else
+    {
+        // Additive increase: grow by one each round trip
+        host.max_in_flight += 1.0 / host.max_in_flight;
+    }
+
+    host.max_in_flight = std::min(host.max_in_flight, MaxRequestsPerHost);
+}
+
+void tr_announce_hosts::prune(uint64_t now_msec)
+{
+    for (auto iter = std::begin(hosts_); iter != std::end(hosts_);)
+    {
+        auto const& host = iter->second;
+        auto const is_idle = now_msec - std::min(now_msec, host.last_active_msec) >= IdleMsec;
+
+        if (host.in_flight == 0U && is_idle)
+        {
+            iter = hosts_.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
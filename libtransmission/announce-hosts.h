@@ -0,0 +1,91 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t, uint64_t
+#include <map>
+#include <optional>
+
+#include "libtransmission/interned-string.h"
+
+/**
+ * How many announces & scrapes each tracker host may have in flight at once.
+ *
+ * A host's limit starts at InitialRequestsPerHost and grows while the
+ * host keeps up, and is halved when a request fails or comes back slowly.
+ */
+class tr_announce_hosts
+{
+public:
+    static auto constexpr InitialRequestsPerHost = 4.0;
+    static auto constexpr MaxRequestsPerHost = 100.0;
+
+    // A response counts as slow if it took longer than SlowLatencyFactor times
+    // the fastest one we've had from that host, and longer than SlowLatencyFloorMsec.
+    static auto constexpr SlowLatencyFactor = int64_t{ 4 };
+    static auto constexpr SlowLatencyFloorMsec = int64_t{ 2000 };
+
+    // How long a host with nothing in flight is remembered. By then what
+    // we learned about it is stale, so it may as well start over from
+    // the default window.
+    static auto constexpr IdleMsec = uint64_t{ 60U * 60U * 1000U };
+
+    struct Host
+    {
+        // how many requests this host may have in flight, grown and shrunk AIMD-style
+        double max_in_flight = InitialRequestsPerHost;
+        double slow_start_threshold = MaxRequestsPerHost;
+
+        size_t in_flight = 0;
+
+        // how many due announces and scrapes the latest upkeep held back
+        // because this host had no free slots
+        size_t queue_depth = 0;
+
+        // smoothed response time, and the fastest response seen
+        std::optional<int64_t> latency_msec;
+        std::optional<int64_t> min_latency_msec;
+
+        uint64_t last_backoff_msec = 0;
+        uint64_t last_active_msec = 0;
+    };
+
+    [[nodiscard]] Host const* get(tr_interned_string host_and_port) const
+    {
+        auto const iter = hosts_.find(host_and_port);
+        return iter == std::end(hosts_) ? nullptr : &iter->second;
+    }
+
+    // @return true if `host_and_port` has a free slot, which the caller
+    // must give back with on_request_done() when the response arrives
+    [[nodiscard]] bool try_start_request(tr_interned_string host_and_port, uint64_t now_msec);
+
+    void on_request_done(tr_interned_string host_and_port, uint64_t started_msec, uint64_t now_msec, bool succeeded);
+
+    void clear_queue_depths()
+    {
+        for (auto& [key, host] : hosts_)
+        {
+            host.queue_depth = 0U;
+        }
+    }
+
+    // forget the hosts that have nothing in flight and haven't been used in IdleMsec
+    void prune(uint64_t now_msec);
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return std::size(hosts_);
+    }
+
+private:
+    std::map<tr_interned_string, Host> hosts_;
+};
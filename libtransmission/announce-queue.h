@@ -0,0 +1,118 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm> // std::push_heap, std::pop_heap
+#include <cstddef> // size_t
+#include <ctime> // time_t
+#include <functional> // std::greater
+#include <map>
+#include <tuple> // std::tie
+#include <vector>
+
+#include "libtransmission/transmission.h" // tr_torrent_id_t
+
+/**
+ * A min-heap of when each tracker tier next needs to announce or scrape,
+ * so that the announcer's upkeep doesn't have to walk every tier of every
+ * torrent.
+ *
+ * Entries aren't removed when a tier is rescheduled or freed; the stale
+ * ones are dropped when they reach the front.
+ */
+class tr_announce_queue
+{
+public:
+    struct Key
+    {
+        tr_torrent_id_t tor_id = {};
+        int tier_id = {};
+        bool is_scrape = {};
+
+        [[nodiscard]] bool operator<(Key const& that) const noexcept
+        {
+            return std::tie(tor_id, tier_id, is_scrape) < std::tie(that.tor_id, that.tier_id, that.is_scrape);
+        }
+
+        [[nodiscard]] bool operator==(Key const& that) const noexcept
+        {
+            return tor_id == that.tor_id && tier_id == that.tier_id && is_scrape == that.is_scrape;
+        }
+    };
+
+    // Queue `key` to come due at `when`, superseding any earlier schedule
+    // for it. A `when` of 0 means "not scheduled" and is ignored.
+    void schedule(Key const& key, time_t when)
+    {
+        if (when == 0)
+        {
+            return;
+        }
+
+        auto& queued_at = queued_at_[key];
+        if (queued_at == when)
+        {
+            return;
+        }
+
+        queued_at = when;
+        heap_.push_back({ when, key });
+        std::push_heap(std::begin(heap_), std::end(heap_), std::greater{});
+    }
+
+    // Remove the keys that are due by `now` and append them to `setme`,
+    // soonest first. Superseded entries are silently dropped.
+    void take_due(time_t now, std::vector<Key>& setme)
+    {
+        while (!std::empty(heap_) && heap_.front().when <= now)
+        {
+            std::pop_heap(std::begin(heap_), std::end(heap_), std::greater{});
+            auto const entry = heap_.back();
+            heap_.pop_back();
+
+            auto const iter = queued_at_.find(entry.key);
+            if (iter == std::end(queued_at_) || iter->second != entry.when)
+            {
+                continue;
+            }
+
+            queued_at_.erase(iter);
+            setme.push_back(entry.key);
+        }
+    }
+
+    // when `key` is next due, or 0 if it isn't queued
+    [[nodiscard]] time_t when(Key const& key) const noexcept
+    {
+        auto const iter = queued_at_.find(key);
+        return iter != std::end(queued_at_) ? iter->second : 0;
+    }
+
+    // the number of entries in the heap, including stale ones
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return std::size(heap_);
+    }
+
+private:
+    struct Entry
+    {
+        time_t when;
+        Key key;
+
+        [[nodiscard]] bool operator>(Entry const& that) const noexcept
+        {
+            return when > that.when;
+        }
+    };
+
+    std::vector<Entry> heap_;
+    std::map<Key, time_t> queued_at_;
+};
@@ -12,7 +12,9 @@
 #include <cstring> // memcpy()
 #include <ctime>
 #include <future>
+#include <iterator> // std::back_inserter
 #include <list>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
@@ -37,13 +39,17 @@
 #include "libtransmission/announcer.h"
 #include "libtransmission/announcer-common.h"
 #include "libtransmission/crypto-utils.h" // for tr_rand_obj()
+#include "libtransmission/file.h"
 #include "libtransmission/interned-string.h"
 #include "libtransmission/log.h"
 #include "libtransmission/net.h"
 #include "libtransmission/peer-mgr.h" // for tr_pex::fromCompact4()
+#include "libtransmission/quark.h"
 #include "libtransmission/tr-assert.h"
 #include "libtransmission/tr-buffer.h"
+#include "libtransmission/tr-strbuf.h"
 #include "libtransmission/utils.h"
+#include "libtransmission/variant.h"
 #include "libtransmission/web-utils.h"
 
 #define logwarn(interned, msg) tr_logAddWarn(msg, (interned).sv())
@@ -63,6 +69,9 @@ using PayloadBuffer = libtransmission::StackBuffer<4096, std::byte>;
 
 constexpr auto TauConnectionTtlSecs = time_t{ 45 };
 
+// BEP 15: "Up to about 74 torrents can be scraped at once."
+constexpr auto TauMaxScrapeHashes = size_t{ 74 };
+
 auto tau_transaction_new()
 {
     return tr_rand_obj<tau_transaction_t>();
@@ -79,6 +88,9 @@ enum tau_action_t
 
 // --- SCRAPE
 
+// A scrape that the announcer asked for. Its info hashes are sent in one or
+// more tau_scrape_batch datagrams, maybe alongside other scrapes to the same
+// tracker, and it's finished when all of those datagrams have been answered.
 struct tau_scrape_request
 {
     tau_scrape_request(tr_scrape_request const& in, tr_scrape_response_func on_response)
@@ -90,55 +102,112 @@ struct tau_scrape_request
         {
             this->response.rows[i].info_hash = in.info_hash[i];
         }
+    }
 
-        // build the payload
+    void add_batch() noexcept
+    {
+        ++n_pending_batches_;
+    }
+
+    void fail(bool did_connect, bool did_timeout, std::string_view errmsg)
+    {
+        failed_ = true;
+        response.did_connect = did_connect;
+        response.did_timeout = did_timeout;
+        response.errmsg = errmsg;
+        onBatchDone();
+    }
+
+    void onRows(int first_row, int n_rows, InBuf& buf)
+    {
+        if (!failed_)
+        {
+            response.did_connect = true;
+            response.did_timeout = false;
+        }
+
+        for (int i = first_row, end = first_row + n_rows; i < end && std::size(buf) >= sizeof(uint32_t) * 3U; ++i)
+        {
+            auto& row = response.rows[i];
+            row.seeders = buf.to_uint32();
+            row.downloads = buf.to_uint32();
+            row.leechers = buf.to_uint32();
+        }
+
+        onBatchDone();
+    }
+
+    tr_scrape_response response = {};
+
+private:
+    void onBatchDone()
+    {
+        TR_ASSERT(n_pending_batches_ > 0U);
+        if (--n_pending_batches_ == 0U && on_response_)
+        {
+            on_response_(response);
+        }
+    }
+
+    tr_scrape_response_func on_response_;
+
+    size_t n_pending_batches_ = 0U;
+
+    bool failed_ = false;
+};
+
+// One scrape datagram, carrying info hashes from one or more scrape requests.
+struct tau_scrape_batch
+{
+    tau_scrape_batch()
+    {
         auto buf = PayloadBuffer{};
         buf.add_uint32(TAU_ACTION_SCRAPE);
         buf.add_uint32(transaction_id);
-        for (int i = 0; i < in.info_hash_count; ++i)
-        {
-            buf.add(in.info_hash[i]);
-        }
-        this->payload.insert(std::end(this->payload), std::begin(buf), std::end(buf));
+        payload.insert(std::end(payload), std::begin(buf), std::end(buf));
     }
 
-    [[nodiscard]] auto has_callback() const noexcept
+    [[nodiscard]] constexpr auto n_hashes() const noexcept
     {
-        return !!on_response_;
+        return n_hashes_;
     }
 
-    void requestFinished() const
+    void add(std::shared_ptr<tau_scrape_request> const& request, int first_row, int n_rows)
     {
-        if (on_response_)
+        for (int i = first_row, end = first_row + n_rows; i < end; ++i)
         {
-            on_response_(response);
+            auto const& info_hash = request->response.rows[i].info_hash;
+            auto const* const begin = reinterpret_cast<std::byte const*>(std::data(info_hash));
+            payload.insert(std::end(payload), begin, begin + std::size(info_hash));
         }
+
+        n_hashes_ += static_cast<size_t>(n_rows);
+        request->add_batch();
+        slices_.push_back({ request, first_row, n_rows });
+    }
+
+    [[nodiscard]] constexpr auto has_callback() const noexcept
+    {
+        return true;
     }
 
     void fail(bool did_connect, bool did_timeout, std::string_view errmsg)
     {
-        response.did_connect = did_connect;
-        response.did_timeout = did_timeout;
-        response.errmsg = errmsg;
-        requestFinished();
+        for (auto const& slice : slices_)
+        {
+            slice.request->fail(did_connect, did_timeout, errmsg);
+        }
     }
 
     void onResponse(tau_action_t action, InBuf& buf)
     {
-        response.did_connect = true;
-        response.did_timeout = false;
-
         if (action == TAU_ACTION_SCRAPE)
         {
-            for (int i = 0; i < response.row_count && std::size(buf) >= sizeof(uint32_t) * 3U; ++i)
+            // the tracker answers in the same order that we asked
+            for (auto const& slice : slices_)
             {
-                auto& row = response.rows[i];
-                row.seeders = buf.to_uint32();
-                row.downloads = buf.to_uint32();
-                row.leechers = buf.to_uint32();
+                slice.request->onRows(slice.first_row, slice.n_rows, buf);
             }
-
-            requestFinished();
         }
         else
         {
@@ -155,14 +224,21 @@ struct tau_scrape_request
     std::vector<std::byte> payload;
 
     time_t sent_at = 0;
-    tau_transaction_t const transaction_id = tau_transaction_new();
-
-    tr_scrape_response response = {};
+    tau_transaction_t transaction_id = tau_transaction_new();
 
 private:
-    time_t const created_at_ = tr_time();
+    struct Slice
+    {
+        std::shared_ptr<tau_scrape_request> request;
+        int first_row;
+        int n_rows;
+    };
 
-    tr_scrape_response_func on_response_;
+    std::vector<Slice> slices_;
+
+    size_t n_hashes_ = 0U;
+
+    time_t created_at_ = tr_time();
 };
 
 // --- ANNOUNCE
@@ -266,7 +342,7 @@ struct tau_announce_request
     std::vector<std::byte> payload;
 
     time_t sent_at = 0;
-    tau_transaction_t const transaction_id = tau_transaction_new();
+    tau_transaction_t transaction_id = tau_transaction_new();
 
     tr_announce_response response = {};
 
@@ -289,7 +365,7 @@ private:
         }
     }
 
-    time_t const created_at_ = tr_time();
+    time_t created_at_ = tr_time();
 
     tr_announce_response_func on_response_;
 };
@@ -308,6 +384,11 @@ struct tau_tracker
     {
     }
 
+    [[nodiscard]] constexpr bool is_connected(time_t now) const noexcept
+    {
+        return connection_id != tau_connection_t{} && now < connection_expiration_time;
+    }
+
     void sendto(std::byte const* buf, size_t buflen)
     {
         TR_ASSERT(addr_);
@@ -320,6 +401,29 @@ struct tau_tracker
         mediator_.sendto(buf, buflen, reinterpret_cast<sockaddr const*>(&ss), sslen);
     }
 
+    // Queue a scrape, packing its info hashes into the datagrams that
+    // haven't been sent yet. They're sent on the next upkeep.
+    void scrape(tr_scrape_request const& in, tr_scrape_response_func on_response)
+    {
+        auto const request = std::make_shared<tau_scrape_request>(in, std::move(on_response));
+        auto const n_rows = request->response.row_count;
+        auto row = int{};
+
+        do
+        {
+            // unsent batches are always at the end, since they're all sent together
+            if (std::empty(scrapes) || scrapes.back().sent_at != 0 || scrapes.back().n_hashes() >= TauMaxScrapeHashes)
+            {
+                scrapes.emplace_back();
+            }
+
+            auto& batch = scrapes.back();
+            auto const n = std::min(n_rows - row, static_cast<int>(TauMaxScrapeHashes - batch.n_hashes()));
+            batch.add(request, row, n);
+            row += n;
+        } while (row < n_rows);
+    }
+
     void on_connection_response(tau_action_t action, InBuf& buf)
     {
         this->connecting_at = 0;
@@ -406,11 +510,6 @@ private:
     using Sockaddr = std::pair<sockaddr_storage, socklen_t>;
     using MaybeSockaddr = std::optional<Sockaddr>;
 
-    [[nodiscard]] constexpr bool is_connected(time_t now) const noexcept
-    {
-        return connection_id != tau_connection_t{} && now < connection_expiration_time;
-    }
-
     [[nodiscard]] static MaybeSockaddr lookup(tr_interned_string host, tr_port port, tr_interned_string logname)
     {
         auto szport = std::array<char, 16>{};
@@ -451,18 +550,19 @@ private:
 
     void failAll(bool did_connect, bool did_timeout, std::string_view errmsg)
     {
-        for (auto& req : this->scrapes)
+        // take them out of the queues first, since the callbacks may queue more
+        auto scrapes_to_fail = std::exchange(this->scrapes, {});
+        auto announces_to_fail = std::exchange(this->announces, {});
+
+        for (auto& req : scrapes_to_fail)
         {
             req.fail(did_connect, did_timeout, errmsg);
         }
 
-        for (auto& req : this->announces)
+        for (auto& req : announces_to_fail)
         {
             req.fail(did_connect, did_timeout, errmsg);
         }
-
-        this->scrapes.clear();
-        this->announces.clear();
     }
 
     ///
@@ -480,20 +580,27 @@ private:
     }
 
     template<typename T>
-    void timeout_requests(std::list<T>& requests, time_t now, std::string_view name)
+    void timeout_requests(std::vector<T>& requests, time_t now, std::string_view name)
     {
-        for (auto it = std::begin(requests); it != std::end(requests);)
+        auto const expired = std::stable_partition(
+            std::begin(requests),
+            std::end(requests),
+            [now](auto const& req) { return req.expiresAt() > now; });
+        if (expired == std::end(requests))
         {
-            if (auto& req = *it; req.expiresAt() <= now)
-            {
-                logtrace(this->key, fmt::format("timeout {} req {}", name, fmt::ptr(&req)));
-                req.fail(false, true, "");
-                it = requests.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
+            return;
+        }
+
+        // take them out of the queue first, since the callbacks may queue more
+        auto timed_out = std::vector<T>{};
+        timed_out.reserve(std::distance(expired, std::end(requests)));
+        std::move(expired, std::end(requests), std::back_inserter(timed_out));
+        requests.erase(expired, std::end(requests));
+
+        for (auto& req : timed_out)
+        {
+            logtrace(this->key, fmt::format("timeout {} req {}", name, fmt::ptr(&req)));
+            req.fail(false, true, "");
         }
     }
 
@@ -511,17 +618,15 @@ private:
     }
 
     template<typename T>
-    void send_requests(std::list<T>& reqs)
+    void send_requests(std::vector<T>& reqs)
     {
         auto const now = tr_time();
+        auto n_sent_without_callback = size_t{};
 
-        for (auto it = std::begin(reqs); it != std::end(reqs);)
+        for (auto& req : reqs)
         {
-            auto& req = *it;
-
             if (req.sent_at != 0) // it's already been sent; we're awaiting a response
             {
-                ++it;
                 continue;
             }
 
@@ -529,14 +634,21 @@ private:
             req.sent_at = now;
             send_request(std::data(req.payload), std::size(req.payload));
 
-            if (req.has_callback())
+            if (!req.has_callback())
             {
-                ++it;
-                continue;
+                ++n_sent_without_callback;
             }
+        }
 
-            // no response needed, so we can remove it now
-            it = reqs.erase(it);
+        // no response needed, so we can remove them now
+        if (n_sent_without_callback > 0U)
+        {
+            reqs.erase(
+                std::remove_if(
+                    std::begin(reqs),
+                    std::end(reqs),
+                    [](auto const& req) { return req.sent_at != 0 && !req.has_callback(); }),
+                std::end(reqs));
         }
     }
 
@@ -561,8 +673,8 @@ public:
     tau_connection_t connection_id = {};
     tau_transaction_t connection_transaction_id = {};
 
-    std::list<tau_announce_request> announces;
-    std::list<tau_scrape_request> scrapes;
+    std::vector<tau_announce_request> announces;
+    std::vector<tau_scrape_batch> scrapes;
 
 private:
     Mediator& mediator_;
@@ -584,6 +696,17 @@ public:
     explicit tr_announcer_udp_impl(Mediator& mediator)
         : mediator_{ mediator }
     {
+        load_connections();
+    }
+
+    tr_announcer_udp_impl(tr_announcer_udp_impl&&) = delete;
+    tr_announcer_udp_impl(tr_announcer_udp_impl const&) = delete;
+    tr_announcer_udp_impl& operator=(tr_announcer_udp_impl&&) = delete;
+    tr_announcer_udp_impl& operator=(tr_announcer_udp_impl const&) = delete;
+
+    ~tr_announcer_udp_impl() override
+    {
+        save_connections();
     }
 
     void announce(tr_announce_request const& request, tr_announce_response_func on_response) override
@@ -607,8 +730,15 @@ public:
             return;
         }
 
-        tracker->scrapes.emplace_back(request, std::move(on_response));
-        tracker->upkeep(false);
+        tracker->scrape(request, std::move(on_response));
+
+        // If we're already connected, leave the scrape queued until the
+        // next upkeep so that other scrapes to this tracker can share its
+        // datagram. Otherwise, start connecting now.
+        if (!tracker->is_connected(tr_time()))
+        {
+            tracker->upkeep(false);
+        }
     }
 
     void upkeep() override
@@ -661,8 +791,8 @@ public:
                     it != std::end(reqs))
                 {
                     logtrace(tracker.key, fmt::format("{} is an announce request!", transaction_id));
-                    auto req = *it;
-                    it = reqs.erase(it);
+                    auto req = std::move(*it);
+                    reqs.erase(it);
                     req.onResponse(action_id, buf);
                     return true;
                 }
@@ -678,8 +808,8 @@ public:
                     it != std::end(reqs))
                 {
                     logtrace(tracker.key, fmt::format("{} is a scrape request!", transaction_id));
-                    auto req = *it;
-                    it = reqs.erase(it);
+                    auto req = std::move(*it);
+                    reqs.erase(it);
                     req.onResponse(action_id, buf);
                     return true;
                 }
@@ -717,9 +847,94 @@ private:
         trackers_.emplace_back(mediator_, key, tr_interned_string(parsed->host), tr_port::from_host(parsed->port));
         auto* const tracker = &trackers_.back();
         logtrace(tracker->key, "New tau_tracker created");
+
+        // reuse the connection ID from an earlier session if it's still good
+        if (auto const iter = saved_connections_.find(key); iter != std::end(saved_connections_))
+        {
+            std::tie(tracker->connection_id, tracker->connection_expiration_time) = iter->second;
+            saved_connections_.erase(iter);
+            logdbg(tracker->key, fmt::format("Reusing connection ID {}", tracker->connection_id));
+        }
+
         return tracker;
     }
 
+    // --- connection IDs
+    // These are good for a minute, so remember them across a quick restart
+    // instead of shaking hands with every tracker again.
+
+    [[nodiscard]] std::string connections_filename() const
+    {
+        auto const config_dir = mediator_.config_dir();
+        return std::empty(config_dir) ? std::string{} : std::string{ tr_pathbuf{ config_dir, "/udp-trackers.dat"sv } };
+    }
+
+    void load_connections()
+    {
+        auto const filename = connections_filename();
+        if (std::empty(filename) || !tr_sys_path_exists(filename))
+        {
+            return;
+        }
+
+        auto const otop = tr_variant_serde::benc().parse_file(filename);
+        auto const* const top = otop ? otop->get_if<tr_variant::Map>() : nullptr;
+        if (top == nullptr)
+        {
+            return;
+        }
+
+        auto const now = tr_time();
+        for (auto const& [key, entry_var] : *top)
+        {
+            auto const* const entry = entry_var.get_if<tr_variant::Map>();
+            if (entry == nullptr)
+            {
+                continue;
+            }
+
+            auto const id = entry->value_if<int64_t>(TR_KEY_id);
+            auto const expires_at = entry->value_if<int64_t>(TR_KEY_expires_at);
+            if (id && expires_at && *expires_at > now)
+            {
+                saved_connections_.try_emplace(
+                    tr_interned_string{ key },
+                    static_cast<tau_connection_t>(*id),
+                    static_cast<time_t>(*expires_at));
+            }
+        }
+    }
+
+    void save_connections() const
+    {
+        auto const filename = connections_filename();
+        if (std::empty(filename))
+        {
+            return;
+        }
+
+        auto const now = tr_time();
+        auto top = tr_variant::Map{ std::size(trackers_) };
+        for (auto const& tracker : trackers_)
+        {
+            if (tracker.is_connected(now))
+            {
+                auto entry = tr_variant::Map{ 2U };
+                entry.try_emplace(TR_KEY_expires_at, tracker.connection_expiration_time);
+                entry.try_emplace(TR_KEY_id, static_cast<int64_t>(tracker.connection_id));
+                top.try_emplace(tracker.key.quark(), std::move(entry));
+            }
+        }
+
+        if (std::empty(top))
+        {
+            tr_sys_path_remove(filename);
+            return;
+        }
+
+        tr_variant_serde::benc().to_file(tr_variant{ std::move(top) }, filename);
+    }
+
     [[nodiscard]] static constexpr bool isResponseMessage(tau_action_t action, size_t msglen) noexcept
     {
         if (action == TAU_ACTION_CONNECT)
@@ -747,6 +962,9 @@ private:
 
     std::list<tau_tracker> trackers_;
 
+    // connection IDs saved by an earlier session for trackers we haven't used yet
+    std::map<tr_interned_string, std::pair<tau_connection_t, time_t>> saved_connections_;
+
     Mediator& mediator_;
 };
 
@@ -6,13 +6,16 @@
 #include <algorithm>
 #include <array>
 #include <chrono> // operator""ms
+#include <cstdint>
 #include <cstdio>
 #include <ctime>
 #include <deque>
+#include <functional>
 #include <iterator>
 #include <map>
 #include <memory>
 #include <numeric>
+#include <optional>
 #include <set>
 #include <string>
 #include <string_view>
@@ -25,7 +28,9 @@
 
 #include "libtransmission/transmission.h"
 
+#include "libtransmission/announce-hosts.h"
 #include "libtransmission/announce-list.h"
+#include "libtransmission/announce-queue.h"
 #include "libtransmission/announcer-common.h"
 #include "libtransmission/announcer.h"
 #include "libtransmission/crypto-utils.h" /* tr_rand_int() */
@@ -51,13 +56,13 @@ namespace
 /* unless the tracker says otherwise, rescrape this frequently */
 auto constexpr DefaultScrapeIntervalSec = int{ 60 * 30 };
 
+/* how long to wait before retrying a scrape that came due while
+ * the tier had no tracker that supports scraping */
+auto constexpr UnscrapableRetrySec = int{ 60 * 5 };
+
 /* the value of the 'numwant' argument passed in tracker requests. */
 auto constexpr Numwant = int{ 80 };
 
-/* how often to announce & scrape */
-auto constexpr MaxAnnouncesPerUpkeep = int{ 20 };
-auto constexpr MaxScrapesPerUpkeep = int{ 20 };
-
 /* how many infohashes to remove when we get a scrape-too-long error */
 auto constexpr TrMultiscrapeStep = int{ 5 };
 
@@ -109,6 +114,8 @@ struct tr_scrape_info
     }
 };
 
+struct tr_tier;
+
 /**
  * "global" (per-tr_session) fields
  */
@@ -152,6 +159,39 @@ public:
     void onAnnounceDone(int tier_id, tr_announce_event event, bool is_running_on_success, tr_announce_response const& response);
     void onScrapeDone(tr_scrape_response const& response);
 
+    // Tell upkeep when `tier` next needs to announce or scrape.
+    // Call these when its announceAt or scrapeAt changes, and when it
+    // finishes an announce or scrape that may have held up the other.
+    void scheduleAnnounce(tr_tier& tier);
+    void scheduleScrape(tr_tier& tier);
+
+    // Move the tiers whose announce or scrape is due out of the upkeep queue
+    void takeDueTiers(time_t now, std::vector<tr_tier*>& announce_me, std::vector<tr_tier*>& scrape_me);
+
+    // --- per-host concurrency
+
+    [[nodiscard]] tr_announce_hosts::Host const* trackerHost(tr_interned_string host_and_port) const
+    {
+        return hosts_.get(host_and_port);
+    }
+
+    // @return true if `host_and_port` has a free slot, which the caller
+    // must give back with onRequestDone() when the response arrives
+    [[nodiscard]] bool tryStartRequest(tr_interned_string host_and_port)
+    {
+        return hosts_.try_start_request(host_and_port, tr_time_msec());
+    }
+
+    void onRequestDone(tr_interned_string host_and_port, uint64_t started_msec, bool succeeded)
+    {
+        hosts_.on_request_done(host_and_port, started_msec, tr_time_msec(), succeeded);
+    }
+
+    void clearQueueDepths()
+    {
+        hosts_.clear_queue_depths();
+    }
+
     [[nodiscard]] tr_scrape_info* scrape_info(tr_interned_string url)
     {
         if (std::empty(url))
@@ -233,6 +273,10 @@ private:
 
     tr_announcer_udp& announcer_udp_;
 
+    tr_announce_queue upkeep_queue_;
+
+    tr_announce_hosts hosts_;
+
     std::map<tr_interned_string, tr_scrape_info> scrape_info_;
 
     std::unique_ptr<libtransmission::Timer> const upkeep_timer_;
@@ -389,8 +433,12 @@ tr_interned_string tr_announcerGetKey(tr_url_parsed_t const& parsed)
 /** @brief A group of trackers in a single tier, as per the multitracker spec */
 struct tr_tier
 {
-    tr_tier(tr_announcer_impl* announcer, tr_torrent* tor_in, std::vector<tr_announce_list::tracker_info const*> const& infos)
-        : tor{ tor_in }
+    tr_tier(
+        tr_announcer_impl* announcer_in,
+        tr_torrent* tor_in,
+        std::vector<tr_announce_list::tracker_info const*> const& infos)
+        : announcer{ announcer_in }
+        , tor{ tor_in }
     {
         trackers.reserve(std::size(infos));
         for (auto const* info : infos)
@@ -508,6 +556,7 @@ struct tr_tier
     void scheduleNextScrape(time_t interval_secs)
     {
         this->scrapeAt = getNextScrapeTime(tor->session, this, interval_secs);
+        announcer->scheduleScrape(*this);
     }
 
     std::deque<tr_announce_event> announce_events;
@@ -523,6 +572,8 @@ struct tr_tier
 
     std::optional<size_t> current_tracker_index_;
 
+    tr_announcer_impl* const announcer;
+
     tr_torrent* const tor;
 
     time_t scrapeAt = 0;
@@ -867,6 +918,7 @@ void tier_announce_event_push(tr_tier* tier, tr_announce_event e, time_t announc
     events.push_back(e);
     tier->announceAt = announce_at;
     tier_update_announce_priority(tier);
+    tier->announcer->scheduleAnnounce(*tier);
 
     tr_logAddTrace_tier_announce_queue(tier);
     tr_logAddTraceTier(tier, fmt::format("announcing in {} seconds", difftime(announce_at, tr_time())));
@@ -1174,6 +1226,10 @@ void tr_announcer_impl::onAnnounceDone(
             tier_announce_event_push(tier, TR_ANNOUNCE_EVENT_NONE, now + i);
         }
     }
+
+    // anything that came due while we were announcing can go now
+    scheduleAnnounce(*tier);
+    scheduleScrape(*tier);
 }
 
 void tr_announcer_impl::startTorrent(tr_torrent* tor)
@@ -1403,6 +1459,10 @@ void tr_announcer_impl::onScrapeDone(tr_scrape_response const& response)
 
             publishPeerCounts(tier, row.seeders, row.leechers);
         }
+
+        // anything that came due while we were scraping can go now
+        scheduleAnnounce(*tier);
+        scheduleScrape(*tier);
     }
 
     checkMultiscrapeMax(this, response);
@@ -1413,8 +1473,8 @@ namespace
 void multiscrape(tr_announcer_impl* announcer, std::vector<tr_tier*> const& tiers)
 {
     auto const now = tr_time();
-    auto requests = std::array<tr_scrape_request, MaxScrapesPerUpkeep>{};
-    auto request_count = size_t{};
+    auto requests = std::vector<tr_scrape_request>{};
+    auto request_hosts = std::vector<tr_interned_string>{};
 
     // batch as many info_hashes into a request as we can
     for (auto* tier : tiers)
@@ -1436,7 +1496,7 @@ void multiscrape(tr_announcer_impl* announcer, std::vector<tr_tier*> const& tier
         bool found = false;
 
         /* if there's a request with this scrape URL and a free slot, use it */
-        for (size_t j = 0; !found && j < request_count; ++j)
+        for (size_t j = 0, n = std::size(requests); !found && j < n; ++j)
         {
             auto* const req = &requests[j];
 
@@ -1457,31 +1517,33 @@ void multiscrape(tr_announcer_impl* announcer, std::vector<tr_tier*> const& tier
             found = true;
         }
 
-        /* otherwise, if there's room for another request, build a new one */
-        if (!found && request_count < MaxScrapesPerUpkeep)
+        /* otherwise, if the tracker host can take another request, build a new one */
+        if (!found && announcer->tryStartRequest(current_tracker->host_and_port))
         {
-            auto* const req = &requests[request_count];
+            auto* const req = &requests.emplace_back();
             req->scrape_url = scrape_info->scrape_url;
             req->log_name = tier->buildLogName();
+            request_hosts.emplace_back(current_tracker->host_and_port);
 
             req->info_hash[req->info_hash_count] = tier->tor->info_hash();
             ++req->info_hash_count;
             tier->isScraping = true;
             tier->lastScrapeStartTime = now;
-
-            ++request_count;
         }
     }
 
     /* send the requests we just built */
-    for (size_t i = 0; i < request_count; ++i)
+    auto const started_msec = tr_time_msec();
+    for (size_t i = 0, n = std::size(requests); i < n; ++i)
     {
         announcer->scrape(
             requests[i],
-            [session = announcer->session, announcer](tr_scrape_response const& response)
+            [session = announcer->session, announcer, host = request_hosts[i], started_msec](
+                tr_scrape_response const& response)
             {
                 if (session->announcer_)
                 {
+                    announcer->onRequestDone(host, started_msec, response.did_connect && !response.did_timeout);
                     announcer->onScrapeDone(response);
                 }
             });
@@ -1549,13 +1611,17 @@ void tierAnnounce(tr_announcer_impl* announcer, tr_tier* tier)
 
     auto tier_id = tier->id;
     auto is_running_on_success = tor->is_running();
+    auto host = tier->currentTracker()->host_and_port;
+    auto started_msec = tr_time_msec();
 
     announcer->announce(
         req,
-        [session = announcer->session, announcer, tier_id, event, is_running_on_success](tr_announce_response const& response)
+        [session = announcer->session, announcer, tier_id, event, is_running_on_success, host, started_msec](
+            tr_announce_response const& response)
         {
             if (session->announcer_)
             {
+                announcer->onRequestDone(host, started_msec, response.did_connect && !response.did_timeout);
                 announcer->onAnnounceDone(tier_id, event, is_running_on_success, response);
             }
         });
@@ -1568,21 +1634,8 @@ void scrapeAndAnnounceMore(tr_announcer_impl* announcer)
     /* build a list of tiers that need to be announced */
     auto announce_me = std::vector<tr_tier*>{};
     auto scrape_me = std::vector<tr_tier*>{};
-    for (auto* const tor : announcer->session->torrents())
-    {
-        for (auto& tier : tor->torrent_announcer->tiers)
-        {
-            if (tier.needsToAnnounce(now))
-            {
-                announce_me.push_back(&tier);
-            }
-
-            if (tier.needsToScrape(now))
-            {
-                scrape_me.push_back(&tier);
-            }
-        }
-    }
+    announcer->takeDueTiers(now, announce_me, scrape_me);
+    announcer->clearQueueDepths();
 
     /* First, scrape what we can. We handle scrapes first because
      * we can work through that queue much faster than announces
@@ -1590,27 +1643,91 @@ void scrapeAndAnnounceMore(tr_announcer_impl* announcer)
      * us which swarms are interesting and should be announced next. */
     multiscrape(announcer, scrape_me);
 
-    /* Second, announce what we can. If there aren't enough slots
-     * available, use compareAnnounceTiers to prioritize. */
-    if (announce_me.size() > MaxAnnouncesPerUpkeep)
+    // requeue the ones that didn't fit so they're tried again next upkeep
+    for (auto* const tier : scrape_me)
     {
-        std::partial_sort(
-            std::begin(announce_me),
-            std::begin(announce_me) + MaxAnnouncesPerUpkeep,
-            std::end(announce_me),
-            [](auto const* a, auto const* b) { return compareAnnounceTiers(a, b) < 0; });
-        announce_me.resize(MaxAnnouncesPerUpkeep);
+        if (!tier->isScraping)
+        {
+            announcer->scheduleScrape(*tier);
+        }
     }
 
-    for (auto*& tier : announce_me)
+    /* Second, announce what we can. If a tracker host doesn't have
+     * enough slots available, use compareAnnounceTiers to prioritize. */
+    std::sort(
+        std::begin(announce_me),
+        std::end(announce_me),
+        [](auto const* a, auto const* b) { return compareAnnounceTiers(a, b) < 0; });
+
+    for (auto* const tier : announce_me)
     {
-        tr_logAddTraceTier(tier, "Announcing to tracker");
-        tierAnnounce(announcer, tier);
+        if (announcer->tryStartRequest(tier->currentTracker()->host_and_port))
+        {
+            tr_logAddTraceTier(tier, "Announcing to tracker");
+            tierAnnounce(announcer, tier);
+        }
+        else
+        {
+            announcer->scheduleAnnounce(*tier);
+        }
     }
 }
 } // namespace upkeep_helpers
 } // namespace
 
+void tr_announcer_impl::scheduleAnnounce(tr_tier& tier)
+{
+    if (std::empty(tier.announce_events))
+    {
+        return;
+    }
+
+    upkeep_queue_.schedule({ tier.tor->id(), tier.id, false }, tier.announceAt);
+}
+
+void tr_announcer_impl::scheduleScrape(tr_tier& tier)
+{
+    upkeep_queue_.schedule({ tier.tor->id(), tier.id, true }, tier.scrapeAt);
+}
+
+void tr_announcer_impl::takeDueTiers(time_t now, std::vector<tr_tier*>& announce_me, std::vector<tr_tier*>& scrape_me)
+{
+    auto due = std::vector<tr_announce_queue::Key>{};
+    upkeep_queue_.take_due(now, due);
+
+    for (auto const& entry : due)
+    {
+        auto* const tor = session->torrents().get(entry.tor_id);
+        if (tor == nullptr || tor->torrent_announcer == nullptr)
+        {
+            continue;
+        }
+
+        auto* const tier = tor->torrent_announcer->getTier(entry.tier_id);
+        if (tier == nullptr)
+        {
+            continue;
+        }
+
+        // If the tier is busy, it'll be rescheduled when it's done.
+        if (entry.is_scrape && tier->needsToScrape(now))
+        {
+            scrape_me.push_back(tier);
+        }
+        else if (entry.is_scrape && !tier->isScraping && tier->scrapeAt != 0)
+        {
+            // No scrapable tracker yet, e.g. the tracker hasn't been
+            // picked or its scrape URL isn't known. Try again later
+            // instead of never scraping this tier again.
+            tier->scheduleNextScrape(UnscrapableRetrySec);
+        }
+        else if (!entry.is_scrape && tier->needsToAnnounce(now))
+        {
+            announce_me.push_back(tier);
+        }
+    }
+}
+
 void tr_announcer_impl::upkeep()
 {
     using namespace upkeep_helpers;
@@ -1626,6 +1743,8 @@ void tr_announcer_impl::upkeep()
         scrapeAndAnnounceMore(this);
     }
 
+    hosts_.prune(tr_time_msec());
+
     announcer_udp_.upkeep();
 }
 
@@ -1656,6 +1775,19 @@ namespace tracker_view_helpers
     view.leecherCount = tracker.leecher_count().value_or(-1);
     view.downloadCount = tracker.download_count().value_or(-1);
 
+    if (auto const* const host = tier.announcer->trackerHost(tracker.host_and_port); host != nullptr)
+    {
+        view.hostLatency = static_cast<int>(host->latency_msec.value_or(-1));
+        view.hostInFlight = host->in_flight;
+        view.hostMaxInFlight = static_cast<size_t>(host->max_in_flight);
+        view.hostQueueDepth = host->queue_depth;
+    }
+    else
+    {
+        view.hostLatency = -1;
+        view.hostMaxInFlight = static_cast<size_t>(tr_announce_hosts::InitialRequestsPerHost);
+    }
+
     if (view.isBackup)
     {
         view.scrapeState = TR_TRACKER_INACTIVE;
@@ -144,6 +144,9 @@ public:
         virtual ~Mediator() noexcept = default;
         virtual void sendto(void const* buf, size_t buflen, sockaddr const* addr, socklen_t addrlen) = 0;
         [[nodiscard]] virtual std::optional<tr_address> announce_ip() const = 0;
+
+        // where to keep state between sessions, or empty to not keep any
+        [[nodiscard]] virtual std::string_view config_dir() const = 0;
     };
 
     virtual ~tr_announcer_udp() noexcept = default;
@@ -4,7 +4,12 @@
 // License text can be found in the licenses/ folder.
 
 #include <algorithm>
+#include <cmath> // for std::ceil(), std::log()
 #include <initializer_list>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <random>
 #include <utility> // for std::swap()
 #include <vector>
 
@@ -81,6 +86,11 @@ tr_bandwidth::tr_bandwidth(tr_bandwidth* new_parent)
     this->set_parent(new_parent);
 }
 
+tr_bandwidth::~tr_bandwidth() noexcept
+{
+    deparent();
+}
+
 // ---
 
 namespace
@@ -134,127 +144,415 @@ void tr_bandwidth::set_parent(tr_bandwidth* new_parent)
 
 // ---
 
-void tr_bandwidth::allocate_bandwidth(
-    tr_priority_t parent_priority,
-    uint64_t period_msec,
-    std::vector<std::shared_ptr<tr_peerIo>>& peer_pool)
+// --- scheduling
+
+struct tr_bandwidth::Scheduler
 {
-    auto const priority = std::max(parent_priority, this->priority_);
+    // peer-ios that have something to do
+    std::array<std::vector<std::weak_ptr<tr_peerIo>>, 2> ready;
 
-    // set the available bandwidth
-    for (auto const dir : { TR_UP, TR_DOWN })
+    // peer-ios that are waiting for bandwidth
+    std::array<std::vector<std::weak_ptr<tr_peerIo>>, 2> waiting;
+
+    WakeupCallback wakeup;
+
+    // when wake() is due, or 0 if it isn't scheduled
+    uint64_t wake_at = 0U;
+};
+
+void tr_bandwidth::refill(Band& band, uint64_t const now) noexcept
+{
+    if (now <= band.refilled_at_)
+    {
+        return;
+    }
+
+    auto const elapsed_msec = static_cast<double>(now - band.refilled_at_);
+    band.tokens_ = std::min(capacity(band), band.tokens_ + band.desired_speed_bps_ * elapsed_msec / 1000.0);
+    band.refilled_at_ = now;
+}
+
+double tr_bandwidth::capacity(Band const& band) noexcept
+{
+    auto const burst = static_cast<double>(band.desired_speed_bps_) * BurstMSec / 1000.0;
+    return std::max(burst, static_cast<double>(MinBurstBytes));
+}
+
+uint64_t tr_bandwidth::msec_until_available(tr_direction const dir, uint64_t const now) const noexcept
+{
+    auto wait_msec = uint64_t{ 0U };
+
+    for (auto const* node = this; node != nullptr; node = node->band_[dir].honor_parent_limits_ ? node->parent_ : nullptr)
     {
-        if (auto& bandwidth = band_[dir]; bandwidth.is_limited_)
+        auto& band = node->band_[dir];
+        if (!band.is_limited_)
+        {
+            continue;
+        }
+
+        refill(band, now);
+        auto const wanted = std::min(static_cast<double>(Increment), capacity(band));
+        if (band.tokens_ >= wanted)
+        {
+            continue;
+        }
+
+        if (band.desired_speed_bps_ == 0U)
         {
-            auto const next_pulse_speed = bandwidth.desired_speed_bps_;
-            bandwidth.bytes_left_ = next_pulse_speed * period_msec / 1000U;
+            return MaxWaitMSec;
         }
+
+        auto const msec = std::ceil((wanted - band.tokens_) * 1000.0 / band.desired_speed_bps_);
+        wait_msec = std::max(wait_msec, static_cast<uint64_t>(msec));
+    }
+
+    return std::min(wait_msec, MaxWaitMSec);
+}
+
+tr_priority_t tr_bandwidth::effective_priority() const noexcept
+{
+    auto priority = priority_;
+
+    for (auto const* node = parent_; node != nullptr; node = node->parent_)
+    {
+        priority = std::max(priority, node->priority_);
     }
 
-    // add this bandwidth's peer, if any, to the peer pool
-    if (auto shared = this->peer_.lock(); shared)
+    return priority;
+}
+
+size_t tr_bandwidth::backlog(tr_direction const dir) const
+{
+    auto const* root = this;
+    while (root->parent_ != nullptr)
     {
-        shared->set_priority(priority);
-        peer_pool.push_back(std::move(shared));
+        root = root->parent_;
     }
 
-    // traverse & repeat for the subtree
-    for (auto* child : this->children_)
+    if (!root->scheduler_)
     {
-        child->allocate_bandwidth(priority, period_msec, peer_pool);
+        return {};
     }
+
+    auto const is_in_subtree = [this](tr_bandwidth const* node)
+    {
+        for (; node != nullptr; node = node->parent_)
+        {
+            if (node == this)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    auto n = size_t{};
+    for (auto const& weak : root->scheduler_->waiting[dir])
+    {
+        if (auto const shared = weak.lock(); shared && is_in_subtree(&shared->bandwidth()))
+        {
+            ++n;
+        }
+    }
+    return n;
 }
 
-void tr_bandwidth::phase_one(std::vector<tr_peerIo*>& peers, tr_direction dir)
+tr_bandwidth* tr_bandwidth::root() noexcept
 {
-    // First phase of IO. Tries to distribute bandwidth fairly to keep faster
-    // peers from starving the others.
-    tr_logAddTrace(fmt::format("{} peers to go round-robin for {}", peers.size(), dir == TR_UP ? "upload" : "download"));
+    auto* node = this;
+
+    while (node->parent_ != nullptr)
+    {
+        node = node->parent_;
+    }
+
+    return node;
+}
+
+tr_bandwidth::Scheduler& tr_bandwidth::scheduler()
+{
+    if (!scheduler_)
+    {
+        scheduler_ = std::make_unique<Scheduler>();
+    }
+
+    return *scheduler_;
+}
+
+void tr_bandwidth::set_wakeup_callback(WakeupCallback callback)
+{
+    scheduler().wakeup = std::move(callback);
+}
+
+void tr_bandwidth::schedule_wake(uint64_t const now, uint64_t const delay_msec)
+{
+    auto& sched = scheduler();
+
+    // if an earlier wake is already scheduled, it'll take care of this
+    if (auto const when = now + delay_msec; sched.wake_at == 0U || when < sched.wake_at)
+    {
+        sched.wake_at = when;
+
+        if (sched.wakeup)
+        {
+            sched.wakeup(delay_msec);
+        }
+    }
+}
+
+void tr_bandwidth::request_io(tr_direction const dir)
+{
+    TR_ASSERT(tr_isDirection(dir));
+
+    // nothing to schedule if there's no peer-io, e.g. for a torrent's bandwidth
+    auto& band = band_[dir];
+    if (band.is_ready_ || peer_.expired())
+    {
+        return;
+    }
+
+    band.is_ready_ = true;
+    auto* const root = this->root();
+    root->scheduler().ready[dir].push_back(peer_);
+    root->schedule_wake(tr_time_msec(), 0U);
+}
+
+void tr_bandwidth::wait_for_bandwidth(tr_direction const dir)
+{
+    TR_ASSERT(tr_isDirection(dir));
+
+    // nothing to schedule if there's no peer-io, e.g. for a torrent's bandwidth
+    auto& band = band_[dir];
+    if (band.is_waiting_ || peer_.expired())
+    {
+        return;
+    }
+
+    band.is_waiting_ = true;
+    auto* const root = this->root();
+    root->scheduler().waiting[dir].push_back(peer_);
 
-    // Shuffle the peers so they all have equal chance to be first in line.
+    auto const now = tr_time_msec();
+    root->schedule_wake(now, msec_until_available(dir, now));
+}
+
+namespace
+{
+namespace scheduling_helpers
+{
+// Shuffle `items` so that each one's chance to be first in line is
+// proportional to its weight. This is Efraimidis and Spirakis'
+// weighted random sampling.
+template<typename T, typename WeightFunc>
+void weighted_shuffle(std::vector<T>& items, WeightFunc const& weight)
+{
     thread_local auto urbg = tr_urbg<size_t>{};
-    std::shuffle(std::begin(peers), std::end(peers), urbg);
+    auto dist = std::uniform_real_distribution<double>{ std::numeric_limits<double>::min(), 1.0 };
+
+    auto keys = std::vector<std::pair<double, size_t>>{};
+    keys.reserve(std::size(items));
+    for (size_t i = 0, n = std::size(items); i < n; ++i)
+    {
+        keys.emplace_back(-std::log(dist(urbg)) / weight(items[i]), i);
+    }
+    std::sort(std::begin(keys), std::end(keys));
+
+    auto shuffled = std::vector<T>{};
+    shuffled.reserve(std::size(items));
+    for (auto const& [key, idx] : keys)
+    {
+        shuffled.emplace_back(std::move(items[idx]));
+    }
+    items = std::move(shuffled);
+}
+} // namespace scheduling_helpers
+} // namespace
 
-    // Give each peer `Increment` bandwidth bytes to use. Repeat this
-    // process until we run out of bandwidth and/or peers that can use it.
-    for (size_t n_unfinished = std::size(peers); n_unfinished > 0U;)
+tr_bandwidth const* tr_bandwidth::scheduling_class() const noexcept
+{
+    for (auto const* node = this; node != nullptr; node = node->parent_)
     {
-        for (size_t i = 0; i < n_unfinished;)
+        if (node->weight_ != 0U)
         {
-            // Value of 3000 bytes chosen so that when using µTP we'll send a full-size
-            // frame right away and leave enough buffered data for the next frame to go
-            // out in a timely manner.
-            static auto constexpr Increment = 3000U;
+            return node;
+        }
+    }
+
+    return nullptr;
+}
+
+void tr_bandwidth::flush_fair(std::vector<std::pair<tr_peerIo*, size_t>>& peers, tr_direction dir, uint64_t now)
+{
+    using namespace scheduling_helpers;
+
+    tr_logAddTrace(fmt::format("{} peers to go round-robin for {}", peers.size(), dir == TR_UP ? "upload" : "download"));
 
-            auto const bytes_used = peers[i]->flush(dir, Increment);
-            tr_logAddTrace(fmt::format("peer #{} of {} used {} bytes in this pass", i, n_unfinished, bytes_used));
+    struct Class
+    {
+        tr_bandwidth const* node = nullptr;
+        std::vector<std::pair<tr_peerIo*, size_t>> peers;
+        size_t n_unfinished = 0U;
+        size_t next = 0U;
+        double weight = DefaultWeight;
+        double deficit = 0.0;
+        bool is_below_guarantee = false;
+    };
+
+    // sort the peers into their scheduling classes, e.g. bandwidth groups
+    auto classes = std::vector<Class>{};
+    for (auto const& peer : peers)
+    {
+        auto const* const node = peer.first->bandwidth().scheduling_class();
+        auto it = std::find_if(std::begin(classes), std::end(classes), [node](auto const& cls) { return cls.node == node; });
+        if (it == std::end(classes))
+        {
+            auto& cls = classes.emplace_back();
+            cls.node = node;
 
-            if (bytes_used != Increment)
+            if (node != nullptr)
             {
-                // peer is done writing for now; move it to the end of the list
-                std::swap(peers[i], peers[n_unfinished - 1]);
-                --n_unfinished;
+                cls.weight = node->weight_;
+
+                auto const guaranteed = node->band_[dir].guaranteed_speed_bps_;
+                cls.is_below_guarantee = guaranteed > 0U && node->get_piece_speed_bytes_per_second(now, dir) < guaranteed;
             }
-            else
+
+            it = std::prev(std::end(classes));
+        }
+
+        it->peers.push_back(peer);
+    }
+
+    // Within a class, higher priority peers are more likely to go first.
+    // Classes that haven't reached their guaranteed speed go first,
+    // then the rest in a random order weighted by their weights.
+    for (auto& cls : classes)
+    {
+        weighted_shuffle(cls.peers, [](auto const& peer) { return static_cast<double>(peer.second); });
+        cls.n_unfinished = std::size(cls.peers);
+    }
+    weighted_shuffle(classes, [](Class const& cls) { return cls.weight; });
+    std::stable_partition(std::begin(classes), std::end(classes), [](Class const& cls) { return cls.is_below_guarantee; });
+
+    // Deficit round robin: each round, every class can move `Quantum` bytes
+    // per unit of weight, shared round-robin between its peers. Repeat until
+    // we run out of bandwidth and/or peers that can use it.
+    for (auto n_active = std::size(classes); n_active > 0U;)
+    {
+        for (auto& cls : classes)
+        {
+            if (cls.n_unfinished == 0U)
+            {
+                continue;
+            }
+
+            cls.deficit = cls.is_below_guarantee ? std::numeric_limits<double>::max() :
+                                                   cls.deficit + Quantum * cls.weight;
+
+            while (cls.n_unfinished > 0U && cls.deficit >= 1.0)
+            {
+                auto const idx = cls.next % cls.n_unfinished;
+                auto const [io, share] = cls.peers[idx];
+                auto const wanted = static_cast<size_t>(std::min(static_cast<double>(share), cls.deficit));
+                auto const bytes_used = io->flush(dir, wanted);
+                tr_logAddTrace(fmt::format("peer #{} of {} used {} bytes in this pass", idx, cls.n_unfinished, bytes_used));
+                cls.deficit -= static_cast<double>(bytes_used);
+
+                if (bytes_used != wanted)
+                {
+                    // peer is done for now; move it to the end of the list
+                    std::swap(cls.peers[idx], cls.peers[cls.n_unfinished - 1U]);
+                    --cls.n_unfinished;
+                }
+                else
+                {
+                    ++cls.next;
+                }
+            }
+
+            if (cls.n_unfinished == 0U)
             {
-                ++i;
+                --n_active;
             }
         }
     }
 }
 
-void tr_bandwidth::allocate(uint64_t period_msec)
+void tr_bandwidth::wake(uint64_t const now_msec)
 {
-    // keep these peers alive for the scope of this function
-    auto refs = std::vector<std::shared_ptr<tr_peerIo>>{};
+    TR_ASSERT(parent_ == nullptr);
 
-    auto peer_arrays = std::array<std::vector<tr_peerIo*>, 3>{};
-    auto& high = peer_arrays[0];
-    auto& normal = peer_arrays[1];
-    auto& low = peer_arrays[2];
+    auto& sched = scheduler();
+    sched.wake_at = 0U;
 
-    // allocateBandwidth () is a helper function with two purposes:
-    // 1. allocate bandwidth to b and its subtree
-    // 2. accumulate an array of all the peerIos from b and its subtree.
-    this->allocate_bandwidth(TR_PRI_LOW, period_msec, refs);
+    // keep these peers alive for the scope of this function
+    auto refs = std::vector<std::shared_ptr<tr_peerIo>>{};
+    auto next_wake_msec = std::optional<uint64_t>{};
 
-    for (auto const& io : refs)
+    for (auto const dir : { TR_UP, TR_DOWN })
     {
-        io->flush_outgoing_protocol_msgs();
+        auto peers = std::vector<std::pair<tr_peerIo*, size_t>>{};
+
+        auto ready = std::move(sched.ready[dir]);
+        sched.ready[dir] = {};
+        for (auto const& weak : ready)
+        {
+            if (auto shared = weak.lock(); shared)
+            {
+                shared->bandwidth().band_[dir].is_ready_ = false;
+                peers.emplace_back(shared.get(), 0U);
+                refs.push_back(std::move(shared));
+            }
+        }
 
-        switch (io->priority())
+        // wake the waiting peers that have bandwidth now
+        auto waiting = std::move(sched.waiting[dir]);
+        sched.waiting[dir] = {};
+        for (auto& weak : waiting)
         {
-        case TR_PRI_HIGH:
-            high.push_back(io.get());
-            [[fallthrough]];
+            auto shared = weak.lock();
+            if (!shared)
+            {
+                continue;
+            }
 
-        case TR_PRI_NORMAL:
-            normal.push_back(io.get());
-            [[fallthrough]];
+            auto& bandwidth = shared->bandwidth();
+            if (auto const wait_msec = bandwidth.msec_until_available(dir, now_msec); wait_msec > 0U)
+            {
+                sched.waiting[dir].push_back(std::move(weak));
+                next_wake_msec = std::min(next_wake_msec.value_or(wait_msec), wait_msec);
+                continue;
+            }
 
-        default:
-            low.push_back(io.get());
+            bandwidth.band_[dir].is_waiting_ = false;
+            peers.emplace_back(shared.get(), 0U);
+            refs.push_back(std::move(shared));
         }
-    }
 
-    // First phase of IO. Tries to distribute bandwidth fairly to keep faster
-    // peers from starving the others. Loop through the peers, giving each a
-    // small chunk of bandwidth. Keep looping until we run out of bandwidth
-    // and/or peers that can use it
-    for (auto& peers : peer_arrays)
-    {
-        phase_one(peers, TR_UP);
-        phase_one(peers, TR_DOWN);
+        // a peer can be both ready and waiting
+        std::sort(std::begin(peers), std::end(peers));
+        peers.erase(std::unique(std::begin(peers), std::end(peers)), std::end(peers));
+
+        // higher priority peers get a bigger share each round
+        for (auto& [io, share] : peers)
+        {
+            auto const priority = io->bandwidth().effective_priority();
+            io->set_priority(priority);
+            share = Increment << (priority - TR_PRI_LOW);
+
+            if (dir == TR_UP)
+            {
+                io->flush_outgoing_protocol_msgs();
+            }
+        }
+
+        flush_fair(peers, dir, now_msec);
     }
 
-    // Second phase of IO. To help us scale in high bandwidth situations,
-    // enable on-demand IO for peers with bandwidth left to burn.
-    // This on-demand IO is enabled until (1) the peer runs out of bandwidth,
-    // or (2) the next tr_bandwidth::allocate () call, when we start over again.
-    for (auto const& io : refs)
+    if (next_wake_msec)
     {
-        io->set_enabled(TR_UP, io->has_bandwidth_left(TR_UP));
-        io->set_enabled(TR_DOWN, io->has_bandwidth_left(TR_DOWN));
+        schedule_wake(now_msec, *next_wake_msec);
     }
 }
 
@@ -264,9 +562,10 @@ size_t tr_bandwidth::clamp(tr_direction const dir, size_t byte_count) const noex
 {
     TR_ASSERT(tr_isDirection(dir));
 
-    if (this->band_[dir].is_limited_)
+    if (auto& band = this->band_[dir]; band.is_limited_)
     {
-        byte_count = std::min(byte_count, this->band_[dir].bytes_left_);
+        refill(band, tr_time_msec());
+        byte_count = std::min(byte_count, static_cast<size_t>(band.tokens_));
     }
 
     if (this->parent_ != nullptr && this->band_[dir].honor_parent_limits_ && byte_count > 0)
@@ -285,7 +584,7 @@ void tr_bandwidth::notify_bandwidth_consumed(tr_direction dir, size_t byte_count
 
     if (band->is_limited_ && is_piece_data)
     {
-        band->bytes_left_ -= std::min(band->bytes_left_, byte_count);
+        band->tokens_ = std::max(0.0, band->tokens_ - static_cast<double>(byte_count));
     }
 
 #ifdef DEBUG_DIRECTION
@@ -12,6 +12,7 @@
 #include <array>
 #include <cstddef> // size_t
 #include <cstdint> // uint64_t
+#include <functional>
 #include <memory>
 #include <utility> // for std::move()
 #include <vector>
@@ -62,17 +63,27 @@ struct tr_bandwidth_limits
  *
  * CONSTRAINING
  *
- *   Call `tr_bandwidth::allocate()` periodically. `tr_bandwidth` knows its current
- *   speed and will decide how many bytes to make available over the
- *   user-specified period to reach the user-specified desired speed.
- *   If appropriate, it notifies its peer-ios that new bandwidth is available.
- *
- *   `tr_bandwidth::allocate()` operates on the `tr_bandwidth` subtree, so usually
- *   you'll only need to invoke it for the top-level `tr_session` bandwidth.
+ *   Each limited `tr_bandwidth` is a token bucket that refills continuously at
+ *   its desired speed and holds at most a fraction of a second's worth of
+ *   bytes, so limits are smooth instead of arriving in bursts.
  *
  *   The peer-ios all have a pointer to their associated `tr_bandwidth` object,
  *   and call `tr_bandwidth::clamp()` before performing I/O to see how much
- *   bandwidth they can safely use.
+ *   bandwidth they can safely use. A peer-io that has queued data to send
+ *   calls `tr_bandwidth::request_io()`, and one that ran out of bandwidth calls
+ *   `tr_bandwidth::wait_for_bandwidth()`.
+ *
+ *   The root of the tree keeps those peer-ios until `tr_bandwidth::wake()`
+ *   is called on it and flushes them. The root tells its owner when that
+ *   needs to happen with the callback set by `set_wakeup_callback()`, so
+ *   nothing runs while all the peer-ios are idle or waiting for bandwidth.
+ *   Priorities are weighted rather than strictly ordered: each round, a
+ *   high-priority peer-io gets to move more bytes than a low-priority one.
+ *
+ *   Subtrees with a weight, e.g. bandwidth groups, are scheduling classes.
+ *   `wake()` shares bandwidth between the classes with deficit round robin
+ *   so that, when they compete for a parent's limit, each gets its weight's
+ *   share. A class that's slower than its guaranteed speed goes first.
  */
 struct tr_bandwidth
 {
@@ -81,7 +92,31 @@ private:
     static constexpr size_t GranularityMSec = 250U;
     static constexpr size_t HistorySize = HistoryMSec / GranularityMSec;
 
+    // a limited bandwidth holds at most this many milliseconds' worth of bytes
+    static constexpr uint64_t BurstMSec = 250U;
+    static constexpr size_t MinBurstBytes = 4096U;
+
+    // Peer-ios handed to wake() move this many bytes per round, times the
+    // weight of their priority. 3000 bytes is enough that µTP sends a
+    // full-size frame right away and keeps enough buffered for the next.
+    static constexpr size_t Increment = 3000U;
+
+    // waiting peer-ios are checked at least this often, e.g. in case a limit was raised
+    static constexpr uint64_t MaxWaitMSec = 500U;
+
+    // how many bytes a scheduling class can move per round, per unit of weight
+    static constexpr size_t Quantum = Increment * 4U;
+
 public:
+    // the weight of peer-ios that aren't in a weighted subtree, e.g. a bandwidth group
+    static constexpr unsigned int DefaultWeight = 1U;
+
+    // the biggest weight a scheduling class can have
+    static constexpr unsigned int MaxWeight = 1000U;
+
+    // Asks the owner of the root bandwidth to call `wake()` on it in `delay_msec`.
+    using WakeupCallback = std::function<void(uint64_t delay_msec)>;
+
     explicit tr_bandwidth(tr_bandwidth* new_parent);
 
     tr_bandwidth()
@@ -89,10 +124,7 @@ public:
     {
     }
 
-    ~tr_bandwidth() noexcept
-    {
-        deparent();
-    }
+    ~tr_bandwidth() noexcept;
 
     tr_bandwidth& operator=(tr_bandwidth&&) = delete;
     tr_bandwidth& operator=(tr_bandwidth) = delete;
@@ -114,9 +146,24 @@ public:
     void notify_bandwidth_consumed(tr_direction dir, size_t byte_count, bool is_piece_data, uint64_t now);
 
     /**
-     * @brief allocate the next `period_msec`'s worth of bandwidth for the peer-ios to consume
+     * @brief This bandwidth's peer-io has something to do in `dir`, e.g. new data to send.
+     * It will be flushed the next time the root's `wake()` is called.
      */
-    void allocate(uint64_t period_msec);
+    void request_io(tr_direction dir);
+
+    /**
+     * @brief This bandwidth's peer-io couldn't do I/O in `dir` because `clamp()` returned 0.
+     * It will be flushed by the first `wake()` after bandwidth is available again.
+     */
+    void wait_for_bandwidth(tr_direction dir);
+
+    /**
+     * @brief Flush the peer-ios that requested I/O or that were waiting for bandwidth that's now available.
+     * Call this on the root of the tree when its wakeup callback asks for it.
+     */
+    void wake(uint64_t now_msec);
+
+    void set_wakeup_callback(WakeupCallback callback);
 
     void set_parent(tr_bandwidth* new_parent);
 
@@ -153,8 +200,9 @@ public:
 
     /**
      * @brief Set the desired speed for this bandwidth subtree.
-     * @see `tr_bandwidth::allocate`
-     * @see `tr_bandwidth::getDesiredSpeed`
+     * @see `tr_bandwidth::clamp`
+     * @see `tr_bandwidth::wake`
+     * @see `tr_bandwidth::get_desired_speed_bytes_per_second`
      */
     constexpr bool set_desired_speed_bytes_per_second(tr_direction dir, tr_bytes_per_second_t desired_speed)
     {
@@ -229,6 +277,39 @@ public:
 
     void set_limits(tr_bandwidth_limits const& limits);
 
+    /**
+     * @brief Make this subtree a scheduling class, e.g. a bandwidth group.
+     * When the peer-ios in different classes compete for bandwidth,
+     * e.g. for the session's speed limit, they get it in proportion to
+     * their classes' weights. 0 makes the subtree part of its parent's class.
+     */
+    constexpr void set_weight(unsigned int weight) noexcept
+    {
+        weight_ = weight;
+    }
+
+    [[nodiscard]] constexpr auto weight() const noexcept
+    {
+        return weight_;
+    }
+
+    /**
+     * @brief Set the speed a scheduling class gets before its weight is considered.
+     * While the class is slower than this, its peer-ios get bandwidth before any other class's.
+     */
+    constexpr void set_guaranteed_speed_bytes_per_second(tr_direction dir, tr_bytes_per_second_t speed) noexcept
+    {
+        band_[dir].guaranteed_speed_bps_ = speed;
+    }
+
+    [[nodiscard]] constexpr auto get_guaranteed_speed_bytes_per_second(tr_direction dir) const noexcept
+    {
+        return band_[dir].guaranteed_speed_bps_;
+    }
+
+    /** @brief Get how many peer-ios in this subtree are waiting for bandwidth. */
+    [[nodiscard]] size_t backlog(tr_direction dir) const;
+
 private:
     struct RateControl
     {
@@ -243,14 +324,40 @@ private:
     {
         RateControl raw_;
         RateControl piece_;
-        size_t bytes_left_;
+        double tokens_;
+        uint64_t refilled_at_;
         tr_bytes_per_second_t desired_speed_bps_;
+        tr_bytes_per_second_t guaranteed_speed_bps_;
         bool is_limited_ = false;
         bool honor_parent_limits_ = true;
+
+        // whether this bandwidth's peer-io is queued in the root's scheduler
+        bool is_ready_ = false;
+        bool is_waiting_ = false;
     };
 
+    struct Scheduler;
+
     static tr_bytes_per_second_t get_speed_bytes_per_second(RateControl& r, unsigned int interval_msec, uint64_t now);
 
+    static void refill(Band& band, uint64_t now) noexcept;
+
+    [[nodiscard]] static double capacity(Band const& band) noexcept;
+
+    // @return how long until every limit between here and the root allows an `Increment`
+    [[nodiscard]] uint64_t msec_until_available(tr_direction dir, uint64_t now) const noexcept;
+
+    [[nodiscard]] tr_priority_t effective_priority() const noexcept;
+
+    // @return the nearest weighted subtree that this is in, or nullptr
+    [[nodiscard]] tr_bandwidth const* scheduling_class() const noexcept;
+
+    [[nodiscard]] tr_bandwidth* root() noexcept;
+
+    Scheduler& scheduler();
+
+    void schedule_wake(uint64_t now, uint64_t delay_msec);
+
     [[nodiscard]] constexpr auto* parent() noexcept
     {
         return parent_;
@@ -260,17 +367,17 @@ private:
 
     static void notify_bandwidth_consumed_bytes(uint64_t now, RateControl& r, size_t size);
 
-    static void phase_one(std::vector<tr_peerIo*>& peers, tr_direction dir);
-
-    void allocate_bandwidth(
-        tr_priority_t parent_priority,
-        uint64_t period_msec,
-        std::vector<std::shared_ptr<tr_peerIo>>& peer_pool);
+    static void flush_fair(std::vector<std::pair<tr_peerIo*, size_t>>& peers, tr_direction dir, uint64_t now);
 
     mutable std::array<Band, 2> band_ = {};
     std::vector<tr_bandwidth*> children_;
     tr_bandwidth* parent_ = nullptr;
     std::weak_ptr<tr_peerIo> peer_;
+
+    // only used by the root
+    std::unique_ptr<Scheduler> scheduler_;
+
+    unsigned int weight_ = 0U;
     tr_priority_t priority_ = 0;
 };
 
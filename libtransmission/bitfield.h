@@ -116,6 +116,9 @@ public:
     tr_bitfield& operator&=(tr_bitfield const& that) noexcept;
     [[nodiscard]] bool intersects(tr_bitfield const& that) const noexcept;
 
+    // @return how many bits are set in both `this` and `that`
+    [[nodiscard]] size_t count_intersection(tr_bitfield const& that) const noexcept;
+
 private:
     [[nodiscard]] size_t count_flags() const noexcept;
     [[nodiscard]] size_t count_flags(size_t begin, size_t end) const noexcept;
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <cerrno>
 #include <cstdint> // uint8_t
+#include <functional>
 #include <iterator> // std::distance(), std::next(), std::prev()
 #include <memory>
 #include <numeric> // std::accumulate()
@@ -24,6 +25,7 @@
 #include "libtransmission/torrents.h"
 #include "libtransmission/tr-assert.h"
 #include "libtransmission/utils.h" // tr_formatter
+#include "libtransmission/worker-pool.h"
 
 Cache::Key Cache::make_key(tr_torrent const* torrent, tr_block_info::Location loc) noexcept
 {
@@ -32,88 +34,155 @@ Cache::Key Cache::make_key(tr_torrent const* torrent, tr_block_info::Location lo
 
 Cache::CIter Cache::find_span_end(CIter span_begin, CIter end) noexcept
 {
-    static constexpr auto NotAdjacent = [](CacheBlock const& block1, CacheBlock const& block2)
+    static constexpr auto NotAdjacent = [](Blocks::value_type const& block1, Blocks::value_type const& block2)
     {
-        return block1.key.first != block2.key.first || block1.key.second + 1 != block2.key.second;
+        return block1.first.first != block2.first.first || block1.first.second + 1 != block2.first.second;
     };
     auto const span_end = std::adjacent_find(span_begin, end, NotAdjacent);
     return span_end == end ? end : std::next(span_end);
 }
 
-std::pair<Cache::CIter, Cache::CIter> Cache::find_biggest_span(CIter const begin, CIter const end) noexcept
+int Cache::write_contiguous(CIter const begin, CIter const end)
 {
-    auto biggest_begin = begin;
-    auto biggest_end = begin;
-    auto biggest_len = std::distance(biggest_begin, biggest_end);
-
-    for (auto span_begin = begin; span_begin < end;)
+    auto const& [torrent_id, block] = begin->first;
+    auto* const tor = torrents_.get(torrent_id);
+    if (tor == nullptr)
     {
-        auto span_end = find_span_end(span_begin, end);
-        auto const len = std::distance(span_begin, span_end);
+        return EINVAL;
+    }
 
-        if (len > biggest_len)
-        {
-            biggest_begin = span_begin;
-            biggest_end = span_end;
-            biggest_len = len;
-        }
+    auto const loc = tor->block_loc(block);
 
-        std::advance(span_begin, len);
+    // With more than one disk worker, two writes of the same block
+    // (e.g. one that's downloaded again after its piece failed its
+    // checksum) could finish in either order and leave the older data
+    // on disk. So wait for the older write to finish first.
+    if (is_in_flight(torrent_id, block, std::prev(end)->first.second + 1))
+    {
+        disk_io_.wait_idle(torrent_id);
     }
 
-    return { biggest_begin, biggest_end };
-}
+    // Move the blocks out of the cache and keep them around
+    // until the write is done so that reads can still find them.
+    auto& in_flight = in_flight_.emplace_front();
+    auto const in_flight_iter = std::begin(in_flight_);
+    for (auto iter = begin; iter != end; ++iter)
+    {
+        in_flight.blocks.push_back(CacheBlock{ iter->first, std::move(iter->second) });
+    }
+    n_in_flight_blocks_ += std::size(in_flight.blocks);
 
-int Cache::write_contiguous(CIter const begin, CIter const end) const
-{
     // The most common case without an extra data copy.
-    auto const* out = std::data(*begin->buf);
-    auto outlen = std::size(*begin->buf);
+    auto const* out = std::data(*in_flight.blocks.front().buf);
+    auto outlen = std::size(*in_flight.blocks.front().buf);
 
-    // Contiguous area to join more than one block, if any.
-    auto buf = std::vector<uint8_t>{};
-
-    if (end - begin > 1)
+    if (std::size(in_flight.blocks) > 1U)
     {
         // copy blocks into contiguous memory
+        auto const& blocks = in_flight.blocks;
         auto const buflen = std::accumulate(
-            begin,
-            end,
+            std::begin(blocks),
+            std::end(blocks),
             size_t{},
-            [](size_t sum, auto const& block) { return sum + std::size(*block.buf); });
-        buf.resize(buflen);
-        auto* walk = std::data(buf);
-        for (auto iter = begin; iter != end; ++iter)
+            [](size_t sum, auto const& cache_block) { return sum + std::size(*cache_block.buf); });
+        in_flight.buf.resize(buflen);
+        auto* walk = std::data(in_flight.buf);
+        for (auto iter = std::begin(blocks); iter != std::end(blocks); ++iter)
         {
-            TR_ASSERT(begin->key.first == iter->key.first);
-            TR_ASSERT(begin->key.second + std::distance(begin, iter) == iter->key.second);
+            TR_ASSERT(blocks.front().key.first == iter->key.first);
+            TR_ASSERT(blocks.front().key.second + std::distance(std::begin(blocks), iter) == iter->key.second);
             walk = std::copy_n(std::data(*iter->buf), std::size(*iter->buf), walk);
         }
-        TR_ASSERT(std::data(buf) + std::size(buf) == walk);
-        out = std::data(buf);
-        outlen = std::size(buf);
+        TR_ASSERT(std::data(in_flight.buf) + std::size(in_flight.buf) == walk);
+        out = std::data(in_flight.buf);
+        outlen = std::size(in_flight.buf);
     }
 
     // save it
-    auto const& [torrent_id, block] = begin->key;
-    auto* const tor = torrents_.get(torrent_id);
-    if (tor == nullptr)
+    auto on_done = [this, in_flight_iter, outlen](int err)
     {
-        return EINVAL;
-    }
+        if (err == 0)
+        {
+            ++disk_writes_;
+            disk_write_bytes_ += outlen;
+        }
+        else
+        {
+            // tr_ioWriteAsync() has already set the torrent's error.
+            // Hold onto the data so that it isn't lost if the torrent
+            // is resumed once the problem is fixed.
+            requeue_blocks(*in_flight_iter);
+        }
 
-    auto const loc = tor->block_loc(block);
+        n_in_flight_blocks_ -= std::size(in_flight_iter->blocks);
+        in_flight_.erase(in_flight_iter);
+    };
 
-    if (auto const err = tr_ioWrite(tor, loc, outlen, out); err != 0)
+    if (auto const err = tr_ioWriteAsync(tor, loc, outlen, out, std::move(on_done)); err != 0)
     {
+        // the write never started, so give the blocks back to the cache
+        auto iter = begin;
+        for (auto& cache_block : in_flight.blocks)
+        {
+            iter->second = std::move(cache_block.buf);
+            ++iter;
+        }
+        n_in_flight_blocks_ -= std::size(in_flight.blocks);
+        in_flight_.erase(in_flight_iter);
         return err;
     }
 
-    ++disk_writes_;
-    disk_write_bytes_ += outlen;
     return {};
 }
 
+void Cache::requeue_blocks(InFlight& failed)
+{
+    // if the cache is off, there's nowhere to keep them
+    if (max_blocks_ == 0U)
+    {
+        return;
+    }
+
+    for (auto& [key, buf] : failed.blocks)
+    {
+        if (torrents_.get(key.first) == nullptr)
+        {
+            continue;
+        }
+
+        // Older writes of the same block finished before this one started,
+        // so any other write of it that's still in flight is newer
+        if (is_in_flight(key.first, key.second, key.second + 1, &failed))
+        {
+            continue;
+        }
+
+        // if the block has been written to the cache again since, that's newer
+        if (auto const [iter, is_new] = blocks_.try_emplace(key, std::move(buf)); is_new)
+        {
+            runs_.add(key);
+        }
+    }
+}
+
+bool Cache::is_in_flight(
+    tr_torrent_id_t const tor_id,
+    tr_block_index_t const block_begin,
+    tr_block_index_t const block_end,
+    InFlight const* const ignore) const noexcept
+{
+    return std::any_of(
+        std::begin(in_flight_),
+        std::end(in_flight_),
+        [&](InFlight const& in_flight)
+        {
+            // each write's blocks are sorted and contiguous
+            auto const& blocks = in_flight.blocks;
+            return &in_flight != ignore && blocks.front().key.first == tor_id &&
+                blocks.front().key.second < block_end && block_begin <= blocks.back().key.second;
+        });
+}
+
 size_t Cache::get_max_blocks(size_t max_bytes) noexcept
 {
     return max_bytes / tr_block_info::BlockSize;
@@ -128,8 +197,9 @@ int Cache::set_limit(size_t new_limit)
     return cache_trim();
 }
 
-Cache::Cache(tr_torrents& torrents, size_t max_bytes)
+Cache::Cache(tr_torrents& torrents, tr_worker_pool& disk_io, size_t max_bytes)
     : torrents_{ torrents }
+    , disk_io_{ disk_io }
     , max_blocks_(get_max_blocks(max_bytes))
 {
 }
@@ -145,50 +215,151 @@ int Cache::write_block(tr_torrent_id_t tor_id, tr_block_index_t block, std::uniq
         // Bypass cache. This may be helpful for those whose filesystem
         // already has a cache layer for the very purpose of this cache
         // https://github.com/transmission/transmission/pull/5668
-        auto* const tor = torrents_.get(tor_id);
-        return tr_ioWrite(tor, tor->block_loc(block), std::size(*writeme), std::data(*writeme));
+        auto blocks = Blocks{};
+        blocks.try_emplace(Key{ tor_id, block }, std::move(writeme));
+        if (auto const err = write_contiguous(std::begin(blocks), std::end(blocks)); err != 0)
+        {
+            return err;
+        }
+
+        wait_for_in_flight();
+        return {};
     }
 
-    auto const key = Key{ tor_id, block };
-    auto iter = std::lower_bound(std::begin(blocks_), std::end(blocks_), key, CompareCacheBlockByKey);
-    if (iter == std::end(blocks_) || iter->key != key)
+    // don't let reads see stale data
+    if (auto const* const tor = torrents_.get(tor_id); tor != nullptr && !read_cache_.empty())
     {
-        iter = blocks_.emplace(iter);
-        iter->key = key;
+        erase_read_block(tor, block);
     }
 
-    iter->buf = std::move(writeme);
+    auto const key = Key{ tor_id, block };
+    auto const [iter, is_new] = blocks_.try_emplace(key);
+    iter->second = std::move(writeme);
+    if (is_new)
+    {
+        runs_.add(key);
+    }
 
     ++cache_writes_;
-    cache_write_bytes_ += std::size(*iter->buf);
+    cache_write_bytes_ += std::size(*iter->second);
 
     return cache_trim();
 }
 
 Cache::CIter Cache::get_block(tr_torrent const* torrent, tr_block_info::Location const& loc) noexcept
 {
-    if (auto const [begin, end] = std::equal_range(
-            std::begin(blocks_),
-            std::end(blocks_),
-            make_key(torrent, loc),
-            CompareCacheBlockByKey);
-        begin < end)
+    return blocks_.find(make_key(torrent, loc));
+}
+
+Cache::BlockData const* Cache::get_in_flight_block(Key const& key) const noexcept
+{
+    for (auto const& in_flight : in_flight_)
     {
-        return begin;
+        auto const& blocks = in_flight.blocks;
+        if (auto const [begin, end] = std::equal_range(std::begin(blocks), std::end(blocks), key, CompareCacheBlockByKey);
+            begin < end)
+        {
+            return begin->buf.get();
+        }
     }
 
-    return std::end(blocks_);
+    return nullptr;
 }
 
 int Cache::read_block(tr_torrent* torrent, tr_block_info::Location const& loc, uint32_t len, uint8_t* setme)
 {
-    if (auto const iter = get_block(torrent, loc); iter != std::end(blocks_))
+    if (read_from_memory(torrent, loc, len, setme))
     {
-        std::copy_n(std::begin(*iter->buf), len, setme);
         return {};
     }
 
-    return tr_ioRead(torrent, loc, len, setme);
+    auto const piece_key = PieceKey{ torrent->id(), loc.piece };
+    auto const admitted = admit_read_piece(piece_key);
+    if (admitted)
+    {
+        read_cache_.on_read_started(piece_key);
+    }
+
+    auto const err = tr_ioRead(torrent, loc, len, setme);
+    if (admitted)
+    {
+        if (err == 0)
+        {
+            auto data = std::make_shared<BlockData>(len);
+            std::copy_n(setme, len, std::data(*data));
+            add_read_block(torrent, loc, std::move(data));
+        }
+
+        read_cache_.on_read_done(piece_key);
+    }
+
+    return err;
+}
+
+void Cache::read_block_async(
+    tr_torrent* torrent,
+    tr_block_info::Location const& loc,
+    uint32_t len,
+    std::function<void(int, SharedBlockData)>&& on_done)
+{
+    if (auto [buf, shared] = find_in_memory(torrent, loc, len); buf != nullptr)
+    {
+        // share the whole block if we can
+        if (shared && loc.block_offset == 0U && len == std::size(*shared))
+        {
+            on_done(0, std::move(shared));
+            return;
+        }
+
+        auto data = std::make_shared<BlockData>(len);
+        std::copy_n(std::data(*buf) + loc.block_offset, len, std::data(*data));
+        on_done(0, std::move(data));
+        return;
+    }
+
+    auto const tor_id = torrent->id();
+    auto const piece_key = PieceKey{ tor_id, loc.piece };
+    auto const admitted = admit_read_piece(piece_key);
+    if (admitted)
+    {
+        read_cache_.on_read_started(piece_key);
+    }
+
+    // if the read couldn't even be started, on_done is still ours to call
+    auto done = std::make_shared<std::function<void(int, SharedBlockData)>>(std::move(on_done));
+    auto data = std::make_shared<BlockData>(len);
+    auto* const setme = std::data(*data);
+    auto on_read = [this, done, admitted, piece_key, loc, data = std::move(data)](int err) mutable
+    {
+        if (admitted)
+        {
+            if (auto const* const tor = torrents_.get(piece_key.first); tor != nullptr && err == 0)
+            {
+                add_read_block(tor, loc, data);
+            }
+
+            // after add_read_block(), so that a new piece isn't dropped for being empty
+            read_cache_.on_read_done(piece_key);
+        }
+
+        if (err != 0)
+        {
+            (*done)(err, {});
+            return;
+        }
+
+        (*done)(0, std::move(data));
+    };
+
+    if (auto const err = tr_ioReadAsync(torrent, loc, len, setme, std::move(on_read)); err != 0)
+    {
+        if (admitted)
+        {
+            read_cache_.on_read_done(piece_key);
+        }
+
+        (*done)(err, {});
+    }
 }
 
 int Cache::prefetch_block(tr_torrent* torrent, tr_block_info::Location const& loc, uint32_t len)
@@ -198,14 +369,284 @@ int Cache::prefetch_block(tr_torrent* torrent, tr_block_info::Location const& lo
         return {}; // already have it
     }
 
+    if (get_in_flight_block(make_key(torrent, loc)) != nullptr)
+    {
+        return {}; // already have it
+    }
+
+    if (read_cache_.contains({ torrent->id(), loc.piece }, loc.block))
+    {
+        return {}; // already have it
+    }
+
     return tr_ioPrefetch(torrent, loc, len);
 }
 
+void Cache::wait_for_in_flight()
+{
+    if (n_in_flight_blocks_ > std::max(max_blocks_, MinInFlightBlocks))
+    {
+        disk_io_.wait_idle();
+    }
+}
+
+// --- read cache
+
+std::pair<Cache::BlockData const*, Cache::SharedBlockData> Cache::find_in_memory(
+    tr_torrent const* torrent,
+    tr_block_info::Location const& loc,
+    uint32_t len)
+{
+    auto const* buf = static_cast<BlockData const*>(nullptr);
+    auto shared = SharedBlockData{};
+
+    if (auto const iter = get_block(torrent, loc); iter != std::end(blocks_))
+    {
+        buf = iter->second.get();
+    }
+    else
+    {
+        buf = get_in_flight_block(make_key(torrent, loc));
+    }
+
+    if (buf == nullptr)
+    {
+        shared = read_cache_.get({ torrent->id(), loc.piece }, loc.block);
+        buf = shared.get();
+    }
+
+    if (buf == nullptr || loc.block_offset + len > std::size(*buf))
+    {
+        ++read_misses_;
+        return {};
+    }
+
+    ++read_hits_;
+    return { buf, std::move(shared) };
+}
+
+bool Cache::read_from_memory(tr_torrent const* torrent, tr_block_info::Location const& loc, uint32_t len, uint8_t* setme)
+{
+    auto const [buf, shared] = find_in_memory(torrent, loc, len);
+    if (buf == nullptr)
+    {
+        return false;
+    }
+
+    std::copy_n(std::data(*buf) + loc.block_offset, len, setme);
+    return true;
+}
+
+bool Cache::admit_read_piece(PieceKey const& key)
+{
+    if (max_blocks_ == 0U)
+    {
+        return false;
+    }
+
+    return read_cache_.admit(key);
+}
+
+void Cache::add_read_block(tr_torrent const* torrent, tr_block_info::Location const& loc, SharedBlockData data)
+{
+    // only cache whole blocks of pieces that passed their checksum
+    if (loc.block_offset != 0U || std::size(*data) != torrent->block_size(loc.block) || !torrent->has_piece(loc.piece))
+    {
+        return;
+    }
+
+    read_cache_.add({ torrent->id(), loc.piece }, loc.block, std::move(data));
+    trim_read_cache();
+}
+
+void Cache::erase_read_block(tr_torrent const* torrent, tr_block_index_t block)
+{
+    read_cache_.erase({ torrent->id(), torrent->block_loc(block).piece }, block);
+}
+
+void Cache::trim_read_cache()
+{
+    read_cache_.trim(max_blocks_ > std::size(blocks_) ? max_blocks_ - std::size(blocks_) : size_t{});
+}
+
+// ---
+
+bool Cache::ReadCache::admit(PieceKey const& key)
+{
+    if (pieces_index_.count(key) != 0U)
+    {
+        return true;
+    }
+
+    // first time we've seen it lately? remember it, but don't cache it yet
+    auto const ghost = ghosts_index_.find(key);
+    if (ghost == std::end(ghosts_index_))
+    {
+        ghosts_index_.try_emplace(key, ghosts_.insert(std::end(ghosts_), key));
+
+        while (std::size(ghosts_) > MaxGhosts)
+        {
+            ghosts_index_.erase(ghosts_.front());
+            ghosts_.pop_front();
+        }
+
+        return false;
+    }
+
+    // seen twice, so promote it out of the ghost list
+    ghosts_.erase(ghost->second);
+    ghosts_index_.erase(ghost);
+
+    auto& piece = pieces_.emplace_front();
+    piece.key = key;
+    pieces_index_.try_emplace(key, std::begin(pieces_));
+    return true;
+}
+
+void Cache::ReadCache::add(PieceKey const& key, tr_block_index_t block, SharedBlockData data)
+{
+    auto const iter = pieces_index_.find(key);
+    if (iter == std::end(pieces_index_))
+    {
+        return;
+    }
+
+    auto& slot = iter->second->blocks[block];
+    if (!slot)
+    {
+        ++n_blocks_;
+    }
+
+    slot = std::move(data);
+}
+
+Cache::SharedBlockData Cache::ReadCache::get(PieceKey const& key, tr_block_index_t block)
+{
+    auto const iter = pieces_index_.find(key);
+    if (iter == std::end(pieces_index_))
+    {
+        return {};
+    }
+
+    auto const piece_iter = iter->second;
+    auto const block_iter = piece_iter->blocks.find(block);
+    if (block_iter == std::end(piece_iter->blocks))
+    {
+        return {};
+    }
+
+    // mark it as most recently used
+    pieces_.splice(std::begin(pieces_), pieces_, piece_iter);
+    return block_iter->second;
+}
+
+bool Cache::ReadCache::contains(PieceKey const& key, tr_block_index_t block) const
+{
+    auto const iter = pieces_index_.find(key);
+    return iter != std::end(pieces_index_) && iter->second->blocks.count(block) != 0U;
+}
+
+void Cache::ReadCache::erase(PieceKey const& key, tr_block_index_t block)
+{
+    if (auto const iter = pieces_index_.find(key); iter != std::end(pieces_index_) && iter->second->blocks.erase(block) != 0U)
+    {
+        --n_blocks_;
+        erase_piece_if_unused(iter->second);
+    }
+}
+
+void Cache::ReadCache::erase(tr_torrent_id_t tor_id, tr_piece_index_t piece_begin, tr_piece_index_t piece_end)
+{
+    auto const begin = pieces_index_.lower_bound({ tor_id, piece_begin });
+    auto const end = pieces_index_.lower_bound({ tor_id, piece_end });
+
+    for (auto iter = begin; iter != end; ++iter)
+    {
+        n_blocks_ -= std::size(iter->second->blocks);
+        n_reads_in_flight_ -= iter->second->n_reads_in_flight;
+        pieces_.erase(iter->second);
+    }
+
+    pieces_index_.erase(begin, end);
+}
+
+void Cache::ReadCache::erase_piece(Pieces::iterator iter)
+{
+    n_blocks_ -= std::size(iter->blocks);
+    n_reads_in_flight_ -= iter->n_reads_in_flight;
+    pieces_index_.erase(iter->key);
+    pieces_.erase(iter);
+}
+
+void Cache::ReadCache::erase_piece_if_unused(Pieces::iterator iter)
+{
+    if (std::empty(iter->blocks) && iter->n_reads_in_flight == 0U)
+    {
+        erase_piece(iter);
+    }
+}
+
+void Cache::ReadCache::trim(size_t max_blocks)
+{
+    for (auto iter = std::end(pieces_); iter != std::begin(pieces_);)
+    {
+        if (max_blocks != 0U && n_blocks_ + n_reads_in_flight_ <= max_blocks)
+        {
+            break;
+        }
+
+        --iter;
+        if (iter->n_reads_in_flight == 0U)
+        {
+            erase_piece(iter++);
+        }
+    }
+}
+
+void Cache::ReadCache::on_read_started(PieceKey const& key)
+{
+    if (auto const iter = pieces_index_.find(key); iter != std::end(pieces_index_))
+    {
+        ++iter->second->n_reads_in_flight;
+        ++n_reads_in_flight_;
+    }
+}
+
+void Cache::ReadCache::on_read_done(PieceKey const& key)
+{
+    if (auto const iter = pieces_index_.find(key); iter != std::end(pieces_index_) && iter->second->n_reads_in_flight > 0U)
+    {
+        --iter->second->n_reads_in_flight;
+        --n_reads_in_flight_;
+        erase_piece_if_unused(iter->second);
+    }
+}
+
+std::vector<tr_piece_index_t> Cache::ReadCache::hot_pieces(tr_torrent_id_t tor_id, size_t max_pieces) const
+{
+    auto pieces = std::vector<tr_piece_index_t>{};
+
+    for (auto const& piece : pieces_)
+    {
+        if (std::size(pieces) >= max_pieces)
+        {
+            break;
+        }
+
+        if (piece.key.first == tor_id && !std::empty(piece.blocks))
+        {
+            pieces.push_back(piece.key.second);
+        }
+    }
+
+    return pieces;
+}
+
 // ---
 
 int Cache::flush_span(CIter const begin, CIter const end)
 {
-    for (auto span_begin = begin; span_begin < end;)
+    for (auto span_begin = begin; span_begin != end;)
     {
         auto const span_end = find_span_end(span_begin, end);
 
@@ -214,10 +655,12 @@ int Cache::flush_span(CIter const begin, CIter const end)
             return err;
         }
 
+        auto const tor_id = span_begin->first.first;
+        runs_.erase(tor_id, span_begin->first.second, std::prev(span_end)->first.second + 1);
+        blocks_.erase(span_begin, span_end);
         span_begin = span_end;
     }
 
-    blocks_.erase(begin, end);
     return {};
 }
 
@@ -226,38 +669,149 @@ int Cache::flush_file(tr_torrent const* torrent, tr_file_index_t file)
     auto const tor_id = torrent->id();
     auto const [block_begin, block_end] = tr_torGetFileBlockSpan(torrent, file);
 
-    return flush_span(
-        std::lower_bound(std::begin(blocks_), std::end(blocks_), std::make_pair(tor_id, block_begin), CompareCacheBlockByKey),
-        std::lower_bound(std::begin(blocks_), std::end(blocks_), std::make_pair(tor_id, block_end), CompareCacheBlockByKey));
+    auto const err = flush_span(
+        blocks_.lower_bound(std::make_pair(tor_id, block_begin)),
+        blocks_.lower_bound(std::make_pair(tor_id, block_end)));
+
+    if (block_begin < block_end)
+    {
+        read_cache_.erase(tor_id, torrent->block_loc(block_begin).piece, torrent->block_loc(block_end - 1).piece + 1);
+    }
+
+    // callers expect the data to be on disk when this returns
+    disk_io_.wait_idle(tor_id);
+    return err;
 }
 
 int Cache::flush_torrent(tr_torrent const* torrent)
 {
     auto const tor_id = torrent->id();
 
-    return flush_span(
-        std::lower_bound(std::begin(blocks_), std::end(blocks_), std::make_pair(tor_id, 0), CompareCacheBlockByKey),
-        std::lower_bound(std::begin(blocks_), std::end(blocks_), std::make_pair(tor_id + 1, 0), CompareCacheBlockByKey));
+    auto const err = flush_span(
+        blocks_.lower_bound(std::make_pair(tor_id, 0)),
+        blocks_.lower_bound(std::make_pair(tor_id + 1, 0)));
+
+    read_cache_.erase(tor_id, 0, torrent->piece_count());
+
+    // callers expect the data to be on disk when this returns
+    disk_io_.wait_idle(tor_id);
+    return err;
 }
 
 int Cache::flush_biggest()
 {
-    auto const [begin, end] = find_biggest_span(std::begin(blocks_), std::end(blocks_));
-
-    if (begin == end) // nothing to flush
+    auto const biggest = runs_.biggest();
+    if (!biggest) // nothing to flush
     {
         return 0;
     }
 
+    auto const& [key, len] = *biggest;
+    auto const begin = blocks_.find(key);
+    TR_ASSERT(begin != std::end(blocks_));
+    auto const end = std::next(begin, len);
+
     if (auto const err = write_contiguous(begin, end); err != 0)
     {
         return err;
     }
 
+    runs_.erase(key.first, key.second, key.second + len);
     blocks_.erase(begin, end);
     return 0;
 }
 
+// --- contiguous runs of unwritten blocks
+
+void Cache::BlockRuns::add_run(Key const& begin, tr_block_index_t end)
+{
+    TR_ASSERT(begin.second < end);
+
+    runs_.try_emplace(begin, end);
+    runs_by_size_.emplace(end - begin.second, begin);
+}
+
+Cache::BlockRuns::Runs::iterator Cache::BlockRuns::erase_run(Runs::iterator iter)
+{
+    auto const& [begin, end] = *iter;
+    runs_by_size_.erase({ end - begin.second, begin });
+    return runs_.erase(iter);
+}
+
+void Cache::BlockRuns::add(Key const& key)
+{
+    auto const& [tor_id, block] = key;
+    auto begin = key;
+    auto end = block + 1;
+
+    // join the run that ends right before this block
+    if (auto iter = runs_.lower_bound(key); iter != std::begin(runs_))
+    {
+        if (auto const prev = std::prev(iter); prev->first.first == tor_id && prev->second == block)
+        {
+            begin = prev->first;
+            erase_run(prev);
+        }
+    }
+
+    // join the run that starts right after this block
+    if (auto const next = runs_.find({ tor_id, block + 1 }); next != std::end(runs_))
+    {
+        end = next->second;
+        erase_run(next);
+    }
+
+    add_run(begin, end);
+}
+
+void Cache::BlockRuns::erase(tr_torrent_id_t tor_id, tr_block_index_t block_begin, tr_block_index_t block_end)
+{
+    auto iter = runs_.lower_bound({ tor_id, block_begin });
+
+    // a run that starts before the range might reach into it
+    if (iter != std::begin(runs_))
+    {
+        if (auto const prev = std::prev(iter); prev->first.first == tor_id && prev->second > block_begin)
+        {
+            iter = prev;
+        }
+    }
+
+    auto leftovers = small::max_size_vector<std::pair<tr_block_index_t, tr_block_index_t>, 2U>{};
+    while (iter != std::end(runs_) && iter->first.first == tor_id && iter->first.second < block_end)
+    {
+        auto const run_begin = iter->first.second;
+        auto const run_end = iter->second;
+        iter = erase_run(iter);
+
+        if (run_begin < block_begin)
+        {
+            leftovers.emplace_back(run_begin, block_begin);
+        }
+
+        if (run_end > block_end)
+        {
+            leftovers.emplace_back(block_end, run_end);
+        }
+    }
+
+    for (auto const& [run_begin, run_end] : leftovers)
+    {
+        add_run({ tor_id, run_begin }, run_end);
+    }
+}
+
+std::optional<std::pair<Cache::Key, size_t>> Cache::BlockRuns::biggest() const
+{
+    if (std::empty(runs_by_size_))
+    {
+        return {};
+    }
+
+    auto const& [len, key] = *std::rbegin(runs_by_size_);
+    return std::make_pair(key, len);
+}
+
 int Cache::cache_trim()
 {
     while (std::size(blocks_) > max_blocks_)
@@ -268,5 +822,7 @@ int Cache::cache_trim()
         }
     }
 
+    trim_read_cache();
+    wait_for_in_flight();
     return 0;
 }
@@ -11,7 +11,12 @@
 
 #include <cstddef> // for size_t
 #include <cstdint> // for intX_t, uintX_t
+#include <functional>
+#include <list>
+#include <map>
 #include <memory> // for std::unique_ptr
+#include <optional>
+#include <set>
 #include <utility> // for std::pair
 #include <vector>
 
@@ -21,6 +26,7 @@
 
 #include "block-info.h"
 
+class tr_worker_pool;
 class tr_torrents;
 struct tr_torrent;
 
@@ -29,7 +35,145 @@ class Cache
 public:
     using BlockData = small::max_size_vector<uint8_t, tr_block_info::BlockSize>;
 
-    Cache(tr_torrents& torrents, size_t max_bytes);
+    // Block data that doesn't change once it's been filled, so that the
+    // read cache and the peers that it's being sent to can share it
+    using SharedBlockData = std::shared_ptr<BlockData const>;
+
+    using Key = std::pair<tr_torrent_id_t, tr_block_index_t>;
+    using PieceKey = std::pair<tr_torrent_id_t, tr_piece_index_t>;
+
+    // Contiguous runs of unwritten blocks, kept up to date as blocks
+    // come and go so that the longest run is cheap to find.
+    class BlockRuns
+    {
+    public:
+        // Start a new run for `key` or grow the one(s) next to it
+        void add(Key const& key);
+
+        // Forget about blocks [block_begin, block_end) of torrent `tor_id`,
+        // splitting any runs that extend outside that range.
+        void erase(tr_torrent_id_t tor_id, tr_block_index_t block_begin, tr_block_index_t block_end);
+
+        // @return the first block and the length of the longest run
+        [[nodiscard]] std::optional<std::pair<Key, size_t>> biggest() const;
+
+        [[nodiscard]] auto empty() const noexcept
+        {
+            return std::empty(runs_);
+        }
+
+        [[nodiscard]] auto size() const noexcept
+        {
+            return std::size(runs_);
+        }
+
+    private:
+        // keyed by their first block; the value is one past the run's last block
+        using Runs = std::map<Key, tr_block_index_t>;
+
+        // the same runs, ordered by length
+        using RunsBySize = std::set<std::pair<size_t, Key>>;
+
+        void add_run(Key const& begin, tr_block_index_t end);
+
+        Runs::iterator erase_run(Runs::iterator iter);
+
+        Runs runs_;
+        RunsBySize runs_by_size_;
+    };
+
+    // Blocks of pieces that have been read from disk recently.
+    // Seeders are usually asked for the same pieces by many peers,
+    // so the read cache works a piece at a time.
+    class ReadCache
+    {
+    public:
+        // How many pieces that were read once recently are remembered
+        static auto constexpr MaxGhosts = size_t{ 1024U };
+
+        // Called when `key`'s piece is about to be read from disk.
+        // Pieces only get a slot in the read cache the second time they're
+        // read while in the ghost list, so a one-off scan across a torrent
+        // (e.g. a peer downloading everything) can't evict the hot pieces.
+        // @return true if the piece is in the read cache.
+        bool admit(PieceKey const& key);
+
+        // Save a block of a piece that's in the read cache.
+        // Does nothing if the piece isn't in the read cache (anymore).
+        void add(PieceKey const& key, tr_block_index_t block, SharedBlockData data);
+
+        // @return the block if it's in the read cache, and mark its piece
+        //         as most recently used
+        [[nodiscard]] SharedBlockData get(PieceKey const& key, tr_block_index_t block);
+
+        [[nodiscard]] bool contains(PieceKey const& key, tr_block_index_t block) const;
+
+        // Drop a block. Its piece is dropped too if that was its last
+        // block and no reads for it are in flight.
+        void erase(PieceKey const& key, tr_block_index_t block);
+
+        // Drop `tor_id`'s pieces in [piece_begin, piece_end)
+        void erase(tr_torrent_id_t tor_id, tr_piece_index_t piece_begin, tr_piece_index_t piece_end);
+
+        // Evict least-recently-used pieces until the cached blocks, plus
+        // the ones that are being read for it, fit in `max_blocks`.
+        // Pieces with reads in flight are kept so that those reads aren't wasted.
+        void trim(size_t max_blocks);
+
+        // A block of `key`'s piece is being read from disk
+        // and will be add()ed when it's done.
+        void on_read_started(PieceKey const& key);
+
+        // A read that was announced with on_read_started() is done,
+        // whether or not it succeeded. Call this after add()ing its block,
+        // since a piece that's left with no blocks and no reads is dropped.
+        void on_read_done(PieceKey const& key);
+
+        // Up to `max_pieces` of the torrent's pieces that have cached blocks,
+        // most recently used first.
+        [[nodiscard]] std::vector<tr_piece_index_t> hot_pieces(tr_torrent_id_t tor_id, size_t max_pieces) const;
+
+        [[nodiscard]] constexpr auto n_blocks() const noexcept
+        {
+            return n_blocks_;
+        }
+
+        [[nodiscard]] auto empty() const noexcept
+        {
+            return std::empty(pieces_);
+        }
+
+    private:
+        struct Piece
+        {
+            PieceKey key;
+            std::map<tr_block_index_t, SharedBlockData> blocks;
+            size_t n_reads_in_flight = 0;
+        };
+
+        using Pieces = std::list<Piece>;
+        using Ghosts = std::list<PieceKey>;
+
+        void erase_piece(Pieces::iterator iter);
+
+        // Drop a piece that has no blocks and no reads in flight, e.g. because
+        // its first read failed. trim() stops as soon as the blocks fit, so
+        // such pieces would otherwise pile up in the middle of the LRU list.
+        void erase_piece_if_unused(Pieces::iterator iter);
+
+        // most recently used pieces are at the front
+        Pieces pieces_;
+        std::map<PieceKey, Pieces::iterator> pieces_index_;
+        size_t n_blocks_ = 0;
+        size_t n_reads_in_flight_ = 0;
+
+        // Pieces that were read once recently but aren't cached (yet),
+        // oldest at the front
+        Ghosts ghosts_;
+        std::map<PieceKey, Ghosts::iterator> ghosts_index_;
+    };
+
+    Cache(tr_torrents& torrents, tr_worker_pool& disk_io, size_t max_bytes);
 
     int set_limit(size_t new_limit);
 
@@ -37,12 +181,48 @@ public:
     int write_block(tr_torrent_id_t tor, tr_block_index_t block, std::unique_ptr<BlockData> writeme);
 
     int read_block(tr_torrent* torrent, tr_block_info::Location const& loc, uint32_t len, uint8_t* setme);
+
+    // Like read_block(), but if the block has to come from disk,
+    // the read is done by a disk I/O worker thread. `on_done` is called
+    // in the session thread with 0 and the `len` bytes at `loc` on success,
+    // or with an errno on failure. This may happen before returning.
+    // If the block is in the read cache, its buffer is shared instead of copied.
+    void read_block_async(
+        tr_torrent* torrent,
+        tr_block_info::Location const& loc,
+        uint32_t len,
+        std::function<void(int, SharedBlockData)>&& on_done);
+
     int prefetch_block(tr_torrent* torrent, tr_block_info::Location const& loc, uint32_t len);
     int flush_torrent(tr_torrent const* torrent);
     int flush_file(tr_torrent const* torrent, tr_file_index_t file);
 
+    // how many block reads were served from memory
+    [[nodiscard]] constexpr auto read_hits() const noexcept
+    {
+        return read_hits_;
+    }
+
+    // how many block reads had to go to disk
+    [[nodiscard]] constexpr auto read_misses() const noexcept
+    {
+        return read_misses_;
+    }
+
+    // how much memory the read cache is using
+    [[nodiscard]] constexpr auto read_cache_bytes() const noexcept
+    {
+        return read_cache_.n_blocks() * tr_block_info::BlockSize;
+    }
+
+    // Up to `max_pieces` of the torrent's pieces that are in the read cache,
+    // most recently used first. Sending these to a peer won't need a disk read.
+    [[nodiscard]] std::vector<tr_piece_index_t> hot_pieces(tr_torrent_id_t tor_id, size_t max_pieces) const
+    {
+        return read_cache_.hot_pieces(tor_id, max_pieces);
+    }
+
 private:
-    using Key = std::pair<tr_torrent_id_t, tr_block_index_t>;
 
     struct CacheBlock
     {
@@ -50,17 +230,37 @@ private:
         std::unique_ptr<BlockData> buf;
     };
 
-    using Blocks = std::vector<CacheBlock>;
-    using CIter = Blocks::const_iterator;
+    // Unwritten blocks, sorted by torrent and block index
+    using Blocks = std::map<Key, std::unique_ptr<BlockData>>;
+    using CIter = Blocks::iterator;
 
-    [[nodiscard]] static Key make_key(tr_torrent const* torrent, tr_block_info::Location loc) noexcept;
+    // Blocks that have been flushed from the cache but whose disk writes
+    // haven't finished yet. Reads are served from here until they do.
+    struct InFlight
+    {
+        std::vector<CacheBlock> blocks;
+        std::vector<uint8_t> buf;
+    };
 
-    [[nodiscard]] static std::pair<CIter, CIter> find_biggest_span(CIter begin, CIter end) noexcept;
+    [[nodiscard]] static Key make_key(tr_torrent const* torrent, tr_block_info::Location loc) noexcept;
 
     [[nodiscard]] static CIter find_span_end(CIter span_begin, CIter end) noexcept;
 
-    // @return any error code from tr_ioWrite()
-    [[nodiscard]] int write_contiguous(CIter begin, CIter end) const;
+    // Moves the blocks to `in_flight_` and queues a disk write.
+    // @return any error code from tr_ioWriteAsync()
+    [[nodiscard]] int write_contiguous(CIter begin, CIter end);
+
+    // Put the blocks of a failed write back into the cache,
+    // unless a newer copy of them has been written since
+    void requeue_blocks(InFlight& failed);
+
+    // @return true if any of blocks [block_begin, block_end) of torrent
+    //         `tor_id` are being written by an in-flight write other than `ignore`
+    [[nodiscard]] bool is_in_flight(
+        tr_torrent_id_t tor_id,
+        tr_block_index_t block_begin,
+        tr_block_index_t block_end,
+        InFlight const* ignore = nullptr) const noexcept;
 
     // @return any error code from writeContiguous()
     [[nodiscard]] int flush_span(CIter begin, CIter end);
@@ -75,11 +275,61 @@ private:
 
     [[nodiscard]] CIter get_block(tr_torrent const* torrent, tr_block_info::Location const& loc) noexcept;
 
+    [[nodiscard]] BlockData const* get_in_flight_block(Key const& key) const noexcept;
+
+    // --- read cache
+
+    // Look for the block in the unwritten, in-flight, and read-cached blocks.
+    // Counts a read cache hit or miss.
+    // @return the block, and if it's in the read cache, its shared buffer
+    [[nodiscard]] std::pair<BlockData const*, SharedBlockData> find_in_memory(
+        tr_torrent const* torrent,
+        tr_block_info::Location const& loc,
+        uint32_t len);
+
+    // Copy the block into `setme` if it's in memory.
+    // Counts a read cache hit or miss.
+    [[nodiscard]] bool read_from_memory(
+        tr_torrent const* torrent,
+        tr_block_info::Location const& loc,
+        uint32_t len,
+        uint8_t* setme);
+
+    // @return true if the piece is in the read cache. See ReadCache::admit().
+    bool admit_read_piece(PieceKey const& key);
+
+    // Save a block that was just read from disk, if its piece is in the read cache
+    void add_read_block(tr_torrent const* torrent, tr_block_info::Location const& loc, SharedBlockData data);
+
+    void erase_read_block(tr_torrent const* torrent, tr_block_index_t block);
+
+    // Evict least-recently-used pieces so that reads and unwritten writes
+    // share the `max_blocks_` budget. Unwritten blocks take priority.
+    void trim_read_cache();
+
+    // Keep the number of blocks waiting to be written from growing
+    // without bound when the disk can't keep up with the network.
+    void wait_for_in_flight();
+
     tr_torrents& torrents_;
+    tr_worker_pool& disk_io_;
 
     Blocks blocks_ = {};
     size_t max_blocks_ = 0;
 
+    BlockRuns runs_;
+
+    std::list<InFlight> in_flight_;
+    size_t n_in_flight_blocks_ = 0;
+
+    // Let at least this many blocks be in flight even if the cache is tiny
+    static auto constexpr MinInFlightBlocks = size_t{ 64U };
+
+    ReadCache read_cache_;
+
+    size_t read_hits_ = 0;
+    size_t read_misses_ = 0;
+
     mutable size_t disk_writes_ = 0;
     mutable size_t disk_write_bytes_ = 0;
     mutable size_t cache_writes_ = 0;
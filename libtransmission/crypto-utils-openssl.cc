@@ -195,7 +195,7 @@ private:
 
 // --- sha
 
-std::unique_ptr<tr_sha1> tr_sha1::create()
+std::unique_ptr<tr_sha1> tr_sha1::create_library()
 {
     using namespace sha_helpers;
 
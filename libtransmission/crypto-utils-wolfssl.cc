@@ -162,7 +162,7 @@ private:
 
 } // namespace
 
-std::unique_ptr<tr_sha1> tr_sha1::create()
+std::unique_ptr<tr_sha1> tr_sha1::create_library()
 {
     return std::make_unique<Sha1Impl>();
 }
@@ -27,7 +27,12 @@
 class tr_sha1
 {
 public:
+    // Uses the built-in SHA-1 if this CPU has a fast kernel for it,
+    // or the crypto library's implementation if not. See sha1.h.
     static std::unique_ptr<tr_sha1> create();
+
+    // The crypto library's implementation
+    static std::unique_ptr<tr_sha1> create_library();
     virtual ~tr_sha1() = default;
 
     virtual void clear() = 0;
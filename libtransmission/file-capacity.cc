@@ -533,3 +533,8 @@ std::optional<tr_sys_path_capacity> tr_sys_path_get_capacity(std::string_view pa
 
     return capacity;
 }
+
+std::string tr_sys_path_get_device(std::string_view path)
+{
+    return tr_device_info_create(path).device;
+}
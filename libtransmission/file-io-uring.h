@@ -0,0 +1,39 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#ifndef _WIN32
+
+#include <cstddef> // size_t
+
+#include "libtransmission/file.h"
+
+namespace libtransmission
+{
+
+// Wrapper around the io_uring_enter() syscall used by the io_uring backend
+// of tr_sys_file_io_batch(). This calls the kernel in production, but makes
+// it possible for tests to inject a mock.
+struct IoUringAPI
+{
+    virtual ~IoUringAPI() = default;
+
+    // @return what io_uring_enter() returns, with errno set on failure
+    virtual long enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags);
+};
+
+// Like tr_sys_file_io_batch() with the io_uring backend, but in a ring of
+// its own whose syscalls go through `api`.
+// @return false if io_uring isn't available, in which case `ops` are untouched
+bool io_uring_batch(IoUringAPI& api, tr_sys_file_io_op* ops, size_t n_ops);
+
+} // namespace libtransmission
+
+#endif // _WIN32
@@ -8,13 +8,18 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <climits> /* PATH_MAX */
 #include <cstdint> /* SIZE_MAX */
 #include <cstdlib> // mkdtemp, mkstemp, realpath
+#include <cstring> // memset
+#include <limits>
 #include <optional>
 #include <string_view>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <dirent.h>
@@ -48,11 +53,20 @@
 #define USE_COPY_FILE_RANGE
 #endif /* __linux__ */
 
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h> // mmap(), munmap()
+#include <sys/syscall.h> // __NR_io_uring_setup, __NR_io_uring_enter
+#include <sys/uio.h> // iovec
+#define USE_IO_URING
+#endif
+
 #include <fmt/core.h>
 
 #include "libtransmission/transmission.h"
 
 #include "libtransmission/error.h"
+#include "libtransmission/file-io-uring.h"
 #include "libtransmission/file.h"
 #include "libtransmission/log.h"
 #include "libtransmission/tr-assert.h"
@@ -788,6 +802,524 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+namespace io_batch_helpers
+{
+namespace
+{
+auto io_backend = std::atomic<tr_sys_file_io_backend_t>{ TR_SYS_FILE_IO_BACKEND_SYNC };
+
+// Finish an op with pread() / pwrite(), starting `done` bytes in.
+void run_op_sync(tr_sys_file_io_op& op, uint64_t done = 0U)
+{
+    auto* buf = static_cast<uint8_t*>(op.buffer) + done;
+    auto offset = op.offset + done;
+    auto left = op.size - done;
+
+    while (left > 0U)
+    {
+        auto n = uint64_t{};
+        tr_error* error = nullptr;
+        auto const ok = op.is_write ? tr_sys_file_write_at(op.handle, buf, left, offset, &n, &error) :
+                                      tr_sys_file_read_at(op.handle, buf, left, offset, &n, &error);
+
+        if (error != nullptr)
+        {
+            op.err = error->code;
+            tr_error_clear(&error);
+            return;
+        }
+
+        if (!ok || n == 0U) // end of file
+        {
+            // don't let the caller use the rest of the buffer
+            op.err = EIO;
+            return;
+        }
+
+        buf += n;
+        offset += n;
+        left -= n;
+    }
+}
+
+#ifdef USE_IO_URING
+
+// A minimal io_uring wrapper. We talk to the kernel directly instead
+// of using liburing since all we need is "submit a batch, wait for it".
+class IoUring
+{
+public:
+    explicit IoUring(libtransmission::IoUringAPI& api)
+        : api_{ api }
+    {
+        auto params = io_uring_params{};
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, QueueDepth, &params));
+        if (fd_ < 0)
+        {
+            fd_ = -1;
+            return;
+        }
+
+        if (!map_rings(params))
+        {
+            unmap_rings();
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    ~IoUring()
+    {
+        if (fd_ != -1)
+        {
+            unmap_rings();
+            close(fd_);
+        }
+    }
+
+    IoUring(IoUring&&) = delete;
+    IoUring(IoUring const&) = delete;
+    IoUring& operator=(IoUring&&) = delete;
+    IoUring& operator=(IoUring const&) = delete;
+
+    [[nodiscard]] constexpr bool is_valid() const noexcept
+    {
+        return fd_ != -1 && !failed_;
+    }
+
+    void run(tr_sys_file_io_op* ops, size_t n_ops)
+    {
+        while (n_ops > 0U)
+        {
+            auto const n = std::min({ n_ops, size_t{ sq_entries_ }, size_t{ QueueDepth } });
+            // the ring is torn down if it fails partway through
+            if (!is_valid() || !run_some(ops, n))
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    run_op_sync(ops[i]);
+                }
+            }
+
+            ops += n;
+            n_ops -= n;
+        }
+    }
+
+    // Check whether the kernel lets us use io_uring, without making a ring.
+    // io_uring_setup() looks at whether io_uring is allowed before it looks
+    // at its arguments, so an empty ring fails with EINVAL only if it is.
+    [[nodiscard]] static bool is_supported()
+    {
+        static auto const supported = []()
+        {
+            auto params = io_uring_params{};
+            return syscall(__NR_io_uring_setup, 0U, &params) < 0 && errno == EINVAL;
+        }();
+
+        return supported;
+    }
+
+private:
+    bool map_rings(io_uring_params const& params)
+    {
+        sq_entries_ = std::min(params.sq_entries, params.cq_entries);
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+        auto const single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0U;
+        if (single_mmap)
+        {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED)
+        {
+            sq_ring_ = nullptr;
+            return false;
+        }
+
+        if (single_mmap)
+        {
+            cq_ring_ = sq_ring_;
+        }
+        else
+        {
+            cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED)
+            {
+                cq_ring_ = nullptr;
+                return false;
+            }
+        }
+
+        auto* const sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto* const sq = static_cast<uint8_t*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto* const cq = static_cast<uint8_t*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cq_overflow_ = reinterpret_cast<unsigned*>(cq + params.cq_off.overflow);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    void unmap_rings()
+    {
+        if (sqes_ != nullptr)
+        {
+            munmap(sqes_, sqes_size_);
+        }
+
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+        {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+
+        if (sq_ring_ != nullptr)
+        {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+    }
+
+    // @return false if the ops couldn't be queued; they're untouched
+    bool run_some(tr_sys_file_io_op* ops, size_t n_ops)
+    {
+        // everything from the last batch was submitted or taken back out,
+        // so the queue should be empty
+        auto tail = *sq_tail_; // we're the only producer
+        if (tail != __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) || n_ops > sq_entries_)
+        {
+            return false;
+        }
+
+        // queue the ops
+        auto iovecs = std::array<iovec, QueueDepth>{};
+        for (size_t i = 0; i < n_ops; ++i)
+        {
+            auto const& op = ops[i];
+            iovecs[i].iov_base = op.buffer;
+            iovecs[i].iov_len = op.size;
+
+            auto& sqe = next_sqe(tail);
+            sqe.opcode = op.is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe.fd = op.handle;
+            sqe.off = op.offset;
+            sqe.addr = reinterpret_cast<uintptr_t>(&iovecs[i]);
+            sqe.len = 1U;
+            sqe.user_data = i;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        // submit them and wait for them to finish
+        auto results = Results{};
+        results.fill(NoResult);
+        auto n_unsubmitted = n_ops;
+        auto n_pending = size_t{};
+        auto overflow = __atomic_load_n(cq_overflow_, __ATOMIC_ACQUIRE);
+        while (n_unsubmitted > 0U || n_pending > 0U)
+        {
+            auto const ret = enter(n_unsubmitted, n_unsubmitted + n_pending);
+
+            if (ret > 0)
+            {
+                n_unsubmitted -= static_cast<size_t>(ret);
+                n_pending += static_cast<size_t>(ret);
+            }
+            else if (ret == 0 && n_pending == 0U)
+            {
+                // the kernel didn't take any of them; do them ourselves
+                withdraw_unsubmitted();
+                n_unsubmitted = 0U;
+            }
+            else if (auto const err = errno; ret < 0 && err != EINTR)
+            {
+                // EAGAIN and EBUSY go away once we've reaped some completions
+                auto const is_transient = (err == EAGAIN || err == EBUSY) && n_pending > 0U;
+                if (!is_transient && n_unsubmitted > 0U)
+                {
+                    // take the unsubmitted ops back out and do them in run_op_sync()
+                    withdraw_unsubmitted();
+                    n_unsubmitted = 0U;
+                    failed_ = err != EAGAIN && err != EBUSY;
+                }
+                else if (!is_transient)
+                {
+                    // Can't even wait for the rest. They may still be using
+                    // `iovecs` and the ops' buffers, so cancel them and wait
+                    // until the kernel's done with them before redoing them
+                    // with run_op_sync().
+                    failed_ = true;
+                    cancel_pending(n_ops, results, n_pending, overflow);
+                    break;
+                }
+            }
+
+            reap(results, n_pending, overflow);
+        }
+
+        // check the results
+        for (size_t i = 0; i < n_ops; ++i)
+        {
+            auto& op = ops[i];
+
+            if (auto const res = results[i]; res == NoResult || res == -ECANCELED)
+            {
+                run_op_sync(op);
+            }
+            else if (res < 0)
+            {
+                op.err = -res;
+            }
+            else if (auto const n_done = static_cast<uint64_t>(res); n_done < op.size)
+            {
+                // short read or write; finish it the old-fashioned way
+                run_op_sync(op, n_done);
+            }
+        }
+
+        // nothing's in flight anymore, so it's safe to let go of the ring
+        if (failed_)
+        {
+            unmap_rings();
+            close(fd_);
+            fd_ = -1;
+        }
+
+        return true;
+    }
+
+    static auto constexpr QueueDepth = unsigned{ 64U };
+
+    static auto constexpr NoResult = std::numeric_limits<int>::min();
+
+    // user_data of the cancel requests, so that their completions
+    // aren't mistaken for the ops'
+    static auto constexpr CancelTag = uint64_t{ 1U } << 63U;
+
+    using Results = std::array<int, QueueDepth>;
+
+    io_uring_sqe& next_sqe(unsigned& tail) noexcept
+    {
+        auto const index = tail & sq_mask_;
+        auto& sqe = sqes_[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sq_array_[index] = index;
+        ++tail;
+        return sqe;
+    }
+
+    // take any queued entries that the kernel hasn't taken back out of the SQ
+    void withdraw_unsubmitted() noexcept
+    {
+        __atomic_store_n(sq_tail_, __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    }
+
+    long enter(size_t to_submit, size_t min_complete) const
+    {
+        return api_.enter(fd_, static_cast<unsigned>(to_submit), static_cast<unsigned>(min_complete), IORING_ENTER_GETEVENTS);
+    }
+
+    // Move any completions from the CQ to `results`
+    void reap(Results& results, size_t& n_pending, unsigned& overflow)
+    {
+        auto head = *cq_head_;
+        auto const cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; ++head)
+        {
+            if (auto const& cqe = cqes_[head & cq_mask_]; (cqe.user_data & CancelTag) == 0U)
+            {
+                results[cqe.user_data] = cqe.res;
+                --n_pending;
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        // Completions that didn't fit in the CQ are dropped by kernels
+        // without IORING_FEAT_NODROP. We don't know which ops they were
+        // for, so those ops keep NoResult and are redone by the caller.
+        if (auto const new_overflow = __atomic_load_n(cq_overflow_, __ATOMIC_ACQUIRE); new_overflow != overflow)
+        {
+            n_pending -= std::min(n_pending, size_t{ new_overflow - overflow });
+            overflow = new_overflow;
+        }
+    }
+
+    // Ask the kernel to cancel the ops that haven't completed yet, then
+    // wait until every one of them has, cancelled or not. If the ring
+    // won't take the cancels, keep watching the CQ: the kernel still
+    // finishes the ops on its own.
+    void cancel_pending(size_t n_ops, Results& results, size_t& n_pending, unsigned& overflow)
+    {
+        reap(results, n_pending, overflow);
+
+        auto tail = *sq_tail_;
+        auto n_unsubmitted = size_t{};
+        for (size_t i = 0; i < n_ops && n_pending > 0U; ++i)
+        {
+            if (results[i] == NoResult)
+            {
+                auto& sqe = next_sqe(tail);
+                sqe.opcode = IORING_OP_ASYNC_CANCEL;
+                sqe.fd = -1;
+                sqe.addr = i;
+                sqe.user_data = CancelTag | i;
+                ++n_unsubmitted;
+            }
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        while (n_pending > 0U)
+        {
+            if (auto const ret = enter(n_unsubmitted, n_pending); ret >= 0)
+            {
+                n_unsubmitted -= std::min(n_unsubmitted, static_cast<size_t>(ret));
+            }
+            else if (errno != EINTR)
+            {
+                withdraw_unsubmitted();
+                n_unsubmitted = 0U;
+                std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+            }
+
+            reap(results, n_pending, overflow);
+        }
+
+        withdraw_unsubmitted();
+    }
+
+    libtransmission::IoUringAPI& api_;
+
+    int fd_ = -1;
+
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sq_ring_size_ = {};
+    size_t cq_ring_size_ = {};
+    size_t sqes_size_ = {};
+
+    unsigned sq_entries_ = {};
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = {};
+    unsigned* sq_array_ = nullptr;
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = {};
+    unsigned* cq_overflow_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    // set when the kernel gives us an error that won't go away
+    bool failed_ = false;
+};
+
+// Each thread gets its own ring so that batches don't need locking.
+IoUring& thread_io_uring()
+{
+    static auto api = libtransmission::IoUringAPI{};
+    thread_local auto ring = IoUring{ api };
+    return ring;
+}
+
+#endif // USE_IO_URING
+} // namespace
+} // namespace io_batch_helpers
+
+bool tr_sys_file_io_set_backend(tr_sys_file_io_backend_t backend)
+{
+    using namespace io_batch_helpers;
+
+#ifdef USE_IO_URING
+    // The rings themselves are made by the threads that use them
+    if (backend == TR_SYS_FILE_IO_BACKEND_IO_URING && !IoUring::is_supported())
+    {
+        backend = TR_SYS_FILE_IO_BACKEND_SYNC;
+        io_backend = backend;
+        return false;
+    }
+#else
+    if (backend == TR_SYS_FILE_IO_BACKEND_IO_URING)
+    {
+        io_backend = TR_SYS_FILE_IO_BACKEND_SYNC;
+        return false;
+    }
+#endif
+
+    io_backend = backend;
+    return true;
+}
+
+void tr_sys_file_io_batch(tr_sys_file_io_op* ops, size_t n_ops)
+{
+    using namespace io_batch_helpers;
+
+    TR_ASSERT(ops != nullptr || n_ops == 0U);
+
+#ifdef USE_IO_URING
+    if (io_backend == TR_SYS_FILE_IO_BACKEND_IO_URING)
+    {
+        if (auto& ring = thread_io_uring(); ring.is_valid())
+        {
+            ring.run(ops, n_ops);
+            return;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < n_ops; ++i)
+    {
+        run_op_sync(ops[i]);
+    }
+}
+
+long libtransmission::IoUringAPI::enter(
+    [[maybe_unused]] int ring_fd,
+    [[maybe_unused]] unsigned to_submit,
+    [[maybe_unused]] unsigned min_complete,
+    [[maybe_unused]] unsigned flags)
+{
+#ifdef USE_IO_URING
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+bool libtransmission::io_uring_batch(
+    [[maybe_unused]] IoUringAPI& api,
+    [[maybe_unused]] tr_sys_file_io_op* ops,
+    [[maybe_unused]] size_t n_ops)
+{
+#ifdef USE_IO_URING
+    using namespace io_batch_helpers;
+
+    if (auto ring = IoUring{ api }; ring.is_valid())
+    {
+        ring.run(ops, n_ops);
+        return true;
+    }
+#endif
+
+    return false;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
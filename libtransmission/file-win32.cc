@@ -5,6 +5,7 @@
 
 #include <algorithm>
 #include <cctype> // for isalpha()
+#include <cerrno> // EIO
 #include <cstring>
 #include <ctime>
 #include <iterator> // for std::back_inserter
@@ -1092,6 +1093,51 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+bool tr_sys_file_io_set_backend(tr_sys_file_io_backend_t backend)
+{
+    // io_uring is Linux-only
+    return backend == TR_SYS_FILE_IO_BACKEND_SYNC;
+}
+
+void tr_sys_file_io_batch(tr_sys_file_io_op* ops, size_t n_ops)
+{
+    TR_ASSERT(ops != nullptr || n_ops == 0U);
+
+    for (size_t i = 0; i < n_ops; ++i)
+    {
+        auto& op = ops[i];
+        auto* buf = static_cast<uint8_t*>(op.buffer);
+        auto offset = op.offset;
+        auto left = op.size;
+
+        while (left > 0U)
+        {
+            auto n = uint64_t{};
+            tr_error* error = nullptr;
+            auto const ok = op.is_write ? tr_sys_file_write_at(op.handle, buf, left, offset, &n, &error) :
+                                          tr_sys_file_read_at(op.handle, buf, left, offset, &n, &error);
+
+            if (error != nullptr)
+            {
+                op.err = error->code;
+                tr_error_clear(&error);
+                break;
+            }
+
+            if (!ok || n == 0U) // end of file
+            {
+                // don't let the caller use the rest of the buffer
+                op.err = EIO;
+                break;
+            }
+
+            buf += n;
+            offset += n;
+            left -= n;
+        }
+    }
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <cstddef> // size_t
 #include <cstdint> // uint64_t
 #include <ctime> // time_t
 #include <functional>
@@ -121,6 +122,25 @@ struct tr_sys_path_capacity
     int64_t total = -1;
 };
 
+enum tr_sys_file_io_backend_t
+{
+    TR_SYS_FILE_IO_BACKEND_SYNC, /* pread() / pwrite() */
+    TR_SYS_FILE_IO_BACKEND_IO_URING /* Linux io_uring */
+};
+
+/** @brief A positioned read or write, for use with `tr_sys_file_io_batch()`. */
+struct tr_sys_file_io_op
+{
+    tr_sys_file_t handle = TR_BAD_SYS_FILE;
+    void* buffer = nullptr;
+    uint64_t size = {};
+    uint64_t offset = {};
+    bool is_write = false;
+
+    /** @brief Set by `tr_sys_file_io_batch()`: 0 on success, or an errno. */
+    int err = {};
+};
+
 /**
  * @name Platform-specific wrapper functions
  *
@@ -172,6 +192,15 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, struct tr_erro
  */
 [[nodiscard]] std::optional<tr_sys_path_capacity> tr_sys_path_get_capacity(std::string_view path, tr_error** error = nullptr);
 
+/**
+ * @brief Get the name of the device that a file or directory is on, e.g. "/dev/sda1".
+ *
+ * @param[in] path Path to file or directory.
+ *
+ * @return The device's name, or an empty string if it can't be determined.
+ */
+[[nodiscard]] std::string tr_sys_path_get_device(std::string_view path);
+
 /**
  * @brief Portability wrapper for `access()`.
  *
@@ -448,6 +477,31 @@ bool tr_sys_file_write_at(
     uint64_t* bytes_written,
     struct tr_error** error = nullptr);
 
+/**
+ * @brief Choose how `tr_sys_file_io_batch()` talks to the kernel.
+ *        This affects every thread in the process.
+ *
+ * @param[in] backend The backend to use.
+ *
+ * @return `True` if `backend` works on this system, `false` otherwise (in which
+ *         case `TR_SYS_FILE_IO_BACKEND_SYNC` is used instead).
+ */
+bool tr_sys_file_io_set_backend(tr_sys_file_io_backend_t backend);
+
+/**
+ * @brief Read and write several buffers at once. Each op either transfers its
+ *        whole buffer or has its `err` set. A read that hits end-of-file
+ *        before filling its buffer fails with `EIO`.
+ *        Thread-safe, as long as the ops don't overlap.
+ *
+ *        With `TR_SYS_FILE_IO_BACKEND_IO_URING`, the whole batch is submitted
+ *        to the kernel with a single syscall.
+ *
+ * @param[in,out] ops   The reads and writes to do.
+ * @param[in]     n_ops Number of items in `ops`.
+ */
+void tr_sys_file_io_batch(tr_sys_file_io_op* ops, size_t n_ops);
+
 /**
  * @brief Portability wrapper for `fsync()`.
  *
@@ -69,8 +69,11 @@ ReadState tr_handshake::read_yb(tr_peerIo* peer_io)
 
     // get the peer's public key
     peer_io->read_bytes(std::data(peer_public_key), std::size(peer_public_key));
-    dh_.setPeerPublicKey(peer_public_key);
+    return compute_secret(peer_public_key, State::SendingCryptoProvide);
+}
 
+ReadState tr_handshake::send_crypto_provide(tr_peerIo* peer_io)
+{
     /* now send these: HASH('req1', S), HASH('req2', SKEY) xor HASH('req3', S),
      * ENCRYPT(VC, crypto_provide, len(PadC), PadC, len(IA)), ENCRYPT(IA) */
     static auto constexpr BufSize = std::tuple_size_v<tr_sha1_digest_t> * 2 + std::size(VC) + sizeof(crypto_provide_) +
@@ -363,14 +366,13 @@ ReadState tr_handshake::read_ya(tr_peerIo* peer_io)
 
     /* read the incoming peer's public key */
     peer_io->read_bytes(std::data(peer_public_key), std::size(peer_public_key));
-    dh_.setPeerPublicKey(peer_public_key);
 
-    // send our public key to the peer
+    // send our public key to the peer. This doesn't need the secret,
+    // so there's no need to wait for it
     tr_logAddTraceHand(this, "sending B->A: Diffie Hellman Yb, PadB");
     send_public_key_and_pad<PadbMaxlen>(peer_io);
 
-    set_state(State::AwaitingPadA);
-    return READ_NOW;
+    return compute_secret(peer_public_key, State::AwaitingPadA);
 }
 
 ReadState tr_handshake::read_pad_a(tr_peerIo* peer_io)
@@ -550,6 +552,41 @@ ReadState tr_handshake::read_ia(tr_peerIo* peer_io)
 
 // ---
 
+ReadState tr_handshake::compute_secret(DH::key_bigend_t const& peer_public_key, State next_state)
+{
+    auto dh = std::make_shared<DH>(dh_);
+
+    auto work = [dh, peer_public_key]()
+    {
+        dh->setPeerPublicKey(peer_public_key);
+    };
+
+    auto done = [dh, next_state, weak_handshake = std::weak_ptr<tr_handshake*>{ self_ref_ }]()
+    {
+        if (auto const self_ref = weak_handshake.lock(); self_ref)
+        {
+            auto* const handshake = *self_ref;
+            handshake->dh_ = *dh;
+            handshake->set_state(next_state);
+
+            // the peer may have sent more while we were busy
+            auto const keep_alive = handshake->peer_io_;
+            keep_alive->process_read_buffer();
+        }
+    };
+
+    if (mediator_->run_in_background(std::move(work), std::move(done)))
+    {
+        tr_logAddTraceHand(this, "computing the shared secret in a worker thread");
+        set_state(State::AwaitingSecret);
+        return READ_LATER;
+    }
+
+    dh_.setPeerPublicKey(peer_public_key);
+    set_state(next_state);
+    return READ_NOW;
+}
+
 ReadState tr_handshake::can_read(tr_peerIo* peer_io, void* vhandshake, size_t* piece)
 {
     auto* handshake = static_cast<tr_handshake*>(vhandshake);
@@ -572,6 +609,10 @@ ReadState tr_handshake::can_read(tr_peerIo* peer_io, void* vhandshake, size_t* p
             ret = handshake->read_peer_id(peer_io);
             break;
 
+        case State::AwaitingSecret:
+            ret = READ_LATER;
+            break;
+
         case State::AwaitingYa:
             ret = handshake->read_ya(peer_io);
             break;
@@ -596,6 +637,10 @@ ReadState tr_handshake::can_read(tr_peerIo* peer_io, void* vhandshake, size_t* p
             ret = handshake->read_yb(peer_io);
             break;
 
+        case State::SendingCryptoProvide:
+            ret = handshake->send_crypto_provide(peer_io);
+            break;
+
         case State::AwaitingVc:
             ret = handshake->read_vc(peer_io);
             break;
@@ -782,6 +827,8 @@ std::string_view tr_handshake::state_string(State state) noexcept
         return "awaiting handshake";
     case State::AwaitingPeerId:
         return "awaiting peer id";
+    case State::AwaitingSecret:
+        return "awaiting secret";
     case State::AwaitingYa:
         return "awaiting ya";
     case State::AwaitingPadA:
@@ -796,6 +843,8 @@ std::string_view tr_handshake::state_string(State state) noexcept
     // outgoing
     case State::AwaitingYb:
         return "awaiting yb";
+    case State::SendingCryptoProvide:
+        return "sending crypto provide";
     case State::AwaitingVc:
         return "awaiting vc";
     case State::AwaitingCryptoSelect:
@@ -71,6 +71,14 @@ public:
             return DH::randomPrivateKey();
         }
 
+        // Run `work` in a worker thread and then `done` in the session thread.
+        // Returns false without calling either if there's no worker thread,
+        // in which case the caller does the work itself.
+        [[nodiscard]] virtual bool run_in_background(std::function<void()> /*work*/, std::function<void()> /*done*/)
+        {
+            return false;
+        }
+
         virtual void set_utp_failed(tr_sha1_digest_t const& info_hash, tr_socket_address const& socket_address) = 0;
     };
 
@@ -82,6 +90,7 @@ private:
         // incoming and outgoing
         AwaitingHandshake,
         AwaitingPeerId,
+        AwaitingSecret,
 
         // incoming
         AwaitingYa,
@@ -92,6 +101,7 @@ private:
 
         // outgoing
         AwaitingYb,
+        SendingCryptoProvide,
         AwaitingVc,
         AwaitingCryptoSelect,
         AwaitingPadD
@@ -111,6 +121,8 @@ private:
     ReadState read_ya(tr_peerIo*);
     ReadState read_yb(tr_peerIo*);
 
+    ReadState compute_secret(DH::key_bigend_t const& peer_public_key, State next_state);
+    ReadState send_crypto_provide(tr_peerIo*);
     void send_ya(tr_peerIo*);
 
     void set_peer_id(tr_peer_id_t const& id) noexcept
@@ -252,6 +264,7 @@ private:
     static inline auto dh_pool_size = size_t{};
     static inline auto dh_pool = std::array<tr_message_stream_encryption::DH, DhPoolMaxSize>{};
     static inline auto dh_pool_mutex = std::mutex{};
+    static inline auto dh_pool_is_refilling = false;
 
     [[nodiscard]] static DH get_dh(Mediator* mediator)
     {
@@ -262,9 +275,13 @@ private:
             auto dh = DH{};
             std::swap(dh, dh_pool[dh_pool_size - 1U]);
             --dh_pool_size;
+            lock.unlock();
+            refill_dh_pool(mediator);
             return dh;
         }
 
+        lock.unlock();
+        refill_dh_pool(mediator);
         return DH{ mediator->private_key() };
     }
 
@@ -279,6 +296,56 @@ private:
         }
     }
 
+    // If there's a worker thread, keep the pool stocked with keys whose
+    // public half is already computed, so that a burst of new connections
+    // doesn't need to wait on them.
+    static void refill_dh_pool(Mediator* mediator)
+    {
+        {
+            auto const lock = std::unique_lock(dh_pool_mutex);
+
+            if (dh_pool_is_refilling || dh_pool_size >= DhPoolMaxSize / 2U)
+            {
+                return;
+            }
+
+            dh_pool_is_refilling = true;
+        }
+
+        auto work = []()
+        {
+            for (;;)
+            {
+                auto dh = DH{};
+                (void)dh.publicKey(); // computes and caches it
+
+                auto const lock = std::unique_lock(dh_pool_mutex);
+                if (dh_pool_size < std::size(dh_pool))
+                {
+                    dh_pool[dh_pool_size] = dh;
+                    ++dh_pool_size;
+                }
+
+                if (dh_pool_size == std::size(dh_pool))
+                {
+                    break;
+                }
+            }
+        };
+
+        auto done = []()
+        {
+            auto const lock = std::unique_lock(dh_pool_mutex);
+            dh_pool_is_refilling = false;
+        };
+
+        if (!mediator->run_in_background(std::move(work), std::move(done)))
+        {
+            auto const lock = std::unique_lock(dh_pool_mutex);
+            dh_pool_is_refilling = false;
+        }
+    }
+
     void maybe_recycle_dh()
     {
         // keys are expensive to make, so recycle iff the peer was unreachable
@@ -299,6 +366,9 @@ private:
 
     DoneFunc on_done_;
 
+    // Lets secrets computed in the background after we're destroyed know not to call us.
+    std::shared_ptr<tr_handshake*> const self_ref_ = std::make_shared<tr_handshake*>(this);
+
     std::optional<tr_peer_id_t> peer_id_;
 
     std::shared_ptr<tr_peerIo> peer_io_;
@@ -6,9 +6,14 @@
 #include <algorithm>
 #include <array>
 #include <cerrno>
+#include <functional>
+#include <iterator> // std::distance()
+#include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <utility> // std::move
+#include <vector>
 
 #include <fmt/core.h>
 
@@ -20,13 +25,15 @@
 #include "libtransmission/file.h"
 #include "libtransmission/inout.h"
 #include "libtransmission/log.h"
+#include "libtransmission/open-files.h"
 #include "libtransmission/session.h"
-#include "libtransmission/torrent.h"
 #include "libtransmission/torrent-files.h"
+#include "libtransmission/torrent.h"
 #include "libtransmission/tr-assert.h"
 #include "libtransmission/tr-macros.h" // tr_sha1_digest_t
 #include "libtransmission/tr-strbuf.h" // tr_pathbuf
 #include "libtransmission/utils.h"
+#include "libtransmission/worker-pool.h"
 
 using namespace std::literals;
 
@@ -99,33 +106,39 @@ bool getFilename(tr_pathbuf& setme, tr_torrent const* tor, tr_file_index_t file_
     return true;
 }
 
-void readOrWriteBytes(
-    tr_session* session,
-    tr_torrent* tor,
-    IoMode io_mode,
-    tr_file_index_t file_index,
-    uint64_t file_offset,
-    uint8_t* buf,
-    size_t buflen,
-    tr_error** error)
+// The part of a block I/O request that falls inside a single file.
+struct IoSpan
+{
+    tr_open_files::Handle fd;
+    tr_file_index_t file_index = {};
+    uint64_t file_offset = {};
+    uint64_t length = {};
+};
+
+using IoSpans = std::vector<IoSpan>;
+
+// Details about a failed I/O, kept so that it can be
+// reported in the session thread after a worker thread fails.
+struct IoFailure
 {
-    TR_ASSERT(file_index < tor->file_count());
+    int code = {};
+    std::string message;
+    tr_file_index_t file_index = {};
+};
 
+tr_open_files::Handle getFd(tr_torrent* tor, IoMode io_mode, tr_file_index_t file_index, uint64_t file_size, tr_error** error)
+{
+    auto* const session = tor->session;
     bool const do_write = io_mode == IoMode::Write;
-    auto const file_size = tor->file_size(file_index);
-    TR_ASSERT(file_size == 0 || file_offset < file_size);
-    TR_ASSERT(file_offset + buflen <= file_size);
 
-    if (file_size == 0)
+    auto fd = session->openFiles().get_handle(tor->id(), file_index, do_write);
+    if (fd)
     {
-        return;
+        return fd;
     }
 
-    // --- Find the fd
-
-    auto fd = session->openFiles().get(tor->id(), file_index, do_write);
     auto filename = tr_pathbuf{};
-    if (!fd && !getFilename(filename, tor, file_index, io_mode))
+    if (!getFilename(filename, tor, file_index, io_mode))
     {
         auto const err = ENOENT;
         auto const msg = fmt::format(
@@ -134,20 +147,17 @@ void readOrWriteBytes(
             fmt::arg("error", tr_strerror(err)),
             fmt::arg("error_code", err));
         tr_error_set(error, err, msg);
-        return;
+        return {};
     }
 
-    if (!fd) // not in the cache, so open or create it now
+    // open (and maybe create) the file
+    auto const prealloc = (!do_write || !tor->file_is_wanted(file_index)) ? TR_PREALLOCATE_NONE :
+                                                                            tor->session->preallocationMode();
+    fd = session->openFiles().get_handle(tor->id(), file_index, do_write, filename, prealloc, file_size);
+    if (fd && do_write)
     {
-        // open (and maybe create) the file
-        auto const prealloc = (!do_write || !tor->file_is_wanted(file_index)) ? TR_PREALLOCATE_NONE :
-                                                                                tor->session->preallocationMode();
-        fd = session->openFiles().get(tor->id(), file_index, do_write, filename, prealloc, file_size);
-        if (fd && do_write)
-        {
-            // make a note that we just created a file
-            tor->session->add_file_created();
-        }
+        // make a note that we just created a file
+        tor->session->add_file_created();
     }
 
     if (!fd) // couldn't create/open it either
@@ -160,44 +170,108 @@ void readOrWriteBytes(
             fmt::arg("error_code", err));
         tr_error_set(error, err, msg);
         tr_logAddErrorTor(tor, std::move(msg));
-        return;
+        return {};
     }
 
-    switch (io_mode)
+    return fd;
+}
+
+// Finds (or opens) the files that a block I/O request touches.
+// This must be called in the session thread.
+bool getSpans(tr_torrent* tor, IoMode io_mode, tr_block_info::Location loc, size_t buflen, IoSpans& setme, tr_error** error)
+{
+    auto [file_index, file_offset] = tor->file_offset(loc);
+
+    while (buflen != 0)
     {
-    case IoMode::Read:
-        if (tr_error* my_error = nullptr; !readEntireBuf(*fd, file_offset, buf, buflen, &my_error) && my_error != nullptr)
+        TR_ASSERT(file_index < tor->file_count());
+
+        auto const file_size = tor->file_size(file_index);
+        TR_ASSERT(file_size == 0 || file_offset < file_size);
+        uint64_t const bytes_this_pass = std::min(uint64_t{ buflen }, uint64_t{ file_size - file_offset });
+        TR_ASSERT(file_offset + bytes_this_pass <= file_size);
+
+        if (file_size != 0U)
         {
-            tr_logAddErrorTor(
-                tor,
-                fmt::format(
-                    _("Couldn't read '{path}': {error} ({error_code})"),
-                    fmt::arg("path", tor->file_subpath(file_index)),
-                    fmt::arg("error", my_error->message),
-                    fmt::arg("error_code", my_error->code)));
-            tr_error_propagate(error, &my_error);
-            return;
+            auto fd = getFd(tor, io_mode, file_index, file_size, error);
+            if (!fd)
+            {
+                return false;
+            }
+
+            setme.push_back(IoSpan{ std::move(fd), file_index, file_offset, bytes_this_pass });
         }
-        break;
 
-    case IoMode::Write:
-        if (tr_error* my_error = nullptr; !writeEntireBuf(*fd, file_offset, buf, buflen, &my_error) && my_error != nullptr)
+        buflen -= bytes_this_pass;
+
+        ++file_index;
+        file_offset = 0;
+    }
+
+    return true;
+}
+
+// Reads, writes, or prefetches the spans' contents.
+// This doesn't touch the torrent, so it's safe to call from any thread.
+bool doSpans(IoMode io_mode, IoSpans const& spans, uint8_t* buf, IoFailure& failure)
+{
+    for (auto const& [fd, file_index, file_offset, length] : spans)
+    {
+        tr_error* error = nullptr;
+
+        switch (io_mode)
+        {
+        case IoMode::Read:
+            readEntireBuf(*fd, file_offset, buf, length, &error);
+            break;
+
+        case IoMode::Write:
+            writeEntireBuf(*fd, file_offset, buf, length, &error);
+            break;
+
+        case IoMode::Prefetch:
+            tr_sys_file_advise(*fd, file_offset, length, TR_SYS_FILE_ADVICE_WILL_NEED);
+            break;
+        }
+
+        if (error != nullptr)
         {
-            tr_logAddErrorTor(
-                tor,
-                fmt::format(
-                    _("Couldn't save '{path}': {error} ({error_code})"),
-                    fmt::arg("path", tor->file_subpath(file_index)),
-                    fmt::arg("error", my_error->message),
-                    fmt::arg("error_code", my_error->code)));
-            tr_error_propagate(error, &my_error);
-            return;
+            failure.code = error->code;
+            failure.message = error->message;
+            failure.file_index = file_index;
+            tr_error_clear(&error);
+            return false;
         }
-        break;
 
-    case IoMode::Prefetch:
-        tr_sys_file_advise(*fd, file_offset, buflen, TR_SYS_FILE_ADVICE_WILL_NEED);
-        break;
+        if (buf != nullptr)
+        {
+            buf += length;
+        }
+    }
+
+    return true;
+}
+
+// Logs a failed read or write. If it was a write, also
+// sets the torrent's error and stops it.
+// This must be called in the session thread.
+void onIoFailed(tr_torrent* tor, IoMode io_mode, IoFailure const& failure)
+{
+    auto const fmtstr = io_mode == IoMode::Write ? _("Couldn't save '{path}': {error} ({error_code})") :
+                                                   _("Couldn't read '{path}': {error} ({error_code})");
+    tr_logAddErrorTor(
+        tor,
+        fmt::format(
+            fmtstr,
+            fmt::arg("path", tor->file_subpath(failure.file_index)),
+            fmt::arg("error", failure.message),
+            fmt::arg("error_code", failure.code)));
+
+    // if IO failed, set torrent's error if not already set
+    if (io_mode == IoMode::Write && tor->error().error_type() != TR_STAT_LOCAL_ERROR)
+    {
+        tor->error().set_local_error(failure.message);
+        tr_torrentStop(tor);
     }
 }
 
@@ -209,38 +283,96 @@ int readOrWritePiece(tr_torrent* tor, IoMode io_mode, tr_block_info::Location lo
         return EINVAL;
     }
 
-    auto [file_index, file_offset] = tor->file_offset(loc);
-
-    while (buflen != 0)
+    auto spans = IoSpans{};
+    if (tr_error* error = nullptr; !getSpans(tor, io_mode, loc, buflen, spans, &error))
     {
-        uint64_t const bytes_this_pass = std::min(uint64_t{ buflen }, uint64_t{ tor->file_size(file_index) - file_offset });
+        if (io_mode == IoMode::Write && tor->error().error_type() != TR_STAT_LOCAL_ERROR)
+        {
+            tor->error().set_local_error(error->message);
+            tr_torrentStop(tor);
+        }
 
-        tr_error* error = nullptr;
-        readOrWriteBytes(tor->session, tor, io_mode, file_index, file_offset, buf, bytes_this_pass, &error);
+        auto const error_code = error->code;
+        tr_error_clear(&error);
+        return error_code;
+    }
 
-        if (error != nullptr) // if IO failed, set torrent's error if not already set
-        {
-            if (io_mode == IoMode::Write && tor->error().error_type() != TR_STAT_LOCAL_ERROR)
-            {
-                tor->error().set_local_error(error->message);
-                tr_torrentStop(tor);
-            }
+    if (auto failure = IoFailure{}; !doSpans(io_mode, spans, buf, failure))
+    {
+        onIoFailed(tor, io_mode, failure);
+        return failure.code;
+    }
 
-            auto const error_code = error->code;
-            tr_error_clear(&error);
-            return error_code;
-        }
+    return 0;
+}
 
-        if (buf != nullptr)
+int readOrWritePieceAsync(
+    tr_torrent* tor,
+    IoMode io_mode,
+    tr_block_info::Location loc,
+    uint8_t* buf,
+    size_t buflen,
+    tr_worker_pool::Done&& on_done)
+{
+    if (loc.piece >= tor->piece_count())
+    {
+        return EINVAL;
+    }
+
+    auto spans = IoSpans{};
+    if (tr_error* error = nullptr; !getSpans(tor, io_mode, loc, buflen, spans, &error))
+    {
+        if (io_mode == IoMode::Write && tor->error().error_type() != TR_STAT_LOCAL_ERROR)
         {
-            buf += bytes_this_pass;
+            tor->error().set_local_error(error->message);
+            tr_torrentStop(tor);
         }
-        buflen -= bytes_this_pass;
 
-        ++file_index;
-        file_offset = 0;
+        auto const error_code = error->code;
+        tr_error_clear(&error);
+        return error_code;
     }
 
+    auto ops = std::make_shared<tr_worker_pool::Ops>();
+    ops->reserve(std::size(spans));
+    for (auto const& span : spans)
+    {
+        auto& op = ops->emplace_back();
+        op.handle = *span.fd;
+        op.buffer = buf;
+        op.size = span.length;
+        op.offset = span.file_offset;
+        op.is_write = io_mode == IoMode::Write;
+        buf += span.length;
+    }
+
+    auto* const session = tor->session;
+    auto const tor_id = tor->id();
+
+    // `spans` holds the file handles open until the ops are done
+    session->disk_io().submit(
+        ops,
+        [session, tor_id, io_mode, ops, spans = std::move(spans), on_done = std::move(on_done)](int err)
+        {
+            if (err != 0)
+            {
+                auto const failed = std::find_if(std::begin(*ops), std::end(*ops), [](auto const& op) { return op.err != 0; });
+                auto const& span = spans[std::distance(std::begin(*ops), failed)];
+                auto const failure = IoFailure{ err, tr_strerror(err), span.file_index };
+
+                if (auto* const tor = session->torrents().get(tor_id); tor != nullptr)
+                {
+                    onIoFailed(tor, io_mode, failure);
+                }
+            }
+
+            if (on_done)
+            {
+                on_done(err);
+            }
+        },
+        tor_id);
+
     return 0;
 }
 
@@ -303,6 +435,26 @@ int tr_ioWrite(tr_torrent* tor, tr_block_info::Location const& loc, size_t len,
     return readOrWritePiece(tor, IoMode::Write, loc, const_cast<uint8_t*>(writeme), len);
 }
 
+int tr_ioReadAsync(
+    tr_torrent* tor,
+    tr_block_info::Location const& loc,
+    size_t len,
+    uint8_t* setme,
+    std::function<void(int)>&& on_done)
+{
+    return readOrWritePieceAsync(tor, IoMode::Read, loc, setme, len, std::move(on_done));
+}
+
+int tr_ioWriteAsync(
+    tr_torrent* tor,
+    tr_block_info::Location const& loc,
+    size_t len,
+    uint8_t const* writeme,
+    std::function<void(int)>&& on_done)
+{
+    return readOrWritePieceAsync(tor, IoMode::Write, loc, const_cast<uint8_t*>(writeme), len, std::move(on_done));
+}
+
 bool tr_ioTestPiece(tr_torrent* tor, tr_piece_index_t piece)
 {
     auto const hash = recalculateHash(tor, piece);
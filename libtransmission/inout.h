@@ -11,6 +11,7 @@
 
 #include <cstddef> // size_t
 #include <cstdint> // uint8_t, uint32_t
+#include <functional>
 
 #include "libtransmission/transmission.h"
 
@@ -37,6 +38,34 @@ int tr_ioPrefetch(tr_torrent* tor, tr_block_info::Location const& loc, size_t le
  */
 [[nodiscard]] int tr_ioWrite(struct tr_torrent* tor, tr_block_info::Location const& loc, size_t len, uint8_t const* writeme);
 
+/**
+ * Like tr_ioRead(), but the disk read is done by a disk I/O worker thread.
+ * `setme` must stay valid until `on_done` is called in the session thread
+ * with 0 on success, or an errno value on failure.
+ * @return 0 if the read was queued, or an errno value if it couldn't be
+ *         started. `on_done` is not called in that case.
+ */
+[[nodiscard]] int tr_ioReadAsync(
+    tr_torrent* tor,
+    tr_block_info::Location const& loc,
+    size_t len,
+    uint8_t* setme,
+    std::function<void(int)>&& on_done);
+
+/**
+ * Like tr_ioWrite(), but the disk write is done by a disk I/O worker thread.
+ * `writeme` must stay valid until `on_done` is called in the session thread
+ * with 0 on success, or an errno value on failure.
+ * @return 0 if the write was queued, or an errno value if it couldn't be
+ *         started. `on_done` is not called in that case.
+ */
+[[nodiscard]] int tr_ioWriteAsync(
+    tr_torrent* tor,
+    tr_block_info::Location const& loc,
+    size_t len,
+    uint8_t const* writeme,
+    std::function<void(int)>&& on_done);
+
 /**
  * @brief Test to see if the piece matches its metainfo's SHA1 checksum.
  */
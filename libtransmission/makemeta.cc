@@ -27,6 +27,7 @@
 #include "libtransmission/makemeta.h"
 #include "libtransmission/quark.h" // TR_KEY_length, TR_KEY_a...
 #include "libtransmission/session.h" // TR_NAME
+#include "libtransmission/sha1.h"
 #include "libtransmission/torrent-files.h"
 #include "libtransmission/tr-assert.h"
 #include "libtransmission/tr-strbuf.h" // tr_pathbuf
@@ -163,14 +164,18 @@ bool tr_metainfo_builder::blocking_make_checksums(tr_error** error)
 
     auto hashes = std::vector<std::byte>(std::size(tr_sha1_digest_t{}) * piece_count());
     auto* walk = std::data(hashes);
-    auto sha = tr_sha1::create();
 
     auto file_index = tr_file_index_t{ 0U };
     auto piece_index = tr_piece_index_t{ 0U };
     auto total_remain = total_size();
     auto off = uint64_t{ 0U };
 
-    auto buf = std::vector<char>(piece_size());
+    // read several pieces before hashing them if the SHA-1 kernel
+    // can hash them all at once
+    auto const batch_size = tr_sha1_lanes();
+    auto buf = std::vector<char>(size_t{ piece_size() } * batch_size);
+    auto batch = std::vector<tr_sha1_message>{};
+    auto digests = std::vector<tr_sha1_digest_t>(batch_size);
 
     auto const parent = tr_sys_path_dirname(top_);
     auto fd = tr_sys_file_open(
@@ -190,8 +195,8 @@ bool tr_metainfo_builder::blocking_make_checksums(tr_error** error)
         TR_ASSERT(piece_index < piece_count());
 
         auto const piece_size = block_info_.piece_size(piece_index);
-        buf.resize(piece_size);
-        auto* bufptr = std::data(buf);
+        auto* const piece_begin = std::data(buf) + std::size(batch) * this->piece_size();
+        auto* bufptr = piece_begin;
 
         auto left_in_piece = piece_size;
         while (left_in_piece > 0U)
@@ -225,15 +230,22 @@ bool tr_metainfo_builder::blocking_make_checksums(tr_error** error)
             }
         }
 
-        TR_ASSERT(bufptr - std::data(buf) == (int)piece_size);
+        TR_ASSERT(bufptr - piece_begin == (int)piece_size);
         TR_ASSERT(left_in_piece == 0);
-        sha->add(std::data(buf), std::size(buf));
-        auto const digest = sha->finish();
-        walk = std::copy(std::begin(digest), std::end(digest), walk);
-        sha->clear();
+        batch.push_back({ piece_begin, piece_size });
 
         total_remain -= piece_size;
         ++piece_index;
+
+        if (std::size(batch) == batch_size || total_remain == 0U)
+        {
+            tr_sha1_digest_many(std::data(batch), std::size(batch), std::data(digests));
+            for (size_t i = 0, n = std::size(batch); i < n; ++i)
+            {
+                walk = std::copy(std::begin(digests[i]), std::end(digests[i]), walk);
+            }
+            batch.clear();
+        }
     }
 
     TR_ASSERT(cancel_ || size_t(walk - std::data(hashes)) == std::size(hashes));
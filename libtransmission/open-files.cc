@@ -113,7 +113,47 @@ bool preallocate_file_full(tr_sys_file_t fd, uint64_t length, tr_error** error)
 
 // ---
 
+tr_open_files::Handle tr_open_files::make_handle(tr_sys_file_t fd)
+{
+    return Handle{ new tr_sys_file_t{ fd },
+                   [](tr_sys_file_t const* pfd)
+                   {
+                       if (is_open(*pfd))
+                       {
+                           tr_sys_file_close(*pfd);
+                       }
+
+                       delete pfd;
+                   } };
+}
+
 std::optional<tr_sys_file_t> tr_open_files::get(tr_torrent_id_t tor_id, tr_file_index_t file_num, bool writable)
+{
+    if (auto const handle = get_handle(tor_id, file_num, writable); handle)
+    {
+        return *handle;
+    }
+
+    return {};
+}
+
+std::optional<tr_sys_file_t> tr_open_files::get(
+    tr_torrent_id_t tor_id,
+    tr_file_index_t file_num,
+    bool writable,
+    std::string_view filename,
+    tr_preallocation_mode allocation,
+    uint64_t file_size)
+{
+    if (auto const handle = get_handle(tor_id, file_num, writable, filename, allocation, file_size); handle)
+    {
+        return *handle;
+    }
+
+    return {};
+}
+
+tr_open_files::Handle tr_open_files::get_handle(tr_torrent_id_t tor_id, tr_file_index_t file_num, bool writable)
 {
     if (auto* const found = pool_.get(make_key(tor_id, file_num)); found != nullptr)
     {
@@ -128,7 +168,7 @@ std::optional<tr_sys_file_t> tr_open_files::get(tr_torrent_id_t tor_id, tr_file_
     return {};
 }
 
-std::optional<tr_sys_file_t> tr_open_files::get(
+tr_open_files::Handle tr_open_files::get_handle(
     tr_torrent_id_t tor_id,
     tr_file_index_t file_num,
     bool writable,
@@ -241,10 +281,10 @@ std::optional<tr_sys_file_t> tr_open_files::get(
 
     // cache it
     auto& entry = pool_.add(std::move(key));
-    entry.fd_ = fd;
+    entry.fd_ = make_handle(fd);
     entry.writable_ = writable;
 
-    return fd;
+    return entry.fd_;
 }
 
 void tr_open_files::close_all()
@@ -261,11 +301,3 @@ void tr_open_files::close_file(tr_torrent_id_t tor_id, tr_file_index_t file_num)
 {
     pool_.erase(make_key(tor_id, file_num));
 }
-
-tr_open_files::Val::~Val()
-{
-    if (is_open(fd_))
-    {
-        tr_sys_file_close(fd_);
-    }
-}
@@ -11,6 +11,7 @@
 
 #include <cstddef> // for size_t
 #include <cstdint> // for uintX_t
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <utility>
@@ -24,6 +25,11 @@
 class tr_open_files
 {
 public:
+    // An fd that stays open for as long as someone holds a reference to it,
+    // even if it gets evicted from the pool in the meantime. This lets disk
+    // I/O worker threads use an fd without racing the session thread.
+    using Handle = std::shared_ptr<tr_sys_file_t const>;
+
     [[nodiscard]] std::optional<tr_sys_file_t> get(tr_torrent_id_t tor_id, tr_file_index_t file_num, bool writable);
 
     [[nodiscard]] std::optional<tr_sys_file_t> get(
@@ -34,6 +40,16 @@ public:
         tr_preallocation_mode allocation,
         uint64_t file_size);
 
+    [[nodiscard]] Handle get_handle(tr_torrent_id_t tor_id, tr_file_index_t file_num, bool writable);
+
+    [[nodiscard]] Handle get_handle(
+        tr_torrent_id_t tor_id,
+        tr_file_index_t file_num,
+        bool writable,
+        std::string_view filename,
+        tr_preallocation_mode allocation,
+        uint64_t file_size);
+
     void close_all();
     void close_torrent(tr_torrent_id_t tor_id);
     void close_file(tr_torrent_id_t tor_id, tr_file_index_t file_num);
@@ -48,25 +64,12 @@ private:
 
     struct Val
     {
-        Val() noexcept = default;
-        Val(Val const&) = delete;
-        Val& operator=(Val const&) = delete;
-        Val(Val&& that) noexcept
-        {
-            *this = std::move(that);
-        }
-        Val& operator=(Val&& that) noexcept
-        {
-            std::swap(this->fd_, that.fd_);
-            std::swap(this->writable_, that.writable_);
-            return *this;
-        }
-        ~Val();
-
-        tr_sys_file_t fd_ = TR_BAD_SYS_FILE;
+        Handle fd_;
         bool writable_ = false;
     };
 
+    [[nodiscard]] static Handle make_handle(tr_sys_file_t fd);
+
     static constexpr size_t MaxOpenFiles = 32;
     tr_lru_cache<Key, Val, MaxOpenFiles> pool_;
 };
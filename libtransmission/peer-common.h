@@ -13,6 +13,7 @@
 #include <cstddef> // size_t
 #include <cstdint> // uint8_t, uint32_t, uint64_t
 #include <string>
+#include <vector>
 
 #include "libtransmission/transmission.h"
 
@@ -45,7 +46,7 @@ public:
         ClientGotSuggest,
         ClientGotPort,
         ClientGotRej, // applies to webseed too
-        ClientGotBitfield,
+        ClientGotBitfield, // the have-state events are published before tr_peer::has() changes
         ClientGotHave,
         ClientGotHaveAll,
         ClientGotHaveNone,
@@ -238,6 +239,13 @@ public:
 
     tr_recentHistory<uint16_t> cancels_sent_to_client;
 
+    // BEP 6: pieces the peer suggested that we download, oldest first.
+    // They're likely to be in its cache.
+    std::vector<tr_piece_index_t> suggested_pieces;
+
+    // BEP 6: pieces the peer lets us request even while it's choking us
+    std::vector<tr_piece_index_t> allowed_fast_pieces;
+
     /// The following fields are only to be used in peer-mgr.cc.
     /// TODO(ckerr): refactor them out of `tr_peer`
 
@@ -250,6 +258,9 @@ public:
     // how many bad pieces this piece has contributed to
     uint8_t strikes = 0;
 
+    // how many of the pieces that we want this peer has
+    size_t n_interesting_pieces = 0;
+
     // how many blocks this peer has sent us
     tr_recentHistory<uint16_t> blocks_sent_to_client;
 
@@ -88,6 +88,8 @@ tr_peerIo::tr_peerIo(
     tr_bandwidth* parent_bandwidth)
     : bandwidth_{ parent_bandwidth }
     , info_hash_{ info_hash != nullptr ? *info_hash : tr_sha1_digest_t{} }
+    , inbuf_{ session->peer_buffer_pool() }
+    , outbuf_{ session->peer_buffer_pool() }
     , session_{ session }
     , is_seed_{ is_seed }
     , is_incoming_{ is_incoming }
@@ -224,6 +226,9 @@ void tr_peerIo::set_socket(tr_peer_socket socket_in)
     {
         TR_ASSERT_MSG(false, "unsupported peer socket type");
     }
+
+    // start reading when the bandwidth scheduler gets to us
+    bandwidth().request_io(TR_DOWN);
 }
 
 void tr_peerIo::close()
@@ -279,7 +284,7 @@ void tr_peerIo::did_write_wrapper(size_t bytes_transferred)
 
     while (bytes_transferred != 0 && !std::empty(outbuf_info_))
     {
-        auto& [n_bytes_left, is_piece_data] = outbuf_info_.front();
+        auto& [n_bytes_left, is_piece_data, is_shared] = outbuf_info_.front();
 
         size_t const payload = std::min(uint64_t{ n_bytes_left }, uint64_t{ bytes_transferred });
         /* For µTP sockets, the overhead is computed in utp_on_overhead. */
@@ -316,19 +321,26 @@ size_t tr_peerIo::try_write(size_t max)
         return {};
     }
 
-    auto& buf = outbuf_;
-    max = std::min(max, std::size(buf));
+    max = std::min(max, write_buffer_size());
+    if (max == 0)
+    {
+        set_enabled(Dir, false);
+        return {};
+    }
+
     max = bandwidth().clamp(Dir, max);
     if (max == 0)
     {
         set_enabled(Dir, false);
+        bandwidth().wait_for_bandwidth(Dir);
         return {};
     }
 
     tr_error* error = nullptr;
-    auto const n_written = socket_.try_write(buf, max, &error);
+    auto const n_written = std::empty(outbuf_shared_) ? socket_.try_write(outbuf_, max, &error) :
+                                                        try_write_spans(max, &error);
     // enable further writes if there's more data to write
-    set_enabled(Dir, !std::empty(buf) && (error == nullptr || canRetryFromError(error->code)));
+    set_enabled(Dir, write_buffer_size() != 0U && (error == nullptr || canRetryFromError(error->code)));
 
     if (error != nullptr)
     {
@@ -350,6 +362,82 @@ size_t tr_peerIo::try_write(size_t max)
     return n_written;
 }
 
+size_t tr_peerIo::try_write_spans(size_t max, tr_error** error)
+{
+    TR_ASSERT(socket_.is_tcp());
+
+    // gather the spans to write, in the order they were queued
+    auto spans = std::array<tr_peer_socket::ConstSpan, tr_peer_socket::MaxWriteSpans>{};
+    auto n_spans = size_t{};
+    auto const* outbuf_pos = std::data(outbuf_);
+    auto shared_iter = std::begin(outbuf_shared_);
+    for (auto const& [n_bytes, is_piece_data, is_shared] : outbuf_info_)
+    {
+        if (max == 0U)
+        {
+            break;
+        }
+
+        auto const n_this_span = std::min(n_bytes, max);
+        auto const* const begin = is_shared ? (shared_iter++)->begin : outbuf_pos;
+        if (!is_shared)
+        {
+            outbuf_pos += n_bytes;
+        }
+
+        // messages that are next to each other in `outbuf_` can share a span
+        if (n_spans > 0U && spans[n_spans - 1U].first + spans[n_spans - 1U].second == begin)
+        {
+            spans[n_spans - 1U].second += n_this_span;
+        }
+        else if (n_spans < std::size(spans))
+        {
+            spans[n_spans++] = { begin, n_this_span };
+        }
+        else
+        {
+            break;
+        }
+
+        max -= n_this_span;
+    }
+
+    auto const n_written = socket_.try_write(std::data(spans), n_spans, error);
+
+    // drop what was written
+    auto n_left = n_written;
+    auto n_outbuf_bytes = size_t{};
+    for (auto const& [n_bytes, is_piece_data, is_shared] : outbuf_info_)
+    {
+        if (n_left == 0U)
+        {
+            break;
+        }
+
+        auto const n_this_span = std::min(n_bytes, n_left);
+        if (is_shared)
+        {
+            auto& shared = outbuf_shared_.front();
+            shared.begin += n_this_span;
+            shared.n_bytes -= n_this_span;
+            n_outbuf_shared_bytes_ -= n_this_span;
+            if (shared.n_bytes == 0U)
+            {
+                outbuf_shared_.pop_front();
+            }
+        }
+        else
+        {
+            n_outbuf_bytes += n_this_span;
+        }
+
+        n_left -= n_this_span;
+    }
+    outbuf_.drain(n_outbuf_bytes);
+
+    return n_written;
+}
+
 void tr_peerIo::event_write_cb([[maybe_unused]] evutil_socket_t fd, short /*event*/, void* vio)
 {
     auto* const io = static_cast<tr_peerIo*>(vio);
@@ -440,12 +528,13 @@ size_t tr_peerIo::try_read(size_t max)
         return {};
     }
 
-    // Do not write more than the bandwidth allows.
-    // If there is no bandwidth left available, disable writes.
+    // Do not read more than the bandwidth allows.
+    // If there is no bandwidth left available, disable reads until there is.
     max = bandwidth().clamp(Dir, max);
     if (max == 0)
     {
         set_enabled(Dir, false);
+        bandwidth().wait_for_bandwidth(Dir);
         return {};
     }
 
@@ -456,6 +545,12 @@ size_t tr_peerIo::try_read(size_t max)
 
     if (error != nullptr)
     {
+        // nothing was read, so give back the space we reserved for it
+        if (std::empty(buf))
+        {
+            buf.clear();
+        }
+
         if (!canRetryFromError(error->code))
         {
             tr_logAddTraceIo(this, fmt::format("try_read err: n_read:{} errno:{} ({})", n_read, error->code, error->message));
@@ -486,8 +581,15 @@ void tr_peerIo::event_read_cb([[maybe_unused]] evutil_socket_t fd, short /*event
 
     // if we don't have any bandwidth left, stop reading
     auto const n_used = std::size(io->inbuf_);
-    auto const n_left = n_used >= MaxLen ? 0 : MaxLen - n_used;
-    io->try_read(n_left);
+    if (n_used >= MaxLen)
+    {
+        // the buffer is full but doesn't hold a whole message yet,
+        // so let the bandwidth scheduler read more in small steps
+        io->bandwidth().request_io(TR_DOWN);
+        return;
+    }
+
+    io->try_read(MaxLen - n_used);
 }
 
 // ---
@@ -585,7 +687,7 @@ size_t tr_peerIo::flush_outgoing_protocol_msgs()
 
     /* count up how many bytes are used by non-piece-data messages
        at the front of our outbound queue */
-    for (auto const& [n_bytes, is_piece_data] : outbuf_info_)
+    for (auto const& [n_bytes, is_piece_data, is_shared] : outbuf_info_)
     {
         if (is_piece_data)
         {
@@ -603,12 +705,31 @@ size_t tr_peerIo::flush_outgoing_protocol_msgs()
 size_t tr_peerIo::get_write_buffer_space(uint64_t now) const noexcept
 {
     size_t const desired_len = get_desired_output_buffer_size(this, now);
-    size_t const current_len = std::size(outbuf_);
+    size_t const current_len = write_buffer_size();
     return desired_len > current_len ? desired_len - current_len : 0U;
 }
 
 // ---
 
+void tr_peerIo::write_shared(std::shared_ptr<std::byte const> data, size_t n_bytes, bool is_piece_data)
+{
+    // Encryption can't be done in a shared buffer, and
+    // µTP can only be given one buffer at a time
+    if (is_encrypted() || !socket_.is_tcp())
+    {
+        write_bytes(data.get(), n_bytes, is_piece_data);
+        return;
+    }
+
+    outbuf_info_.push_back({ n_bytes, is_piece_data, true });
+    auto const* const begin = data.get();
+    outbuf_shared_.push_back({ std::move(data), begin, n_bytes });
+    n_outbuf_shared_bytes_ += n_bytes;
+    bandwidth_.request_io(TR_UP);
+}
+
+// ---
+
 void tr_peerIo::read_bytes(void* bytes, size_t n_bytes)
 {
     auto walk = reinterpret_cast<std::byte*>(bytes);
@@ -107,6 +107,13 @@ public:
 
     void set_enabled(tr_direction dir, bool is_enabled);
 
+    // Hand what's already in the read buffer to the read callback,
+    // e.g. when it returned READ_LATER to wait on something other than the peer.
+    void process_read_buffer()
+    {
+        can_read_wrapper();
+    }
+
     ///
 
     [[nodiscard]] TR_CONSTEXPR20 auto read_buffer_size() const noexcept
@@ -142,13 +149,19 @@ public:
 
     void write_bytes(void const* bytes, size_t n_bytes, bool is_piece_data)
     {
-        outbuf_info_.emplace_back(n_bytes, is_piece_data);
+        outbuf_info_.push_back({ n_bytes, is_piece_data, false });
 
         auto [resbuf, reslen] = outbuf_.reserve_space(n_bytes);
         filter_.encrypt(reinterpret_cast<std::byte const*>(bytes), n_bytes, resbuf);
         outbuf_.commit_space(n_bytes);
+        bandwidth_.request_io(TR_UP);
     }
 
+    // Like write_bytes(), but `data` is queued by reference instead of being
+    // copied when the connection allows it, i.e. on unencrypted TCP sockets.
+    // The bytes must not change until they've been written.
+    void write_shared(std::shared_ptr<std::byte const> data, size_t n_bytes, bool is_piece_data);
+
     // Write all the data from `buf`.
     // This is a destructive add: `buf` is empty after this call.
     template<typename T>
@@ -165,11 +178,6 @@ public:
 
     ///
 
-    [[nodiscard]] auto has_bandwidth_left(tr_direction dir) const noexcept
-    {
-        return bandwidth_.clamp(dir, 1024) > 0;
-    }
-
     [[nodiscard]] auto get_piece_speed_bytes_per_second(uint64_t now, tr_direction dir) const noexcept
     {
         return bandwidth_.get_piece_speed_bytes_per_second(now, dir);
@@ -317,13 +325,13 @@ public:
 
 private:
     // Our target socket receive buffer size.
-    // Gets read from the socket buffer into the PeerBuffer inbuf_.
+    // Gets read from the socket buffer into inbuf_.
     static constexpr auto RcvBuf = size_t{ 256 * 1024 };
 
-    // The buffer size for incoming & outgoing peer messages.
-    // Starts off with enough capacity to read a single BT Piece message,
-    // but has a 5x GrowthFactor so that it can quickly to high volume.
-    using PeerBuffer = libtransmission::StackBuffer<tr_block_info::BlockSize + 16U, std::byte, std::ratio<5, 1>>;
+    // The buffers for incoming & outgoing peer messages.
+    // Their memory comes from the session's peer buffer pool and is
+    // returned there whenever they're drained, so idle peers cost nothing.
+    using PeerBuffer = libtransmission::PooledBuffer;
 
     friend class libtransmission::test::HandshakeTest;
 
@@ -357,6 +365,15 @@ private:
     size_t try_read(size_t max);
     size_t try_write(size_t max);
 
+    // Write from `outbuf_` and `outbuf_shared_` with a single syscall
+    size_t try_write_spans(size_t max, tr_error** error);
+
+    // how many bytes are waiting to be written
+    [[nodiscard]] TR_CONSTEXPR20 size_t write_buffer_size() const noexcept
+    {
+        return std::size(outbuf_) + n_outbuf_shared_bytes_;
+    }
+
     // this is only public for testing purposes.
     // production code should use new_outgoing() or new_incoming()
     static std::shared_ptr<tr_peerIo> create(
@@ -369,7 +386,26 @@ private:
     Filter filter_;
     std::optional<size_t> decrypt_remain_len_;
 
-    std::deque<std::pair<size_t /*n_bytes*/, bool /*is_piece_data*/>> outbuf_info_;
+    // The messages waiting to be written, oldest first
+    struct OutgoingInfo
+    {
+        size_t n_bytes; // how many of its bytes haven't been written yet
+        bool is_piece_data;
+        bool is_shared; // true if its bytes are in `outbuf_shared_` instead of `outbuf_`
+    };
+
+    std::deque<OutgoingInfo> outbuf_info_;
+
+    // Data that's queued by reference. See write_shared().
+    struct SharedSpan
+    {
+        std::shared_ptr<std::byte const> owner;
+        std::byte const* begin;
+        size_t n_bytes;
+    };
+
+    std::deque<SharedSpan> outbuf_shared_;
+    size_t n_outbuf_shared_bytes_ = 0;
 
     tr_peer_socket socket_ = {};
 
@@ -5,66 +5,293 @@
 
 #include <algorithm>
 #include <cstddef> // size_t
+#include <cstdint> // uint32_t
 #include <ctime>
+#include <deque>
+#include <limits>
 #include <memory>
-#include <utility>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include <small/map.hpp>
-
 #define LIBTRANSMISSION_PEER_MODULE
 
 #include "libtransmission/transmission.h"
 
 #include "libtransmission/peer-mgr-active-requests.h"
-#include "libtransmission/peer-mgr-wishlist.h"
 #include "libtransmission/tr-assert.h"
 
 class tr_peer;
 
+// Every request is a node in a pool. It's linked into a list of the
+// requests for its block, which is found through an array indexed by
+// block, and into a list of the requests to its peer. A queue sorted by
+// send time lets sentBefore() stop at the first request that's too new.
 class ActiveRequests::Impl
 {
 public:
-    size_t size() const
+    using Index = uint32_t;
+
+    static auto constexpr NoIndex = std::numeric_limits<Index>::max();
+
+    [[nodiscard]] constexpr auto size() const noexcept
     {
         return size_;
     }
 
-    size_t count(tr_peer const* peer) const
+    [[nodiscard]] size_t count(tr_peer const* peer) const
     {
-        auto const it = count_.find(peer);
-        return it != std::end(count_) ? it->second : size_t{};
+        auto const it = by_peer_.find(peer);
+        return it != std::end(by_peer_) ? it->second.count : size_t{};
     }
 
-    void incCount(tr_peer const* peer)
+    [[nodiscard]] size_t count(tr_block_index_t block) const noexcept
     {
-        ++count_[peer];
+        auto n = size_t{};
+        for (auto idx = block_head(block); idx != NoIndex; idx = nodes_[idx].next_in_block)
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    [[nodiscard]] Index find(tr_block_index_t block, tr_peer const* peer) const noexcept
+    {
+        for (auto idx = block_head(block); idx != NoIndex; idx = nodes_[idx].next_in_block)
+        {
+            if (nodes_[idx].peer == peer)
+            {
+                return idx;
+            }
+        }
+
+        return NoIndex;
+    }
+
+    bool add(tr_block_index_t block, tr_peer* peer, time_t when)
+    {
+        if (find(block, peer) != NoIndex)
+        {
+            return false;
+        }
+
+        auto const idx = alloc();
+        auto& node = nodes_[idx];
+        node.peer = peer;
+        node.block = block;
+        node.when = when;
+
+        // link it into the block's list
+        if (block >= std::size(by_block_))
+        {
+            by_block_.resize(block + 1U, NoIndex);
+        }
+        node.next_in_block = by_block_[block];
+        by_block_[block] = idx;
+
+        // link it into the peer's list
+        auto& peer_requests = by_peer_[peer];
+        node.prev_in_peer = NoIndex;
+        node.next_in_peer = peer_requests.head;
+        if (peer_requests.head != NoIndex)
+        {
+            nodes_[peer_requests.head].prev_in_peer = idx;
+        }
+        peer_requests.head = idx;
+        ++peer_requests.count;
+
+        // `when` is almost always the newest, but keep the queue sorted if it isn't
+        auto const stamp = Timestamp{ when, idx, node.generation };
+        if (std::empty(by_time_) || by_time_.back().when <= when)
+        {
+            by_time_.push_back(stamp);
+        }
+        else
+        {
+            auto const it = std::upper_bound(
+                std::begin(by_time_),
+                std::end(by_time_),
+                when,
+                [](time_t val, Timestamp const& ts) { return val < ts.when; });
+            by_time_.insert(it, stamp);
+        }
+
         ++size_;
+        return true;
     }
 
-    void decCount(tr_peer const* peer)
+    // unlink the request at `idx` from its block and peer and free it
+    void erase(Index idx)
     {
-        auto it = count_.find(peer);
-        TR_ASSERT(it != std::end(count_));
-        TR_ASSERT(it->second > 0);
-        TR_ASSERT(size_ > 0);
+        auto& node = nodes_[idx];
 
-        if (it != std::end(count_))
+        // unlink it from the block's list
+        for (auto* walk = &by_block_[node.block]; *walk != NoIndex; walk = &nodes_[*walk].next_in_block)
         {
-            if (--it->second == 0)
+            if (*walk == idx)
             {
-                count_.erase(it);
+                *walk = node.next_in_block;
+                break;
             }
-            --size_;
         }
+
+        // unlink it from the peer's list
+        auto const peer_it = by_peer_.find(node.peer);
+        TR_ASSERT(peer_it != std::end(by_peer_));
+        auto& peer_requests = peer_it->second;
+        if (node.prev_in_peer != NoIndex)
+        {
+            nodes_[node.prev_in_peer].next_in_peer = node.next_in_peer;
+        }
+        else
+        {
+            peer_requests.head = node.next_in_peer;
+        }
+        if (node.next_in_peer != NoIndex)
+        {
+            nodes_[node.next_in_peer].prev_in_peer = node.prev_in_peer;
+        }
+        if (--peer_requests.count == 0U)
+        {
+            by_peer_.erase(peer_it);
+        }
+
+        free(idx);
     }
 
-    std::unordered_map<tr_peer const*, size_t> count_;
+    template<typename Func>
+    void for_each_request_to(tr_peer const* peer, Func&& func) const
+    {
+        if (auto const it = by_peer_.find(peer); it != std::end(by_peer_))
+        {
+            for (auto idx = it->second.head; idx != NoIndex; idx = nodes_[idx].next_in_peer)
+            {
+                func(idx, nodes_[idx]);
+            }
+        }
+    }
+
+    template<typename Func>
+    void for_each_request_for(tr_block_index_t block, Func&& func) const
+    {
+        for (auto idx = block_head(block); idx != NoIndex; idx = nodes_[idx].next_in_block)
+        {
+            func(idx, nodes_[idx]);
+        }
+    }
+
+    template<typename Func>
+    void for_each_sent_before(time_t when, Func&& func) const
+    {
+        for (auto const& stamp : by_time_)
+        {
+            if (stamp.when >= when)
+            {
+                break;
+            }
 
-    std::unordered_map<tr_block_index_t, small::map<tr_peer const*, time_t, Wishlist::EndgameMaxPeers>> blocks_;
+            if (is_live(stamp))
+            {
+                func(nodes_[stamp.idx]);
+            }
+        }
+    }
 
 private:
+    struct Node
+    {
+        tr_peer* peer = nullptr;
+        tr_block_index_t block = {};
+        time_t when = {};
+        Index next_in_block = NoIndex;
+        Index prev_in_peer = NoIndex;
+        Index next_in_peer = NoIndex;
+
+        // bumped when the node is freed, so that stale entries in `by_time_` can be spotted
+        uint32_t generation = {};
+        bool in_use = false;
+    };
+
+    struct PeerRequests
+    {
+        Index head = NoIndex;
+        size_t count = {};
+    };
+
+    struct Timestamp
+    {
+        time_t when;
+        Index idx;
+        uint32_t generation;
+    };
+
+    [[nodiscard]] Index block_head(tr_block_index_t block) const noexcept
+    {
+        return block < std::size(by_block_) ? by_block_[block] : NoIndex;
+    }
+
+    [[nodiscard]] bool is_live(Timestamp const& stamp) const noexcept
+    {
+        auto const& node = nodes_[stamp.idx];
+        return node.in_use && node.generation == stamp.generation;
+    }
+
+    [[nodiscard]] Index alloc()
+    {
+        auto idx = Index{};
+
+        if (!std::empty(free_))
+        {
+            idx = free_.back();
+            free_.pop_back();
+        }
+        else
+        {
+            idx = static_cast<Index>(std::size(nodes_));
+            nodes_.emplace_back();
+        }
+
+        nodes_[idx].in_use = true;
+        return idx;
+    }
+
+    void free(Index idx)
+    {
+        auto& node = nodes_[idx];
+        node.in_use = false;
+        ++node.generation;
+        free_.push_back(idx);
+        --size_;
+
+        if (size_ == 0U)
+        {
+            // nothing's being downloaded, so give back the block index
+            nodes_.clear();
+            free_.clear();
+            by_time_.clear();
+            by_block_ = {};
+            return;
+        }
+
+        // drop the stale entries at the front of the queue
+        while (!std::empty(by_time_) && !is_live(by_time_.front()))
+        {
+            by_time_.pop_front();
+        }
+    }
+
+    std::vector<Node> nodes_;
+    std::vector<Index> free_;
+
+    // the first request for each block, or NoIndex
+    std::vector<Index> by_block_;
+
+    std::unordered_map<tr_peer const*, PeerRequests> by_peer_;
+
+    // requests sorted by when they were sent, oldest first.
+    // Entries for requests that have been removed are skipped.
+    std::deque<Timestamp> by_time_;
+
     size_t size_ = 0;
 };
 
@@ -77,52 +304,41 @@ ActiveRequests::~ActiveRequests() = default;
 
 bool ActiveRequests::add(tr_block_index_t block, tr_peer* peer, time_t when)
 {
-    bool const added = impl_->blocks_[block].emplace(peer, when).second;
-
-    if (added)
-    {
-        impl_->incCount(peer);
-    }
-
-    return added;
+    return impl_->add(block, peer, when);
 }
 
 // remove a request to `peer` for `block`
 bool ActiveRequests::remove(tr_block_index_t block, tr_peer const* peer)
 {
-    auto const it = impl_->blocks_.find(block);
-    auto const removed = it != std::end(impl_->blocks_) && it->second.erase(peer) != 0;
-
-    if (removed)
+    auto const idx = impl_->find(block, peer);
+    if (idx == Impl::NoIndex)
     {
-        impl_->decCount(peer);
-
-        if (std::empty(it->second))
-        {
-            impl_->blocks_.erase(it);
-        }
+        return false;
     }
 
-    return removed;
+    impl_->erase(idx);
+    return true;
 }
 
 // remove requests to `peer` and return the associated blocks
 std::vector<tr_block_index_t> ActiveRequests::remove(tr_peer const* peer)
 {
     auto removed = std::vector<tr_block_index_t>{};
-    removed.reserve(impl_->blocks_.size());
+    auto indices = std::vector<Impl::Index>{};
+    removed.reserve(impl_->count(peer));
+    indices.reserve(impl_->count(peer));
 
-    for (auto const& [block, peers_at] : impl_->blocks_)
-    {
-        if (peers_at.count(peer) != 0U)
+    impl_->for_each_request_to(
+        peer,
+        [&](Impl::Index idx, auto const& node)
         {
-            removed.push_back(block);
-        }
-    }
+            removed.push_back(node.block);
+            indices.push_back(idx);
+        });
 
-    for (auto block : removed)
+    for (auto const idx : indices)
     {
-        remove(block, peer);
+        impl_->erase(idx);
     }
 
     return removed;
@@ -132,22 +348,19 @@ std::vector<tr_block_index_t> ActiveRequests::remove(tr_peer const* peer)
 std::vector<tr_peer*> ActiveRequests::remove(tr_block_index_t block)
 {
     auto removed = std::vector<tr_peer*>{};
+    auto indices = std::vector<Impl::Index>{};
 
-    if (auto it = impl_->blocks_.find(block); it != std::end(impl_->blocks_))
-    {
-        auto const n = std::size(it->second);
-        removed.resize(n);
-        std::transform(
-            std::begin(it->second),
-            std::end(it->second),
-            std::begin(removed),
-            [](auto const& iter) { return const_cast<tr_peer*>(iter.first); });
-        impl_->blocks_.erase(block);
-    }
+    impl_->for_each_request_for(
+        block,
+        [&](Impl::Index idx, auto const& node)
+        {
+            removed.push_back(node.peer);
+            indices.push_back(idx);
+        });
 
-    for (auto const* const peer : removed)
+    for (auto const idx : indices)
     {
-        impl_->decCount(peer);
+        impl_->erase(idx);
     }
 
     return removed;
@@ -156,16 +369,13 @@ std::vector<tr_peer*> ActiveRequests::remove(tr_block_index_t block)
 // return true if there's an active request to `peer` for `block`
 bool ActiveRequests::has(tr_block_index_t block, tr_peer const* peer) const
 {
-    auto const iter = impl_->blocks_.find(block);
-    return iter != std::end(impl_->blocks_) && (iter->second.count(peer) != 0U);
+    return impl_->find(block, peer) != Impl::NoIndex;
 }
 
 // count how many peers we're asking for `block`
 size_t ActiveRequests::count(tr_block_index_t block) const
 {
-    auto const& blocks = impl_->blocks_;
-    auto const iter = blocks.find(block);
-    return iter == std::end(blocks) ? 0U : std::size(iter->second);
+    return impl_->count(block);
 }
 
 // count how many active block requests we have to `peer`
@@ -180,22 +390,12 @@ size_t ActiveRequests::size() const
     return impl_->size();
 }
 
-// returns the active requests sent before `when`
+// returns the active requests sent before `when`, oldest first
 std::vector<std::pair<tr_block_index_t, tr_peer*>> ActiveRequests::sentBefore(time_t when) const
 {
     auto sent_before = std::vector<std::pair<tr_block_index_t, tr_peer*>>{};
-    sent_before.reserve(std::size(impl_->blocks_));
 
-    for (auto const& [block, peers_at] : impl_->blocks_)
-    {
-        for (auto const& [peer, sent_at] : peers_at)
-        {
-            if (sent_at < when)
-            {
-                sent_before.emplace_back(block, const_cast<tr_peer*>(peer));
-            }
-        }
-    }
+    impl_->for_each_sent_before(when, [&sent_before](auto const& node) { sent_before.emplace_back(node.block, node.peer); });
 
     return sent_before;
 }
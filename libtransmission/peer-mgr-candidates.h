@@ -0,0 +1,147 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <ctime> // time_t
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility> // std::pair
+
+#include "libtransmission/net.h" // tr_socket_address
+#include "libtransmission/utils.h" // tr_compare_3way
+
+/**
+ * The connectable peers of a swarm that we might want to connect to.
+ *
+ * Candidates that can be connected to now are ordered by score, lowest
+ * first, and the others are ordered by when to check them again. Entries
+ * are keyed by socket address so that they can't dangle if the peer pool
+ * changes; the swarm re-checks them when they reach the front.
+ */
+class CandidateIndex
+{
+public:
+    // queue `socket_address` as ready to connect to, replacing any earlier entry
+    void set_ready(tr_socket_address const& socket_address, uint64_t score)
+    {
+        insert(socket_address, { score, true });
+    }
+
+    // queue `socket_address` to be checked again at `when`, replacing any earlier entry
+    void set_waiting(tr_socket_address const& socket_address, time_t when)
+    {
+        insert(socket_address, { static_cast<uint64_t>(when), false });
+    }
+
+    void erase(tr_socket_address const& socket_address)
+    {
+        if (auto const it = states_.find(socket_address); it != std::end(states_))
+        {
+            auto& queue = it->second.is_ready ? ready_ : waiting_;
+            queue.erase(Key{ it->second.order, socket_address });
+            states_.erase(it);
+        }
+    }
+
+    void clear()
+    {
+        ready_.clear();
+        waiting_.clear();
+        states_.clear();
+    }
+
+    // @return the ready candidate with the lowest score and its score
+    [[nodiscard]] std::optional<std::pair<uint64_t, tr_socket_address>> best_ready() const
+    {
+        if (std::empty(ready_))
+        {
+            return {};
+        }
+
+        auto const& [score, socket_address] = *std::begin(ready_);
+        return std::make_pair(score, socket_address);
+    }
+
+    // @return the waiting candidate that's due soonest, if it's due by `now`
+    [[nodiscard]] std::optional<tr_socket_address> next_due(time_t now) const
+    {
+        if (std::empty(waiting_) || std::begin(waiting_)->order > static_cast<uint64_t>(now))
+        {
+            return {};
+        }
+
+        return std::begin(waiting_)->socket_address;
+    }
+
+    // @return the score that `socket_address` was queued with, if it's ready
+    [[nodiscard]] std::optional<uint64_t> ready_score(tr_socket_address const& socket_address) const
+    {
+        if (auto const it = states_.find(socket_address); it != std::end(states_) && it->second.is_ready)
+        {
+            return it->second.order;
+        }
+
+        return {};
+    }
+
+    [[nodiscard]] bool contains(tr_socket_address const& socket_address) const
+    {
+        return states_.count(socket_address) != 0U;
+    }
+
+    [[nodiscard]] size_t count_ready() const noexcept
+    {
+        return std::size(ready_);
+    }
+
+    [[nodiscard]] size_t count_waiting() const noexcept
+    {
+        return std::size(waiting_);
+    }
+
+private:
+    struct Key
+    {
+        uint64_t order; // score if ready, or when to check it again if waiting
+        tr_socket_address socket_address;
+
+        [[nodiscard]] bool operator<(Key const& that) const noexcept
+        {
+            if (auto const val = tr_compare_3way(order, that.order); val != 0)
+            {
+                return val < 0;
+            }
+
+            return socket_address.compare(that.socket_address) < 0;
+        }
+    };
+
+    struct State
+    {
+        uint64_t order;
+        bool is_ready;
+    };
+
+    void insert(tr_socket_address const& socket_address, State const& state)
+    {
+        erase(socket_address);
+
+        auto& queue = state.is_ready ? ready_ : waiting_;
+        queue.insert(Key{ state.order, socket_address });
+        states_.try_emplace(socket_address, state);
+    }
+
+    std::set<Key> ready_;
+    std::set<Key> waiting_;
+    std::unordered_map<tr_socket_address, State> states_;
+};
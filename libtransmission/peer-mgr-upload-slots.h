@@ -0,0 +1,90 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <algorithm> // std::max, std::min
+#include <cstddef> // size_t
+#include <vector>
+
+/**
+ * The session-wide pool of upload slots used when `upload-slots-global`
+ * is set: how many are kept for optimistic unchokes, how the rest are
+ * split between torrents, and how many are still free.
+ */
+class UploadSlotPool
+{
+public:
+    // how much of the pool to keep for optimistic unchokes
+    static auto constexpr OptimisticSlotsDivisor = size_t{ 8U };
+
+    // `n_optimistic` is how many torrents have an optimistic unchoke that
+    // hasn't expired yet; those still hold their slots
+    UploadSlotPool(size_t n_slots, size_t n_optimistic)
+        : n_optimistic_{ n_optimistic }
+        , n_optimistic_slots_{ std::max({ size_t{ 1U }, n_slots / OptimisticSlotsDivisor, n_optimistic }) }
+        , n_free_{ n_slots - std::min(n_slots, n_optimistic_slots_) }
+    {
+    }
+
+    [[nodiscard]] constexpr auto optimistic_slots() const noexcept
+    {
+        return n_optimistic_slots_;
+    }
+
+    // how many slots are left for regular unchokes
+    [[nodiscard]] constexpr auto free() const noexcept
+    {
+        return n_free_;
+    }
+
+    // How many new optimistic unchokes may be made: the optimistic
+    // slots that aren't held, plus any regular ones that went unused.
+    [[nodiscard]] constexpr auto optimistic_free() const noexcept
+    {
+        return n_optimistic_slots_ - n_optimistic_ + n_free_;
+    }
+
+    // Split the free slots between `n_wanting` torrents, at most
+    // `max_fair_share` each. When they don't divide evenly -- e.g. when
+    // there are fewer slots than torrents -- the remainder goes one slot
+    // each to the torrents from index `first` on, wrapping around, so
+    // callers should vary `first` to let every torrent take its turn.
+    [[nodiscard]] std::vector<size_t> fair_shares(size_t n_wanting, size_t max_fair_share, size_t first) const
+    {
+        if (n_wanting == 0U)
+        {
+            return {};
+        }
+
+        auto shares = std::vector<size_t>(n_wanting, n_free_ / n_wanting);
+        for (size_t i = 0, n = n_free_ % n_wanting; i < n; ++i)
+        {
+            ++shares[(first + i) % n_wanting];
+        }
+
+        for (auto& share : shares)
+        {
+            share = std::min(share, max_fair_share);
+        }
+
+        return shares;
+    }
+
+    // mark `n` of the free slots as taken
+    void take(size_t n) noexcept
+    {
+        n_free_ -= std::min(n_free_, n);
+    }
+
+private:
+    size_t n_optimistic_;
+    size_t n_optimistic_slots_;
+    size_t n_free_;
+};
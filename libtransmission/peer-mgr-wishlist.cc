@@ -3,10 +3,9 @@
 // or any future license endorsed by Mnemosyne LLC.
 // License text can be found in the licenses/ folder.
 
-#include <algorithm> // std::min, std::partial_sort
+#include <algorithm> // std::find, std::sort, std::unique
 #include <cstddef>
-#include <set>
-#include <utility>
+#include <functional>
 #include <vector>
 
 #define LIBTRANSMISSION_PEER_MODULE
@@ -15,143 +14,221 @@
 
 #include "libtransmission/crypto-utils.h" // for tr_salt_shaker
 #include "libtransmission/peer-mgr-wishlist.h"
-#include "libtransmission/utils.h"
 
 namespace
 {
-using SaltType = tr_piece_index_t;
-
-struct Candidate
+[[nodiscard]] tr_piece_index_t make_random_salt()
 {
-    tr_piece_index_t piece;
-    size_t n_blocks_missing;
-    tr_priority_t priority;
-    SaltType salt;
+    thread_local auto salter = tr_salt_shaker<tr_piece_index_t>{};
+    return salter();
+}
 
-    Candidate(tr_piece_index_t piece_in, size_t missing_in, tr_priority_t priority_in, SaltType salt_in)
-        : piece{ piece_in }
-        , n_blocks_missing{ missing_in }
-        , priority{ priority_in }
-        , salt{ salt_in }
+std::vector<tr_block_span_t> makeSpans(tr_block_index_t const* sorted_blocks, size_t n_blocks)
+{
+    if (n_blocks == 0)
     {
+        return {};
     }
 
-    [[nodiscard]] constexpr auto compare(Candidate const& that) const noexcept // <=>
+    auto spans = std::vector<tr_block_span_t>{};
+    auto cur = tr_block_span_t{ sorted_blocks[0], sorted_blocks[0] + 1 };
+    for (size_t i = 1; i < n_blocks; ++i)
     {
-        // prefer pieces closer to completion
-        if (auto const val = tr_compare_3way(n_blocks_missing, that.n_blocks_missing); val != 0)
+        if (cur.end == sorted_blocks[i])
+        {
+            ++cur.end;
+        }
+        else
         {
-            return val;
+            spans.push_back(cur);
+            cur = tr_block_span_t{ sorted_blocks[i], sorted_blocks[i] + 1 };
         }
+    }
+    spans.push_back(cur);
+
+    return spans;
+}
+
+} // namespace
 
-        // prefer higher priority
-        if (auto const val = tr_compare_3way(priority, that.priority); val != 0)
+Wishlist::Candidate Wishlist::make_candidate(tr_piece_index_t piece, SaltType salt) const
+{
+    auto const replication = selection_ == TR_PIECE_SELECTION_RAREST_FIRST ? mediator_.replication(piece) : size_t{};
+    return { piece, mediator_.countMissingBlocks(piece), mediator_.priority(piece), replication, salt };
+}
+
+void Wishlist::rebuild()
+{
+    auto const n_pieces = mediator_.countAllPieces();
+    auto const is_sequential = selection_ == TR_PIECE_SELECTION_SEQUENTIAL;
+
+    auto candidates = std::vector<Candidate>{};
+    candidates.reserve(n_pieces);
+    for (tr_piece_index_t piece = 0; piece < n_pieces; ++piece)
+    {
+        if (!mediator_.clientCanRequestPiece(piece) || mediator_.countMissingBlocks(piece) == 0U)
         {
-            return -val;
+            continue;
         }
 
-        return tr_compare_3way(salt, that.salt);
+        candidates.emplace_back(make_candidate(piece, is_sequential ? piece : make_random_salt()));
     }
+    std::sort(std::begin(candidates), std::end(candidates));
 
-    bool operator<(Candidate const& that) const // less than
+    candidates_ = Candidates{ std::begin(candidates), std::end(candidates) };
+    piece_to_candidate_.assign(n_pieces, std::end(candidates_));
+    for (auto it = std::begin(candidates_), end = std::end(candidates_); it != end; ++it)
     {
-        return compare(that) < 0;
+        piece_to_candidate_[it->piece] = it;
     }
-};
 
-std::vector<Candidate> getCandidates(Wishlist::Mediator const& mediator)
+    dirty_pieces_.clear();
+    needs_rebuild_ = false;
+    needs_resort_ = false;
+}
+
+void Wishlist::resort()
 {
-    // count up the pieces that we still want
-    auto wanted_pieces = std::vector<std::pair<tr_piece_index_t, size_t>>{};
-    auto const n_pieces = mediator.countAllPieces();
-    wanted_pieces.reserve(n_pieces);
-    for (tr_piece_index_t i = 0; i < n_pieces; ++i)
+    needs_resort_ = false;
+
+    if (selection_ != TR_PIECE_SELECTION_RAREST_FIRST)
     {
-        if (!mediator.clientCanRequestPiece(i))
-        {
-            continue;
-        }
+        return;
+    }
 
-        size_t const n_missing = mediator.countMissingBlocks(i);
-        if (n_missing == 0)
-        {
-            continue;
-        }
+    auto candidates = std::vector<Candidate>{ std::begin(candidates_), std::end(candidates_) };
+    for (auto& candidate : candidates)
+    {
+        candidate.replication = mediator_.replication(candidate.piece);
+    }
+    std::sort(std::begin(candidates), std::end(candidates));
 
-        wanted_pieces.emplace_back(i, n_missing);
+    candidates_ = Candidates{ std::begin(candidates), std::end(candidates) };
+    for (auto it = std::begin(candidates_), end = std::end(candidates_); it != end; ++it)
+    {
+        piece_to_candidate_[it->piece] = it;
     }
+}
 
-    // transform them into candidates
-    auto salter = tr_salt_shaker<SaltType>{};
-    auto const n = std::size(wanted_pieces);
-    auto candidates = std::vector<Candidate>{};
-    auto const is_sequential = mediator.isSequentialDownload();
-    candidates.reserve(n);
-    for (size_t i = 0; i < n; ++i)
+void Wishlist::update_piece(tr_piece_index_t piece)
+{
+    if (piece >= std::size(piece_to_candidate_))
+    {
+        return;
+    }
+
+    auto& it = piece_to_candidate_[piece];
+    auto salt = selection_ == TR_PIECE_SELECTION_SEQUENTIAL ? piece : SaltType{};
+    if (it != std::end(candidates_))
     {
-        auto const [piece, n_missing] = wanted_pieces[i];
-        auto const salt = is_sequential ? piece : salter();
-        candidates.emplace_back(piece, n_missing, mediator.priority(piece), salt);
+        salt = it->salt;
+        candidates_.erase(it);
+        it = std::end(candidates_);
+    }
+    else if (selection_ != TR_PIECE_SELECTION_SEQUENTIAL)
+    {
+        salt = make_random_salt();
     }
 
-    return candidates;
+    if (mediator_.clientCanRequestPiece(piece) && mediator_.countMissingBlocks(piece) != 0U)
+    {
+        it = candidates_.insert(make_candidate(piece, salt)).first;
+    }
 }
 
-std::vector<tr_block_span_t> makeSpans(tr_block_index_t const* sorted_blocks, size_t n_blocks)
+void Wishlist::refresh()
 {
-    if (n_blocks == 0)
+    auto const selection = mediator_.isSequentialDownload() ? TR_PIECE_SELECTION_SEQUENTIAL : mediator_.pieceSelection();
+    if (selection_ != selection || std::size(piece_to_candidate_) != mediator_.countAllPieces())
     {
-        return {};
+        selection_ = selection;
+        needs_rebuild_ = true;
     }
 
-    auto spans = std::vector<tr_block_span_t>{};
-    auto cur = tr_block_span_t{ sorted_blocks[0], sorted_blocks[0] + 1 };
-    for (size_t i = 1; i < n_blocks; ++i)
+    if (needs_rebuild_)
     {
-        if (cur.end == sorted_blocks[i])
-        {
-            ++cur.end;
-        }
-        else
-        {
-            spans.push_back(cur);
-            cur = tr_block_span_t{ sorted_blocks[i], sorted_blocks[i] + 1 };
-        }
+        rebuild();
+        return;
     }
-    spans.push_back(cur);
 
-    return spans;
+    if (needs_resort_)
+    {
+        resort();
+    }
+
+    std::sort(std::begin(dirty_pieces_), std::end(dirty_pieces_));
+    auto const end = std::unique(std::begin(dirty_pieces_), std::end(dirty_pieces_));
+    std::for_each(std::begin(dirty_pieces_), end, [this](tr_piece_index_t piece) { update_piece(piece); });
+    dirty_pieces_.clear();
 }
 
-} // namespace
+void Wishlist::on_piece_changed(tr_piece_index_t piece)
+{
+    if (needs_rebuild_)
+    {
+        return;
+    }
+
+    // If nobody's asking for requests, e.g. because we're seeding,
+    // don't let the backlog grow without bound.
+    if (std::size(dirty_pieces_) >= std::size(piece_to_candidate_))
+    {
+        dirty_pieces_.clear();
+        needs_rebuild_ = true;
+        return;
+    }
 
-std::vector<tr_block_span_t> Wishlist::next(size_t n_wanted_blocks)
+    dirty_pieces_.push_back(piece);
+}
+
+void Wishlist::on_requests_changed(tr_piece_index_t piece) noexcept
+{
+    if (piece < std::size(piece_to_candidate_))
+    {
+        if (auto const it = piece_to_candidate_[piece]; it != std::end(candidates_))
+        {
+            it->n_unrequested = Candidate::Unknown;
+        }
+    }
+}
+
+std::vector<tr_block_span_t> Wishlist::next(
+    size_t n_wanted_blocks,
+    std::function<bool(tr_piece_index_t)> const& peer_has_piece,
+    std::function<bool(tr_block_index_t)> const& has_active_request_to_peer,
+    std::vector<tr_piece_index_t> const& preferred,
+    bool preferred_only)
 {
     if (n_wanted_blocks == 0)
     {
         return {};
     }
 
-    auto candidates = getCandidates(mediator_);
+    refresh();
 
-    // We usually won't need all the candidates to be sorted until endgame, so don't
-    // waste cycles sorting all of them here. partial sort is enough.
-    static auto constexpr MaxSortedPieces = size_t{ 30 };
-    auto const middle = std::min(std::size(candidates), MaxSortedPieces);
-    std::partial_sort(std::begin(candidates), std::begin(candidates) + middle, std::end(candidates));
+    // don't request from too many peers
+    auto const max_peers = mediator_.isEndgame() ? EndgameMaxPeers : size_t{ 1U };
 
-    auto blocks = std::set<tr_block_index_t>{};
-    for (auto const& candidate : candidates)
+    auto blocks = std::vector<tr_block_index_t>{};
+    blocks.reserve(n_wanted_blocks);
+    auto const add_blocks = [&](Candidate const& candidate)
     {
-        // do we have enough?
-        if (std::size(blocks) >= n_wanted_blocks)
+        // skip pieces whose missing blocks have all been requested already
+        if (candidate.n_unrequested == 0U && max_peers == 1U)
         {
-            break;
+            return;
+        }
+
+        if (!peer_has_piece(candidate.piece))
+        {
+            return;
         }
 
         // walk the blocks in this piece
         auto const [begin, end] = mediator_.blockSpan(candidate.piece);
-        for (tr_block_index_t block = begin; block < end && std::size(blocks) < n_wanted_blocks; ++block)
+        auto n_unrequested = size_t{};
+        auto block = begin;
+        for (; block < end && std::size(blocks) < n_wanted_blocks; ++block)
         {
             // don't request blocks we've already got
             if (!mediator_.clientCanRequestBlock(block))
@@ -159,17 +236,62 @@ std::vector<tr_block_span_t> Wishlist::next(size_t n_wanted_blocks)
                 continue;
             }
 
-            // don't request from too many peers
             size_t const n_peers = mediator_.countActiveRequests(block);
-            if (size_t const max_peers = mediator_.isEndgame() ? 2 : 1; n_peers >= max_peers)
+            if (n_peers == 0U)
+            {
+                ++n_unrequested;
+            }
+
+            if (n_peers >= max_peers || has_active_request_to_peer(block))
             {
                 continue;
             }
 
-            blocks.insert(block);
+            blocks.push_back(block);
+        }
+
+        // remember this for the next peer if we walked the whole piece
+        if (block == end)
+        {
+            candidate.n_unrequested = n_unrequested;
+        }
+    };
+
+    for (auto const piece : preferred)
+    {
+        if (std::size(blocks) >= n_wanted_blocks)
+        {
+            break;
+        }
+
+        if (piece < std::size(piece_to_candidate_))
+        {
+            if (auto const it = piece_to_candidate_[piece]; it != std::end(candidates_))
+            {
+                add_blocks(*it);
+            }
+        }
+    }
+
+    if (!preferred_only)
+    {
+        for (auto const& candidate : candidates_)
+        {
+            // do we have enough?
+            if (std::size(blocks) >= n_wanted_blocks)
+            {
+                break;
+            }
+
+            if (std::find(std::begin(preferred), std::end(preferred), candidate.piece) == std::end(preferred))
+            {
+                add_blocks(candidate);
+            }
         }
     }
 
-    auto const blocks_v = std::vector<tr_block_index_t>{ std::begin(blocks), std::end(blocks) };
-    return makeSpans(std::data(blocks_v), std::size(blocks_v));
+    // a block that straddles two pieces might have been picked twice
+    std::sort(std::begin(blocks), std::end(blocks));
+    blocks.erase(std::unique(std::begin(blocks), std::end(blocks)), std::end(blocks));
+    return makeSpans(std::data(blocks), std::size(blocks));
 }
@@ -10,12 +10,21 @@
 #endif
 
 #include <cstddef> // size_t
+#include <functional>
+#include <limits>
+#include <set>
 #include <vector>
 
 #include "libtransmission/transmission.h"
 
+#include "libtransmission/utils.h" // tr_compare_3way
+
 /**
  * Figures out what blocks we want to request next.
+ *
+ * The wishlist keeps its candidate pieces sorted between calls to next()
+ * and is told when something changes, so that next() doesn't need to look
+ * at every piece in the torrent each time a peer wants more requests.
  */
 class Wishlist
 {
@@ -24,26 +33,133 @@ public:
 
     struct Mediator
     {
-        [[nodiscard]] virtual bool clientCanRequestBlock(tr_block_index_t block) const = 0;
-        [[nodiscard]] virtual bool clientCanRequestPiece(tr_piece_index_t piece) const = 0;
+        [[nodiscard]] virtual bool clientCanRequestBlock(tr_block_index_t block) const = 0; // we don't have it yet
+        [[nodiscard]] virtual bool clientCanRequestPiece(tr_piece_index_t piece) const = 0; // we want it
         [[nodiscard]] virtual bool isEndgame() const = 0;
         [[nodiscard]] virtual bool isSequentialDownload() const = 0;
         [[nodiscard]] virtual size_t countActiveRequests(tr_block_index_t block) const = 0;
         [[nodiscard]] virtual size_t countMissingBlocks(tr_piece_index_t piece) const = 0;
+        [[nodiscard]] virtual size_t replication(tr_piece_index_t piece) const = 0; // how many peers have it
         [[nodiscard]] virtual tr_block_span_t blockSpan(tr_piece_index_t) const = 0;
         [[nodiscard]] virtual tr_piece_index_t countAllPieces() const = 0;
         [[nodiscard]] virtual tr_priority_t priority(tr_piece_index_t) const = 0;
+        [[nodiscard]] virtual tr_piece_selection pieceSelection() const = 0;
         virtual ~Mediator() = default;
     };
 
-    constexpr explicit Wishlist(Mediator const& mediator)
+    explicit Wishlist(Mediator const& mediator)
         : mediator_{ mediator }
     {
     }
 
-    // the next blocks that we should request from a peer
-    [[nodiscard]] std::vector<tr_block_span_t> next(size_t n_wanted_blocks);
+    Wishlist(Wishlist&&) = delete;
+    Wishlist(Wishlist const&) = delete;
+    Wishlist& operator=(Wishlist&&) = delete;
+    Wishlist& operator=(Wishlist const&) = delete;
+    ~Wishlist() = default;
+
+    // The next blocks that we should request from a peer.
+    // Pieces in `preferred`, e.g. ones the peer suggested, are tried first.
+    // If `preferred_only` is true, no other pieces are requested.
+    [[nodiscard]] std::vector<tr_block_span_t> next(
+        size_t n_wanted_blocks,
+        std::function<bool(tr_piece_index_t)> const& peer_has_piece,
+        std::function<bool(tr_block_index_t)> const& has_active_request_to_peer,
+        std::vector<tr_piece_index_t> const& preferred = {},
+        bool preferred_only = false);
+
+    // --- keeping the wishlist up-to-date
+
+    // Something that decides whether or how soon we want `piece` changed:
+    // e.g. we got one of its blocks, finished it, or a peer announced it.
+    void on_piece_changed(tr_piece_index_t piece);
+
+    // A request for one of the blocks in `piece` was sent or cancelled.
+    void on_requests_changed(tr_piece_index_t piece) noexcept;
+
+    // The replication of many pieces changed, e.g. a peer sent a bitfield.
+    void on_replication_changed() noexcept
+    {
+        needs_resort_ = true;
+    }
+
+    // Forget everything, e.g. because the wanted files or their priorities changed.
+    void reset() noexcept
+    {
+        needs_rebuild_ = true;
+    }
 
 private:
+    using SaltType = tr_piece_index_t;
+
+    struct Candidate
+    {
+        // n_unrequested isn't known until we've walked the piece
+        static auto constexpr Unknown = std::numeric_limits<size_t>::max();
+
+        tr_piece_index_t piece;
+        size_t n_blocks_missing;
+        tr_priority_t priority;
+        size_t replication;
+        SaltType salt;
+
+        // how many of the missing blocks nobody has been asked for,
+        // so that next() can skip past pieces that are fully requested
+        mutable size_t n_unrequested = Unknown;
+
+        [[nodiscard]] constexpr auto compare(Candidate const& that) const noexcept // <=>
+        {
+            // prefer pieces closer to completion
+            if (auto const val = tr_compare_3way(n_blocks_missing, that.n_blocks_missing); val != 0)
+            {
+                return val;
+            }
+
+            // prefer higher priority
+            if (auto const val = tr_compare_3way(priority, that.priority); val != 0)
+            {
+                return -val;
+            }
+
+            // prefer rarer pieces
+            if (auto const val = tr_compare_3way(replication, that.replication); val != 0)
+            {
+                return val;
+            }
+
+            if (auto const val = tr_compare_3way(salt, that.salt); val != 0)
+            {
+                return val;
+            }
+
+            return tr_compare_3way(piece, that.piece);
+        }
+
+        [[nodiscard]] constexpr bool operator<(Candidate const& that) const noexcept // less than
+        {
+            return compare(that) < 0;
+        }
+    };
+
+    using Candidates = std::set<Candidate>;
+
+    void refresh();
+    void rebuild();
+    void resort();
+    void update_piece(tr_piece_index_t piece);
+    [[nodiscard]] Candidate make_candidate(tr_piece_index_t piece, SaltType salt) const;
+
     Mediator const& mediator_;
+
+    Candidates candidates_;
+
+    // where each piece is in `candidates_`, or `std::end(candidates_)`
+    std::vector<Candidates::iterator> piece_to_candidate_;
+
+    std::vector<tr_piece_index_t> dirty_pieces_;
+
+    tr_piece_selection selection_ = TR_PIECE_SELECTION_RAREST_FIRST;
+
+    bool needs_rebuild_ = true;
+    bool needs_resort_ = false;
 };
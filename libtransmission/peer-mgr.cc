@@ -11,8 +11,11 @@
 #include <cstddef> // std::byte
 #include <cstdint>
 #include <ctime> // time_t
+#include <functional>
 #include <iterator> // std::back_inserter
+#include <limits>
 #include <optional>
+#include <set>
 #include <tuple> // std::tie
 #include <unordered_map>
 #include <utility>
@@ -37,6 +40,8 @@
 #include "libtransmission/peer-common.h"
 #include "libtransmission/peer-io.h"
 #include "libtransmission/peer-mgr-active-requests.h"
+#include "libtransmission/peer-mgr-candidates.h"
+#include "libtransmission/peer-mgr-upload-slots.h"
 #include "libtransmission/peer-mgr-wishlist.h"
 #include "libtransmission/peer-mgr.h"
 #include "libtransmission/peer-msgs.h"
@@ -118,6 +123,24 @@ public:
         return len;
     }
 
+    [[nodiscard]] bool run_in_background(std::function<void()> work, std::function<void()> done) override
+    {
+        auto& worker = session_.handshake_worker();
+        if (worker.thread_count() == 0U)
+        {
+            return false;
+        }
+
+        worker.submit(
+            [work = std::move(work)]()
+            {
+                work();
+                return 0;
+            },
+            [done = std::move(done)](int /*err*/) { done(); });
+        return true;
+    }
+
 private:
     tr_session& session_;
 };
@@ -275,6 +298,21 @@ constexpr struct
     }
 } CompareAtomsByUsefulness{};
 
+// --- BEP 6 piece hints, i.e. Suggest and Allowed Fast pieces
+
+[[nodiscard]] bool has_hint(std::vector<tr_piece_index_t> const& pieces, tr_piece_index_t piece)
+{
+    return std::find(std::begin(pieces), std::end(pieces), piece) != std::end(pieces);
+}
+
+void remove_hint(std::vector<tr_piece_index_t>& pieces, tr_piece_index_t piece)
+{
+    if (auto const it = std::find(std::begin(pieces), std::end(pieces), piece); it != std::end(pieces))
+    {
+        pieces.erase(it);
+    }
+}
+
 } // namespace
 
 /** @brief Opaque, per-torrent data structure for peer connection information */
@@ -296,8 +334,10 @@ public:
               tor_in->done_.observe([this](tr_torrent*, bool) { on_torrent_done(); }),
               tor_in->doomed_.observe([this](tr_torrent*) { on_torrent_doomed(); }),
               tor_in->got_bad_piece_.observe([this](tr_torrent*, tr_piece_index_t p) { on_got_bad_piece(p); }),
+              tor_in->files_wanted_changed_.observe([this](tr_torrent*) { on_files_wanted_changed(); }),
               tor_in->got_metainfo_.observe([this](tr_torrent*) { on_got_metainfo(); }),
               tor_in->piece_completed_.observe([this](tr_torrent*, tr_piece_index_t p) { on_piece_completed(p); }),
+              tor_in->priority_changed_.observe([this](tr_torrent*) { wishlist.reset(); }),
               tor_in->started_.observe([this](tr_torrent*) { on_torrent_started(); }),
               tor_in->stopped_.observe([this](tr_torrent*) { on_torrent_stopped(); }),
               tor_in->swarm_is_all_seeds_.observe([this](tr_torrent* /*tor*/) { on_swarm_is_all_seeds(); }),
@@ -328,6 +368,7 @@ public:
         {
             maybeSendCancelRequest(peer, block, nullptr);
             active_requests.remove(block, peer);
+            on_requests_changed(block);
         }
     }
 
@@ -337,6 +378,26 @@ public:
         {
             maybeSendCancelRequest(peer, block, no_notify);
         }
+
+        on_requests_changed(block);
+    }
+
+    // let the wishlist know that `block` was requested or a request for it went away
+    void on_requests_changed(tr_block_index_t block) noexcept
+    {
+        auto const [begin, end] = piece_span_for_block(block);
+        for (auto piece = begin; piece < end; ++piece)
+        {
+            wishlist.on_requests_changed(piece);
+        }
+    }
+
+    void on_requests_changed(std::vector<tr_block_index_t> const& blocks) noexcept
+    {
+        for (auto const block : blocks)
+        {
+            on_requests_changed(block);
+        }
     }
 
     void remove_inactive_peer_info() noexcept
@@ -398,6 +459,9 @@ public:
         --stats.peer_count;
         --stats.peer_from_count[peer_info->from_first()];
 
+        replication_sub(peer->has());
+        wishlist.on_replication_changed();
+
         if (auto iter = std::find(std::begin(peers), std::end(peers), peer); iter != std::end(peers))
         {
             peers.erase(iter);
@@ -415,6 +479,9 @@ public:
         else
         {
             graveyard_pool.erase(peer_info->listen_socket_address());
+
+            // we might want to reconnect later
+            enqueue_candidate(peer_info->listen_socket_address(), tr_time());
         }
     }
 
@@ -442,6 +509,43 @@ public:
         return is_endgame_;
     }
 
+    // @return the pieces that overlap `block`. A block might straddle two pieces
+    // when the piece size isn't a multiple of the block size.
+    [[nodiscard]] std::pair<tr_piece_index_t, tr_piece_index_t> piece_span_for_block(tr_block_index_t block) const noexcept
+    {
+        auto const loc = tor->block_loc(block);
+        auto const last = tor->byte_loc(loc.byte + tor->block_size(block) - 1U);
+        return { loc.piece, last.piece + 1U };
+    }
+
+    // @return how many connected peers and webseeds have this piece
+    [[nodiscard]] TR_CONSTEXPR20 size_t replication(tr_piece_index_t piece) const noexcept
+    {
+        return piece < std::size(piece_replication_) ? piece_replication_[piece] : 0U;
+    }
+
+    // --- outbound connection candidates
+
+    // @return the score of the best peer in this swarm to connect to,
+    // or nullopt if there aren't any. Lower scores are better.
+    [[nodiscard]] std::optional<uint64_t> best_candidate_score(time_t now);
+
+    // Remove and return the peer that best_candidate_score() found.
+    [[nodiscard]] tr_socket_address pop_best_candidate();
+
+    // Add the connectable peer at `socket_address`, or update its place
+    // if it's already queued, e.g. because its state changed.
+    void enqueue_candidate(tr_socket_address const& socket_address, time_t now);
+
+    void rebuild_candidates();
+
+    // @return true if the peer has any pieces that we want
+    [[nodiscard]] bool is_interesting(tr_peer* peer)
+    {
+        refresh_interest();
+        return peer->n_interesting_pieces > 0U;
+    }
+
     void addStrike(tr_peerMsgs* peer) const
     {
         tr_logAddTraceSwarm(
@@ -468,6 +572,8 @@ public:
         }
         webseeds.shrink_to_fit();
 
+        rebuild_replication();
+
         stats.active_webseed_count = 0;
     }
 
@@ -508,6 +614,11 @@ public:
             peer_info.set_pex_flags(flags);
         }
 
+        if (is_connectable)
+        {
+            enqueue_candidate(socket_address, tr_time());
+        }
+
         mark_all_seeds_flag_dirty();
 
         return peer_info;
@@ -572,16 +683,36 @@ public:
 
             break;
 
+        // These are published before the peer's have-state changes,
+        // so msgs->has() is still the state that we counted before.
         case tr_peer_event::Type::ClientGotHave:
+            s->replication_add(event.pieceIndex);
+            s->interest_add(msgs, event.pieceIndex);
+            s->wishlist.on_piece_changed(event.pieceIndex);
+            break;
+
         case tr_peer_event::Type::ClientGotHaveAll:
+            s->replication_sub(msgs->has());
+            s->replication_add_all();
+            s->interest_set_all(msgs);
+            s->wishlist.on_replication_changed();
+            break;
+
         case tr_peer_event::Type::ClientGotHaveNone:
+            s->replication_sub(msgs->has());
+            msgs->n_interesting_pieces = 0U;
+            s->wishlist.on_replication_changed();
+            break;
+
         case tr_peer_event::Type::ClientGotBitfield:
-            /* TODO: if we don't need these, should these events be removed? */
-            /* noop */
+            s->replication_sub(msgs->has());
+            s->replication_add(*event.bitfield);
+            s->interest_set(msgs, *event.bitfield);
+            s->wishlist.on_replication_changed();
             break;
 
         case tr_peer_event::Type::ClientGotChoke:
-            s->active_requests.remove(msgs);
+            s->on_requests_changed(s->active_requests.remove(msgs));
             break;
 
         case tr_peer_event::Type::ClientGotPort:
@@ -603,8 +734,26 @@ public:
             break;
 
         case tr_peer_event::Type::ClientGotSuggest:
+            if (auto& pieces = msgs->suggested_pieces; s->client_wants_piece_hint(event.pieceIndex))
+            {
+                // newest suggestions last
+                remove_hint(pieces, event.pieceIndex);
+                if (std::size(pieces) >= MaxSuggestedPieces)
+                {
+                    pieces.erase(std::begin(pieces));
+                }
+                pieces.push_back(event.pieceIndex);
+            }
+            break;
+
         case tr_peer_event::Type::ClientGotAllowedFast:
-            // not currently supported
+            // Peers usually send about ten of these. Ignore any past our
+            // limit so that a misbehaving peer can't make us track a lot.
+            if (auto& pieces = msgs->allowed_fast_pieces; s->client_wants_piece_hint(event.pieceIndex) &&
+                !has_hint(pieces, event.pieceIndex) && std::size(pieces) < MaxAllowedFastPieces)
+            {
+                pieces.push_back(event.pieceIndex);
+            }
             break;
 
         default:
@@ -625,10 +774,82 @@ public:
 
     ActiveRequests active_requests;
 
+    class WishlistMediator final : public Wishlist::Mediator
+    {
+    public:
+        explicit WishlistMediator(tr_swarm const& swarm)
+            : swarm_{ swarm }
+        {
+        }
+
+        [[nodiscard]] bool clientCanRequestBlock(tr_block_index_t block) const override
+        {
+            return !swarm_.tor->has_block(block);
+        }
+
+        [[nodiscard]] bool clientCanRequestPiece(tr_piece_index_t piece) const override
+        {
+            return swarm_.tor->piece_is_wanted(piece);
+        }
+
+        [[nodiscard]] bool isEndgame() const override
+        {
+            return swarm_.isEndgame();
+        }
+
+        [[nodiscard]] size_t countActiveRequests(tr_block_index_t block) const override
+        {
+            return swarm_.active_requests.count(block);
+        }
+
+        [[nodiscard]] size_t countMissingBlocks(tr_piece_index_t piece) const override
+        {
+            return swarm_.tor->count_missing_blocks_in_piece(piece);
+        }
+
+        [[nodiscard]] size_t replication(tr_piece_index_t piece) const override
+        {
+            return swarm_.replication(piece);
+        }
+
+        [[nodiscard]] tr_block_span_t blockSpan(tr_piece_index_t piece) const override
+        {
+            return swarm_.tor->block_span_for_piece(piece);
+        }
+
+        [[nodiscard]] tr_piece_index_t countAllPieces() const override
+        {
+            return swarm_.tor->has_metainfo() ? swarm_.tor->piece_count() : 0U;
+        }
+
+        [[nodiscard]] tr_priority_t priority(tr_piece_index_t piece) const override
+        {
+            return swarm_.tor->piece_priority(piece);
+        }
+
+        [[nodiscard]] bool isSequentialDownload() const override
+        {
+            return swarm_.tor->is_sequential_download();
+        }
+
+        [[nodiscard]] tr_piece_selection pieceSelection() const override
+        {
+            return swarm_.tor->session->pieceSelection();
+        }
+
+    private:
+        tr_swarm const& swarm_;
+    };
+
+    WishlistMediator wishlist_mediator{ *this };
+
     // depends-on: active_requests
+    Wishlist wishlist{ wishlist_mediator };
+
+    // depends-on: active_requests, wishlist
     std::vector<std::unique_ptr<tr_peer>> webseeds;
 
-    // depends-on: active_requests
+    // depends-on: active_requests, wishlist
     Peers peers;
 
     // tr_peerMsgs hold pointers to the items in these containers,
@@ -642,6 +863,151 @@ public:
     time_t lastCancel = 0;
 
 private:
+    // --- piece replication
+
+    void rebuild_replication()
+    {
+        piece_replication_.assign(tor->has_metainfo() ? tor->piece_count() : 0U, 0U);
+
+        // webseeds have every piece
+        for (size_t i = 0, n = std::size(webseeds); i < n; ++i)
+        {
+            replication_add_all();
+        }
+
+        for (auto const* const peer : peers)
+        {
+            replication_add(peer->has());
+        }
+
+        wishlist.on_replication_changed();
+    }
+
+    void replication_add(tr_piece_index_t piece) noexcept
+    {
+        if (piece < std::size(piece_replication_))
+        {
+            ++piece_replication_[piece];
+        }
+    }
+
+    void replication_add_all() noexcept
+    {
+        for (auto& count : piece_replication_)
+        {
+            ++count;
+        }
+    }
+
+    void replication_add(tr_bitfield const& has) noexcept
+    {
+        if (has.has_all())
+        {
+            replication_add_all();
+            return;
+        }
+
+        if (has.has_none())
+        {
+            return;
+        }
+
+        for (size_t piece = 0, n = std::size(piece_replication_); piece < n; ++piece)
+        {
+            if (has.test(piece))
+            {
+                ++piece_replication_[piece];
+            }
+        }
+    }
+
+    void replication_sub(tr_bitfield const& has) noexcept
+    {
+        if (has.has_none())
+        {
+            return;
+        }
+
+        for (size_t piece = 0, n = std::size(piece_replication_); piece < n; ++piece)
+        {
+            if (has.test(piece) && piece_replication_[piece] > 0U)
+            {
+                --piece_replication_[piece];
+            }
+        }
+    }
+
+    // --- interest
+
+    void refresh_interest()
+    {
+        if (!interest_is_dirty_)
+        {
+            return;
+        }
+
+        interest_is_dirty_ = false;
+
+        auto const n_pieces = tor->has_metainfo() ? tor->piece_count() : tr_piece_index_t{};
+        interesting_pieces_ = tr_bitfield{ n_pieces };
+        for (tr_piece_index_t piece = 0; piece < n_pieces; ++piece)
+        {
+            if (tor->piece_is_wanted(piece) && !tor->has_piece(piece))
+            {
+                interesting_pieces_.set(piece);
+            }
+        }
+
+        for (auto* const peer : peers)
+        {
+            peer->n_interesting_pieces = peer->has().count_intersection(interesting_pieces_);
+        }
+    }
+
+    void interest_add(tr_peer* peer, tr_piece_index_t piece)
+    {
+        if (!interest_is_dirty_ && interesting_pieces_.test(piece))
+        {
+            ++peer->n_interesting_pieces;
+        }
+    }
+
+    void interest_set(tr_peer* peer, tr_bitfield const& has)
+    {
+        if (!interest_is_dirty_)
+        {
+            peer->n_interesting_pieces = has.count_intersection(interesting_pieces_);
+        }
+    }
+
+    void interest_set_all(tr_peer* peer)
+    {
+        if (!interest_is_dirty_)
+        {
+            peer->n_interesting_pieces = interesting_pieces_.count();
+        }
+    }
+
+    void interest_remove_piece(tr_piece_index_t piece)
+    {
+        if (interest_is_dirty_ || !interesting_pieces_.test(piece))
+        {
+            return;
+        }
+
+        interesting_pieces_.unset(piece);
+
+        for (auto* const peer : peers)
+        {
+            if (peer->hasPiece(piece) && peer->n_interesting_pieces > 0U)
+            {
+                --peer->n_interesting_pieces;
+            }
+        }
+    }
+
+    // ---
+
     static void maybeSendCancelRequest(tr_peer* peer, tr_block_index_t block, tr_peer const* muted)
     {
         auto* msgs = dynamic_cast<tr_peerMsgs*>(peer);
@@ -684,6 +1050,9 @@ private:
 
     void on_piece_completed(tr_piece_index_t piece)
     {
+        wishlist.on_piece_changed(piece);
+        interest_remove_piece(piece);
+
         bool piece_came_from_peers = false;
 
         for (auto* const peer : peers)
@@ -691,6 +1060,10 @@ private:
             // notify the peer that we now have this piece
             peer->on_piece_completed(piece);
 
+            // we don't need any hints about it anymore
+            remove_hint(peer->suggested_pieces, piece);
+            remove_hint(peer->allowed_fast_pieces, piece);
+
             if (!piece_came_from_peers)
             {
                 piece_came_from_peers = peer->blame.test(piece);
@@ -705,6 +1078,9 @@ private:
 
     void on_got_bad_piece(tr_piece_index_t piece)
     {
+        // we need to download this piece again
+        wishlist.on_piece_changed(piece);
+
         auto const byte_count = tor->piece_size(piece);
 
         for (auto* const peer : peers)
@@ -730,6 +1106,9 @@ private:
         // the webseed list may have changed...
         rebuildWebseeds();
 
+        wishlist.reset();
+        interest_is_dirty_ = true;
+
         // some peer_msgs' progress fields may not be accurate if we
         // didn't have the metadata before now... so refresh them all...
         for (auto* peer : peers)
@@ -743,6 +1122,15 @@ private:
         }
     }
 
+    void on_files_wanted_changed()
+    {
+        wishlist.reset();
+        interest_is_dirty_ = true;
+
+        // whether we're done might have changed, and with it whether we want to connect to seeds
+        rebuild_candidates();
+    }
+
     void on_torrent_started();
     void on_torrent_stopped();
 
@@ -753,7 +1141,12 @@ private:
         switch (event.type)
         {
         case tr_peer_event::Type::ClientGotRej:
-            s->active_requests.remove(s->tor->piece_loc(event.pieceIndex, event.offset).block, peer);
+            {
+                auto const block = s->tor->piece_loc(event.pieceIndex, event.offset).block;
+                s->active_requests.remove(block, peer);
+                s->on_requests_changed(block);
+            }
+
             break;
 
         case tr_peer_event::Type::ClientGotBlock:
@@ -763,6 +1156,12 @@ private:
                 s->cancelAllRequestsForBlock(loc.block, peer);
                 peer->blocks_sent_to_client.add(tr_time(), 1);
                 tr_torrentGotBlock(tor, loc.block);
+
+                auto const [begin, end] = s->piece_span_for_block(loc.block);
+                for (auto piece = begin; piece < end; ++piece)
+                {
+                    s->wishlist.on_piece_changed(piece);
+                }
             }
 
             break;
@@ -845,6 +1244,7 @@ private:
         [[maybe_unused]] auto const inserted = connectable_pool.insert(std::move(nh)).inserted;
         TR_ASSERT(inserted);
         info_this.set_listen_port(event.port);
+        enqueue_candidate(info_this.listen_socket_address(), tr_time());
 
         mark_all_seeds_flag_dirty();
     }
@@ -885,16 +1285,41 @@ private:
 
     // ---
 
+    // @return true if a Suggest or Allowed Fast hint about `piece` is worth keeping
+    [[nodiscard]] bool client_wants_piece_hint(tr_piece_index_t piece) const
+    {
+        return tor->has_metainfo() && piece < tor->piece_count() && !tor->has_piece(piece) && tor->piece_is_wanted(piece);
+    }
+
     // number of bad pieces a peer is allowed to send before we ban them
     static auto constexpr MaxBadPiecesPerPeer = int{ 5 };
 
+    // how many of a peer's most recent suggestions we remember
+    static auto constexpr MaxSuggestedPieces = size_t{ 16U };
+
+    // how many Allowed Fast pieces we'll accept from a peer
+    static auto constexpr MaxAllowedFastPieces = size_t{ 32U };
+
     // how long we'll let requests we've made linger before we cancel them
     static auto constexpr RequestTtlSecs = int{ 90 };
 
-    std::array<libtransmission::ObserverTag, 8> const tags_;
+    std::array<libtransmission::ObserverTag, 10> const tags_;
 
     mutable std::optional<bool> pool_is_all_seeds_;
 
+    // the pieces we want and don't have yet. Peers' `n_interesting_pieces`
+    // are counted against this and kept up-to-date as HAVE / BITFIELD
+    // messages arrive and as we complete pieces
+    tr_bitfield interesting_pieces_{ 0U };
+    bool interest_is_dirty_ = true;
+
+    // the connectable peers that we might want to connect to
+    CandidateIndex candidates_;
+
+    // how many peers and webseeds have each piece, indexed by piece.
+    // Kept up-to-date as HAVE / BITFIELD messages arrive and peers leave.
+    std::vector<uint16_t> piece_replication_;
+
     bool is_endgame_ = false;
 };
 
@@ -930,6 +1355,7 @@ public:
         : session{ session_in }
         , handshake_mediator_{ *session }
         , bandwidth_timer_{ session->timerMaker().create([this]() { bandwidthPulse(); }) }
+        , io_timer_{ session->timerMaker().create([this]() { ioPulse(); }) }
         , rechoke_timer_{ session->timerMaker().create([this]() { rechokePulseMarshall(); }) }
         , refill_upkeep_timer_{ session->timerMaker().create([this]() { refillUpkeep(); }) }
         , blocklist_tag_{ session->blocklist_changed_.observe([this]() { on_blocklist_changed(); }) }
@@ -937,6 +1363,9 @@ public:
         bandwidth_timer_->start_repeating(BandwidthTimerPeriod);
         rechoke_timer_->start_repeating(RechokePeriod);
         refill_upkeep_timer_->start_repeating(RefillUpkeepPeriod);
+
+        session->top_bandwidth_.set_wakeup_callback(
+            [this](uint64_t delay_msec) { io_timer_->start_single_shot(std::chrono::milliseconds{ delay_msec }); });
     }
 
     tr_peerMgr(tr_peerMgr&&) = delete;
@@ -952,6 +1381,7 @@ public:
     ~tr_peerMgr()
     {
         auto const lock = unique_lock();
+        session->top_bandwidth_.set_wakeup_callback({});
         incoming_handshakes.clear();
     }
 
@@ -984,6 +1414,12 @@ private:
         rechoke_timer_->set_interval(RechokePeriod);
     }
 
+    void ioPulse()
+    {
+        auto const lock = unique_lock();
+        session->top_bandwidth_.wake(tr_time_msec());
+    }
+
     void on_blocklist_changed() const
     {
         /* we cache whether or not a peer is blocklisted...
@@ -997,12 +1433,15 @@ private:
                     atom.set_blocklisted_dirty();
                 }
             }
+
+            tor->swarm->rebuild_candidates();
         }
     }
 
     OutboundCandidates outbound_candidates_;
 
     std::unique_ptr<libtransmission::Timer> const bandwidth_timer_;
+    std::unique_ptr<libtransmission::Timer> const io_timer_;
     std::unique_ptr<libtransmission::Timer> const rechoke_timer_;
     std::unique_ptr<libtransmission::Timer> const refill_upkeep_timer_;
 
@@ -1022,7 +1461,7 @@ tr_peer::~tr_peer()
 {
     if (swarm != nullptr)
     {
-        swarm->active_requests.remove(this);
+        swarm->on_requests_changed(swarm->active_requests.remove(this));
     }
 }
 
@@ -1050,9 +1489,10 @@ void tr_peerMgrFree(tr_peerMgr* manager)
  *    This is used for cancelling requests that have been waiting
  *    for too long and avoiding duplicate requests.
  *
- * 2. tr_swarm::pieces, an array of "struct weighted_piece" which lists the
- *    pieces that we want to request. It's used to decide which blocks to
- *    return next when tr_peerMgrGetBlockRequests() is called.
+ * 2. tr_swarm::wishlist, which keeps the pieces that we want to request
+ *    sorted by how soon we want them. It's used to decide which blocks to
+ *    return next when tr_peerMgrGetNextRequests() is called, and is kept
+ *    up-to-date as blocks arrive and requests are sent or cancelled.
  */
 
 // --- struct block_request
@@ -1062,85 +1502,42 @@ void tr_peerMgrClientSentRequests(tr_torrent* torrent, tr_peer* peer, tr_block_s
 {
     auto const now = tr_time();
 
+    auto* const swarm = torrent->swarm;
     for (tr_block_index_t block = span.begin; block < span.end; ++block)
     {
-        torrent->swarm->active_requests.add(block, peer, now);
+        swarm->active_requests.add(block, peer, now);
+        swarm->on_requests_changed(block);
     }
 }
 
-std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_peer const* peer, size_t numwant)
-{
-    class MediatorImpl final : public Wishlist::Mediator
-    {
-    public:
-        MediatorImpl(tr_torrent const* torrent_in, tr_peer const* peer_in)
-            : torrent_{ torrent_in }
-            , swarm_{ torrent_in->swarm }
-            , peer_{ peer_in }
-        {
-        }
-
-        MediatorImpl(MediatorImpl&&) = delete;
-        MediatorImpl(MediatorImpl const&) = delete;
-        MediatorImpl& operator=(MediatorImpl&&) = delete;
-        MediatorImpl& operator=(MediatorImpl const&) = delete;
-
-        ~MediatorImpl() override = default;
-
-        [[nodiscard]] bool clientCanRequestBlock(tr_block_index_t block) const override
-        {
-            return !torrent_->has_block(block) && !swarm_->active_requests.has(block, peer_);
-        }
-
-        [[nodiscard]] bool clientCanRequestPiece(tr_piece_index_t piece) const override
-        {
-            return torrent_->piece_is_wanted(piece) && peer_->hasPiece(piece);
-        }
-
-        [[nodiscard]] bool isEndgame() const override
-        {
-            return swarm_->isEndgame();
-        }
-
-        [[nodiscard]] size_t countActiveRequests(tr_block_index_t block) const override
-        {
-            return swarm_->active_requests.count(block);
-        }
-
-        [[nodiscard]] size_t countMissingBlocks(tr_piece_index_t piece) const override
-        {
-            return torrent_->count_missing_blocks_in_piece(piece);
-        }
-
-        [[nodiscard]] tr_block_span_t blockSpan(tr_piece_index_t piece) const override
-        {
-            return torrent_->block_span_for_piece(piece);
-        }
-
-        [[nodiscard]] tr_piece_index_t countAllPieces() const override
-        {
-            return torrent_->piece_count();
-        }
-
-        [[nodiscard]] tr_priority_t priority(tr_piece_index_t piece) const override
-        {
-            return torrent_->piece_priority(piece);
-        }
-
-        [[nodiscard]] bool isSequentialDownload() const override
-        {
-            return torrent_->is_sequential_download();
-        }
-
-    private:
-        tr_torrent const* const torrent_;
-        tr_swarm const* const swarm_;
-        tr_peer const* const peer_;
-    };
-
-    torrent->swarm->updateEndgame();
-    auto const mediator = MediatorImpl{ torrent, peer };
-    return Wishlist{ mediator }.next(numwant);
+std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(
+    tr_torrent* torrent,
+    tr_peer const* peer,
+    size_t numwant,
+    bool allowed_fast_only)
+{
+    auto* const swarm = torrent->swarm;
+    swarm->updateEndgame();
+
+    // Allowed Fast pieces come first even when we're unchoked, since asking
+    // for them doesn't depend on the peer keeping us unchoked. After them,
+    // prefer the pieces that the peer suggested.
+    auto preferred = peer->allowed_fast_pieces;
+    if (!allowed_fast_only)
+    {
+        std::copy_if(
+            std::rbegin(peer->suggested_pieces),
+            std::rend(peer->suggested_pieces),
+            std::back_inserter(preferred),
+            [&peer](tr_piece_index_t piece) { return !has_hint(peer->allowed_fast_pieces, piece); });
+    }
+
+    return swarm->wishlist.next(
+        numwant,
+        [peer](tr_piece_index_t piece) { return peer->hasPiece(piece); },
+        [swarm, peer](tr_block_index_t block) { return swarm->active_requests.has(block, peer); },
+        preferred,
+        allowed_fast_only);
 }
 
 // --- Piece List Manipulation / Accessors
@@ -1277,6 +1674,12 @@ void create_bit_torrent_peer(tr_torrent* tor, std::shared_ptr<tr_peerIo> io, tr_
         }
     }
 
+    // we might want to try this peer again later
+    if (info_ptr != nullptr && !result.io->is_incoming())
+    {
+        s->enqueue_candidate(socket_address, tr_time());
+    }
+
     return false;
 }
 } // namespace handshake_helpers
@@ -1483,6 +1886,9 @@ void tr_swarm::on_torrent_started()
 {
     auto const lock = tor->unique_lock();
     is_running = true;
+    wishlist.reset();
+    interest_is_dirty_ = true;
+    rebuild_candidates();
     manager->rechokeSoon();
 }
 
@@ -1512,8 +1918,11 @@ int8_t tr_peerMgrPieceAvailability(tr_torrent const* tor, tr_piece_index_t piece
         return -1;
     }
 
-    auto const& peers = tor->swarm->peers;
-    return std::count_if(std::begin(peers), std::end(peers), [piece](auto const* peer) { return peer->hasPiece(piece); });
+    // replication() counts webseeds too, but this only wants peers
+    auto const* const swarm = tor->swarm;
+    auto const replication = swarm->replication(piece);
+    auto const n_peers = replication - std::min(replication, std::size(swarm->webseeds));
+    return static_cast<int8_t>(std::min(n_peers, size_t{ std::numeric_limits<int8_t>::max() }));
 }
 
 void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned int n_tabs)
@@ -1735,32 +2144,6 @@ namespace
 {
 namespace update_interest_helpers
 {
-/* does this peer have any pieces that we want? */
-[[nodiscard]] bool isPeerInteresting(
-    tr_torrent const* const tor,
-    std::vector<bool> const& piece_is_interesting,
-    tr_peerMsgs const* const peer)
-{
-    /* these cases should have already been handled by the calling code... */
-    TR_ASSERT(!tor->is_done());
-    TR_ASSERT(tor->client_can_download());
-
-    if (peer->isSeed())
-    {
-        return true;
-    }
-
-    for (tr_piece_index_t i = 0; i < tor->piece_count(); ++i)
-    {
-        if (piece_is_interesting[i] && peer->hasPiece(i))
-        {
-            return true;
-        }
-    }
-
-    return false;
-}
-
 // determine which peers to show interest in
 void updateInterest(tr_swarm* swarm)
 {
@@ -1771,21 +2154,9 @@ void updateInterest(tr_swarm* swarm)
         return;
     }
 
-    if (auto const& peers = swarm->peers; !std::empty(peers))
+    for (auto* const peer : swarm->peers)
     {
-        int const n = tor->piece_count();
-
-        // build a bitfield of interesting pieces...
-        auto piece_is_interesting = std::vector<bool>(n);
-        for (int i = 0; i < n; ++i)
-        {
-            piece_is_interesting[i] = tor->piece_is_wanted(i) && !tor->has_piece(i);
-        }
-
-        for (auto* const peer : peers)
-        {
-            peer->set_interested(isPeerInteresting(tor, piece_is_interesting, peer));
-        }
+        peer->set_interested(peer->isSeed() || swarm->is_interesting(peer));
     }
 }
 } // namespace update_interest_helpers
@@ -1862,17 +2233,14 @@ struct ChokeData
 // for this many calls to rechokeUploads().
 auto constexpr OptimisticUnchokeMultiplier = uint8_t{ 4 };
 
-void rechokeUploads(tr_swarm* s, uint64_t const now)
+// Choke the peers that can't be unchoked and return the rest,
+// sorted by preference and rate.
+[[nodiscard]] std::vector<ChokeData> getChokeCandidates(tr_swarm* s, uint64_t const now)
 {
-    auto const lock = s->unique_lock();
-
     auto& peers = s->peers;
-    auto const peer_count = std::size(peers);
     auto choked = std::vector<ChokeData>{};
-    choked.reserve(peer_count);
-    auto const* const session = s->manager->session;
+    choked.reserve(std::size(peers));
     bool const choke_all = !s->tor->client_can_upload();
-    bool const is_maxed_out = s->tor->bandwidth_.is_maxed_out(TR_UP, now);
 
     /* an optimistic unchoke peer's "optimistic"
      * state lasts for N calls to rechokeUploads(). */
@@ -1912,28 +2280,34 @@ void rechokeUploads(tr_swarm* s, uint64_t const now)
     }
 
     std::sort(std::begin(choked), std::end(choked));
+    return choked;
+}
 
-    /**
-     * Reciprocation and number of uploads capping is managed by unchoking
-     * the N peers which have the best upload rate and are interested.
-     * This maximizes the client's download rate. These N peers are
-     * referred to as downloaders, because they are interested in downloading
-     * from the client.
-     *
-     * Peers which have a better upload rate (as compared to the downloaders)
-     * but aren't interested get unchoked. If they become interested, the
-     * downloader with the worst upload rate gets choked. If a client has
-     * a complete file, it uses its upload rate rather than its download
-     * rate to decide which peers to unchoke.
-     *
-     * If our bandwidth is maxed out, don't unchoke any more peers.
-     */
+/**
+ * Reciprocation and number of uploads capping is managed by unchoking
+ * the N peers which have the best upload rate and are interested.
+ * This maximizes the client's download rate. These N peers are
+ * referred to as downloaders, because they are interested in downloading
+ * from the client.
+ *
+ * Peers which have a better upload rate (as compared to the downloaders)
+ * but aren't interested get unchoked. If they become interested, the
+ * downloader with the worst upload rate gets choked. If a client has
+ * a complete file, it uses its upload rate rather than its download
+ * rate to decide which peers to unchoke.
+ *
+ * If our bandwidth is maxed out, don't unchoke any more peers.
+ *
+ * @return how many of `choked` were checked and how many interested peers got a slot
+ */
+std::pair<size_t, size_t> unchokeBest(std::vector<ChokeData>& choked, size_t max_unchoked_interested, bool is_maxed_out)
+{
     auto checked_choke_count = size_t{ 0U };
     auto unchoked_interested = size_t{ 0U };
 
     for (auto& item : choked)
     {
-        if (unchoked_interested >= session->uploadSlotsPerTorrent())
+        if (unchoked_interested >= max_unchoked_interested)
         {
             break;
         }
@@ -1948,31 +2322,219 @@ void rechokeUploads(tr_swarm* s, uint64_t const now)
         }
     }
 
-    /* optimistic unchoke */
-    if (s->optimistic == nullptr && !is_maxed_out && checked_choke_count < std::size(choked))
+    return { checked_choke_count, unchoked_interested };
+}
+
+// Unchoke a random interested peer from the ones that weren't checked.
+bool optimisticUnchoke(tr_swarm* s, std::vector<ChokeData>& choked, size_t checked_choke_count)
+{
+    auto rand_pool = std::vector<ChokeData*>{};
+
+    for (auto i = checked_choke_count, n = std::size(choked); i < n; ++i)
+    {
+        if (choked[i].is_interested && choked[i].is_choked)
+        {
+            rand_pool.push_back(&choked[i]);
+        }
+    }
+
+    if (auto const n = std::size(rand_pool); n != 0)
+    {
+        auto* c = rand_pool[tr_rand_int(n)];
+        c->is_choked = false;
+        s->optimistic = c->msgs;
+        s->optimistic_unchoke_time_scaler = OptimisticUnchokeMultiplier;
+        return true;
+    }
+
+    return false;
+}
+
+void applyChokes(std::vector<ChokeData> const& choked)
+{
+    for (auto const& item : choked)
+    {
+        item.msgs->set_choke(item.is_choked);
+    }
+}
+
+void rechokeUploads(tr_swarm* s, uint64_t const now)
+{
+    auto const lock = s->unique_lock();
+
+    auto const* const session = s->manager->session;
+    bool const is_maxed_out = s->tor->bandwidth_.is_maxed_out(TR_UP, now);
+    auto choked = getChokeCandidates(s, now);
+
+    auto const checked_choke_count = unchokeBest(choked, session->uploadSlotsPerTorrent(), is_maxed_out).first;
+
+    if (s->optimistic == nullptr && !is_maxed_out)
+    {
+        optimisticUnchoke(s, choked, checked_choke_count);
+    }
+
+    applyChokes(choked);
+}
+
+// ---
+
+// When `upload-slots-global` is set, the session decides which peers
+// to unchoke across all of its torrents instead of giving each torrent
+// `upload-slots-per-torrent` slots of its own:
+//
+// 1. Every torrent with interested peers gets a fair share of the pool,
+//    up to `upload-slots-per-torrent`, and fills it with its best peers.
+// 2. The rest of the pool goes to the peers, in any torrent, that are
+//    worth the most: their rate, weighted by how much their swarm
+//    needs what we have.
+// 3. Some of the pool is kept for optimistic unchokes so that every
+//    torrent's new peers still get a chance.
+
+// added to every peer's rate so that idle peers are still
+// ranked by how much their swarm needs us
+auto constexpr RankingRateFloorBps = 1024;
+
+struct SwarmChokeData
+{
+    tr_swarm* swarm;
+    std::vector<ChokeData> choked;
+    size_t checked_choke_count = 0U;
+
+    // How much the swarm needs our uploads: lots of peers that
+    // want data and few seeds to get it from
+    double demand = 0.0;
+
+    bool is_wanting = false; // has interested peers
+    bool is_maxed_out = false;
+};
+
+void rechokeUploadsGlobal(
+    std::vector<tr_swarm*> const& swarms,
+    size_t const n_slots,
+    size_t const max_fair_share,
+    uint64_t const now)
+{
+    auto data = std::vector<SwarmChokeData>{};
+    data.reserve(std::size(swarms));
+
+    auto n_optimistic = size_t{ 0U };
+    auto n_wanting = size_t{ 0U };
+    for (auto* const swarm : swarms)
+    {
+        auto& item = data.emplace_back();
+        item.swarm = swarm;
+        item.is_maxed_out = swarm->tor->bandwidth_.is_maxed_out(TR_UP, now);
+        item.choked = getChokeCandidates(swarm, now);
+
+        if (swarm->optimistic != nullptr)
+        {
+            ++n_optimistic;
+        }
+
+        auto const n_interested = std::count_if(
+            std::begin(item.choked),
+            std::end(item.choked),
+            [](auto const& candidate) { return candidate.is_interested; });
+        auto const n_seeds = std::count_if(
+            std::begin(swarm->peers),
+            std::end(swarm->peers),
+            [](auto const* peer) { return peer->isSeed(); });
+        item.demand = static_cast<double>(n_interested) / static_cast<double>(n_seeds + 1);
+
+        if (n_interested > 0)
+        {
+            item.is_wanting = true;
+            ++n_wanting;
+        }
+    }
+
+    auto pool = UploadSlotPool{ n_slots, n_optimistic };
+
+    // 1. each torrent's fair share. Start handing out the remainder
+    // at a random torrent so that each gets its turn over time.
+    if (n_wanting > 0U)
+    {
+        auto const shares = pool.fair_shares(n_wanting, max_fair_share, tr_rand_int(n_wanting));
+        auto next_share = std::begin(shares);
+
+        for (auto& item : data)
+        {
+            // A torrent without interested peers doesn't need slots,
+            // but its uninterested peers are still unchoked.
+            auto const share = item.is_wanting ? *next_share++ : max_fair_share;
+
+            auto const [checked, unchoked] = unchokeBest(item.choked, share, item.is_maxed_out);
+            item.checked_choke_count = checked;
+            pool.take(unchoked);
+        }
+    }
+
+    // 2. the leftovers go to the most valuable peers
+    struct Ranked
     {
-        auto rand_pool = std::vector<ChokeData*>{};
+        ChokeData* item;
+        double value;
+        bool is_maxed_out;
 
-        for (auto i = checked_choke_count, n = std::size(choked); i < n; ++i)
+        [[nodiscard]] constexpr auto operator<(Ranked const& that) const noexcept
         {
-            if (choked[i].is_interested)
+            if (value != that.value)
             {
-                rand_pool.push_back(&choked[i]);
+                return value > that.value;
             }
+
+            return item->compare(*that.item) < 0;
         }
+    };
 
-        if (auto const n = std::size(rand_pool); n != 0)
+    auto ranked = std::vector<Ranked>{};
+    for (auto& item : data)
+    {
+        for (auto i = item.checked_choke_count, n = std::size(item.choked); i < n; ++i)
         {
-            auto* c = rand_pool[tr_rand_int(n)];
-            c->is_choked = false;
-            s->optimistic = c->msgs;
-            s->optimistic_unchoke_time_scaler = OptimisticUnchokeMultiplier;
+            if (auto& candidate = item.choked[i]; candidate.is_interested)
+            {
+                auto const value = static_cast<double>(candidate.rate + RankingRateFloorBps) * item.demand;
+                ranked.push_back({ &candidate, value, item.is_maxed_out });
+            }
         }
     }
 
-    for (auto& item : choked)
+    auto const n_ranked = std::min(pool.free(), std::size(ranked));
+    std::partial_sort(std::begin(ranked), std::begin(ranked) + n_ranked, std::end(ranked));
+    std::for_each(
+        std::begin(ranked),
+        std::begin(ranked) + n_ranked,
+        [](Ranked const& rank) { rank.item->is_choked = rank.is_maxed_out ? rank.item->was_choked : false; });
+    pool.take(n_ranked);
+
+    // 3. optimistic unchokes, in random torrents
+    auto n_optimistic_free = pool.optimistic_free();
+    auto optimistic_pool = std::vector<SwarmChokeData*>{};
+    for (auto& item : data)
     {
-        item.msgs->set_choke(item.is_choked);
+        if (item.swarm->optimistic == nullptr && !item.is_maxed_out)
+        {
+            optimistic_pool.push_back(&item);
+        }
+    }
+
+    while (n_optimistic_free > 0U && !std::empty(optimistic_pool))
+    {
+        auto const idx = tr_rand_int(std::size(optimistic_pool));
+        auto* const item = optimistic_pool[idx];
+        optimistic_pool[idx] = optimistic_pool.back();
+        optimistic_pool.pop_back();
+
+        if (optimisticUnchoke(item->swarm, item->choked, item->checked_choke_count))
+        {
+            --n_optimistic_free;
+        }
+    }
+
+    for (auto const& item : data)
+    {
+        applyChokes(item.choked);
     }
 }
 } // namespace rechoke_uploads_helpers
@@ -1985,7 +2547,9 @@ void tr_peerMgr::rechokePulse() const
 
     auto const lock = unique_lock();
     auto const now = tr_time_msec();
+    auto const n_global_slots = session->uploadSlotsGlobal();
 
+    auto swarms = std::vector<tr_swarm*>{};
     for (auto* const tor : session->torrents())
     {
         if (tor->is_running())
@@ -1998,11 +2562,24 @@ void tr_peerMgr::rechokePulse() const
         {
             if (auto* const swarm = tor->swarm; swarm->stats.peer_count > 0)
             {
-                rechokeUploads(swarm, now);
+                if (n_global_slots == 0U)
+                {
+                    rechokeUploads(swarm, now);
+                }
+                else
+                {
+                    swarms.push_back(swarm);
+                }
+
                 updateInterest(swarm);
             }
         }
     }
+
+    if (!std::empty(swarms))
+    {
+        rechokeUploadsGlobal(swarms, n_global_slots, session->uploadSlotsPerTorrent(), now);
+    }
 }
 
 // --- Life and Death
@@ -2254,10 +2831,6 @@ void tr_peerMgr::bandwidthPulse()
 
     pumpAllPeers(this);
 
-    // allocate bandwidth to the peers
-    static auto constexpr Msec = std::chrono::duration_cast<std::chrono::milliseconds>(BandwidthTimerPeriod).count();
-    session->top_bandwidth_.allocate(Msec);
-
     // torrent upkeep
     for (auto* const tor : session->torrents())
     {
@@ -2320,22 +2893,6 @@ namespace connect_helpers
     return true;
 }
 
-struct peer_candidate
-{
-    peer_candidate() = default;
-
-    peer_candidate(uint64_t score_in, tr_torrent const* const tor_in, tr_peer_info const* const peer_info_in)
-        : score{ score_in }
-        , tor{ tor_in }
-        , peer_info{ peer_info_in }
-    {
-    }
-
-    uint64_t score;
-    tr_torrent const* tor;
-    tr_peer_info const* peer_info;
-};
-
 [[nodiscard]] bool torrentWasRecentlyStarted(tr_torrent const* tor)
 {
     return difftime(tr_time(), tor->startDate) < 120;
@@ -2406,6 +2963,36 @@ struct peer_candidate
     return score;
 }
 
+// @return when to check again if a peer that isn't a candidate now has become one
+[[nodiscard]] time_t next_candidate_check(tr_peer_info const& peer_info, time_t const now)
+{
+    // a connection or handshake that ends requeues the peer,
+    // so this is just a fallback
+    static auto constexpr InUseSecs = time_t{ 60 };
+
+    // e.g. unreachable, blocklisted, or a seed when we're seeding too.
+    // These rarely change, and the ways they change requeue the peer.
+    static auto constexpr UnlikelySecs = time_t{ 15 * 60 };
+
+    if (peer_info.is_in_use())
+    {
+        return now + InUseSecs;
+    }
+
+    if (!peer_info.reconnect_interval_has_passed(now))
+    {
+        return peer_info.reconnect_time(now);
+    }
+
+    return now + UnlikelySecs;
+}
+
+[[nodiscard]] uint8_t make_candidate_salt()
+{
+    thread_local auto salter = tr_salt_shaker{};
+    return salter();
+}
+
 void get_peer_candidates(tr_session* session, tr_peerMgr::OutboundCandidates& setme)
 {
     setme.clear();
@@ -2419,11 +3006,14 @@ void get_peer_candidates(tr_session* session, tr_peerMgr::OutboundCandidates& se
         return;
     }
 
-    auto candidates = std::vector<peer_candidate>{};
-    candidates.reserve(tr_peer_info::known_connectable_count());
+    // each eligible swarm's best candidate
+    using SwarmBest = std::pair<uint64_t, tr_swarm*>;
+    auto heap = std::vector<SwarmBest>{};
+    auto const heap_compare = [](SwarmBest const& a, SwarmBest const& b)
+    {
+        return a.first > b.first; // lowest score on top
+    };
 
-    /* populate the candidate array */
-    auto salter = tr_salt_shaker{};
     for (auto* const tor : session->torrents())
     {
         auto* const swarm = tor->swarm;
@@ -2453,30 +3043,36 @@ void get_peer_candidates(tr_session* session, tr_peerMgr::OutboundCandidates& se
             continue;
         }
 
-        for (auto const& [socket_address, atom] : swarm->connectable_pool)
+        if (auto const score = swarm->best_candidate_score(now); score)
         {
-            if (is_peer_candidate(tor, atom, now))
-            {
-                candidates.emplace_back(getPeerCandidateScore(tor, atom, salter()), tor, &atom);
-            }
+            heap.emplace_back(*score, swarm);
         }
     }
 
-    // only keep the best `max` candidates
-    if (auto const max = tr_peerMgr::OutboundCandidates::requested_inline_size; max < std::size(candidates))
+    // pop the best candidates across all the swarms
+    std::make_heap(std::begin(heap), std::end(heap), heap_compare);
+    auto candidates = std::vector<std::pair<tr_torrent_id_t, tr_socket_address>>{};
+    auto const max = tr_peerMgr::OutboundCandidates::requested_inline_size;
+    candidates.reserve(max);
+    while (!std::empty(heap) && std::size(candidates) < max)
     {
-        std::partial_sort(
-            std::begin(candidates),
-            std::begin(candidates) + max,
-            std::end(candidates),
-            [](auto const& a, auto const& b) { return a.score < b.score; });
-        candidates.resize(max);
+        std::pop_heap(std::begin(heap), std::end(heap), heap_compare);
+        auto* const swarm = heap.back().second;
+        heap.pop_back();
+
+        candidates.emplace_back(swarm->tor->id(), swarm->pop_best_candidate());
+
+        if (auto const score = swarm->best_candidate_score(now); score)
+        {
+            heap.emplace_back(*score, swarm);
+            std::push_heap(std::begin(heap), std::end(heap), heap_compare);
+        }
     }
 
     // put the best candidates at the end of the list
     for (auto it = std::crbegin(candidates), end = std::crend(candidates); it != end; ++it)
     {
-        setme.emplace_back(it->tor->id(), it->peer_info->listen_socket_address());
+        setme.emplace_back(*it);
     }
 }
 
@@ -2525,11 +3121,88 @@ void initiate_connection(tr_peerMgr* mgr, tr_swarm* s, tr_peer_info& peer_info)
 } // namespace connect_helpers
 } // namespace
 
+std::optional<uint64_t> tr_swarm::best_candidate_score(time_t const now)
+{
+    using namespace connect_helpers;
+
+    // check the waiting candidates whose time has come
+    while (auto const socket_address = candidates_.next_due(now))
+    {
+        enqueue_candidate(*socket_address, now);
+    }
+
+    while (auto const best = candidates_.best_ready())
+    {
+        auto const [score, socket_address] = *best;
+
+        // if it's not a candidate anymore, or if its score has
+        // changed since it was queued, then requeue it
+        auto const* const peer_info = get_existing_peer_info(socket_address);
+        if (peer_info == nullptr || !is_peer_candidate(tor, *peer_info, now) ||
+            getPeerCandidateScore(tor, *peer_info, static_cast<uint8_t>(score)) != score)
+        {
+            enqueue_candidate(socket_address, now);
+            continue;
+        }
+
+        return score;
+    }
+
+    return {};
+}
+
+tr_socket_address tr_swarm::pop_best_candidate()
+{
+    auto const best = candidates_.best_ready();
+    TR_ASSERT(best);
+
+    auto const socket_address = best->second;
+    candidates_.erase(socket_address);
+    return socket_address;
+}
+
+void tr_swarm::enqueue_candidate(tr_socket_address const& socket_address, time_t const now)
+{
+    using namespace connect_helpers;
+
+    // keep the salt so that requeueing a peer doesn't reshuffle it
+    auto const score = candidates_.ready_score(socket_address);
+    auto const salt = score ? static_cast<uint8_t>(*score) : make_candidate_salt();
+
+    auto const* const peer_info = get_existing_peer_info(socket_address);
+    if (peer_info == nullptr || peer_info->is_banned())
+    {
+        candidates_.erase(socket_address);
+        return;
+    }
+
+    if (is_peer_candidate(tor, *peer_info, now))
+    {
+        candidates_.set_ready(socket_address, getPeerCandidateScore(tor, *peer_info, salt));
+    }
+    else
+    {
+        candidates_.set_waiting(socket_address, next_candidate_check(*peer_info, now));
+    }
+}
+
+void tr_swarm::rebuild_candidates()
+{
+    candidates_.clear();
+
+    auto const now = tr_time();
+    for (auto const& [socket_address, peer_info] : connectable_pool)
+    {
+        enqueue_candidate(socket_address, now);
+    }
+}
+
 void tr_peerMgr::make_new_peer_connections()
 {
     using namespace connect_helpers;
 
     auto const lock = session->unique_lock();
+    auto const now = tr_time();
 
     // get the candidates if we need to
     auto& candidates = outbound_candidates_;
@@ -2547,10 +3220,14 @@ void tr_peerMgr::make_new_peer_connections()
 
         if (auto* const tor = session->torrents().get(tor_id); tor != nullptr)
         {
-            if (auto* const peer_info = tor->swarm->get_existing_peer_info(sock_addr); peer_info != nullptr)
+            // the peer might have changed since we made the list, e.g. by connecting to us
+            if (auto* const peer_info = tor->swarm->get_existing_peer_info(sock_addr);
+                peer_info != nullptr && is_peer_candidate(tor, *peer_info, now))
             {
                 initiate_connection(this, tor->swarm, *peer_info);
             }
+
+            tor->swarm->enqueue_candidate(sock_addr, now);
         }
     }
 
@@ -286,8 +286,13 @@ public:
 
     [[nodiscard]] constexpr auto reconnect_interval_has_passed(time_t const now) const noexcept
     {
-        auto const interval = now - std::max(connection_attempted_at_, connection_changed_at_);
-        return interval >= get_reconnect_interval_secs(now);
+        return now >= reconnect_time(now);
+    }
+
+    // @return when reconnect_interval_has_passed() will be true
+    [[nodiscard]] constexpr time_t reconnect_time(time_t const now) const noexcept
+    {
+        return std::max(connection_attempted_at_, connection_changed_at_) + get_reconnect_interval_secs(now);
     }
 
     [[nodiscard]] constexpr std::optional<time_t> idle_secs(time_t now) const noexcept
@@ -527,7 +532,13 @@ constexpr bool tr_isPex(tr_pex const* pex)
 
 void tr_peerMgrFree(tr_peerMgr* manager);
 
-[[nodiscard]] std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_peer const* peer, size_t numwant);
+// @param allowed_fast_only true if the peer is choking us,
+//        so that only its BEP 6 Allowed Fast pieces can be requested
+[[nodiscard]] std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(
+    tr_torrent* torrent,
+    tr_peer const* peer,
+    size_t numwant,
+    bool allowed_fast_only = false);
 
 [[nodiscard]] bool tr_peerMgrDidPeerRequest(tr_torrent const* torrent, tr_peer const* peer, tr_block_index_t block);
 
@@ -3,12 +3,12 @@
 // or any future license endorsed by Mnemosyne LLC.
 // License text can be found in the licenses/ folder.
 
+#include <algorithm> // std::copy_n
 #include <array>
-#include <limits> // std::numeric_limits
+#include <cstddef> // size_t, std::byte
+#include <cstdint> // uint8_t, uint32_t, uint64_t
 #include <string_view>
 
-#include <math/wide_integer/uintwide_t.h>
-
 #include "libtransmission/crypto-utils.h" // tr_sha1
 #include "libtransmission/peer-mse.h"
 #include "libtransmission/tr-arc4.h"
@@ -18,51 +18,287 @@ using namespace std::literals;
 
 namespace
 {
-namespace wi
+// Modular exponentiation with the MSE prime as a fixed modulus.
+//
+// Numbers are little-endian arrays of limbs, kept in Montgomery form
+// (x * R mod P, where R = 2^768) so that each modular multiplication is
+// a multiply and a reduction without any division.
+namespace mont
 {
-using key_t = math::wide_integer::uintwide_t<
-    tr_message_stream_encryption::DH::KeySize * std::numeric_limits<unsigned char>::digits>;
+#if defined(__SIZEOF_INT128__)
+using Limb = uint64_t;
+using DoubleLimb = unsigned __int128;
+#else
+using Limb = uint32_t;
+using DoubleLimb = uint64_t;
+#endif
+
+auto constexpr LimbBits = sizeof(Limb) * 8U;
+auto constexpr KeyBits = tr_message_stream_encryption::DH::KeySize * 8U;
+auto constexpr NLimbs = KeyBits / LimbBits;
+auto constexpr ExponentBits = tr_message_stream_encryption::DH::PrivateKeySize * 8U;
 
-using private_key_t = math::wide_integer::uintwide_t<
-    tr_message_stream_encryption::DH::PrivateKeySize * std::numeric_limits<unsigned char>::digits>;
+using Num = std::array<Limb, NLimbs>;
 
-template<typename UIntWide>
-auto import_bits(std::array<std::byte, UIntWide::my_width2 / std::numeric_limits<uint8_t>::digits> const& bigend_bin)
+template<size_t N>
+[[nodiscard]] constexpr auto from_bigend(std::array<std::byte, N> const& bigend) noexcept
 {
-    auto ret = UIntWide{};
-    static_assert(sizeof(UIntWide) == sizeof(bigend_bin));
+    static_assert(N <= NLimbs * sizeof(Limb));
 
-    for (auto const walk : bigend_bin)
+    auto ret = Num{};
+    for (size_t i = 0; i < N; ++i)
     {
-        ret <<= 8;
-        ret += static_cast<uint8_t>(walk);
+        auto const byte = Limb{ static_cast<uint8_t>(bigend[N - 1U - i]) };
+        ret[i / sizeof(Limb)] |= byte << (8U * (i % sizeof(Limb)));
     }
+    return ret;
+}
 
+[[nodiscard]] constexpr auto to_bigend(Num const& num) noexcept
+{
+    auto ret = tr_message_stream_encryption::DH::key_bigend_t{};
+    auto constexpr N = std::size(ret);
+    for (size_t i = 0; i < N; ++i)
+    {
+        ret[N - 1U - i] = std::byte(static_cast<uint8_t>(num[i / sizeof(Limb)] >> (8U * (i % sizeof(Limb)))));
+    }
     return ret;
 }
 
-template<typename UIntWide>
-auto export_bits(UIntWide i)
+// MSE spec: "P is 0xFFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245E485B576625E7EC6F44C42E9A63A36210000000000090563"
+auto constexpr Prime = from_bigend(std::array<std::byte, 96>{
+    std::byte{ 0xFF }, std::byte{ 0xFF }, std::byte{ 0xFF }, std::byte{ 0xFF }, std::byte{ 0xFF }, std::byte{ 0xFF },
+    std::byte{ 0xFF }, std::byte{ 0xFF }, std::byte{ 0xC9 }, std::byte{ 0x0F }, std::byte{ 0xDA }, std::byte{ 0xA2 },
+    std::byte{ 0x21 }, std::byte{ 0x68 }, std::byte{ 0xC2 }, std::byte{ 0x34 }, std::byte{ 0xC4 }, std::byte{ 0xC6 },
+    std::byte{ 0x62 }, std::byte{ 0x8B }, std::byte{ 0x80 }, std::byte{ 0xDC }, std::byte{ 0x1C }, std::byte{ 0xD1 },
+    std::byte{ 0x29 }, std::byte{ 0x02 }, std::byte{ 0x4E }, std::byte{ 0x08 }, std::byte{ 0x8A }, std::byte{ 0x67 },
+    std::byte{ 0xCC }, std::byte{ 0x74 }, std::byte{ 0x02 }, std::byte{ 0x0B }, std::byte{ 0xBE }, std::byte{ 0xA6 },
+    std::byte{ 0x3B }, std::byte{ 0x13 }, std::byte{ 0x9B }, std::byte{ 0x22 }, std::byte{ 0x51 }, std::byte{ 0x4A },
+    std::byte{ 0x08 }, std::byte{ 0x79 }, std::byte{ 0x8E }, std::byte{ 0x34 }, std::byte{ 0x04 }, std::byte{ 0xDD },
+    std::byte{ 0xEF }, std::byte{ 0x95 }, std::byte{ 0x19 }, std::byte{ 0xB3 }, std::byte{ 0xCD }, std::byte{ 0x3A },
+    std::byte{ 0x43 }, std::byte{ 0x1B }, std::byte{ 0x30 }, std::byte{ 0x2B }, std::byte{ 0x0A }, std::byte{ 0x6D },
+    std::byte{ 0xF2 }, std::byte{ 0x5F }, std::byte{ 0x14 }, std::byte{ 0x37 }, std::byte{ 0x4F }, std::byte{ 0xE1 },
+    std::byte{ 0x35 }, std::byte{ 0x6D }, std::byte{ 0x6D }, std::byte{ 0x51 }, std::byte{ 0xC2 }, std::byte{ 0x45 },
+    std::byte{ 0xE4 }, std::byte{ 0x85 }, std::byte{ 0xB5 }, std::byte{ 0x76 }, std::byte{ 0x62 }, std::byte{ 0x5E },
+    std::byte{ 0x7E }, std::byte{ 0xC6 }, std::byte{ 0xF4 }, std::byte{ 0x4C }, std::byte{ 0x42 }, std::byte{ 0xE9 },
+    std::byte{ 0xA6 }, std::byte{ 0x3A }, std::byte{ 0x36 }, std::byte{ 0x21 }, std::byte{ 0x00 }, std::byte{ 0x00 },
+    std::byte{ 0x00 }, std::byte{ 0x00 }, std::byte{ 0x00 }, std::byte{ 0x09 }, std::byte{ 0x05 }, std::byte{ 0x63 },
+});
+
+// MSE spec: "G is 2"
+auto constexpr Generator = Limb{ 2U };
+
+// -P^-1 mod 2^LimbBits, by Newton's iteration
+[[nodiscard]] constexpr Limb neg_inverse(Limb p0) noexcept
 {
-    auto ret = std::array<std::byte, UIntWide::my_width2 / std::numeric_limits<uint8_t>::digits>{};
+    auto inv = Limb{ 1U };
+    for (size_t i = 0; i < 7U; ++i)
+    {
+        inv *= Limb{ 2U } - p0 * inv;
+    }
+    return static_cast<Limb>(Limb{} - inv);
+}
+
+auto constexpr PrimeInv = neg_inverse(Prime[0]);
+static_assert(static_cast<Limb>(Prime[0] * PrimeInv) == static_cast<Limb>(~Limb{}));
+
+// @return a >= b
+[[nodiscard]] constexpr bool greater_or_equal(Num const& a, Num const& b) noexcept
+{
+    for (size_t i = NLimbs; i-- > 0U;)
+    {
+        if (a[i] != b[i])
+        {
+            return a[i] > b[i];
+        }
+    }
+    return true;
+}
 
-    for (auto walk = std::rbegin(ret), end = std::rend(ret); walk != end; ++walk)
+// a -= b, @return the borrow
+constexpr Limb subtract(Num& a, Num const& b) noexcept
+{
+    auto borrow = Limb{};
+    for (size_t i = 0; i < NLimbs; ++i)
     {
-        *walk = std::byte(static_cast<uint8_t>(i & 0xFF));
-        i >>= 8;
+        auto const diff = DoubleLimb{ a[i] } - b[i] - borrow;
+        a[i] = static_cast<Limb>(diff);
+        borrow = static_cast<Limb>(diff >> LimbBits) & 1U;
+    }
+    return borrow;
+}
+
+// (a * 2) mod P, for a < P
+[[nodiscard]] constexpr Num double_mod(Num a) noexcept
+{
+    auto carry = Limb{};
+    for (auto& limb : a)
+    {
+        auto const next_carry = static_cast<Limb>(limb >> (LimbBits - 1U));
+        limb = static_cast<Limb>(limb << 1U) | carry;
+        carry = next_carry;
+    }
+
+    if (carry != 0U || greater_or_equal(a, Prime))
+    {
+        subtract(a, Prime);
+    }
+    return a;
+}
+
+// R^2 mod P, which converts a number into Montgomery form
+[[nodiscard]] constexpr Num make_r_squared() noexcept
+{
+    // R mod P is R - P, since P < R < 2P
+    auto r = Num{};
+    subtract(r, Prime);
+
+    for (size_t i = 0; i < KeyBits; ++i)
+    {
+        r = double_mod(r);
+    }
+    return r;
+}
+
+auto constexpr RSquared = make_r_squared();
+
+// a * b * R^-1 mod P, with the coarsely integrated operand scanning method
+[[nodiscard]] Num multiply(Num const& a, Num const& b) noexcept
+{
+    auto t = std::array<Limb, NLimbs + 2U>{};
+
+    for (size_t i = 0; i < NLimbs; ++i)
+    {
+        // t += a * b[i]
+        auto carry = Limb{};
+        for (size_t j = 0; j < NLimbs; ++j)
+        {
+            auto const sum = DoubleLimb{ a[j] } * b[i] + t[j] + carry;
+            t[j] = static_cast<Limb>(sum);
+            carry = static_cast<Limb>(sum >> LimbBits);
+        }
+        auto sum = DoubleLimb{ t[NLimbs] } + carry;
+        t[NLimbs] = static_cast<Limb>(sum);
+        t[NLimbs + 1U] = static_cast<Limb>(sum >> LimbBits);
+
+        // t = (t + m * P) / 2^LimbBits, where m makes the low limb zero
+        auto const m = static_cast<Limb>(t[0] * PrimeInv);
+        sum = DoubleLimb{ m } * Prime[0] + t[0];
+        carry = static_cast<Limb>(sum >> LimbBits);
+        for (size_t j = 1; j < NLimbs; ++j)
+        {
+            sum = DoubleLimb{ m } * Prime[j] + t[j] + carry;
+            t[j - 1U] = static_cast<Limb>(sum);
+            carry = static_cast<Limb>(sum >> LimbBits);
+        }
+        sum = DoubleLimb{ t[NLimbs] } + carry;
+        t[NLimbs - 1U] = static_cast<Limb>(sum);
+        t[NLimbs] = t[NLimbs + 1U] + static_cast<Limb>(sum >> LimbBits);
     }
 
+    // the result is < 2P, so at most one subtraction is needed
+    auto ret = Num{};
+    std::copy_n(std::data(t), NLimbs, std::data(ret));
+    if (t[NLimbs] != 0U || greater_or_equal(ret, Prime))
+    {
+        subtract(ret, Prime);
+    }
     return ret;
 }
 
-// NOLINTBEGIN(readability-identifier-naming)
-auto WIDE_INTEGER_CONSTEXPR const generator = wi::key_t{ "2" };
-auto WIDE_INTEGER_CONSTEXPR const prime = wi::key_t{
-    "0xFFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245E485B576625E7EC6F44C42E9A63A36210000000000090563"
-};
-// NOLINTEND(readability-identifier-naming)
+[[nodiscard]] Num to_montgomery(Num const& a) noexcept
+{
+    return multiply(a, RSquared);
+}
+
+[[nodiscard]] Num from_montgomery(Num const& a) noexcept
+{
+    auto one = Num{};
+    one[0] = 1U;
+    return multiply(a, one);
+}
+
+// The exponents are private keys, which are read four bits at a time.
+auto constexpr WindowBits = size_t{ 4U };
+auto constexpr WindowSize = size_t{ 1U } << WindowBits;
+auto constexpr NWindows = ExponentBits / WindowBits;
+static_assert(ExponentBits % WindowBits == 0U);
+
+using PrivateKey = tr_message_stream_encryption::DH::private_key_bigend_t;
+
+// @return the `i`th window of `exponent`, counting from the most significant
+[[nodiscard]] constexpr size_t window(PrivateKey const& exponent, size_t i) noexcept
+{
+    auto const byte = static_cast<uint8_t>(exponent[i / 2U]);
+    return i % 2U == 0U ? byte >> 4U : byte & 0x0FU;
+}
+
+// A fixed-base comb for G: table[i][j] is G^(j * 16^(NWindows - 1 - i)),
+// so G^x is one multiplication per window and no squarings.
+using GeneratorTable = std::array<std::array<Num, WindowSize>, NWindows>;
+
+[[nodiscard]] GeneratorTable make_generator_table()
+{
+    auto table = GeneratorTable{};
+
+    auto base = Num{};
+    base[0] = Generator;
+    base = to_montgomery(base);
+
+    auto const one = to_montgomery(Num{ 1U });
+    for (size_t i = NWindows; i-- > 0U;)
+    {
+        auto& row = table[i];
+        row[0] = one;
+        for (size_t j = 1; j < WindowSize; ++j)
+        {
+            row[j] = multiply(row[j - 1U], base);
+        }
+
+        // base = base^16
+        base = multiply(row[WindowSize - 1U], base);
+    }
+
+    return table;
+}
+
+[[nodiscard]] auto generator_pow(PrivateKey const& exponent)
+{
+    static auto const table = make_generator_table();
+
+    auto result = table[0][window(exponent, 0U)];
+    for (size_t i = 1; i < NWindows; ++i)
+    {
+        result = multiply(result, table[i][window(exponent, i)]);
+    }
+    return to_bigend(from_montgomery(result));
+}
+
+// Fixed-window exponentiation for an arbitrary base, e.g. a peer's public key.
+[[nodiscard]] auto pow(tr_message_stream_encryption::DH::key_bigend_t const& base_bigend, PrivateKey const& exponent)
+{
+    auto table = std::array<Num, WindowSize>{};
+    table[0] = to_montgomery(Num{ 1U });
+    table[1] = to_montgomery(from_bigend(base_bigend));
+    for (size_t j = 2; j < WindowSize; ++j)
+    {
+        table[j] = multiply(table[j - 1U], table[1]);
+    }
+
+    auto result = table[window(exponent, 0U)];
+    for (size_t i = 1; i < NWindows; ++i)
+    {
+        for (size_t k = 0; k < WindowBits; ++k)
+        {
+            result = multiply(result, result);
+        }
+
+        result = multiply(result, table[window(exponent, i)]);
+    }
+    return to_bigend(from_montgomery(result));
+}
 
-} // namespace wi
+} // namespace mont
 } // namespace
 
 namespace tr_message_stream_encryption
@@ -75,18 +311,11 @@ namespace tr_message_stream_encryption
     return tr_rand_obj<DH::private_key_bigend_t>();
 }
 
-[[nodiscard]] auto generatePublicKey(DH::private_key_bigend_t const& private_key) noexcept
-{
-    auto const private_key_wi = wi::import_bits<wi::private_key_t>(private_key);
-    auto const public_key_wi = math::wide_integer::powm(wi::generator, private_key_wi, wi::prime);
-    return wi::export_bits(public_key_wi);
-}
-
 DH::key_bigend_t DH::publicKey() noexcept
 {
     if (public_key_ == key_bigend_t{})
     {
-        public_key_ = generatePublicKey(private_key_);
+        public_key_ = mont::generator_pow(private_key_);
     }
 
     return public_key_;
@@ -94,11 +323,7 @@ DH::key_bigend_t DH::publicKey() noexcept
 
 void DH::setPeerPublicKey(key_bigend_t const& peer_public_key)
 {
-    auto const secret = math::wide_integer::powm(
-        wi::import_bits<wi::key_t>(peer_public_key),
-        wi::import_bits<wi::private_key_t>(private_key_),
-        wi::prime);
-    secret_ = wi::export_bits(secret);
+    secret_ = mont::pow(peer_public_key, private_key_);
 }
 
 // --- Filter
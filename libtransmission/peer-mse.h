@@ -123,7 +123,7 @@ private:
         }
     }
 
-    static constexpr void skip(size_t len, bool active, tr_arc4& arc4)
+    static void skip(size_t len, bool active, tr_arc4& arc4) noexcept
     {
         if (active)
         {
@@ -182,10 +182,20 @@ auto constexpr ReqQ = int{ 512 };
 // how many blocks to keep prefetched per peer
 auto constexpr PrefetchMax = size_t{ 18 };
 
-// when we're making requests from another peer,
-// batch them together to send enough requests to
-// meet our bandwidth goals for the next N seconds
-auto constexpr RequestBufSecs = int{ 10 };
+// how many blocks per peer to read ahead in the disk I/O threads
+auto constexpr ReadAheadMax = size_t{ 4 };
+
+// ---
+
+// http://bittorrent.org/beps/bep_0006.html
+// how many pieces a peer may request from us while we're choking it
+auto constexpr AllowedFastSetSize = size_t{ 10 };
+
+// how many cached pieces to suggest each time a peer becomes interested
+auto constexpr SuggestBatchSize = size_t{ 4 };
+
+// the most pieces we'll suggest to one peer
+auto constexpr MaxSuggestedPieces = size_t{ 32 };
 
 // ---
 
@@ -281,7 +291,9 @@ size_t protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index);
 size_t protocolSendPort(tr_peerMsgsImpl* msgs, tr_port port);
 size_t protocolSendRequest(tr_peerMsgsImpl* msgs, struct peer_request const& req);
 void sendInterest(tr_peerMsgsImpl* msgs, bool b);
+void sendAllowedFast(tr_peerMsgsImpl* msgs);
 void sendLtepHandshake(tr_peerMsgsImpl* msgs);
+void sendSuggestions(tr_peerMsgsImpl* msgs);
 void tellPeerWhatWeHave(tr_peerMsgsImpl* msgs);
 void updateDesiredRequestCount(tr_peerMsgsImpl* msgs);
 
@@ -348,6 +360,7 @@ public:
         }
 
         tellPeerWhatWeHave(this);
+        sendAllowedFast(this);
 
         if (session->allowsDHT() && io->supports_dht())
         {
@@ -426,6 +439,7 @@ public:
     void onTorrentGotMetainfo() noexcept override
     {
         invalidatePercentDone();
+        sendAllowedFast(this);
 
         update_active();
     }
@@ -499,16 +513,26 @@ public:
         return tr_torrentReqIsValid(torrent, req.index, req.offset, req.length);
     }
 
+    // BEP 6: can the peer request `piece` from us even while we're choking it?
+    [[nodiscard]] bool is_allowed_fast_for_peer(tr_piece_index_t piece) const
+    {
+        return std::find(std::begin(allowed_fast_set_), std::end(allowed_fast_set_), piece) != std::end(allowed_fast_set_);
+    }
+
     void requestBlocks(tr_block_span_t const* block_spans, size_t n_spans) override
     {
         TR_ASSERT(torrent->client_can_download());
         TR_ASSERT(client_is_interested());
-        TR_ASSERT(!client_is_choked());
+        TR_ASSERT(!client_is_choked() || !std::empty(allowed_fast_pieces));
+
+        auto const now_msec = tr_time_msec();
 
         for (auto const *span = block_spans, *span_end = span + n_spans; span != span_end; ++span)
         {
             for (auto [block, block_end] = *span; block < block_end; ++block)
             {
+                request_pipeline.on_request_sent(block, now_msec);
+
                 // Note that requests can't cross over a piece boundary.
                 // So if a piece isn't evenly divisible by the block size,
                 // we need to split our block request info per-piece chunks.
@@ -550,7 +574,13 @@ public:
 private:
     [[nodiscard]] size_t maxAvailableReqs() const
     {
-        if (torrent->is_done() || !torrent->has_metainfo() || client_is_choked() || !client_is_interested())
+        if (torrent->is_done() || !torrent->has_metainfo() || !client_is_interested())
+        {
+            return 0;
+        }
+
+        // BEP 6: we can still ask for Allowed Fast pieces while choked
+        if (client_is_choked() && std::empty(allowed_fast_pieces))
         {
             return 0;
         }
@@ -574,17 +604,10 @@ private:
             }
         }
 
-        // use this desired rate to figure out how
-        // many requests we should send to this peer
-        size_t constexpr Floor = 32;
-        size_t constexpr Seconds = RequestBufSecs;
-        size_t const estimated_blocks_in_period = (rate_bytes_per_second * Seconds) / tr_block_info::BlockSize;
+        // use this desired rate and the peer's round trip time to
+        // figure out how many requests we should send to this peer
         size_t const ceil = reqq ? *reqq : 250;
-
-        auto max_reqs = estimated_blocks_in_period;
-        max_reqs = std::min(max_reqs, ceil);
-        max_reqs = std::max(max_reqs, Floor);
-        return max_reqs;
+        return request_pipeline.depth(rate_bytes_per_second, ceil, now);
     }
 
     [[nodiscard]] bool calculate_active(tr_direction direction) const
@@ -626,6 +649,8 @@ public:
 
     size_t desired_request_count = 0;
 
+    tr_request_pipeline request_pipeline;
+
     uint8_t ut_pex_id = 0;
     uint8_t ut_metadata_id = 0;
 
@@ -639,6 +664,15 @@ public:
 
     std::shared_ptr<tr_peerIo> const io;
 
+    // A block being read from disk in a disk I/O thread
+    struct PendingRead
+    {
+        Cache::SharedBlockData buf;
+        int err = 0;
+        bool started = false;
+        bool done = false;
+    };
+
     struct QueuedPeerRequest : public peer_request
     {
         explicit QueuedPeerRequest(peer_request in) noexcept
@@ -647,8 +681,13 @@ public:
         }
 
         bool prefetched = false;
+
+        std::shared_ptr<PendingRead> read;
     };
 
+    // Lets disk reads that finish after we're destroyed know not to call us.
+    std::shared_ptr<tr_peerMsgsImpl*> const self_ref_ = std::make_shared<tr_peerMsgsImpl*>(this);
+
     std::vector<QueuedPeerRequest> peer_requested_;
 
     std::array<std::vector<tr_pex>, NUM_TR_AF_INET_TYPES> pex;
@@ -672,6 +711,13 @@ public:
 
     tr_bitfield have_;
 
+    // BEP 6: the pieces this peer may request while we're choking it
+    std::vector<tr_piece_index_t> allowed_fast_set_;
+    bool sent_allowed_fast_ = false;
+
+    // BEP 6: the pieces that we've suggested to this peer
+    std::vector<tr_piece_index_t> suggested_to_peer_;
+
 private:
     friend ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader& payload);
     friend void parseLtepHandshake(tr_peerMsgsImpl* msgs, MessageReader& payload);
@@ -846,6 +892,31 @@ size_t protocol_send_keepalive(tr_peerMsgsImpl* msgs)
     return n_bytes_added;
 }
 
+// Like protocol_send_message(), but the peer io can send the block
+// from its shared buffer instead of copying it into the message
+size_t protocolSendPiece(tr_peerMsgsImpl* const msgs, peer_request const& req, Cache::SharedBlockData block)
+{
+    TR_ASSERT(block && std::size(*block) == req.length);
+
+    logtrace(msgs, fmt::format(FMT_STRING("sending 'piece' {:d}:{:d}->{:d}"), req.index, req.offset, req.length));
+
+    auto const msg_len = static_cast<uint32_t>(sizeof(BtPeerMsgs::Piece) + sizeof(req.index) + sizeof(req.offset) + req.length);
+    TR_ASSERT(messageLengthIsCorrect(msgs->torrent, BtPeerMsgs::Piece, msg_len));
+
+    auto out = MessageBuffer{};
+    out.add_uint32(msg_len);
+    out.add_uint8(BtPeerMsgs::Piece);
+    out.add_uint32(req.index);
+    out.add_uint32(req.offset);
+    auto const n_bytes_added = std::size(out) + req.length;
+    msgs->io->write(out, true);
+
+    auto const* const data = reinterpret_cast<std::byte const*>(std::data(*block));
+    msgs->io->write_shared(std::shared_ptr<std::byte const>{ std::move(block), data }, req.length, true);
+
+    return n_bytes_added;
+}
+
 auto protocolSendReject(tr_peerMsgsImpl* const msgs, struct peer_request const* req)
 {
     TR_ASSERT(msgs->io->supports_fext());
@@ -901,15 +972,80 @@ std::optional<int> popNextMetadataRequest(tr_peerMsgsImpl* msgs)
 
 void cancelAllRequestsToClient(tr_peerMsgsImpl* msgs)
 {
+    // BEP 6: choking a peer doesn't cancel its requests for Allowed Fast pieces
+    auto& requests = msgs->peer_requested_;
+    auto const cancel_begin = std::stable_partition(
+        std::begin(requests),
+        std::end(requests),
+        [msgs](auto const& req) { return msgs->is_allowed_fast_for_peer(req.index); });
+
     if (auto const must_send_rej = msgs->io->supports_fext(); must_send_rej)
     {
-        for (auto const& req : msgs->peer_requested_)
+        for (auto it = cancel_begin, end = std::end(requests); it != end; ++it)
         {
-            protocolSendReject(msgs, &req);
+            protocolSendReject(msgs, &*it);
         }
     }
 
-    msgs->peer_requested_.clear();
+    requests.erase(cancel_begin, std::end(requests));
+}
+
+// http://bittorrent.org/beps/bep_0006.html
+void sendAllowedFast(tr_peerMsgsImpl* msgs)
+{
+    auto const* const tor = msgs->torrent;
+    if (msgs->sent_allowed_fast_ || !msgs->io->supports_fext() || !tor->has_metainfo())
+    {
+        return;
+    }
+
+    msgs->sent_allowed_fast_ = true;
+
+    // If the torrent is this small, the set would be most of the torrent
+    if (tor->piece_count() <= AllowedFastSetSize * 2U)
+    {
+        return;
+    }
+
+    msgs->allowed_fast_set_ = tr_generateAllowedSet(
+        msgs->io->address(),
+        tor->info_hash(),
+        tor->piece_count(),
+        AllowedFastSetSize);
+    for (auto const piece : msgs->allowed_fast_set_)
+    {
+        protocol_send_message(msgs, BtPeerMsgs::FextAllowedFast, piece);
+    }
+}
+
+// Suggest pieces that are in our read cache so that
+// serving the peer's requests won't need disk reads
+void sendSuggestions(tr_peerMsgsImpl* msgs)
+{
+    auto* const tor = msgs->torrent;
+    auto& suggested = msgs->suggested_to_peer_;
+    if (!msgs->io->supports_fext() || !tor->has_metainfo() || std::size(suggested) >= MaxSuggestedPieces)
+    {
+        return;
+    }
+
+    auto n_sent = size_t{};
+    for (auto const piece : msgs->session->cache->hot_pieces(tor->id(), MaxSuggestedPieces))
+    {
+        if (n_sent >= SuggestBatchSize || std::size(suggested) >= MaxSuggestedPieces)
+        {
+            break;
+        }
+
+        if (msgs->have_.test(piece) || std::find(std::begin(suggested), std::end(suggested), piece) != std::end(suggested))
+        {
+            continue;
+        }
+
+        protocol_send_message(msgs, BtPeerMsgs::FextSuggest, piece);
+        suggested.push_back(piece);
+        ++n_sent;
+    }
 }
 
 // ---
@@ -1287,9 +1423,71 @@ void prefetchPieces(tr_peerMsgsImpl* msgs)
     }
 }
 
+[[nodiscard]] bool canSendPiece(tr_peerMsgsImpl* msgs, peer_request const& req)
+{
+    if (!msgs->isValidRequest(req) || !msgs->torrent->has_piece(req.index))
+    {
+        return false;
+    }
+
+    if (!msgs->torrent->ensure_piece_is_checked(req.index))
+    {
+        msgs->torrent->error().set_local_error(
+            fmt::format(FMT_STRING("Please Verify Local Data! Piece #{:d} is corrupt."), req.index));
+        return false;
+    }
+
+    return true;
+}
+
+// ensure that the first `ReadAheadMax` items in `msgs->peer_requested_`
+// are being read from disk so that they're ready to send.
+void startPieceReads(tr_peerMsgsImpl* msgs)
+{
+    auto& requests = msgs->peer_requested_;
+    for (size_t i = 0, n = std::min(ReadAheadMax, std::size(requests)); i < n; ++i)
+    {
+        auto& req = requests[i];
+        if (req.read)
+        {
+            continue;
+        }
+
+        auto read = std::make_shared<tr_peerMsgsImpl::PendingRead>();
+        req.read = read;
+
+        if (!canSendPiece(msgs, req))
+        {
+            read->err = EINVAL;
+            read->done = true;
+            continue;
+        }
+
+        msgs->session->cache->read_block_async(
+            msgs->torrent,
+            msgs->torrent->piece_loc(req.index, req.offset),
+            req.length,
+            [read, weak_msgs = std::weak_ptr<tr_peerMsgsImpl*>{ msgs->self_ref_ }](int err, Cache::SharedBlockData buf)
+            {
+                read->buf = std::move(buf);
+                read->err = err;
+                read->done = true;
+
+                // if the read finished in another thread, the peer
+                // may be waiting on it to send more data
+                if (auto const self_ref = weak_msgs.lock(); self_ref && read->started)
+                {
+                    peerPulse(*self_ref);
+                }
+            });
+
+        read->started = true;
+    }
+}
+
 [[nodiscard]] bool canAddRequestFromPeer(tr_peerMsgsImpl const* const msgs, struct peer_request const& req)
 {
-    if (msgs->peer_is_choked())
+    if (msgs->peer_is_choked() && !msgs->is_allowed_fast_for_peer(req.index))
     {
         logtrace(msgs, "rejecting request from choked peer");
         return false;
@@ -1421,6 +1619,8 @@ ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader
 
         if (!fext)
         {
+            // the peer has dropped all our requests
+            msgs->request_pipeline.on_requests_cleared();
             msgs->publish(tr_peer_event::GotChoke());
         }
 
@@ -1438,6 +1638,7 @@ ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader
         logtrace(msgs, "got Interested");
         msgs->set_peer_interested(true);
         msgs->update_active(TR_CLIENT_TO_PEER);
+        sendSuggestions(msgs);
         break;
 
     case BtPeerMsgs::NotInterested:
@@ -1459,8 +1660,8 @@ ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader
         /* a peer can send the same HAVE message twice... */
         if (!msgs->have_.test(ui32))
         {
-            msgs->have_.set(ui32);
             msgs->publish(tr_peer_event::GotHave(ui32));
+            msgs->have_.set(ui32);
         }
 
         msgs->invalidatePercentDone();
@@ -1468,9 +1669,12 @@ ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader
 
     case BtPeerMsgs::Bitfield:
         logtrace(msgs, "got a bitfield");
-        msgs->have_ = tr_bitfield{ msgs->torrent->has_metainfo() ? msgs->torrent->piece_count() : std::size(payload) * 8 };
-        msgs->have_.set_raw(reinterpret_cast<uint8_t const*>(std::data(payload)), std::size(payload));
-        msgs->publish(tr_peer_event::GotBitfield(&msgs->have_));
+        {
+            auto have = tr_bitfield{ msgs->torrent->has_metainfo() ? msgs->torrent->piece_count() : std::size(payload) * 8 };
+            have.set_raw(reinterpret_cast<uint8_t const*>(std::data(payload)), std::size(payload));
+            msgs->publish(tr_peer_event::GotBitfield(&have));
+            msgs->have_ = std::move(have);
+        }
         msgs->invalidatePercentDone();
         break;
 
@@ -1570,8 +1774,8 @@ ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader
 
         if (fext)
         {
-            msgs->have_.set_has_all();
             msgs->publish(tr_peer_event::GotHaveAll());
+            msgs->have_.set_has_all();
             msgs->invalidatePercentDone();
         }
         else
@@ -1587,8 +1791,8 @@ ReadResult process_peer_message(tr_peerMsgsImpl* msgs, uint8_t id, MessageReader
 
         if (fext)
         {
-            msgs->have_.set_has_none();
             msgs->publish(tr_peer_event::GotHaveNone());
+            msgs->have_.set_has_none();
             msgs->invalidatePercentDone();
         }
         else
@@ -1661,6 +1865,8 @@ int clientGotBlock(tr_peerMsgsImpl* msgs, std::unique_ptr<Cache::BlockData> bloc
         return 0;
     }
 
+    msgs->request_pipeline.on_block_received(block, tr_time_msec());
+
     auto const loc = msgs->torrent->block_loc(block);
     if (msgs->torrent->has_piece(loc.piece))
     {
@@ -1668,6 +1874,8 @@ int clientGotBlock(tr_peerMsgsImpl* msgs, std::unique_ptr<Cache::BlockData> bloc
         return 0;
     }
 
+    msgs->torrent->on_block_data(block, std::data(*block_data));
+
     // NB: if writeBlock() fails the torrent may be paused.
     // If this happens, `msgs` will be a dangling pointer and must no longer be used.
     if (auto const err = msgs->session->cache->write_block(tor->id(), block, std::move(block_data)); err != 0)
@@ -1828,9 +2036,10 @@ void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 
     TR_ASSERT(msgs->client_is_interested());
-    TR_ASSERT(!msgs->client_is_choked());
 
-    if (auto const requests = tr_peerMgrGetNextRequests(tor, msgs, n_wanted); !std::empty(requests))
+    // BEP 6: if the peer is choking us, we can only ask for Allowed Fast pieces
+    auto const allowed_fast_only = msgs->client_is_choked();
+    if (auto const requests = tr_peerMgrGetNextRequests(tor, msgs, n_wanted, allowed_fast_only); !std::empty(requests))
     {
         msgs->requestBlocks(std::data(requests), std::size(requests));
     }
@@ -1874,33 +2083,20 @@ namespace peer_pulse_helpers
         return {};
     }
 
-    auto const req = msgs->peer_requested_.front();
-    msgs->peer_requested_.erase(std::begin(msgs->peer_requested_));
-
-    auto buf = std::array<uint8_t, tr_block_info::BlockSize>{};
-    auto ok = msgs->isValidRequest(req) && msgs->torrent->has_piece(req.index);
+    startPieceReads(msgs);
 
-    if (ok)
+    // wait for the disk read to finish
+    if (auto const& read = msgs->peer_requested_.front().read; !read || !read->done)
     {
-        ok = msgs->torrent->ensure_piece_is_checked(req.index);
-
-        if (!ok)
-        {
-            msgs->torrent->error().set_local_error(
-                fmt::format(FMT_STRING("Please Verify Local Data! Piece #{:d} is corrupt."), req.index));
-        }
+        return {};
     }
 
-    if (ok)
-    {
-        ok = msgs->session->cache
-                 ->read_block(msgs->torrent, msgs->torrent->piece_loc(req.index, req.offset), req.length, std::data(buf)) == 0;
-    }
+    auto const req = msgs->peer_requested_.front();
+    msgs->peer_requested_.erase(std::begin(msgs->peer_requested_));
 
-    if (ok)
+    if (req.read->err == 0)
     {
-        auto const piece_data = std::string_view{ reinterpret_cast<char const*>(std::data(buf)), req.length };
-        return protocol_send_message(msgs, BtPeerMsgs::Piece, req.index, req.offset, piece_data);
+        return protocolSendPiece(msgs, req, std::move(req.read->buf));
     }
 
     if (msgs->io->supports_fext())
@@ -2120,6 +2316,109 @@ tr_peerMsgs::~tr_peerMsgs()
     TR_ASSERT(n_prev > 0U);
 }
 
+std::vector<tr_piece_index_t> tr_generateAllowedSet(
+    tr_address const& addr,
+    tr_sha1_digest_t const& info_hash,
+    tr_piece_index_t piece_count,
+    size_t set_size)
+{
+    auto pieces = std::vector<tr_piece_index_t>{};
+
+    if (!addr.is_ipv4() || piece_count == 0U)
+    {
+        return pieces;
+    }
+
+    set_size = std::min(set_size, size_t{ piece_count });
+    pieces.reserve(set_size);
+
+    // x = 0xFFFFFF00 & ip
+    auto ip = std::array<std::byte, 4>{};
+    std::copy_n(reinterpret_cast<std::byte const*>(&addr.addr.addr4.s_addr), std::size(ip), std::begin(ip));
+    ip[3] = std::byte{ 0 };
+
+    auto x = tr_sha1::digest(ip, info_hash);
+    for (;;)
+    {
+        for (size_t i = 0; i < std::size(x) / 4U; ++i)
+        {
+            auto y = uint32_t{};
+            std::memcpy(&y, std::data(x) + i * 4U, sizeof(y));
+            auto const piece = ntohl(y) % piece_count;
+
+            if (std::find(std::begin(pieces), std::end(pieces), piece) == std::end(pieces))
+            {
+                pieces.push_back(piece);
+            }
+
+            if (std::size(pieces) >= set_size)
+            {
+                return pieces;
+            }
+        }
+
+        x = tr_sha1::digest(x);
+    }
+}
+
+// ---
+
+void tr_request_pipeline::on_request_sent(tr_block_index_t block, uint64_t now_msec)
+{
+    // Forget requests that were never answered, e.g. because they were
+    // rejected or cancelled. They're long past being useful as samples.
+    static auto constexpr MaxAgeMsec = uint64_t{ 60000U };
+    static auto constexpr MaxTracked = size_t{ 4096U };
+    while (!std::empty(sent_) && (now_msec - sent_.front().when_msec > MaxAgeMsec || std::size(sent_) >= MaxTracked))
+    {
+        sent_.pop_front();
+    }
+
+    sent_.push_back({ block, now_msec, is_probing(now_msec) });
+}
+
+void tr_request_pipeline::on_block_received(tr_block_index_t block, uint64_t now_msec)
+{
+    auto const it = std::find_if(std::begin(sent_), std::end(sent_), [block](auto const& sent) { return sent.block == block; });
+    if (it == std::end(sent_))
+    {
+        return;
+    }
+
+    auto const sample_msec = std::max(now_msec - it->when_msec, uint64_t{ 1U });
+    if (!min_rtt_msec_ || sample_msec <= *min_rtt_msec_ || it->is_probe)
+    {
+        min_rtt_msec_ = sample_msec;
+        min_rtt_stamp_msec_ = now_msec;
+    }
+
+    sent_.erase(it);
+}
+
+size_t tr_request_pipeline::depth(tr_bytes_per_second_t rate_bytes_per_second, size_t max_depth, uint64_t now_msec)
+    const noexcept
+{
+    if (!min_rtt_msec_)
+    {
+        return std::min(InitialDepth, max_depth);
+    }
+
+    // let the pipeline drain so that the next request isn't waiting in line
+    if (is_probing(now_msec))
+    {
+        return std::min(MinDepth, max_depth);
+    }
+
+    if (rate_bytes_per_second == 0U)
+    {
+        return std::min(InitialDepth, max_depth);
+    }
+
+    auto const bdp_bytes = uint64_t{ rate_bytes_per_second } * *min_rtt_msec_ / 1000U;
+    auto const n_blocks = (Gain * bdp_bytes + tr_block_info::BlockSize - 1U) / tr_block_info::BlockSize;
+    return std::min(std::max(static_cast<size_t>(n_blocks), MinDepth), max_depth);
+}
+
 tr_peerMsgs* tr_peerMsgsNew(
     tr_torrent* const torrent,
     tr_peer_info* const peer_info,
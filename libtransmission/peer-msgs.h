@@ -12,13 +12,18 @@
 #include <array>
 #include <atomic>
 #include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <deque>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #include "libtransmission/transmission.h" // for tr_direction, tr_block_ind...
 
 #include "libtransmission/interned-string.h"
 #include "libtransmission/net.h" // tr_socket_address
 #include "libtransmission/peer-common.h" // for tr_peer
+#include "libtransmission/tr-macros.h" // for tr_sha1_digest_t
 
 class tr_peerIo;
 class tr_peerMsgs;
@@ -169,6 +174,71 @@ private:
     bool peer_is_interested_ = false;
 };
 
+// BEP 6: the pieces that a peer at `addr` may request even while we're choking it.
+// The BEP only defines this for IPv4, so it's empty for IPv6 peers.
+[[nodiscard]] std::vector<tr_piece_index_t> tr_generateAllowedSet(
+    tr_address const& addr,
+    tr_sha1_digest_t const& info_hash,
+    tr_piece_index_t piece_count,
+    size_t set_size);
+
+// Decides how many block requests to keep outstanding to a peer: enough to
+// cover the bandwidth-delay product, i.e. the peer's rate times the round
+// trip time, with headroom so that the rate has room to grow.
+//
+// The round trip time is the shortest time we've seen between sending a
+// request and getting its block. Once the pipeline fills up, requests wait
+// in line at the peer and those times get longer, so every so often the
+// pipeline is allowed to drain to measure the round trip time again.
+class tr_request_pipeline
+{
+public:
+    // used until we know the peer's rate and round trip time
+    static auto constexpr InitialDepth = size_t{ 32U };
+    static auto constexpr MinDepth = size_t{ 4U };
+
+    // how many times the bandwidth-delay product to keep requested
+    static auto constexpr Gain = size_t{ 2U };
+
+    // how long a round trip time measurement is trusted
+    static auto constexpr MinRttLifetimeMsec = uint64_t{ 10000U };
+
+    void on_request_sent(tr_block_index_t block, uint64_t now_msec);
+    void on_block_received(tr_block_index_t block, uint64_t now_msec);
+
+    // Forget the outstanding requests, e.g. because the peer choked us.
+    void on_requests_cleared() noexcept
+    {
+        sent_.clear();
+    }
+
+    [[nodiscard]] size_t depth(tr_bytes_per_second_t rate_bytes_per_second, size_t max_depth, uint64_t now_msec) const noexcept;
+
+    [[nodiscard]] constexpr auto min_rtt_msec() const noexcept
+    {
+        return min_rtt_msec_;
+    }
+
+private:
+    [[nodiscard]] constexpr bool is_probing(uint64_t now_msec) const noexcept
+    {
+        return min_rtt_msec_ && now_msec - min_rtt_stamp_msec_ > MinRttLifetimeMsec;
+    }
+
+    struct Sent
+    {
+        tr_block_index_t block;
+        uint64_t when_msec;
+        bool is_probe; // sent while the pipeline was drained to measure the RTT
+    };
+
+    // outstanding requests, oldest first
+    std::deque<Sent> sent_;
+
+    std::optional<uint64_t> min_rtt_msec_;
+    uint64_t min_rtt_stamp_msec_ = {};
+};
+
 tr_peerMsgs* tr_peerMsgsNew(
     tr_torrent* torrent,
     tr_peer_info* peer_info,
@@ -3,6 +3,16 @@
 // or any future license endorsed by Mnemosyne LLC.
 // License text can be found in the licenses/ folder.
 
+#include <algorithm> // for std::min
+#include <array>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h> // for sendmsg()
+#include <sys/uio.h> // for struct iovec
+#endif
+
 #include <fmt/core.h>
 
 #include <libutp/utp.h>
@@ -105,6 +115,51 @@ size_t tr_peer_socket::try_write(OutBuf& buf, size_t max, tr_error** error) cons
     return {};
 }
 
+size_t tr_peer_socket::try_write(ConstSpan const* spans, size_t n_spans, tr_error** error) const
+{
+    TR_ASSERT(is_tcp());
+
+    n_spans = std::min(n_spans, MaxWriteSpans);
+    if (n_spans == 0U || !is_tcp())
+    {
+        return {};
+    }
+
+#ifdef _WIN32
+    auto bufs = std::array<WSABUF, MaxWriteSpans>{};
+    for (size_t i = 0; i < n_spans; ++i)
+    {
+        bufs[i].buf = reinterpret_cast<CHAR*>(const_cast<std::byte*>(spans[i].first));
+        bufs[i].len = static_cast<ULONG>(spans[i].second);
+    }
+
+    auto n_sent = DWORD{};
+    if (WSASend(handle.tcp, std::data(bufs), static_cast<DWORD>(n_spans), &n_sent, 0, nullptr, nullptr) == 0)
+    {
+        return n_sent;
+    }
+#else
+    auto iov = std::array<iovec, MaxWriteSpans>{};
+    for (size_t i = 0; i < n_spans; ++i)
+    {
+        iov[i].iov_base = const_cast<std::byte*>(spans[i].first);
+        iov[i].iov_len = spans[i].second;
+    }
+
+    auto msg = msghdr{};
+    msg.msg_iov = std::data(iov);
+    msg.msg_iovlen = n_spans;
+    if (auto const n_sent = sendmsg(handle.tcp, &msg, 0); n_sent >= 0)
+    {
+        return static_cast<size_t>(n_sent);
+    }
+#endif
+
+    auto const err = sockerrno;
+    tr_error_set(error, err, tr_net_strerror(err));
+    return {};
+}
+
 size_t tr_peer_socket::try_read(InBuf& buf, size_t max, [[maybe_unused]] bool buf_is_empty, tr_error** error) const
 {
     if (max == size_t{})
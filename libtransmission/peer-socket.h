@@ -30,6 +30,11 @@ class tr_peer_socket
 public:
     using InBuf = libtransmission::BufferWriter<std::byte>;
     using OutBuf = libtransmission::BufferReader<std::byte>;
+    using ConstSpan = std::pair<std::byte const*, size_t>;
+
+    // The most spans that try_write() will write at once.
+    // This is POSIX's minimum for IOV_MAX.
+    static auto constexpr MaxWriteSpans = size_t{ 16U };
 
     tr_peer_socket() = default;
     tr_peer_socket(tr_session const* session, tr_socket_address const& socket_address, tr_socket_t sock);
@@ -60,6 +65,10 @@ public:
     size_t try_read(InBuf& buf, size_t max, bool buf_is_empty, tr_error** error) const;
     size_t try_write(OutBuf& buf, size_t max, tr_error** error) const;
 
+    // Write from several buffers at once, e.g. a message header and the
+    // block that it carries. Only TCP sockets support this.
+    size_t try_write(ConstSpan const* spans, size_t n_spans, tr_error** error) const;
+
     [[nodiscard]] constexpr auto const& socket_address() const noexcept
     {
         return socket_address_;
@@ -0,0 +1,172 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <cstdint> // uint8_t, uint64_t
+#include <memory>
+#include <optional>
+
+#include "libtransmission/transmission.h"
+
+#include "libtransmission/block-info.h"
+#include "libtransmission/piece-hasher.h"
+#include "libtransmission/tr-assert.h"
+
+void tr_piece_hasher::add_block(tr_block_index_t block, uint8_t const* data)
+{
+    auto const& block_info = mediator_.block_info();
+    TR_ASSERT(block < block_info.block_count());
+
+    // a block can straddle pieces if the piece size isn't a multiple of the block size
+    auto const loc = block_info.block_loc(block);
+    auto const last_piece = block_info.byte_loc(loc.byte + block_info.block_size(block) - 1).piece;
+    for (auto piece = loc.piece; piece <= last_piece; ++piece)
+    {
+        auto [iter, is_new] = pieces_.try_emplace(piece);
+        if (is_new)
+        {
+            iter->second.next_block = block_info.block_span_for_piece(piece).begin;
+            iter->second.id = next_id_++;
+        }
+        else if (block < iter->second.next_block)
+        {
+            // we've already hashed a different copy of this block,
+            // so there's no telling which one will be on disk.
+            pieces_.erase(iter);
+            continue;
+        }
+
+        if (!advance(piece, iter->second, block, data))
+        {
+            pieces_.erase(iter);
+        }
+    }
+}
+
+bool tr_piece_hasher::advance(tr_piece_index_t piece, PartialHash& partial, tr_block_index_t block, uint8_t const* data)
+{
+    auto const end_block = mediator_.block_info().block_span_for_piece(piece).end;
+
+    for (; partial.next_block < end_block && !partial.is_reading; ++partial.next_block)
+    {
+        auto const next = partial.next_block;
+
+        if (next == block)
+        {
+            hash_block(piece, partial, next, data);
+        }
+        else if (mediator_.has_block(next))
+        {
+            // If the block is in memory, the mediator hands it back before
+            // returning and we keep going. Otherwise it's read from disk in
+            // a worker thread, and on_block_read() picks up from there.
+            enum class Result
+            {
+                Pending,
+                Hashed,
+                Failed
+            };
+            auto result = Result::Pending;
+            auto const returned = std::make_shared<bool>(false);
+            mediator_.read_block(
+                next,
+                [this, &partial, &result, returned, piece, id = partial.id, next](uint8_t const* buf)
+                {
+                    if (*returned)
+                    {
+                        on_block_read(piece, id, next, buf);
+                    }
+                    else if (buf != nullptr)
+                    {
+                        hash_block(piece, partial, next, buf);
+                        result = Result::Hashed;
+                    }
+                    else
+                    {
+                        result = Result::Failed;
+                    }
+                });
+            *returned = true;
+
+            if (result == Result::Failed)
+            {
+                return false;
+            }
+
+            if (result == Result::Pending)
+            {
+                partial.is_reading = true;
+                return true;
+            }
+        }
+        else // wait for the gap to be filled
+        {
+            break;
+        }
+    }
+
+    return true;
+}
+
+void tr_piece_hasher::on_block_read(tr_piece_index_t piece, uint64_t id, tr_block_index_t block, uint8_t const* data)
+{
+    // the piece may have been finished or forgotten during the read
+    auto const iter = pieces_.find(piece);
+    if (iter == std::end(pieces_) || iter->second.id != id)
+    {
+        return;
+    }
+
+    auto& partial = iter->second;
+    TR_ASSERT(partial.is_reading);
+    TR_ASSERT(partial.next_block == block);
+    partial.is_reading = false;
+
+    if (data == nullptr || !advance(piece, partial, block, data))
+    {
+        pieces_.erase(iter);
+    }
+}
+
+void tr_piece_hasher::hash_block(tr_piece_index_t piece, PartialHash& partial, tr_block_index_t block, uint8_t const* data)
+    const
+{
+    auto const& block_info = mediator_.block_info();
+    auto const [begin_byte, end_byte] = block_info.byte_span_for_piece(piece);
+    auto const block_byte = block_info.block_loc(block).byte;
+    auto const block_len = block_info.block_size(block);
+
+    auto const* begin = data;
+    auto const* end = data + block_len;
+
+    // handle edge case where blocks aren't on piece boundaries:
+    if (block_byte < begin_byte) // `block` may begin before `piece` does
+    {
+        begin += begin_byte - block_byte;
+    }
+    if (block_byte + block_len > end_byte) // `block` may end after `piece` does
+    {
+        end -= block_byte + block_len - end_byte;
+    }
+
+    partial.sha->add(begin, end - begin);
+}
+
+std::optional<tr_sha1_digest_t> tr_piece_hasher::finish(tr_piece_index_t piece)
+{
+    auto const iter = pieces_.find(piece);
+    if (iter == std::end(pieces_))
+    {
+        return {};
+    }
+
+    auto ret = std::optional<tr_sha1_digest_t>{};
+    if (auto& partial = iter->second; partial.next_block == mediator_.block_info().block_span_for_piece(piece).end)
+    {
+        ret = partial.sha->finish();
+    }
+
+    pieces_.erase(iter);
+    return ret;
+}
@@ -0,0 +1,105 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint64_t
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+
+#include "libtransmission/transmission.h"
+
+#include "libtransmission/block-info.h"
+#include "libtransmission/crypto-utils.h"
+#include "libtransmission/tr-macros.h" // tr_sha1_digest_t
+
+/**
+ * Hashes pieces while they're being downloaded, so that checking a
+ * finished piece doesn't mean reading all of it back from the cache or disk.
+ *
+ * A block is hashed as soon as every block before it in its piece has
+ * been hashed. Blocks that arrived out of order are read back via the
+ * mediator once the gap in front of them is filled; while such a read is
+ * in flight, hashing that piece waits for it.
+ */
+class tr_piece_hasher
+{
+public:
+    struct Mediator
+    {
+        [[nodiscard]] virtual tr_block_info const& block_info() const = 0;
+        [[nodiscard]] virtual bool has_block(tr_block_index_t block) const = 0;
+
+        // Read a block that has_block() says we have, then call `on_done`
+        // with its data, or with nullptr on failure. This may happen before
+        // returning, e.g. if the block is in memory. `on_done` must not be
+        // called if the tr_piece_hasher has been destroyed in the meantime.
+        virtual void read_block(tr_block_index_t block, std::function<void(uint8_t const* data)>&& on_done) = 0;
+
+        virtual ~Mediator() = default;
+    };
+
+    explicit tr_piece_hasher(Mediator& mediator)
+        : mediator_{ mediator }
+    {
+    }
+
+    // Call this when a new block arrives, while has_block(block) is still false.
+    void add_block(tr_block_index_t block, uint8_t const* data);
+
+    // @return the piece's digest if every byte of it was hashed, or nullopt if not.
+    // Either way, the piece is forgotten afterwards.
+    [[nodiscard]] std::optional<tr_sha1_digest_t> finish(tr_piece_index_t piece);
+
+    // Forget about a piece, e.g. because some of its blocks are being thrown away.
+    void erase(tr_piece_index_t piece)
+    {
+        pieces_.erase(piece);
+    }
+
+    void clear()
+    {
+        pieces_.clear();
+    }
+
+    // @return how many pieces are partially hashed
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return std::size(pieces_);
+    }
+
+private:
+    struct PartialHash
+    {
+        std::unique_ptr<tr_sha1> sha = tr_sha1::create();
+        tr_block_index_t next_block = {};
+
+        // tells this hash apart from an earlier one of the same piece
+        uint64_t id = {};
+
+        // true while next_block is being read back
+        bool is_reading = false;
+    };
+
+    // @return false if the piece's hash can't be continued
+    [[nodiscard]] bool advance(tr_piece_index_t piece, PartialHash& partial, tr_block_index_t block, uint8_t const* data);
+
+    void on_block_read(tr_piece_index_t piece, uint64_t id, tr_block_index_t block, uint8_t const* data);
+
+    void hash_block(tr_piece_index_t piece, PartialHash& partial, tr_block_index_t block, uint8_t const* data) const;
+
+    Mediator& mediator_;
+
+    std::map<tr_piece_index_t, PartialHash> pieces_;
+
+    uint64_t next_id_ = {};
+};
@@ -16,7 +16,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
+auto constexpr MyStatic = std::array<std::string_view, 432>{ ""sv,
                                                              "activeTorrentCount"sv,
                                                              "activity-date"sv,
                                                              "activityDate"sv,
@@ -43,6 +43,8 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "anti-brute-force-threshold"sv,
                                                              "arguments"sv,
                                                              "availability"sv,
+                                                             "backlog-down"sv,
+                                                             "backlog-up"sv,
                                                              "bandwidth-priority"sv,
                                                              "bandwidthPriority"sv,
                                                              "beginPiece"sv,
@@ -55,8 +57,12 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "blocklist-updates-enabled"sv,
                                                              "blocklist-url"sv,
                                                              "blocks"sv,
+                                                             "blocksInUse"sv,
                                                              "bytesCompleted"sv,
+                                                             "bytesIdle"sv,
+                                                             "bytesInUse"sv,
                                                              "cache-size-mb"sv,
+                                                             "cache-stats"sv,
                                                              "clientIsChoked"sv,
                                                              "clientIsInterested"sv,
                                                              "clientName"sv,
@@ -83,6 +89,7 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "details-window-height"sv,
                                                              "details-window-width"sv,
                                                              "dht-enabled"sv,
+                                                             "disk-io-threads"sv,
                                                              "dnd"sv,
                                                              "done-date"sv,
                                                              "doneDate"sv,
@@ -92,6 +99,7 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "download-queue-size"sv,
                                                              "downloadCount"sv,
                                                              "downloadDir"sv,
+                                                             "downloadGuarantee"sv,
                                                              "downloadLimit"sv,
                                                              "downloadLimited"sv,
                                                              "downloadSpeed"sv,
@@ -112,6 +120,7 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "errorString"sv,
                                                              "eta"sv,
                                                              "etaIdle"sv,
+                                                             "expires-at"sv,
                                                              "fields"sv,
                                                              "file-count"sv,
                                                              "fileStats"sv,
@@ -135,6 +144,9 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "fromPex"sv,
                                                              "fromTracker"sv,
                                                              "group"sv,
+                                                             "guaranteed-speed-down"sv,
+                                                             "guaranteed-speed-up"sv,
+                                                             "handshake-threads"sv,
                                                              "hasAnnounced"sv,
                                                              "hasScraped"sv,
                                                              "hashString"sv,
@@ -143,6 +155,10 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "haveValid"sv,
                                                              "honorsSessionLimits"sv,
                                                              "host"sv,
+                                                             "hostInFlight"sv,
+                                                             "hostLatency"sv,
+                                                             "hostMaxInFlight"sv,
+                                                             "hostQueueDepth"sv,
                                                              "id"sv,
                                                              "idle-limit"sv,
                                                              "idle-mode"sv,
@@ -154,6 +170,7 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "incomplete-dir-enabled"sv,
                                                              "info"sv,
                                                              "inhibit-desktop-hibernation"sv,
+                                                             "io-uring-enabled"sv,
                                                              "ipv4"sv,
                                                              "ipv6"sv,
                                                              "isBackup"sv,
@@ -216,6 +233,8 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "path.utf-8"sv,
                                                              "paused"sv,
                                                              "pausedTorrentCount"sv,
+                                                             "peakBytesInUse"sv,
+                                                             "peer-buffer-stats"sv,
                                                              "peer-congestion-algorithm"sv,
                                                              "peer-limit"sv,
                                                              "peer-limit-global"sv,
@@ -239,6 +258,7 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "pex-enabled"sv,
                                                              "piece"sv,
                                                              "piece length"sv,
+                                                             "piece-selection"sv,
                                                              "pieceCount"sv,
                                                              "pieceSize"sv,
                                                              "pieces"sv,
@@ -273,6 +293,9 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "ratio-limit-enabled"sv,
                                                              "ratio-mode"sv,
                                                              "read-clipboard"sv,
+                                                             "readCacheBytes"sv,
+                                                             "readHits"sv,
+                                                             "readMisses"sv,
                                                              "recent-download-dir-1"sv,
                                                              "recent-download-dir-2"sv,
                                                              "recent-download-dir-3"sv,
@@ -393,7 +416,9 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "trash-original-torrent-files"sv,
                                                              "umask"sv,
                                                              "units"sv,
+                                                             "upload-slots-global"sv,
                                                              "upload-slots-per-torrent"sv,
+                                                             "uploadGuarantee"sv,
                                                              "uploadLimit"sv,
                                                              "uploadLimited"sv,
                                                              "uploadRatio"sv,
@@ -414,12 +439,14 @@ auto constexpr MyStatic = std::array<std::string_view, 405>{ ""sv,
                                                              "ut_recommend"sv,
                                                              "utp-enabled"sv,
                                                              "v"sv,
+                                                             "verify-threads"sv,
                                                              "version"sv,
                                                              "wanted"sv,
                                                              "watch-dir"sv,
                                                              "watch-dir-enabled"sv,
                                                              "webseeds"sv,
                                                              "webseedsSendingToUs"sv,
+                                                             "weight"sv,
                                                              "yourip"sv };
 
 bool constexpr quarks_are_sorted()
@@ -48,6 +48,8 @@ enum
     TR_KEY_anti_brute_force_threshold, /* rpc */
     TR_KEY_arguments, /* rpc */
     TR_KEY_availability, // rpc
+    TR_KEY_backlog_down,
+    TR_KEY_backlog_up,
     TR_KEY_bandwidth_priority,
     TR_KEY_bandwidthPriority,
     TR_KEY_beginPiece,
@@ -60,8 +62,12 @@ enum
     TR_KEY_blocklist_updates_enabled,
     TR_KEY_blocklist_url,
     TR_KEY_blocks,
+    TR_KEY_blocksInUse,
     TR_KEY_bytesCompleted,
+    TR_KEY_bytesIdle,
+    TR_KEY_bytesInUse,
     TR_KEY_cache_size_mb,
+    TR_KEY_cache_stats,
     TR_KEY_clientIsChoked,
     TR_KEY_clientIsInterested,
     TR_KEY_clientName,
@@ -88,6 +94,7 @@ enum
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
     TR_KEY_dht_enabled,
+    TR_KEY_disk_io_threads,
     TR_KEY_dnd,
     TR_KEY_done_date,
     TR_KEY_doneDate,
@@ -97,6 +104,7 @@ enum
     TR_KEY_download_queue_size,
     TR_KEY_downloadCount,
     TR_KEY_downloadDir,
+    TR_KEY_downloadGuarantee,
     TR_KEY_downloadLimit,
     TR_KEY_downloadLimited,
     TR_KEY_downloadSpeed,
@@ -117,6 +125,7 @@ enum
     TR_KEY_errorString,
     TR_KEY_eta,
     TR_KEY_etaIdle,
+    TR_KEY_expires_at,
     TR_KEY_fields,
     TR_KEY_file_count,
     TR_KEY_fileStats,
@@ -140,6 +149,9 @@ enum
     TR_KEY_fromPex,
     TR_KEY_fromTracker,
     TR_KEY_group,
+    TR_KEY_guaranteed_speed_down,
+    TR_KEY_guaranteed_speed_up,
+    TR_KEY_handshake_threads,
     TR_KEY_hasAnnounced,
     TR_KEY_hasScraped,
     TR_KEY_hashString,
@@ -148,6 +160,10 @@ enum
     TR_KEY_haveValid,
     TR_KEY_honorsSessionLimits,
     TR_KEY_host,
+    TR_KEY_hostInFlight,
+    TR_KEY_hostLatency,
+    TR_KEY_hostMaxInFlight,
+    TR_KEY_hostQueueDepth,
     TR_KEY_id,
     TR_KEY_idle_limit,
     TR_KEY_idle_mode,
@@ -159,6 +175,7 @@ enum
     TR_KEY_incomplete_dir_enabled,
     TR_KEY_info,
     TR_KEY_inhibit_desktop_hibernation,
+    TR_KEY_io_uring_enabled,
     TR_KEY_ipv4,
     TR_KEY_ipv6,
     TR_KEY_isBackup,
@@ -221,6 +238,8 @@ enum
     TR_KEY_path_utf_8,
     TR_KEY_paused,
     TR_KEY_pausedTorrentCount,
+    TR_KEY_peakBytesInUse,
+    TR_KEY_peer_buffer_stats,
     TR_KEY_peer_congestion_algorithm,
     TR_KEY_peer_limit,
     TR_KEY_peer_limit_global,
@@ -244,6 +263,7 @@ enum
     TR_KEY_pex_enabled,
     TR_KEY_piece,
     TR_KEY_piece_length,
+    TR_KEY_piece_selection,
     TR_KEY_pieceCount,
     TR_KEY_pieceSize,
     TR_KEY_pieces,
@@ -278,6 +298,9 @@ enum
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
     TR_KEY_read_clipboard,
+    TR_KEY_readCacheBytes,
+    TR_KEY_readHits,
+    TR_KEY_readMisses,
     TR_KEY_recent_download_dir_1,
     TR_KEY_recent_download_dir_2,
     TR_KEY_recent_download_dir_3,
@@ -398,7 +421,9 @@ enum
     TR_KEY_trash_original_torrent_files,
     TR_KEY_umask,
     TR_KEY_units,
+    TR_KEY_upload_slots_global,
     TR_KEY_upload_slots_per_torrent,
+    TR_KEY_uploadGuarantee,
     TR_KEY_uploadLimit,
     TR_KEY_uploadLimited,
     TR_KEY_uploadRatio,
@@ -419,12 +444,14 @@ enum
     TR_KEY_ut_recommend,
     TR_KEY_utp_enabled,
     TR_KEY_v,
+    TR_KEY_verify_threads,
     TR_KEY_version,
     TR_KEY_wanted,
     TR_KEY_watch_dir,
     TR_KEY_watch_dir_enabled,
     TR_KEY_webseeds,
     TR_KEY_webseedsSendingToUs,
+    TR_KEY_weight,
     TR_KEY_yourip,
     TR_N_KEYS
 };
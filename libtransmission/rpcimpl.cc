@@ -24,6 +24,7 @@
 #include "libtransmission/transmission.h"
 
 #include "libtransmission/announcer.h"
+#include "libtransmission/cache.h"
 #include "libtransmission/crypto-utils.h"
 #include "libtransmission/error.h"
 #include "libtransmission/file.h"
@@ -427,13 +428,17 @@ namespace make_torrent_field_helpers
     for (size_t idx = 0U; idx != n_trackers; ++idx)
     {
         auto const tracker = tr_torrentTracker(&tor, idx);
-        auto stats_map = tr_variant::Map{ 27U };
+        auto stats_map = tr_variant::Map{ 31U };
         stats_map.try_emplace(TR_KEY_announce, tracker.announce);
         stats_map.try_emplace(TR_KEY_announceState, tracker.announceState);
         stats_map.try_emplace(TR_KEY_downloadCount, tracker.downloadCount);
         stats_map.try_emplace(TR_KEY_hasAnnounced, tracker.hasAnnounced);
         stats_map.try_emplace(TR_KEY_hasScraped, tracker.hasScraped);
         stats_map.try_emplace(TR_KEY_host, tracker.host_and_port);
+        stats_map.try_emplace(TR_KEY_hostInFlight, tracker.hostInFlight);
+        stats_map.try_emplace(TR_KEY_hostLatency, tracker.hostLatency);
+        stats_map.try_emplace(TR_KEY_hostMaxInFlight, tracker.hostMaxInFlight);
+        stats_map.try_emplace(TR_KEY_hostQueueDepth, tracker.hostQueueDepth);
         stats_map.try_emplace(TR_KEY_id, tracker.id);
         stats_map.try_emplace(TR_KEY_isBackup, tracker.isBackup);
         stats_map.try_emplace(TR_KEY_lastAnnouncePeerCount, tracker.lastAnnouncePeerCount);
@@ -1588,14 +1593,28 @@ char const* groupGet(tr_session* s, tr_variant* args_in, tr_variant* args_out, s
     {
         if (names.empty() || names.count(name.sv()) > 0)
         {
-            tr_variant* dict = tr_variantListAddDict(list, 5);
+            tr_variant* dict = tr_variantListAddDict(list, 14);
             auto limits = group->get_limits();
+            auto const now = tr_time_msec();
+            tr_variantDictAddInt(dict, TR_KEY_backlog_down, group->backlog(TR_DOWN));
+            tr_variantDictAddInt(dict, TR_KEY_backlog_up, group->backlog(TR_UP));
+            tr_variantDictAddInt(
+                dict,
+                TR_KEY_guaranteed_speed_down,
+                tr_toSpeedKBps(group->get_guaranteed_speed_bytes_per_second(TR_DOWN)));
+            tr_variantDictAddInt(
+                dict,
+                TR_KEY_guaranteed_speed_up,
+                tr_toSpeedKBps(group->get_guaranteed_speed_bytes_per_second(TR_UP)));
             tr_variantDictAddBool(dict, TR_KEY_honorsSessionLimits, group->are_parent_limits_honored(TR_UP));
             tr_variantDictAddStr(dict, TR_KEY_name, name);
+            tr_variantDictAddInt(dict, TR_KEY_rateDownload, group->get_piece_speed_bytes_per_second(now, TR_DOWN));
+            tr_variantDictAddInt(dict, TR_KEY_rateUpload, group->get_piece_speed_bytes_per_second(now, TR_UP));
             tr_variantDictAddInt(dict, TR_KEY_speed_limit_down, limits.down_limit_KBps);
             tr_variantDictAddBool(dict, TR_KEY_speed_limit_down_enabled, limits.down_limited);
             tr_variantDictAddInt(dict, TR_KEY_speed_limit_up, limits.up_limit_KBps);
             tr_variantDictAddBool(dict, TR_KEY_speed_limit_up_enabled, limits.up_limited);
+            tr_variantDictAddInt(dict, TR_KEY_weight, group->weight());
         }
     }
 
@@ -1612,6 +1631,23 @@ char const* groupSet(tr_session* session, tr_variant* args_in, tr_variant* /*arg
         return "No group name given";
     }
 
+    // validate everything before changing anything
+    auto weight = int64_t{};
+    auto const has_weight = tr_variantDictFindInt(args_in, TR_KEY_weight, &weight);
+    if (has_weight && (weight < 1 || weight > int64_t{ tr_bandwidth::MaxWeight }))
+    {
+        return "weight must be between 1 and 1000";
+    }
+
+    auto guaranteed_down = int64_t{};
+    auto const has_guaranteed_down = tr_variantDictFindInt(args_in, TR_KEY_guaranteed_speed_down, &guaranteed_down);
+    auto guaranteed_up = int64_t{};
+    auto const has_guaranteed_up = tr_variantDictFindInt(args_in, TR_KEY_guaranteed_speed_up, &guaranteed_up);
+    if ((has_guaranteed_down && guaranteed_down < 0) || (has_guaranteed_up && guaranteed_up < 0))
+    {
+        return "guaranteed speed must not be negative";
+    }
+
     auto& group = session->getBandwidthGroup(name);
     auto limits = group.get_limits();
 
@@ -1636,6 +1672,23 @@ char const* groupSet(tr_session* session, tr_variant* args_in, tr_variant* /*arg
         group.honor_parent_limits(TR_DOWN, honors);
     }
 
+    if (has_weight)
+    {
+        group.set_weight(static_cast<unsigned int>(weight));
+    }
+
+    if (has_guaranteed_down)
+    {
+        group.set_guaranteed_speed_bytes_per_second(
+            TR_DOWN,
+            tr_toSpeedBytes(static_cast<tr_kilobytes_per_second_t>(guaranteed_down)));
+    }
+
+    if (has_guaranteed_up)
+    {
+        group.set_guaranteed_speed_bytes_per_second(TR_UP, tr_toSpeedBytes(static_cast<tr_kilobytes_per_second_t>(guaranteed_up)));
+    }
+
     return nullptr;
 }
 
@@ -1935,6 +1988,19 @@ char const* sessionStats(tr_session* session, tr_variant* /*args_in*/, tr_varian
     tr_variantDictAddInt(d, TR_KEY_sessionCount, stats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, stats.uploadedBytes);
 
+    auto const& cache = *session->cache;
+    d = tr_variantDictAddDict(args_out, TR_KEY_cache_stats, 3);
+    tr_variantDictAddInt(d, TR_KEY_readCacheBytes, cache.read_cache_bytes());
+    tr_variantDictAddInt(d, TR_KEY_readHits, cache.read_hits());
+    tr_variantDictAddInt(d, TR_KEY_readMisses, cache.read_misses());
+
+    auto const& pool_stats = session->peer_buffer_pool().stats();
+    d = tr_variantDictAddDict(args_out, TR_KEY_peer_buffer_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_blocksInUse, pool_stats.blocks_in_use);
+    tr_variantDictAddInt(d, TR_KEY_bytesInUse, pool_stats.bytes_in_use);
+    tr_variantDictAddInt(d, TR_KEY_bytesIdle, pool_stats.bytes_idle);
+    tr_variantDictAddInt(d, TR_KEY_peakBytesInUse, pool_stats.peak_bytes_in_use);
+
     return nullptr;
 }
 
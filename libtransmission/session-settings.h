@@ -27,14 +27,17 @@ struct tr_variant;
     V(TR_KEY_cache_size_mb, cache_size_mb, size_t, 4U, "") \
     V(TR_KEY_default_trackers, default_trackers_str, std::string, "", "") \
     V(TR_KEY_dht_enabled, dht_enabled, bool, true, "") \
+    V(TR_KEY_disk_io_threads, disk_io_threads, size_t, 2U, "") \
     V(TR_KEY_download_dir, download_dir, std::string, tr_getDefaultDownloadDir(), "") \
     V(TR_KEY_download_queue_enabled, download_queue_enabled, bool, true, "") \
     V(TR_KEY_download_queue_size, download_queue_size, size_t, 5U, "") \
     V(TR_KEY_encryption, encryption_mode, tr_encryption_mode, TR_ENCRYPTION_PREFERRED, "") \
+    V(TR_KEY_handshake_threads, handshake_threads, size_t, 1U, "") \
     V(TR_KEY_idle_seeding_limit, idle_seeding_limit_minutes, size_t, 30U, "") \
     V(TR_KEY_idle_seeding_limit_enabled, idle_seeding_limit_enabled, bool, false, "") \
     V(TR_KEY_incomplete_dir, incomplete_dir, std::string, tr_getDefaultDownloadDir(), "") \
     V(TR_KEY_incomplete_dir_enabled, incomplete_dir_enabled, bool, false, "") \
+    V(TR_KEY_io_uring_enabled, io_uring_enabled, bool, false, "") \
     V(TR_KEY_lpd_enabled, lpd_enabled, bool, true, "") \
     V(TR_KEY_message_level, log_level, tr_log_level, TR_LOG_INFO, "") \
     V(TR_KEY_peer_congestion_algorithm, peer_congestion_algorithm, std::string, "", "") \
@@ -50,6 +53,7 @@ struct tr_variant;
     V(TR_KEY_peer_port_random_on_start, peer_port_random_on_start, bool, false, "") \
     V(TR_KEY_peer_socket_tos, peer_socket_tos, tr_tos_t, 0x04, "") \
     V(TR_KEY_pex_enabled, pex_enabled, bool, true, "") \
+    V(TR_KEY_piece_selection, piece_selection, tr_piece_selection, TR_PIECE_SELECTION_RAREST_FIRST, "") \
     V(TR_KEY_port_forwarding_enabled, port_forwarding_enabled, bool, true, "") \
     V(TR_KEY_preallocation, preallocation_mode, tr_preallocation_mode, TR_PREALLOCATE_SPARSE, "") \
     V(TR_KEY_prefetch_enabled, is_prefetch_enabled, bool, true, "") \
@@ -75,8 +79,10 @@ struct tr_variant;
     V(TR_KEY_tcp_enabled, tcp_enabled, bool, true, "") \
     V(TR_KEY_trash_original_torrent_files, should_delete_source_torrents, bool, false, "") \
     V(TR_KEY_umask, umask, tr_mode_t, 022, "") \
+    V(TR_KEY_upload_slots_global, upload_slots_global, size_t, 0U, "") \
     V(TR_KEY_upload_slots_per_torrent, upload_slots_per_torrent, size_t, 8U, "") \
     V(TR_KEY_utp_enabled, utp_enabled, bool, true, "") \
+    V(TR_KEY_verify_threads, verify_threads, size_t, 2U, "") \
     V(TR_KEY_preferred_transport, preferred_transport, tr_preferred_transport, TR_PREFER_UTP, "") \
     V(TR_KEY_torrent_added_verify_mode, torrent_added_verify_mode, tr_verify_added_mode, TR_VERIFY_ADDED_FAST, "")
 
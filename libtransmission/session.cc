@@ -126,6 +126,21 @@ void bandwidthGroupRead(tr_session* session, std::string_view config_dir)
             group.honor_parent_limits(TR_UP, *val);
             group.honor_parent_limits(TR_DOWN, *val);
         }
+
+        if (auto const* val = group_map->find_if<int64_t>(TR_KEY_weight); val != nullptr && *val > 0)
+        {
+            group.set_weight(static_cast<unsigned int>(std::min(*val, int64_t{ tr_bandwidth::MaxWeight })));
+        }
+
+        if (auto const* val = group_map->find_if<int64_t>(TR_KEY_uploadGuarantee); val != nullptr && *val >= 0)
+        {
+            group.set_guaranteed_speed_bytes_per_second(TR_UP, tr_toSpeedBytes(static_cast<tr_kilobytes_per_second_t>(*val)));
+        }
+
+        if (auto const* val = group_map->find_if<int64_t>(TR_KEY_downloadGuarantee); val != nullptr && *val >= 0)
+        {
+            group.set_guaranteed_speed_bytes_per_second(TR_DOWN, tr_toSpeedBytes(static_cast<tr_kilobytes_per_second_t>(*val)));
+        }
     }
 }
 
@@ -136,13 +151,16 @@ void bandwidthGroupWrite(tr_session const* session, std::string_view config_dir)
     for (auto const& [name, group] : groups)
     {
         auto const limits = group->get_limits();
-        auto group_map = tr_variant::Map{ 6U };
+        auto group_map = tr_variant::Map{ 9U };
+        group_map.try_emplace(TR_KEY_downloadGuarantee, tr_toSpeedKBps(group->get_guaranteed_speed_bytes_per_second(TR_DOWN)));
         group_map.try_emplace(TR_KEY_downloadLimit, limits.down_limit_KBps);
         group_map.try_emplace(TR_KEY_downloadLimited, limits.down_limited);
         group_map.try_emplace(TR_KEY_honorsSessionLimits, group->are_parent_limits_honored(TR_UP));
         group_map.try_emplace(TR_KEY_name, name.sv());
+        group_map.try_emplace(TR_KEY_uploadGuarantee, tr_toSpeedKBps(group->get_guaranteed_speed_bytes_per_second(TR_UP)));
         group_map.try_emplace(TR_KEY_uploadLimit, limits.up_limit_KBps);
         group_map.try_emplace(TR_KEY_uploadLimited, limits.up_limited);
+        group_map.try_emplace(TR_KEY_weight, group->weight());
         groups_map.try_emplace(name.quark(), std::move(group_map));
     }
 
@@ -584,6 +602,7 @@ void tr_session::onNowTimer()
     // tr_session upkeep tasks to perform once per second
     tr_timeUpdate(std::chrono::system_clock::to_time_t(now));
     alt_speeds_.check_scheduler();
+    peer_buffer_pool_.trim();
 
     // set the timer to kick again right after (10ms after) the next second
     auto const target_time = std::chrono::time_point_cast<std::chrono::seconds>(now) + 1s + 10ms;
@@ -663,6 +682,29 @@ void tr_session::setSettings(tr_session_settings&& settings_in, bool force)
         tr_sessionSetCacheLimit_MB(this, val);
     }
 
+    if (auto const& val = new_settings.disk_io_threads; force || val != old_settings.disk_io_threads)
+    {
+        disk_io_.set_thread_count(val);
+    }
+
+    if (auto const& val = new_settings.handshake_threads; force || val != old_settings.handshake_threads)
+    {
+        handshake_worker_.set_thread_count(val);
+    }
+
+    if (auto const& val = new_settings.verify_threads; force || val != old_settings.verify_threads)
+    {
+        verifier_->set_hash_thread_count(val);
+    }
+
+    if (auto const& val = new_settings.io_uring_enabled; force || val != old_settings.io_uring_enabled)
+    {
+        if (!tr_sys_file_io_set_backend(val ? TR_SYS_FILE_IO_BACKEND_IO_URING : TR_SYS_FILE_IO_BACKEND_SYNC))
+        {
+            tr_logAddWarn(_("io_uring isn't available; using pread/pwrite instead"));
+        }
+    }
+
     if (auto const& val = new_settings.bind_address_ipv4; force || val != old_settings.bind_address_ipv4)
     {
         global_ip_cache_->update_addr(TR_AF_INET);
@@ -1257,6 +1299,10 @@ void tr_session::closeImplPart1(std::promise<void>* closed_promise, std::chrono:
     // down soon. This leaves the `event=stopped` going but refuses any
     // new tasks.
     this->web_->startShutdown(10s);
+    // ...the torrents have flushed their data to disk, so stop the disk I/O
+    // workers and run any remaining callbacks before the cache goes away.
+    this->disk_io_.set_thread_count(0U);
+    this->handshake_worker_.set_thread_count(0U);
     this->cache.reset();
 
     // recycle the now-unused save_timer_ here to wait for UDP shutdown
@@ -1537,7 +1583,8 @@ tr_bandwidth& tr_session::getBandwidthGroup(std::string_view name)
         }
     }
 
-    auto& [group_name, group] = groups.emplace_back(name, std::make_unique<tr_bandwidth>(new tr_bandwidth(&top_bandwidth_)));
+    auto& [group_name, group] = groups.emplace_back(name, std::make_unique<tr_bandwidth>(&top_bandwidth_));
+    group->set_weight(tr_bandwidth::DefaultWeight);
     return *group;
 }
 
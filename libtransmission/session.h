@@ -57,15 +57,18 @@
 #include "libtransmission/stats.h"
 #include "libtransmission/torrents.h"
 #include "libtransmission/tr-assert.h"
+#include "libtransmission/tr-buffer.h"
 #include "libtransmission/tr-dht.h"
 #include "libtransmission/tr-lpd.h"
 #include "libtransmission/tr-macros.h"
 #include "libtransmission/utils-ev.h"
 #include "libtransmission/verify.h"
 #include "libtransmission/web.h"
+#include "libtransmission/worker-pool.h"
 
 tr_peer_id_t tr_peerIdInit();
 
+struct mmsghdr;
 class tr_peer_socket;
 struct tr_pex;
 class tr_rpc_server;
@@ -157,6 +160,11 @@ private:
             return tr_address::from_string(session_.announceIP());
         }
 
+        [[nodiscard]] std::string_view config_dir() const override
+        {
+            return session_.config_dir_;
+        }
+
     private:
         tr_session& session_;
     };
@@ -327,10 +335,26 @@ private:
     class tr_udp_core
     {
     public:
+        // Wrapper around the syscall that sends batches of datagrams.
+        // This calls the kernel in production, but makes it possible for tests to inject a mock.
+        struct API
+        {
+            virtual ~API() = default;
+
+            // Only called where the system has sendmmsg()
+            virtual int sendmmsg(tr_socket_t sock, mmsghdr* msgs, unsigned int n_msgs, int flags);
+        };
+
         tr_udp_core(tr_session& session, tr_port udp_port);
+        tr_udp_core(tr_session& session, tr_port udp_port, API& api);
         ~tr_udp_core();
 
-        void sendto(void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen) const;
+        // Queues a datagram to be sent. Everything queued during an
+        // event loop iteration is sent in bulk when the iteration is done.
+        void sendto(void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
+        // Sends all the queued datagrams now.
+        void flush();
 
         [[nodiscard]] constexpr auto socket4() const noexcept
         {
@@ -343,12 +367,42 @@ private:
         }
 
     private:
+        struct OutgoingDatagram
+        {
+            sockaddr_storage to;
+            socklen_t tolen;
+            tr_socket_t sock;
+            size_t offset; // where the payload starts in `outgoing_bytes_`
+            size_t len;
+        };
+
+        [[nodiscard]] static API& default_api();
+
+        static void event_callback(evutil_socket_t sock, short type, void* vself);
+        static void flush_callback(evutil_socket_t sock, short type, void* vself);
+
+        void on_readable(tr_socket_t sock);
+        void send_batched(tr_socket_t sock, OutgoingDatagram const* datagrams, size_t n_datagrams);
+
         tr_port const udp_port_;
         tr_session& session_;
+        API& api_;
         tr_socket_t udp4_socket_ = TR_BAD_SOCKET;
         tr_socket_t udp6_socket_ = TR_BAD_SOCKET;
         libtransmission::evhelpers::event_unique_ptr udp4_event_;
         libtransmission::evhelpers::event_unique_ptr udp6_event_;
+        libtransmission::evhelpers::event_unique_ptr flush_event_;
+
+        std::vector<OutgoingDatagram> outgoing_;
+        std::vector<std::byte> outgoing_bytes_;
+
+        // where batched reads land
+        std::vector<unsigned char> recv_buf_;
+
+        // true if the kernel can split one big send into many
+        // datagrams for us, i.e. Linux's UDP generic segmentation offload
+        bool udp4_gso_ = false;
+        bool udp6_gso_ = false;
     };
 
 public:
@@ -554,6 +608,26 @@ public:
     void closeTorrentFiles(tr_torrent* tor) noexcept;
     void closeTorrentFile(tr_torrent* tor, tr_file_index_t file_num) noexcept;
 
+    [[nodiscard]] constexpr auto& disk_io() noexcept
+    {
+        return disk_io_;
+    }
+
+    [[nodiscard]] constexpr auto& handshake_worker() noexcept
+    {
+        return handshake_worker_;
+    }
+
+    [[nodiscard]] constexpr auto& peer_buffer_pool() noexcept
+    {
+        return peer_buffer_pool_;
+    }
+
+    [[nodiscard]] constexpr auto const& peer_buffer_pool() const noexcept
+    {
+        return peer_buffer_pool_;
+    }
+
     // announce ip
 
     [[nodiscard]] constexpr std::string const& announceIP() const noexcept
@@ -726,6 +800,12 @@ public:
         return settings_.upload_slots_per_torrent;
     }
 
+    // @return how many upload slots the session shares between all of its torrents, or 0 if each torrent has its own
+    [[nodiscard]] constexpr auto uploadSlotsGlobal() const noexcept
+    {
+        return settings_.upload_slots_global;
+    }
+
     [[nodiscard]] constexpr auto isClosing() const noexcept
     {
         return is_closing_;
@@ -736,6 +816,11 @@ public:
         return settings_.encryption_mode;
     }
 
+    [[nodiscard]] constexpr auto pieceSelection() const noexcept
+    {
+        return settings_.piece_selection;
+    }
+
     [[nodiscard]] constexpr auto preallocationMode() const noexcept
     {
         return settings_.preallocation_mode;
@@ -1163,9 +1248,21 @@ private:
     WebMediator web_mediator_{ this };
     std::unique_ptr<tr_web> web_ = tr_web::create(this->web_mediator_);
 
+    // blocking disk reads and writes
+    // depends-on: session_thread_
+    tr_worker_pool disk_io_{ *session_thread_, 0U };
+
+    // the Diffie-Hellman math for encrypted peer handshakes
+    // depends-on: session_thread_
+    tr_worker_pool handshake_worker_{ *session_thread_, 0U };
+
+    // Where peer I/O buffers get their memory while they're in use.
+    // Must outlive peer_mgr_ and every tr_peerIo.
+    libtransmission::BufferPool peer_buffer_pool_;
+
 public:
-    // depends-on: settings_, open_files_, torrents_
-    std::unique_ptr<Cache> cache = std::make_unique<Cache>(torrents_, 1024 * 1024 * 2);
+    // depends-on: settings_, open_files_, torrents_, disk_io_
+    std::unique_ptr<Cache> cache = std::make_unique<Cache>(torrents_, disk_io_, 1024 * 1024 * 2);
 
 private:
     // depends-on: timer_maker_, top_bandwidth_, utp_context, torrents_, web_, blocklist_changed_
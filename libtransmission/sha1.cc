@@ -0,0 +1,663 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint32_t, uint64_t
+#include <memory>
+#include <string_view>
+#include <utility> // std::index_sequence
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TR_SHA1_X86_KERNELS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "libtransmission/transmission.h"
+
+#include "libtransmission/crypto-utils.h"
+#include "libtransmission/sha1.h"
+#include "libtransmission/tr-assert.h"
+
+using namespace std::literals;
+
+namespace
+{
+namespace sha1_helpers
+{
+auto constexpr BlockSize = size_t{ 64U };
+
+using State = std::array<uint32_t, 5>;
+
+auto constexpr InitialState = State{ 0x67452301U, 0xEFCDAB89U, 0x98BADCFEU, 0x10325476U, 0xC3D2E1F0U };
+
+[[nodiscard]] constexpr uint32_t rotl(uint32_t val, int n) noexcept
+{
+    return (val << n) | (val >> (32 - n));
+}
+
+[[nodiscard]] constexpr uint32_t load_be32(uint8_t const* src) noexcept
+{
+    return (uint32_t{ src[0] } << 24U) | (uint32_t{ src[1] } << 16U) | (uint32_t{ src[2] } << 8U) | uint32_t{ src[3] };
+}
+
+constexpr void store_be32(uint32_t val, std::byte* dst) noexcept
+{
+    dst[0] = std::byte(val >> 24U);
+    dst[1] = std::byte(val >> 16U);
+    dst[2] = std::byte(val >> 8U);
+    dst[3] = std::byte(val);
+}
+
+[[nodiscard]] tr_sha1_digest_t state_to_digest(State const& state) noexcept
+{
+    auto digest = tr_sha1_digest_t{};
+    for (size_t i = 0; i < std::size(state); ++i)
+    {
+        store_be32(state[i], std::data(digest) + i * 4U);
+    }
+    return digest;
+}
+
+// Write the end of a `len`-byte message and its padding into `setme`.
+// `rem` points to the message's last `len % BlockSize` bytes.
+// @return how many blocks that took: 1 or 2
+size_t make_tail(uint8_t const* rem, uint64_t len, std::array<uint8_t, BlockSize * 2U>& setme) noexcept
+{
+    auto const n_rem = static_cast<size_t>(len % BlockSize);
+    auto const n_blocks = n_rem + 1U + 8U <= BlockSize ? 1U : 2U;
+
+    setme.fill(0U);
+    std::copy_n(rem, n_rem, std::data(setme));
+    setme[n_rem] = 0x80U;
+
+    // message length in bits, big-endian
+    auto const n_bits = len * 8U;
+    auto* const end = std::data(setme) + n_blocks * BlockSize;
+    for (size_t i = 0; i < 8U; ++i)
+    {
+        *(end - 1U - i) = static_cast<uint8_t>(n_bits >> (i * 8U));
+    }
+
+    return n_blocks;
+}
+
+// --- generic
+
+void compress_generic(State& state, uint8_t const* blocks, size_t n_blocks) noexcept
+{
+    for (; n_blocks > 0U; --n_blocks, blocks += BlockSize)
+    {
+        auto w = std::array<uint32_t, 80>{};
+        for (size_t t = 0; t < 16U; ++t)
+        {
+            w[t] = load_be32(blocks + t * 4U);
+        }
+        for (size_t t = 16; t < 80U; ++t)
+        {
+            w[t] = rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+        }
+
+        auto a = state[0];
+        auto b = state[1];
+        auto c = state[2];
+        auto d = state[3];
+        auto e = state[4];
+        auto const round = [&](uint32_t f, uint32_t k, uint32_t w_t)
+        {
+            auto const tmp = rotl(a, 5) + f + e + k + w_t;
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = tmp;
+        };
+
+        for (size_t t = 0; t < 20U; ++t)
+        {
+            round((b & c) | (~b & d), 0x5A827999U, w[t]);
+        }
+        for (size_t t = 20; t < 40U; ++t)
+        {
+            round(b ^ c ^ d, 0x6ED9EBA1U, w[t]);
+        }
+        for (size_t t = 40; t < 60U; ++t)
+        {
+            round((b & c) | (d & (b | c)), 0x8F1BBCDCU, w[t]);
+        }
+        for (size_t t = 60; t < 80U; ++t)
+        {
+            round(b ^ c ^ d, 0xCA62C1D6U, w[t]);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+// --- x86
+
+#ifdef TR_SHA1_X86_KERNELS
+
+#define TR_SHA1_TARGET_SHANI __attribute__((target("sha,sse4.1")))
+#define TR_SHA1_TARGET_AVX2 __attribute__((target("avx2")))
+
+struct CpuFeatures
+{
+    bool sha_ni = false;
+    bool avx2 = false;
+};
+
+[[nodiscard]] CpuFeatures detect_cpu_features() noexcept
+{
+    auto ret = CpuFeatures{};
+
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return ret;
+    }
+
+    auto const has_ssse3 = (ecx & (1U << 9U)) != 0U;
+    auto const has_sse41 = (ecx & (1U << 19U)) != 0U;
+    auto const has_osxsave = (ecx & (1U << 27U)) != 0U;
+    auto const has_avx = (ecx & (1U << 28U)) != 0U;
+
+    // AVX registers are only usable if the OS saves them on context switches
+    auto os_saves_ymm = false;
+    if (has_osxsave && has_avx)
+    {
+        uint32_t xcr0_lo = 0;
+        uint32_t xcr0_hi = 0;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        os_saves_ymm = (xcr0_lo & 0x6U) == 0x6U;
+    }
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return ret;
+    }
+
+    ret.sha_ni = has_ssse3 && has_sse41 && (ebx & (1U << 29U)) != 0U;
+    ret.avx2 = os_saves_ymm && (ebx & (1U << 5U)) != 0U;
+    return ret;
+}
+
+[[nodiscard]] CpuFeatures const& cpu_features() noexcept
+{
+    static auto const features = detect_cpu_features();
+    return features;
+}
+
+// One group of four rounds, after the first, with the SHA-NI instructions.
+// msg[i] holds the schedule words for groups i, i+4, i+8... and e[0]
+// and e[1] take turns holding the next group's E. Everything is indexed
+// by `G` so that the compiler can keep it all in registers.
+template<size_t G>
+TR_SHA1_TARGET_SHANI inline void shani_group(__m128i& abcd, __m128i (&e)[2], __m128i (&msg)[4]) noexcept
+{
+    auto& cur = e[G % 2U];
+    auto& next = e[(G + 1U) % 2U];
+
+    cur = _mm_sha1nexte_epu32(cur, msg[G % 4U]);
+    next = abcd;
+
+    if constexpr (G >= 3U && G <= 18U)
+    {
+        msg[(G + 1U) % 4U] = _mm_sha1msg2_epu32(msg[(G + 1U) % 4U], msg[G % 4U]);
+    }
+
+    abcd = _mm_sha1rnds4_epu32(abcd, cur, G / 5U);
+
+    if constexpr (G <= 16U)
+    {
+        msg[(G + 3U) % 4U] = _mm_sha1msg1_epu32(msg[(G + 3U) % 4U], msg[G % 4U]);
+    }
+
+    if constexpr (G >= 2U && G <= 17U)
+    {
+        msg[(G + 2U) % 4U] = _mm_xor_si128(msg[(G + 2U) % 4U], msg[G % 4U]);
+    }
+}
+
+template<size_t... Gs>
+TR_SHA1_TARGET_SHANI inline void shani_groups(
+    __m128i& abcd,
+    __m128i (&e)[2],
+    __m128i (&msg)[4],
+    std::index_sequence<Gs...> /*unused*/) noexcept
+{
+    // groups 1-19, i.e. rounds 4-79
+    (shani_group<Gs + 1U>(abcd, e, msg), ...);
+}
+
+TR_SHA1_TARGET_SHANI void compress_shani(State& state, uint8_t const* blocks, size_t n_blocks) noexcept
+{
+    auto const byteswap_mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    auto abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(std::data(state))), 0x1B);
+    auto e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+
+    for (; n_blocks > 0U; --n_blocks, blocks += BlockSize)
+    {
+        auto const abcd_save = abcd;
+        auto const e0_save = e0;
+
+        __m128i msg[4];
+        for (size_t i = 0; i < 4U; ++i)
+        {
+            msg[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(blocks + i * 16U));
+            msg[i] = _mm_shuffle_epi8(msg[i], byteswap_mask);
+        }
+
+        // rounds 0-3
+        __m128i e[2] = { _mm_add_epi32(e0, msg[0]), abcd };
+        abcd = _mm_sha1rnds4_epu32(abcd, e[0], 0);
+
+        shani_groups(abcd, e, msg, std::make_index_sequence<19>{});
+
+        // after group 19, e[0] holds the E that was current before it
+        e0 = _mm_sha1nexte_epu32(e[0], e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(std::data(state)), abcd);
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+// --- AVX2, eight messages at once
+
+auto constexpr Avx2Lanes = size_t{ 8U };
+
+// The state of eight messages, word-major: word `i` of lane `l` is at [i * 8 + l]
+using MultiState = std::array<uint32_t, 5U * Avx2Lanes>;
+
+template<int N>
+TR_SHA1_TARGET_AVX2 inline __m256i rotl8(__m256i val) noexcept
+{
+    return _mm256_or_si256(_mm256_slli_epi32(val, N), _mm256_srli_epi32(val, 32 - N));
+}
+
+// Compress one block for each lane
+TR_SHA1_TARGET_AVX2 void compress_avx2(MultiState& state, uint8_t const* const* blocks) noexcept
+{
+    // transpose the message words so that each vector holds one word of every lane
+    alignas(32) std::array<uint32_t, 16U * Avx2Lanes> words = {};
+    for (size_t lane = 0; lane < Avx2Lanes; ++lane)
+    {
+        for (size_t t = 0; t < 16U; ++t)
+        {
+            words[t * Avx2Lanes + lane] = load_be32(blocks[lane] + t * 4U);
+        }
+    }
+
+    __m256i w[16];
+    for (size_t t = 0; t < 16U; ++t)
+    {
+        w[t] = _mm256_load_si256(reinterpret_cast<__m256i const*>(std::data(words) + t * Avx2Lanes));
+    }
+
+    auto* const s = reinterpret_cast<__m256i*>(std::data(state));
+    auto a = _mm256_loadu_si256(s + 0);
+    auto b = _mm256_loadu_si256(s + 1);
+    auto c = _mm256_loadu_si256(s + 2);
+    auto d = _mm256_loadu_si256(s + 3);
+    auto e = _mm256_loadu_si256(s + 4);
+
+    for (size_t t = 0; t < 80U; ++t)
+    {
+        if (t >= 16U)
+        {
+            auto const x = _mm256_xor_si256(
+                _mm256_xor_si256(w[(t - 3U) % 16U], w[(t - 8U) % 16U]),
+                _mm256_xor_si256(w[(t - 14U) % 16U], w[t % 16U]));
+            w[t % 16U] = rotl8<1>(x);
+        }
+
+        auto f = __m256i{};
+        auto k = __m256i{};
+        if (t < 20U)
+        {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d));
+            k = _mm256_set1_epi32(0x5A827999);
+        }
+        else if (t < 40U)
+        {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(0x6ED9EBA1);
+        }
+        else if (t < 60U)
+        {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            k = _mm256_set1_epi32(static_cast<int>(0x8F1BBCDCU));
+        }
+        else
+        {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(static_cast<int>(0xCA62C1D6U));
+        }
+
+        auto const tmp = _mm256_add_epi32(
+            _mm256_add_epi32(rotl8<5>(a), f),
+            _mm256_add_epi32(_mm256_add_epi32(e, k), w[t % 16U]));
+        e = d;
+        d = c;
+        c = rotl8<30>(b);
+        b = a;
+        a = tmp;
+    }
+
+    _mm256_storeu_si256(s + 0, _mm256_add_epi32(_mm256_loadu_si256(s + 0), a));
+    _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1), b));
+    _mm256_storeu_si256(s + 2, _mm256_add_epi32(_mm256_loadu_si256(s + 2), c));
+    _mm256_storeu_si256(s + 3, _mm256_add_epi32(_mm256_loadu_si256(s + 3), d));
+    _mm256_storeu_si256(s + 4, _mm256_add_epi32(_mm256_loadu_si256(s + 4), e));
+}
+
+// Hash 2-8 messages that pad out to the same number of blocks
+void digest_lanes_avx2(tr_sha1_message const* messages, size_t n_messages, tr_sha1_digest_t* setme)
+{
+    TR_ASSERT(n_messages > 1U && n_messages <= Avx2Lanes);
+
+    struct Lane
+    {
+        uint8_t const* data = nullptr;
+        size_t n_full_blocks = 0U;
+        std::array<uint8_t, BlockSize * 2U> tail = {};
+    };
+
+    auto lanes = std::array<Lane, Avx2Lanes>{};
+    auto n_blocks = size_t{};
+    for (size_t i = 0; i < n_messages; ++i)
+    {
+        auto& lane = lanes[i];
+        lane.data = static_cast<uint8_t const*>(messages[i].data);
+        lane.n_full_blocks = messages[i].size / BlockSize;
+        auto const* const rem = lane.data + lane.n_full_blocks * BlockSize;
+        n_blocks = lane.n_full_blocks + make_tail(rem, messages[i].size, lane.tail);
+    }
+
+    // unused lanes just repeat the first message
+    for (size_t i = n_messages; i < Avx2Lanes; ++i)
+    {
+        lanes[i] = lanes[0];
+    }
+
+    auto state = MultiState{};
+    for (size_t word = 0; word < std::size(InitialState); ++word)
+    {
+        std::fill_n(std::data(state) + word * Avx2Lanes, Avx2Lanes, InitialState[word]);
+    }
+
+    auto blocks = std::array<uint8_t const*, Avx2Lanes>{};
+    for (size_t block = 0; block < n_blocks; ++block)
+    {
+        for (size_t i = 0; i < Avx2Lanes; ++i)
+        {
+            auto const& lane = lanes[i];
+            blocks[i] = block < lane.n_full_blocks ? lane.data + block * BlockSize :
+                                                     std::data(lane.tail) + (block - lane.n_full_blocks) * BlockSize;
+        }
+
+        compress_avx2(state, std::data(blocks));
+    }
+
+    for (size_t i = 0; i < n_messages; ++i)
+    {
+        auto lane_state = State{};
+        for (size_t word = 0; word < std::size(lane_state); ++word)
+        {
+            lane_state[word] = state[word * Avx2Lanes + i];
+        }
+        setme[i] = state_to_digest(lane_state);
+    }
+}
+
+#endif // TR_SHA1_X86_KERNELS
+
+// ---
+
+[[nodiscard]] std::atomic<tr_sha1_kernel>& current_kernel() noexcept
+{
+    static auto kernel = std::atomic<tr_sha1_kernel>{ tr_sha1_best_kernel() };
+    return kernel;
+}
+
+using CompressFunc = void (*)(State&, uint8_t const*, size_t) noexcept;
+
+[[nodiscard]] CompressFunc stream_compress_func(tr_sha1_kernel kernel) noexcept
+{
+#ifdef TR_SHA1_X86_KERNELS
+    if (kernel == tr_sha1_kernel::ShaNi)
+    {
+        return compress_shani;
+    }
+#endif
+
+    (void)kernel;
+    return compress_generic;
+}
+
+[[nodiscard]] size_t padded_block_count(size_t len) noexcept
+{
+    return len / BlockSize + (len % BlockSize + 1U + 8U <= BlockSize ? 1U : 2U);
+}
+
+class Sha1Impl final : public tr_sha1
+{
+public:
+    Sha1Impl() = default;
+    Sha1Impl(Sha1Impl&&) = delete;
+    Sha1Impl(Sha1Impl const&) = delete;
+    ~Sha1Impl() override = default;
+    Sha1Impl& operator=(Sha1Impl&&) = delete;
+    Sha1Impl& operator=(Sha1Impl const&) = delete;
+
+    void clear() override
+    {
+        state_ = InitialState;
+        n_buffered_ = 0U;
+        n_bytes_ = 0U;
+    }
+
+    void add(void const* data, size_t data_length) override
+    {
+        auto const* walk = static_cast<uint8_t const*>(data);
+        n_bytes_ += data_length;
+
+        // top off a partial block
+        if (n_buffered_ > 0U)
+        {
+            auto const n = std::min(data_length, BlockSize - n_buffered_);
+            std::copy_n(walk, n, std::data(buffer_) + n_buffered_);
+            n_buffered_ += n;
+            walk += n;
+            data_length -= n;
+
+            if (n_buffered_ < BlockSize)
+            {
+                return;
+            }
+
+            compress_(state_, std::data(buffer_), 1U);
+            n_buffered_ = 0U;
+        }
+
+        // hash whole blocks straight from the caller's buffer
+        if (auto const n_blocks = data_length / BlockSize; n_blocks > 0U)
+        {
+            compress_(state_, walk, n_blocks);
+            walk += n_blocks * BlockSize;
+            data_length -= n_blocks * BlockSize;
+        }
+
+        std::copy_n(walk, data_length, std::data(buffer_));
+        n_buffered_ = data_length;
+    }
+
+    [[nodiscard]] tr_sha1_digest_t finish() override
+    {
+        auto tail = std::array<uint8_t, BlockSize * 2U>{};
+        auto const n_tail_blocks = make_tail(std::data(buffer_), n_bytes_, tail);
+        compress_(state_, std::data(tail), n_tail_blocks);
+
+        auto const digest = state_to_digest(state_);
+        clear();
+        return digest;
+    }
+
+private:
+    CompressFunc const compress_ = stream_compress_func(tr_sha1_get_kernel());
+    State state_ = InitialState;
+    std::array<uint8_t, BlockSize> buffer_ = {};
+    size_t n_buffered_ = 0U;
+    uint64_t n_bytes_ = 0U;
+};
+} // namespace sha1_helpers
+} // namespace
+
+tr_sha1_kernel tr_sha1_best_kernel() noexcept
+{
+#ifdef TR_SHA1_X86_KERNELS
+    using namespace sha1_helpers;
+
+    if (cpu_features().sha_ni)
+    {
+        return tr_sha1_kernel::ShaNi;
+    }
+
+    if (cpu_features().avx2)
+    {
+        return tr_sha1_kernel::Avx2;
+    }
+#endif
+
+    return tr_sha1_kernel::Generic;
+}
+
+bool tr_sha1_kernel_is_supported(tr_sha1_kernel kernel) noexcept
+{
+#ifdef TR_SHA1_X86_KERNELS
+    using namespace sha1_helpers;
+
+    switch (kernel)
+    {
+    case tr_sha1_kernel::ShaNi:
+        return cpu_features().sha_ni;
+    case tr_sha1_kernel::Avx2:
+        return cpu_features().avx2;
+    default:
+        return true;
+    }
+#else
+    return kernel == tr_sha1_kernel::Generic;
+#endif
+}
+
+tr_sha1_kernel tr_sha1_get_kernel() noexcept
+{
+    return sha1_helpers::current_kernel().load();
+}
+
+bool tr_sha1_set_kernel(tr_sha1_kernel kernel) noexcept
+{
+    if (!tr_sha1_kernel_is_supported(kernel))
+    {
+        return false;
+    }
+
+    sha1_helpers::current_kernel() = kernel;
+    return true;
+}
+
+std::string_view tr_sha1_kernel_name(tr_sha1_kernel kernel) noexcept
+{
+    switch (kernel)
+    {
+    case tr_sha1_kernel::ShaNi:
+        return "sha-ni"sv;
+    case tr_sha1_kernel::Avx2:
+        return "avx2"sv;
+    default:
+        return "generic"sv;
+    }
+}
+
+size_t tr_sha1_lanes() noexcept
+{
+#ifdef TR_SHA1_X86_KERNELS
+    if (tr_sha1_get_kernel() == tr_sha1_kernel::Avx2)
+    {
+        return sha1_helpers::Avx2Lanes;
+    }
+#endif
+
+    return 1U;
+}
+
+std::unique_ptr<tr_sha1> tr_sha1_create_builtin()
+{
+    return std::make_unique<sha1_helpers::Sha1Impl>();
+}
+
+std::unique_ptr<tr_sha1> tr_sha1::create()
+{
+    // the generic kernel is no faster than the crypto library's
+    if (tr_sha1_get_kernel() == tr_sha1_kernel::ShaNi)
+    {
+        return tr_sha1_create_builtin();
+    }
+
+    return create_library();
+}
+
+void tr_sha1_digest_many(tr_sha1_message const* messages, size_t n_messages, tr_sha1_digest_t* setme)
+{
+    using namespace sha1_helpers;
+
+    auto const lanes = tr_sha1_lanes();
+    auto sha = std::unique_ptr<tr_sha1>{};
+
+    for (size_t i = 0; i < n_messages;)
+    {
+        // gather up to `lanes` messages that take the same number of blocks.
+        // When hashing pieces, that's all of them but maybe the last.
+        auto const n_blocks = padded_block_count(messages[i].size);
+        auto end = i + 1U;
+        while (end < n_messages && end - i < lanes && padded_block_count(messages[end].size) == n_blocks)
+        {
+            ++end;
+        }
+
+#ifdef TR_SHA1_X86_KERNELS
+        if (end - i > 1U)
+        {
+            digest_lanes_avx2(messages + i, end - i, setme + i);
+            i = end;
+            continue;
+        }
+#endif
+
+        if (!sha)
+        {
+            sha = tr_sha1::create();
+        }
+
+        sha->add(messages[i].data, messages[i].size);
+        setme[i] = sha->finish();
+        sha->clear();
+        ++i;
+    }
+}
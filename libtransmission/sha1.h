@@ -0,0 +1,65 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <memory>
+#include <string_view>
+
+#include "libtransmission/crypto-utils.h"
+#include "libtransmission/tr-macros.h" // tr_sha1_digest_t
+
+/**
+ * Built-in SHA-1 for hashing piece data.
+ *
+ * The kernel is picked at runtime from what the CPU supports. SHA-NI
+ * speeds up a single stream, so tr_sha1::create() uses it when it's
+ * available and falls back to the crypto library otherwise. AVX2 can't
+ * speed up a single stream, but it can hash eight messages at once,
+ * which is what tr_sha1_digest_many() does with it.
+ */
+
+enum class tr_sha1_kernel : uint8_t
+{
+    Generic,
+    ShaNi,
+    Avx2
+};
+
+struct tr_sha1_message
+{
+    void const* data;
+    size_t size;
+};
+
+// @return the fastest kernel this CPU supports
+[[nodiscard]] tr_sha1_kernel tr_sha1_best_kernel() noexcept;
+
+[[nodiscard]] bool tr_sha1_kernel_is_supported(tr_sha1_kernel kernel) noexcept;
+
+[[nodiscard]] tr_sha1_kernel tr_sha1_get_kernel() noexcept;
+
+// Use another kernel, e.g. for tests or benchmarks.
+// @return false if this CPU doesn't support it
+bool tr_sha1_set_kernel(tr_sha1_kernel kernel) noexcept;
+
+[[nodiscard]] std::string_view tr_sha1_kernel_name(tr_sha1_kernel kernel) noexcept;
+
+// @return how many messages tr_sha1_digest_many() can hash at once with the current kernel
+[[nodiscard]] size_t tr_sha1_lanes() noexcept;
+
+// A streaming SHA-1 that uses the current kernel, or the generic one if
+// the current kernel is multi-buffer only. Prefer tr_sha1::create().
+[[nodiscard]] std::unique_ptr<tr_sha1> tr_sha1_create_builtin();
+
+// Hash `n_messages` independent messages, e.g. a run of pieces,
+// and write their digests to `setme`.
+void tr_sha1_digest_many(tr_sha1_message const* messages, size_t n_messages, tr_sha1_digest_t* setme);
@@ -8,6 +8,7 @@
 #include <cerrno> // EINVAL
 #include <climits> /* INT_MAX */
 #include <ctime>
+#include <functional>
 #include <map>
 #include <sstream>
 #include <string>
@@ -31,6 +32,7 @@
 
 #include "libtransmission/announcer.h"
 #include "libtransmission/bandwidth.h"
+#include "libtransmission/cache.h"
 #include "libtransmission/completion.h"
 #include "libtransmission/crypto-utils.h" // for tr_sha1()
 #include "libtransmission/error.h"
@@ -823,6 +825,7 @@ void torrentStop(tr_torrent* const tor)
 
     tor->is_running_ = false;
     tor->is_stopping_ = false;
+    tor->piece_hasher_.clear();
 
     if (!tor->session->isClosing())
     {
@@ -980,6 +983,7 @@ void tr_torrent::on_metainfo_updated()
     file_priorities_.reset(&fpm_);
     files_wanted_.reset(&fpm_);
     checked_pieces_ = tr_bitfield{ size_t(piece_count()) };
+    piece_hasher_.clear();
 }
 
 void tr_torrent::init(tr_ctor const* const ctor)
@@ -1700,6 +1704,20 @@ void tr_torrent::set_verify_state(VerifyState const state)
     mark_changed();
 }
 
+template<typename Func>
+void tr_torrent::VerifyMediator::run_in_session_thread(Func&& func) const
+{
+    auto* const session = tor_->session;
+    session->runInSessionThread(
+        [session, tor_id = tor_->id(), func = std::forward<Func>(func)]()
+        {
+            if (auto* const tor = session->torrents().get(tor_id); tor != nullptr)
+            {
+                func(tor);
+            }
+        });
+}
+
 tr_torrent_metainfo const& tr_torrent::VerifyMediator::metainfo() const
 {
     return tor_->metainfo_;
@@ -1718,6 +1736,7 @@ std::optional<std::string> tr_torrent::VerifyMediator::find_file(tr_file_index_t
 void tr_torrent::VerifyMediator::on_verify_queued()
 {
     tr_logAddTraceTor(tor_, "Queued for verification");
+    generation_ = ++tor_->verify_generation_;
     tor_->set_verify_state(VerifyState::Queued);
 }
 
@@ -1725,22 +1744,44 @@ void tr_torrent::VerifyMediator::on_verify_started()
 {
     tr_logAddDebugTor(tor_, "Verifying torrent");
     time_started_ = tr_time();
-    tor_->set_verify_state(VerifyState::Active);
+    run_in_session_thread(
+        [generation = generation_](tr_torrent* const tor)
+        {
+            if (tor->verify_generation_ == generation)
+            {
+                tor->set_verify_state(VerifyState::Active);
+            }
+        });
 }
 
-void tr_torrent::VerifyMediator::on_piece_checked(tr_piece_index_t const piece, bool const has_piece)
+void tr_torrent::VerifyMediator::on_pieces_checked(tr_piece_index_t const begin_piece, std::vector<bool> has_pieces)
 {
-    auto const had_piece = tor_->has_piece(piece);
+    run_in_session_thread(
+        [generation = generation_, begin_piece, has_pieces = std::move(has_pieces)](tr_torrent* const tor)
+        {
+            auto const end_piece = static_cast<tr_piece_index_t>(begin_piece + std::size(has_pieces));
 
-    if (has_piece || had_piece)
-    {
-        tor_->set_has_piece(piece, has_piece);
-        tor_->set_dirty();
-    }
+            for (auto piece = begin_piece; piece < end_piece; ++piece)
+            {
+                auto const has_piece = has_pieces[piece - begin_piece];
+                auto const had_piece = tor->has_piece(piece);
+
+                if (has_piece || had_piece)
+                {
+                    tor->set_has_piece(piece, has_piece);
+                    tor->set_dirty();
+                }
+
+                tor->checked_pieces_.set(piece, true);
+            }
+
+            tor->mark_changed();
 
-    tor_->checked_pieces_.set(piece, true);
-    tor_->mark_changed();
-    tor_->verify_progress_ = std::clamp(static_cast<float>(piece + 1U) / tor_->metainfo_.piece_count(), 0.0F, 1.0F);
+            if (tor->verify_generation_ == generation)
+            {
+                tor->verify_progress_ = std::clamp(static_cast<float>(end_piece) / tor->metainfo_.piece_count(), 0.0F, 1.0F);
+            }
+        });
 }
 
 void tr_torrent::VerifyMediator::on_verify_done(bool const aborted)
@@ -1760,17 +1801,26 @@ void tr_torrent::VerifyMediator::on_verify_done(bool const aborted)
                 total_size / (1 + duration_secs)));
     }
 
-    tor_->set_verify_state(VerifyState::None);
+    run_in_session_thread(
+        [aborted, generation = generation_](tr_torrent* const tor)
+        {
+            // an aborted verify may have been queued again by the time
+            // this runs, so leave the new one's state be
+            if (tor->verify_generation_ == generation)
+            {
+                tor->set_verify_state(VerifyState::None);
+            }
 
-    if (!aborted && !tor_->is_deleting_)
-    {
-        tor_->session->runInSessionThread(onVerifyDoneThreadFunc, tor_);
-    }
+            if (!aborted)
+            {
+                onVerifyDoneThreadFunc(tor);
+            }
 
-    if (tor_->verify_done_callback_)
-    {
-        tor_->verify_done_callback_(tor_);
-    }
+            if (tor->verify_done_callback_)
+            {
+                tor->verify_done_callback_(tor);
+            }
+        });
 }
 
 // ---
@@ -2021,11 +2071,38 @@ tr_block_span_t tr_torGetFileBlockSpan(tr_torrent const* tor, tr_file_index_t fi
 // TODO: should be const after tr_ioTestPiece() is const
 bool tr_torrent::check_piece(tr_piece_index_t piece)
 {
+    // if the piece was hashed as it arrived, there's no need to read it back
+    if (auto const digest = piece_hasher_.finish(piece); digest)
+    {
+        bool const pass = *digest == piece_hash(piece);
+        tr_logAddTraceTor(this, fmt::format("tr_torrent.checkPiece hashed piece {} on arrival, pass=={}", piece, pass));
+        return pass;
+    }
+
     bool const pass = tr_ioTestPiece(this, piece);
     tr_logAddTraceTor(this, fmt::format("[LAZY] tr_torrent.checkPiece tested piece {}, pass=={}", piece, pass));
     return pass;
 }
 
+void tr_torrent::PieceHasherMediator::read_block(tr_block_index_t block, std::function<void(uint8_t const* data)>&& on_done)
+{
+    auto* const session = tor_->session;
+    session->cache->read_block_async(
+        tor_,
+        tor_->block_loc(block),
+        tor_->block_size(block),
+        [session, tor_id = tor_->id(), on_done = std::move(on_done)](int err, Cache::SharedBlockData data)
+        {
+            // the torrent, and its piece hasher, may be gone by now
+            if (session->torrents().get(tor_id) == nullptr)
+            {
+                return;
+            }
+
+            on_done(err == 0 ? std::data(*data) : nullptr);
+        });
+}
+
 // ---
 
 bool tr_torrent::set_tracker_list(std::string_view text)
@@ -2626,6 +2703,7 @@ void tr_torrent::mark_changed()
 void tr_torrent::set_blocks(tr_bitfield blocks)
 {
     this->completion.set_blocks(std::move(blocks));
+    piece_hasher_.clear();
 }
 
 [[nodiscard]] bool tr_torrent::ensure_piece_is_checked(tr_piece_index_t piece)
@@ -31,6 +31,7 @@
 #include "libtransmission/interned-string.h"
 #include "libtransmission/log.h"
 #include "libtransmission/observable.h"
+#include "libtransmission/piece-hasher.h"
 #include "libtransmission/session.h"
 #include "libtransmission/torrent-magnet.h"
 #include "libtransmission/torrent-metainfo.h"
@@ -96,12 +97,22 @@ public:
 
         void on_verify_queued() override;
         void on_verify_started() override;
-        void on_piece_checked(tr_piece_index_t piece, bool has_piece) override;
+        void on_pieces_checked(tr_piece_index_t begin_piece, std::vector<bool> has_pieces) override;
         void on_verify_done(bool aborted) override;
 
     private:
+        // The verify callbacks come from a verify thread, so they hand
+        // their changes over to the session thread. `func` is skipped if
+        // the torrent's been removed by the time it gets there.
+        template<typename Func>
+        void run_in_session_thread(Func&& func) const;
+
         tr_torrent* const tor_;
         std::optional<time_t> time_started_;
+
+        // the torrent's verify_generation_ when this verify was queued.
+        // If they differ, the torrent's been queued again since then.
+        uint64_t generation_ = {};
     };
 
     explicit tr_torrent(tr_torrent_metainfo&& tm)
@@ -313,6 +324,21 @@ public:
     void set_has_piece(tr_piece_index_t piece, bool has)
     {
         completion.set_has_piece(piece, has);
+
+        if (!has)
+        {
+            piece_hasher_.erase(piece);
+        }
+    }
+
+    // Called with a newly-downloaded block's contents before it's
+    // written, so that its piece can be hashed incrementally.
+    void on_block_data(tr_block_index_t block, uint8_t const* data)
+    {
+        if (!has_block(block))
+        {
+            piece_hasher_.add_block(block, data);
+        }
     }
 
     /// FILE <-> PIECE
@@ -366,12 +392,14 @@ public:
     void set_file_priorities(tr_file_index_t const* files, tr_file_index_t file_count, tr_priority_t priority)
     {
         file_priorities_.set(files, file_count, priority);
+        priority_changed_.emit(this);
         set_dirty();
     }
 
     void set_file_priority(tr_file_index_t file, tr_priority_t priority)
     {
         file_priorities_.set(file, priority);
+        priority_changed_.emit(this);
         set_dirty();
     }
 
@@ -919,7 +947,9 @@ public:
     libtransmission::SimpleObservable<tr_torrent*, tr_piece_index_t> got_bad_piece_;
     libtransmission::SimpleObservable<tr_torrent*, tr_piece_index_t> piece_completed_;
     libtransmission::SimpleObservable<tr_torrent*> doomed_;
+    libtransmission::SimpleObservable<tr_torrent*> files_wanted_changed_;
     libtransmission::SimpleObservable<tr_torrent*> got_metainfo_;
+    libtransmission::SimpleObservable<tr_torrent*> priority_changed_;
     libtransmission::SimpleObservable<tr_torrent*> started_;
     libtransmission::SimpleObservable<tr_torrent*> stopped_;
     libtransmission::SimpleObservable<tr_torrent*> swarm_is_all_seeds_;
@@ -927,6 +957,34 @@ public:
     // TODO(ckerr): make private once some of torrent.cc's `tr_torrentFoo()` methods are member functions
     tr_completion completion;
 
+    class PieceHasherMediator final : public tr_piece_hasher::Mediator
+    {
+    public:
+        explicit PieceHasherMediator(tr_torrent* tor)
+            : tor_{ tor }
+        {
+        }
+
+        [[nodiscard]] tr_block_info const& block_info() const override
+        {
+            return tor_->block_info();
+        }
+
+        [[nodiscard]] bool has_block(tr_block_index_t block) const override
+        {
+            return tor_->has_block(block);
+        }
+
+        void read_block(tr_block_index_t block, std::function<void(uint8_t const* data)>&& on_done) override;
+
+    private:
+        tr_torrent* const tor_;
+    };
+
+    // pieces that are being hashed as their blocks arrive
+    PieceHasherMediator piece_hasher_mediator_{ this };
+    tr_piece_hasher piece_hasher_{ piece_hasher_mediator_ };
+
     // true iff the piece was verified more recently than any of the piece's
     // files' mtimes (file_mtimes_). If checked_pieces_.test(piece) is false,
     // it means that piece needs to be checked before its data is used.
@@ -1142,6 +1200,7 @@ private:
 
         files_wanted_.set(files, n_files, wanted);
         completion.invalidate_size_when_done();
+        files_wanted_changed_.emit(this);
 
         if (!is_bootstrapping)
         {
@@ -1199,6 +1258,9 @@ private:
 
     VerifyState verify_state_ = VerifyState::None;
 
+    // bumped each time the torrent is queued for verification
+    uint64_t verify_generation_ = 0U;
+
     uint16_t idle_limit_minutes_ = 0;
 
     bool needs_completeness_check_ = true;
@@ -4,9 +4,16 @@
 
 #pragma once
 
+#include <algorithm> // std::min
 #include <array>
 #include <cstddef> // size_t
-#include <cstdint> // uint8_t
+#include <cstdint> // uint8_t, uint64_t
+#include <cstring> // std::memcpy
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TR_ARC4_SSE2
+#endif
 
 /**
  * This is a tiny and reusable implementation of alleged RC4 cipher.
@@ -22,6 +29,10 @@
  * Nonetheless it's still used in BitTorrent Protocol Encryption
  * https://en.wikipedia.org/wiki/BitTorrent_protocol_encryption,
  * so this header file provides an implementation.
+ *
+ * The keystream can't be vectorized since each byte depends on the last
+ * swap, so it's generated a block at a time in a tight loop and then
+ * XORed with the data 16 bytes at a time.
  */
 class tr_arc4
 {
@@ -37,7 +48,7 @@ public:
     {
         for (size_t i = 0; i < 256; ++i)
         {
-            s_[i] = static_cast<uint8_t>(i);
+            s_[i] = static_cast<uint32_t>(i);
         }
 
         for (size_t i = 0, j = 0; i < 256; ++i)
@@ -45,25 +56,49 @@ public:
             j = static_cast<uint8_t>(j + s_[i] + ((uint8_t const*)key)[i % key_length]);
             arc4_swap(i, j);
         }
+
+        i_ = 0;
+        j_ = 0;
     }
 
-    constexpr void process(uint8_t const* const src, size_t n_bytes, uint8_t* const tgt)
+    void process(uint8_t const* src, size_t n_bytes, uint8_t* tgt) noexcept
     {
-        for (size_t i = 0; i != n_bytes; ++i)
+        // not zero-initialized since it's overwritten before it's read
+        alignas(16) std::array<uint8_t, KeystreamBlockSize> keystream; // NOLINT(cppcoreguidelines-pro-type-member-init)
+
+        while (n_bytes > 0U)
         {
-            tgt[i] = src[i] ^ arc4_next();
+            auto const n_this_pass = std::min(n_bytes, std::size(keystream));
+            generate(std::data(keystream), n_this_pass);
+            xor_bytes(src, std::data(keystream), n_this_pass, tgt);
+            src += n_this_pass;
+            tgt += n_this_pass;
+            n_bytes -= n_this_pass;
         }
     }
 
-    constexpr void discard(size_t length)
+    void discard(size_t length) noexcept
     {
+        auto* const s = std::data(s_);
+        auto i = i_;
+        auto j = j_;
+
         while (length-- > 0)
         {
-            arc4_next();
+            i = (i + 1U) & 0xFFU;
+            auto const si = s[i];
+            j = (j + si) & 0xFFU;
+            s[i] = s[j];
+            s[j] = si;
         }
+
+        i_ = i;
+        j_ = j;
     }
 
 private:
+    static constexpr auto KeystreamBlockSize = size_t{ 512U };
+
     constexpr void arc4_swap(size_t i, size_t j)
     {
         auto const tmp = s_[i];
@@ -71,17 +106,60 @@ private:
         s_[j] = tmp;
     }
 
-    constexpr uint8_t arc4_next()
+    // Writes the next `n_bytes` of keystream to `out`.
+    void generate(uint8_t* const out, size_t n_bytes) noexcept
     {
-        i_ += 1;
-        j_ += s_[i_];
+        auto* const s = std::data(s_);
+        auto i = i_;
+        auto j = j_;
 
-        arc4_swap(i_, j_);
+        for (size_t k = 0; k != n_bytes; ++k)
+        {
+            i = (i + 1U) & 0xFFU;
+            auto const si = s[i];
+            j = (j + si) & 0xFFU;
+            auto const sj = s[j];
+            s[i] = sj;
+            s[j] = si;
+            out[k] = static_cast<uint8_t>(s[(si + sj) & 0xFFU]);
+        }
+
+        i_ = i;
+        j_ = j;
+    }
 
-        return s_[static_cast<uint8_t>(s_[i_] + s_[j_])];
+    static void xor_bytes(uint8_t const* src, uint8_t const* keystream, size_t n_bytes, uint8_t* tgt) noexcept
+    {
+        auto k = size_t{};
+
+#ifdef TR_ARC4_SSE2
+        for (; k + sizeof(__m128i) <= n_bytes; k += sizeof(__m128i))
+        {
+            auto const data = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + k));
+            auto const key = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keystream + k));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(tgt + k), _mm_xor_si128(data, key));
+        }
+#endif
+
+        for (; k + sizeof(uint64_t) <= n_bytes; k += sizeof(uint64_t))
+        {
+            auto data = uint64_t{};
+            auto key = uint64_t{};
+            std::memcpy(&data, src + k, sizeof(data));
+            std::memcpy(&key, keystream + k, sizeof(key));
+            data ^= key;
+            std::memcpy(tgt + k, &data, sizeof(data));
+        }
+
+        for (; k != n_bytes; ++k)
+        {
+            tgt[k] = src[k] ^ keystream[k];
+        }
     }
 
-    std::array<uint8_t, 256> s_ = {};
-    uint8_t i_ = 0;
-    uint8_t j_ = 0;
+    // The state is a permutation of 0..255, but it's stored as words:
+    // byte-sized loads and stores are slower in this loop.
+    std::array<uint32_t, 256> s_ = {};
+    uint32_t i_ = 0;
+    uint32_t j_ = 0;
 };
@@ -6,11 +6,15 @@
 #pragma once
 
 #include <algorithm> // for std::copy_n
+#include <array>
 #include <cstddef>
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <utility> // for std::pair
+#include <vector>
 
 #include <small/vector.hpp>
 
@@ -307,4 +311,240 @@ private:
     size_t end_pos_ = {};
 };
 
+// ---
+
+// A pool of heap blocks for buffers that are often empty, e.g. peer I/O.
+// Buffers borrow a block while they're holding data and give it back
+// when they're drained, so idle connections don't pin any memory.
+// Blocks are rounded up to a power of two so that they can be reused.
+// Call trim() periodically to free the blocks that aren't being reused.
+// Not thread-safe.
+class BufferPool
+{
+public:
+    struct Block
+    {
+        std::unique_ptr<std::byte[]> data;
+        size_t size = {};
+    };
+
+    struct Stats
+    {
+        size_t bytes_in_use = {};
+        size_t bytes_idle = {};
+        size_t peak_bytes_in_use = {};
+        size_t blocks_in_use = {};
+    };
+
+    static auto constexpr MinBlockSize = size_t{ 4U * 1024U };
+    static auto constexpr MaxPooledBlockSize = size_t{ 1024U * 1024U };
+    static auto constexpr DefaultMaxIdleBytes = size_t{ 16U * 1024U * 1024U };
+
+    explicit BufferPool(size_t max_idle_bytes = DefaultMaxIdleBytes) noexcept
+        : max_idle_bytes_{ max_idle_bytes }
+    {
+    }
+
+    BufferPool(BufferPool&&) = delete;
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool&&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+    ~BufferPool() = default;
+
+    // @return a block that can hold at least `n_bytes`
+    [[nodiscard]] Block acquire(size_t n_bytes)
+    {
+        auto block = Block{};
+        block.size = block_size(n_bytes);
+
+        if (auto const idx = size_class(block.size); idx < NumSizeClasses && !std::empty(idle_[idx]))
+        {
+            block.data = std::move(idle_[idx].back());
+            idle_[idx].pop_back();
+            stats_.bytes_idle -= block.size;
+            min_idle_[idx] = std::min(min_idle_[idx], std::size(idle_[idx]));
+        }
+        else
+        {
+            block.data = std::make_unique<std::byte[]>(block.size);
+        }
+
+        stats_.bytes_in_use += block.size;
+        stats_.peak_bytes_in_use = std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+        ++stats_.blocks_in_use;
+        return block;
+    }
+
+    void release(Block&& block)
+    {
+        if (!block.data)
+        {
+            return;
+        }
+
+        stats_.bytes_in_use -= block.size;
+        --stats_.blocks_in_use;
+
+        // keep it for reuse unless it's oversized or we're already holding enough
+        if (auto const idx = size_class(block.size);
+            idx < NumSizeClasses && stats_.bytes_idle + block.size <= max_idle_bytes_)
+        {
+            stats_.bytes_idle += block.size;
+            idle_[idx].emplace_back(std::move(block.data));
+        }
+
+        block = {};
+    }
+
+    // Free the idle blocks that weren't needed since the last trim(),
+    // i.e. the ones that stayed idle the whole time.
+    void trim()
+    {
+        for (size_t idx = 0; idx < NumSizeClasses; ++idx)
+        {
+            auto& blocks = idle_[idx];
+            auto const n_unneeded = std::min(min_idle_[idx], std::size(blocks));
+            blocks.resize(std::size(blocks) - n_unneeded);
+            stats_.bytes_idle -= n_unneeded * (MinBlockSize << idx);
+            min_idle_[idx] = std::size(blocks);
+        }
+    }
+
+    [[nodiscard]] constexpr auto const& stats() const noexcept
+    {
+        return stats_;
+    }
+
+private:
+    // one for each power of two in [MinBlockSize...MaxPooledBlockSize]
+    static auto constexpr NumSizeClasses = size_t{ 9U };
+
+    [[nodiscard]] static constexpr size_t block_size(size_t n_bytes) noexcept
+    {
+        if (n_bytes > MaxPooledBlockSize)
+        {
+            return n_bytes;
+        }
+
+        auto size = MinBlockSize;
+        while (size < n_bytes)
+        {
+            size *= 2U;
+        }
+
+        return size;
+    }
+
+    [[nodiscard]] static constexpr size_t size_class(size_t block_size) noexcept
+    {
+        auto idx = size_t{};
+        for (auto size = MinBlockSize; size < block_size && idx < NumSizeClasses; size *= 2U)
+        {
+            ++idx;
+        }
+
+        return idx;
+    }
+
+    std::array<std::vector<std::unique_ptr<std::byte[]>>, NumSizeClasses> idle_;
+
+    // the fewest idle blocks each size class had since the last trim()
+    std::array<size_t, NumSizeClasses> min_idle_ = {};
+
+    Stats stats_;
+    size_t const max_idle_bytes_;
+};
+
+// A buffer whose storage is borrowed from a BufferPool.
+// It holds no memory while it's empty.
+class PooledBuffer final
+    : public BufferReader<std::byte>
+    , public BufferWriter<std::byte>
+{
+public:
+    explicit PooledBuffer(BufferPool& pool) noexcept
+        : pool_{ pool }
+    {
+    }
+
+    PooledBuffer(PooledBuffer&&) = delete;
+    PooledBuffer(PooledBuffer const&) = delete;
+    PooledBuffer& operator=(PooledBuffer&&) = delete;
+    PooledBuffer& operator=(PooledBuffer const&) = delete;
+
+    ~PooledBuffer() override
+    {
+        release();
+    }
+
+    [[nodiscard]] size_t size() const noexcept override
+    {
+        return end_pos_ - begin_pos_;
+    }
+
+    [[nodiscard]] std::byte const* data() const noexcept override
+    {
+        return block_.data.get() + begin_pos_;
+    }
+
+    [[nodiscard]] constexpr auto capacity() const noexcept
+    {
+        return block_.size;
+    }
+
+    void drain(size_t n_bytes) override
+    {
+        begin_pos_ += std::min(n_bytes, size());
+
+        if (begin_pos_ == end_pos_) // empty; give the block back
+        {
+            release();
+        }
+    }
+
+    std::pair<std::byte*, size_t> reserve_space(size_t n_bytes) override
+    {
+        if (auto const free_at_end = block_.size - end_pos_; free_at_end < n_bytes)
+        {
+            auto const size = this->size();
+
+            if (auto const total_free = begin_pos_ + free_at_end; total_free >= n_bytes)
+            {
+                // move data so that all free space is at the end
+                std::copy_n(data(), size, block_.data.get());
+            }
+            else // even `total_free` is not enough, so get a bigger block
+            {
+                auto block = pool_.acquire(size + n_bytes);
+                std::copy_n(data(), size, block.data.get());
+                pool_.release(std::move(block_));
+                block_ = std::move(block);
+            }
+
+            begin_pos_ = 0U;
+            end_pos_ = size;
+        }
+
+        return { block_.data.get() + end_pos_, n_bytes };
+    }
+
+    void commit_space(size_t n_bytes) override
+    {
+        end_pos_ += n_bytes;
+    }
+
+private:
+    void release()
+    {
+        pool_.release(std::move(block_));
+        block_ = {};
+        begin_pos_ = end_pos_ = 0U;
+    }
+
+    BufferPool& pool_;
+    BufferPool::Block block_;
+    size_t begin_pos_ = {};
+    size_t end_pos_ = {};
+};
+
 } // namespace libtransmission
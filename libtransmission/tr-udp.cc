@@ -4,13 +4,20 @@
 
 #include <array>
 #include <cerrno>
+#include <cstddef> // for std::byte, size_t
+#include <cstdint> // for uint16_t
+#include <cstring> // for std::memcmp
 #include <string>
 
 #ifdef _WIN32
 #include <ws2tcpip.h>
 #else
 #include <netinet/in.h> // IPV6_V6ONLY, IPPROTO_IPV6
-#include <sys/socket.h> // setsockopt, SOL_SOCKET, bind
+#include <sys/socket.h> // setsockopt, SOL_SOCKET, bind, recvmmsg, sendmmsg
+#include <sys/uio.h> // iovec
+#ifdef HAVE_UDP_SEGMENT
+#include <netinet/udp.h> // UDP_SEGMENT
+#endif
 #endif
 
 #include <event2/event.h>
@@ -89,18 +96,52 @@ void set_socket_buffers(tr_socket_t fd, bool large)
     }
 }
 
-void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+// The largest datagram we read. The extra byte is for the DHT's '\0'.
+auto constexpr MaxDatagramSize = size_t{ 8192U };
+
+// How many datagrams to read with a single syscall, and how many to
+// read in total before giving the rest of the event loop a turn.
+auto constexpr RecvBatchSize = size_t{ 32U };
+auto constexpr MaxDatagramsPerWakeup = size_t{ 256U };
+
+// How many datagrams to send with a single syscall, and how many
+// to queue before sending them without waiting for the event loop.
+auto constexpr SendBatchSize = size_t{ 64U };
+auto constexpr MaxQueuedDatagrams = size_t{ 512U };
+
+#ifdef HAVE_UDP_SEGMENT
+// Linux's limits for one UDP GSO send
+auto constexpr MaxGsoSegments = size_t{ 64U };
+auto constexpr MaxGsoBytes = size_t{ 65000U };
+
+[[nodiscard]] bool enable_gso(tr_socket_t sock)
 {
-    TR_ASSERT(vsession != nullptr);
-    TR_ASSERT(type == EV_READ);
+    // setting a segment size of 0 does nothing,
+    // but it fails if the kernel doesn't support GSO
+    auto optval = int{ 0 };
+    return setsockopt(sock, SOL_UDP, UDP_SEGMENT, &optval, sizeof(optval)) == 0;
+}
+#endif
+
+void log_send_error(sockaddr const* to, int error_code)
+{
+    auto display_name = std::string{};
+    if (auto const addrport = tr_socket_address::from_sockaddr(to); addrport)
+    {
+        display_name = addrport->display_name();
+    }
 
-    auto buf = std::array<unsigned char, 8192>{};
-    auto from = sockaddr_storage{};
-    auto fromlen = socklen_t{ sizeof(from) };
-    auto* const from_sa = reinterpret_cast<sockaddr*>(&from);
+    tr_logAddWarn(fmt::format(
+        "Couldn't send to {address}: {errno} ({error})",
+        fmt::arg("address", display_name),
+        fmt::arg("errno", error_code),
+        fmt::arg("error", tr_strerror(error_code))));
+}
 
-    auto const rc = recvfrom(s, reinterpret_cast<char*>(std::data(buf)), std::size(buf) - 1, 0, from_sa, &fromlen);
-    if (rc <= 0)
+// `buf` must have room for one more byte after `buflen`
+void handle_datagram(tr_session* session, unsigned char* buf, size_t buflen, sockaddr* from_sa, socklen_t fromlen)
+{
+    if (buflen == 0U)
     {
         return;
     }
@@ -112,25 +153,24 @@ void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsessi
          is between 0 and 3
        - the above cannot be µTP packets, since these start with a 4-bit
          version number (1). */
-    auto* const session = static_cast<tr_session*>(vsession);
     if (buf[0] == 'd')
     {
         if (session->dht_)
         {
-            buf[rc] = '\0'; // libdht requires zero-terminated messages
-            session->dht_->handle_message(std::data(buf), rc, from_sa, fromlen);
+            buf[buflen] = '\0'; // libdht requires zero-terminated messages
+            session->dht_->handle_message(buf, buflen, from_sa, fromlen);
         }
     }
-    else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    else if (buflen >= 8U && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
     {
-        if (!session->announcer_udp_->handle_message(std::data(buf), rc))
+        if (!session->announcer_udp_->handle_message(buf, buflen))
         {
             tr_logAddTrace("Couldn't parse UDP tracker packet.");
         }
     }
     else if (session->allowsUTP() && (session->utp_context != nullptr))
     {
-        if (!tr_utpPacket(std::data(buf), rc, from_sa, fromlen, session))
+        if (!tr_utpPacket(buf, buflen, from_sa, fromlen, session))
         {
             tr_logAddTrace("Unexpected UDP packet");
         }
@@ -140,9 +180,35 @@ void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsessi
 
 // BEP-32 explains why we need to bind to one IPv6 address
 
+int tr_session::tr_udp_core::API::sendmmsg(
+    [[maybe_unused]] tr_socket_t sock,
+    [[maybe_unused]] mmsghdr* msgs,
+    [[maybe_unused]] unsigned int n_msgs,
+    [[maybe_unused]] int flags)
+{
+#ifdef HAVE_SENDMMSG
+    return ::sendmmsg(sock, msgs, n_msgs, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+tr_session::tr_udp_core::API& tr_session::tr_udp_core::default_api()
+{
+    static auto api = API{};
+    return api;
+}
+
 tr_session::tr_udp_core::tr_udp_core(tr_session& session, tr_port udp_port)
+    : tr_udp_core{ session, udp_port, default_api() }
+{
+}
+
+tr_session::tr_udp_core::tr_udp_core(tr_session& session, tr_port udp_port, API& api)
     : udp_port_{ udp_port }
     , session_{ session }
+    , api_{ api }
 {
     if (std::empty(udp_port_))
     {
@@ -174,8 +240,11 @@ tr_session::tr_udp_core::tr_udp_core(tr_session& session, tr_port udp_port)
             session_.setSocketTOS(sock, TR_AF_INET);
             set_socket_buffers(sock, session_.allowsUTP());
             udp4_socket_ = sock;
-            udp4_event_.reset(event_new(session_.event_base(), udp4_socket_, EV_READ | EV_PERSIST, event_callback, &session_));
+            udp4_event_.reset(event_new(session_.event_base(), udp4_socket_, EV_READ | EV_PERSIST, event_callback, this));
             event_add(udp4_event_.get(), nullptr);
+#ifdef HAVE_UDP_SEGMENT
+            udp4_gso_ = enable_gso(sock);
+#endif
         }
     }
 
@@ -208,8 +277,11 @@ tr_session::tr_udp_core::tr_udp_core(tr_session& session, tr_port udp_port)
             session_.setSocketTOS(sock, TR_AF_INET6);
             set_socket_buffers(sock, session_.allowsUTP());
             udp6_socket_ = sock;
-            udp6_event_.reset(event_new(session_.event_base(), udp6_socket_, EV_READ | EV_PERSIST, event_callback, &session_));
+            udp6_event_.reset(event_new(session_.event_base(), udp6_socket_, EV_READ | EV_PERSIST, event_callback, this));
             event_add(udp6_event_.get(), nullptr);
+#ifdef HAVE_UDP_SEGMENT
+            udp6_gso_ = enable_gso(sock);
+#endif
 
 #ifdef IPV6_V6ONLY
             // Since we always open an IPv4 socket on the same port,
@@ -219,10 +291,21 @@ tr_session::tr_udp_core::tr_udp_core(tr_session& session, tr_port udp_port)
 #endif
         }
     }
+
+    flush_event_.reset(event_new(session_.event_base(), -1, 0, flush_callback, this));
+
+#ifdef HAVE_RECVMMSG
+    recv_buf_.resize(RecvBatchSize * MaxDatagramSize);
+#else
+    recv_buf_.resize(MaxDatagramSize);
+#endif
 }
 
 tr_session::tr_udp_core::~tr_udp_core()
 {
+    flush();
+    flush_event_.reset();
+
     udp6_event_.reset();
 
     if (udp6_socket_ != TR_BAD_SOCKET)
@@ -240,39 +323,290 @@ tr_session::tr_udp_core::~tr_udp_core()
     }
 }
 
-void tr_session::tr_udp_core::sendto(void const* buf, size_t buflen, struct sockaddr const* to, socklen_t const tolen) const
+void tr_session::tr_udp_core::sendto(void const* buf, size_t buflen, struct sockaddr const* to, socklen_t const tolen)
 {
     auto const addrport = tr_socket_address::from_sockaddr(to);
     if (to->sa_family != AF_INET && to->sa_family != AF_INET6)
     {
-        errno = EAFNOSUPPORT;
+        log_send_error(to, EAFNOSUPPORT);
+        return;
     }
-    else if (auto const sock = to->sa_family == AF_INET ? udp4_socket_ : udp6_socket_; sock == TR_BAD_SOCKET)
+
+    auto const sock = to->sa_family == AF_INET ? udp4_socket_ : udp6_socket_;
+    if (sock == TR_BAD_SOCKET)
     {
         // don't warn on bad sockets; the system may not support IPv6
         return;
     }
-    else if (
-        addrport && addrport->address().is_global_unicast_address() &&
+
+    if (addrport && addrport->address().is_global_unicast_address() &&
         !session_.global_source_address(tr_af_to_ip_protocol(to->sa_family)))
     {
         // don't try to connect to a global address if we don't have connectivity to public internet
         return;
     }
-    else if (::sendto(sock, static_cast<char const*>(buf), buflen, 0, to, tolen) != -1)
+
+    if (buflen > MaxDatagramSize || tolen > sizeof(sockaddr_storage))
     {
+        log_send_error(to, EMSGSIZE);
         return;
     }
 
-    auto display_name = std::string{};
-    if (addrport)
+    if (std::empty(outgoing_) && flush_event_)
     {
-        display_name = addrport->display_name();
+        event_active(flush_event_.get(), EV_TIMEOUT, 0);
     }
 
-    tr_logAddWarn(fmt::format(
-        "Couldn't send to {address}: {errno} ({error})",
-        fmt::arg("address", display_name),
-        fmt::arg("errno", errno),
-        fmt::arg("error", tr_strerror(errno))));
+    auto datagram = OutgoingDatagram{};
+    std::memcpy(&datagram.to, to, tolen);
+    datagram.tolen = tolen;
+    datagram.sock = sock;
+    datagram.offset = std::size(outgoing_bytes_);
+    datagram.len = buflen;
+    outgoing_.emplace_back(datagram);
+    auto const* const bytes = static_cast<std::byte const*>(buf);
+    outgoing_bytes_.insert(std::end(outgoing_bytes_), bytes, bytes + buflen);
+
+    if (std::size(outgoing_) >= MaxQueuedDatagrams)
+    {
+        flush();
+    }
+}
+
+void tr_session::tr_udp_core::flush()
+{
+    // send each socket's datagrams in the order they were queued
+    for (size_t begin = 0, n = std::size(outgoing_); begin < n;)
+    {
+        auto const sock = outgoing_[begin].sock;
+        auto end = begin + 1U;
+        while (end < n && outgoing_[end].sock == sock)
+        {
+            ++end;
+        }
+
+        send_batched(sock, &outgoing_[begin], end - begin);
+        begin = end;
+    }
+
+    outgoing_.clear();
+    outgoing_bytes_.clear();
+}
+
+#ifdef HAVE_SENDMMSG
+
+void tr_session::tr_udp_core::send_batched(tr_socket_t sock, OutgoingDatagram const* datagrams, size_t n_datagrams)
+{
+    static auto constexpr MaxIovecs = SendBatchSize * 4U;
+
+    auto hdrs = std::array<mmsghdr, SendBatchSize>{};
+    auto iovs = std::array<iovec, MaxIovecs>{};
+    auto n_segments = std::array<size_t, SendBatchSize>{};
+
+#ifdef HAVE_UDP_SEGMENT
+    auto& gso = sock == udp4_socket_ ? udp4_gso_ : udp6_gso_;
+    struct alignas(cmsghdr) ControlBuf
+    {
+        std::array<char, CMSG_SPACE(sizeof(uint16_t))> buf;
+    };
+    auto controls = std::array<ControlBuf, SendBatchSize>{};
+
+    // With GSO, a run of same-sized datagrams to the same address can be
+    // sent as one message that the kernel splits up. Only the last one
+    // in the run may be shorter than the others.
+    auto const can_coalesce = [&gso](OutgoingDatagram const* first, OutgoingDatagram const* next, size_t n_segs, size_t n_bytes)
+    {
+        auto const* const prev = next - 1;
+        return gso && n_segs < MaxGsoSegments && n_bytes + next->len <= MaxGsoBytes && prev->len == first->len &&
+            next->len <= first->len && next->tolen == first->tolen && std::memcmp(&next->to, &first->to, first->tolen) == 0;
+    };
+#else
+    auto const can_coalesce = [](OutgoingDatagram const* /*first*/, OutgoingDatagram const* /*next*/, size_t, size_t)
+    {
+        return false;
+    };
+#endif
+
+    while (n_datagrams > 0U)
+    {
+        // build a batch of messages
+        auto n_msgs = size_t{};
+        auto n_iovs = size_t{};
+        for (auto const *walk = datagrams, *const end = datagrams + n_datagrams;
+             walk != end && n_msgs < SendBatchSize && n_iovs < MaxIovecs;)
+        {
+            hdrs[n_msgs] = {};
+            auto& msg = hdrs[n_msgs].msg_hdr;
+            msg.msg_name = const_cast<sockaddr_storage*>(&walk->to);
+            msg.msg_namelen = walk->tolen;
+            msg.msg_iov = &iovs[n_iovs];
+
+            auto const* const first = walk;
+            auto n_segs = size_t{};
+            auto n_bytes = size_t{};
+            do
+            {
+                iovs[n_iovs++] = { std::data(outgoing_bytes_) + walk->offset, walk->len };
+                n_bytes += walk->len;
+                ++n_segs;
+                ++walk;
+            } while (walk != end && n_iovs < MaxIovecs && can_coalesce(first, walk, n_segs, n_bytes));
+
+            msg.msg_iovlen = n_segs;
+            n_segments[n_msgs] = n_segs;
+
+#ifdef HAVE_UDP_SEGMENT
+            if (n_segs > 1U)
+            {
+                msg.msg_control = std::data(controls[n_msgs].buf);
+                msg.msg_controllen = sizeof(controls[n_msgs].buf);
+                auto* const cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                auto const segment_size = static_cast<uint16_t>(msg.msg_iov[0].iov_len);
+                std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            }
+#endif
+
+            ++n_msgs;
+        }
+
+        // If only some of the messages were sent, `errno` isn't set.
+        // The rest are sent on the next pass, and if one of them is
+        // the reason the kernel stopped, that's when we'll hear about it.
+        auto n_done = size_t{};
+        if (auto const rc = api_.sendmmsg(sock, std::data(hdrs), static_cast<unsigned int>(n_msgs), 0); rc >= 0)
+        {
+            for (size_t i = 0, n_sent = static_cast<size_t>(rc); i < n_sent; ++i)
+            {
+                n_done += n_segments[i];
+            }
+        }
+        else if (auto const error_code = errno; error_code == EINTR)
+        {
+            continue;
+        }
+#ifdef HAVE_UDP_SEGMENT
+        else if (n_segments[0] > 1U && (error_code == EIO || error_code == EINVAL))
+        {
+            // the kernel or the NIC can't do GSO after all;
+            // leave the datagrams queued and retry without it
+            tr_logAddDebug(fmt::format("Disabling UDP GSO: {} ({})", tr_strerror(error_code), error_code));
+            gso = false;
+        }
+#endif
+        else
+        {
+            log_send_error(reinterpret_cast<sockaddr const*>(&datagrams[0].to), error_code);
+            n_done = n_segments[0];
+        }
+
+        datagrams += n_done;
+        n_datagrams -= n_done;
+    }
+}
+
+#else
+
+void tr_session::tr_udp_core::send_batched(tr_socket_t sock, OutgoingDatagram const* datagrams, size_t n_datagrams)
+{
+    for (auto const *walk = datagrams, *const end = datagrams + n_datagrams; walk != end; ++walk)
+    {
+        auto const* const to = reinterpret_cast<sockaddr const*>(&walk->to);
+        auto const* const buf = reinterpret_cast<char const*>(std::data(outgoing_bytes_) + walk->offset);
+        if (::sendto(sock, buf, walk->len, 0, to, walk->tolen) == -1)
+        {
+            log_send_error(to, sockerrno);
+        }
+    }
+}
+
+#endif
+
+void tr_session::tr_udp_core::flush_callback(evutil_socket_t /*sock*/, short /*type*/, void* vself)
+{
+    static_cast<tr_udp_core*>(vself)->flush();
+}
+
+void tr_session::tr_udp_core::event_callback(evutil_socket_t sock, [[maybe_unused]] short type, void* vself)
+{
+    TR_ASSERT(vself != nullptr);
+    TR_ASSERT(type == EV_READ);
+
+    static_cast<tr_udp_core*>(vself)->on_readable(sock);
+}
+
+void tr_session::tr_udp_core::on_readable(tr_socket_t sock)
+{
+    auto* const session = &session_;
+
+#ifdef HAVE_RECVMMSG
+    auto hdrs = std::array<mmsghdr, RecvBatchSize>{};
+    auto iovs = std::array<iovec, RecvBatchSize>{};
+    auto froms = std::array<sockaddr_storage, RecvBatchSize>{};
+
+    for (size_t n_read = 0; n_read < MaxDatagramsPerWakeup;)
+    {
+        for (size_t i = 0; i < RecvBatchSize; ++i)
+        {
+            iovs[i] = { &recv_buf_[i * MaxDatagramSize], MaxDatagramSize - 1U };
+            hdrs[i] = {};
+            hdrs[i].msg_hdr.msg_name = &froms[i];
+            hdrs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        auto const rc = recvmmsg(sock, std::data(hdrs), RecvBatchSize, MSG_DONTWAIT, nullptr);
+        if (rc <= 0)
+        {
+            break;
+        }
+
+        auto const n_msgs = static_cast<size_t>(rc);
+        for (size_t i = 0; i < n_msgs; ++i)
+        {
+            auto& msg = hdrs[i].msg_hdr;
+            auto* const buf = static_cast<unsigned char*>(msg.msg_iov->iov_base);
+            handle_datagram(session, buf, hdrs[i].msg_len, static_cast<sockaddr*>(msg.msg_name), msg.msg_namelen);
+        }
+
+        n_read += n_msgs;
+        if (n_msgs < RecvBatchSize)
+        {
+            break;
+        }
+    }
+#else
+    auto* const buf = std::data(recv_buf_);
+
+    for (size_t n_read = 0; n_read < MaxDatagramsPerWakeup; ++n_read)
+    {
+        auto from = sockaddr_storage{};
+        auto fromlen = socklen_t{ sizeof(from) };
+        auto* const from_sa = reinterpret_cast<sockaddr*>(&from);
+
+#ifdef _WIN32
+        // no MSG_DONTWAIT, so read one datagram per wakeup
+        static auto constexpr Flags = 0;
+#else
+        static auto constexpr Flags = MSG_DONTWAIT;
+#endif
+        auto const rc = recvfrom(sock, reinterpret_cast<char*>(buf), MaxDatagramSize - 1U, Flags, from_sa, &fromlen);
+        if (rc <= 0)
+        {
+            break;
+        }
+
+        handle_datagram(session, buf, static_cast<size_t>(rc), from_sa, fromlen);
+
+        if (Flags == 0)
+        {
+            break;
+        }
+    }
+#endif
+
+    tr_utpSocketDrained(session);
 }
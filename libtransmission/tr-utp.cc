@@ -56,6 +56,10 @@ bool tr_utpPacket(
     return false;
 }
 
+void tr_utpSocketDrained(tr_session* /*ss*/)
+{
+}
+
 struct UTPSocket* utp_create_socket(struct_utp_context* /*ctx*/)
 {
     return nullptr;
@@ -212,12 +216,15 @@ void tr_utpInit(tr_session* session)
 
 bool tr_utpPacket(unsigned char const* buf, size_t buflen, struct sockaddr const* from, socklen_t fromlen, tr_session* ss)
 {
-    auto const ret = utp_process_udp(ss->utp_context, buf, buflen, from, fromlen);
-
-    /* utp_internal.cpp says "Should be called each time the UDP socket is drained" but it's tricky with libevent */
-    utp_issue_deferred_acks(ss->utp_context);
+    return utp_process_udp(ss->utp_context, buf, buflen, from, fromlen) != 0;
+}
 
-    return ret != 0;
+void tr_utpSocketDrained(tr_session* ss)
+{
+    if (ss->utp_context != nullptr)
+    {
+        utp_issue_deferred_acks(ss->utp_context);
+    }
 }
 
 void tr_utpClose(tr_session* session)
@@ -16,4 +16,7 @@ void tr_utpInit(tr_session* session);
 
 bool tr_utpPacket(unsigned char const* buf, size_t buflen, struct sockaddr const* from, socklen_t fromlen, tr_session* ss);
 
+// Call after a batch of packets has been passed to tr_utpPacket().
+void tr_utpSocketDrained(tr_session* ss);
+
 void tr_utpClose(tr_session*);
@@ -69,6 +69,19 @@ enum tr_verify_added_mode
     TR_VERIFY_ADDED_FULL = 1
 };
 
+enum tr_piece_selection
+{
+    // Prefer the pieces that the fewest peers have, so that they
+    // don't vanish from the swarm when their last peer leaves.
+    TR_PIECE_SELECTION_RAREST_FIRST = 0,
+
+    // Request pieces in order.
+    TR_PIECE_SELECTION_SEQUENTIAL = 1,
+
+    // Request pieces in random order.
+    TR_PIECE_SELECTION_RANDOM = 2
+};
+
 enum tr_preallocation_mode
 {
     TR_PREALLOCATE_NONE = 0,
@@ -1281,6 +1294,12 @@ struct tr_tracker_view
     int leecherCount; // number of leechers the tracker knows of, or -1 if unknown
     int seederCount; // number of seeders the tracker knows of, or -1 if unknown
 
+    // These describe the tracker's host and are shared by every torrent that uses it.
+    int hostLatency; // smoothed time in msec for the host to answer an announce or scrape, or -1 if unknown
+    size_t hostInFlight; // number of announces and scrapes sent to the host and not yet answered
+    size_t hostMaxInFlight; // how many announces and scrapes the host may have in flight right now
+    size_t hostQueueDepth; // number of due announces and scrapes held back because the host had no free slots
+
     size_t tier; // which tier this tracker is in
     tr_tracker_id_t id; // unique transmission-generated ID for use in libtransmission API
 
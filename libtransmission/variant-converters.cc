@@ -41,6 +41,12 @@ auto constexpr LogKeys = std::array<std::pair<std::string_view, tr_log_level>, 7
     { "warn", TR_LOG_WARN },
 } };
 
+auto constexpr PieceSelectionKeys = std::array<std::pair<std::string_view, tr_piece_selection>, 3>{ {
+    { "rarest-first", TR_PIECE_SELECTION_RAREST_FIRST },
+    { "sequential", TR_PIECE_SELECTION_SEQUENTIAL },
+    { "random", TR_PIECE_SELECTION_RANDOM },
+} };
+
 auto constexpr PreallocationKeys = std::array<std::pair<std::string_view, tr_preallocation_mode>, 5>{ {
     { "off", TR_PREALLOCATE_NONE },
     { "none", TR_PREALLOCATE_NONE },
@@ -227,6 +233,54 @@ tr_variant VariantConverter::save<tr_port>(tr_port const& val)
 
 // ---
 
+template<>
+std::optional<tr_piece_selection> VariantConverter::load<tr_piece_selection>(tr_variant const& src)
+{
+    static constexpr auto& Keys = PieceSelectionKeys;
+
+    if (auto const* val = src.get_if<std::string_view>(); val != nullptr)
+    {
+        auto const needle = tr_strlower(tr_strv_strip(*val));
+
+        for (auto const& [name, value] : Keys)
+        {
+            if (name == needle)
+            {
+                return value;
+            }
+        }
+    }
+
+    if (auto const* val = src.get_if<int64_t>(); val != nullptr)
+    {
+        for (auto const& [name, value] : Keys)
+        {
+            if (value == *val)
+            {
+                return value;
+            }
+        }
+    }
+
+    return {};
+}
+
+template<>
+tr_variant VariantConverter::save<tr_piece_selection>(tr_piece_selection const& val)
+{
+    for (auto const& [key, value] : PieceSelectionKeys)
+    {
+        if (value == val)
+        {
+            return key;
+        }
+    }
+
+    return static_cast<int64_t>(val);
+}
+
+// ---
+
 template<>
 std::optional<tr_preallocation_mode> VariantConverter::load<tr_preallocation_mode>(tr_variant const& src)
 {
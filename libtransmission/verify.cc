@@ -4,10 +4,15 @@
 // License text can be found in the licenses/ folder.
 
 #include <algorithm>
-#include <chrono>
-#include <ctime>
+#include <condition_variable>
+#include <cstddef> // size_t, std::byte
+#include <cstdint> // uint64_t
+#include <deque>
+#include <functional> // std::ref
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -18,138 +23,463 @@
 #include "libtransmission/completion.h"
 #include "libtransmission/crypto-utils.h"
 #include "libtransmission/file.h"
+#include "libtransmission/sha1.h"
 #include "libtransmission/verify.h"
 
-using namespace std::chrono_literals;
-
 namespace
 {
-auto constexpr SleepPerSecondDuringVerify = 100ms;
+namespace verify_helpers
+{
+// Pieces are read and hashed in chunks of about this size
+auto constexpr ChunkSize = size_t{ 4U * 1024U * 1024U };
 
-[[nodiscard]] auto current_time_secs()
+// A run of consecutive pieces
+struct Chunk
 {
-    return std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::steady_clock::now());
-}
-} // namespace
+    tr_piece_index_t begin_piece = {};
+    tr_piece_index_t end_piece = {};
+    std::vector<std::byte> buf;
+
+    // false for pieces that couldn't be read in full
+    std::vector<bool> was_read;
+
+    // set by HashWorkers
+    std::vector<bool> has_piece;
+    bool hashed = false;
+};
 
-void tr_verify_worker::verify_torrent(Mediator& verify_mediator, std::atomic<bool> const& abort_flag)
+// Reads a torrent's files front-to-back
+class TorrentReader
 {
-    verify_mediator.on_verify_started();
+public:
+    explicit TorrentReader(tr_verify_worker::Mediator const& mediator)
+        : mediator_{ mediator }
+        , metainfo_{ mediator.metainfo() }
+    {
+    }
 
-    tr_sys_file_t fd = TR_BAD_SYS_FILE;
-    uint64_t file_pos = 0U;
-    uint32_t piece_pos = 0U;
-    tr_file_index_t file_index = 0U;
-    tr_file_index_t prev_file_index = ~file_index;
-    tr_piece_index_t piece = 0U;
-    auto buffer = std::vector<std::byte>(1024U * 256U);
-    auto sha = tr_sha1::create();
-    auto last_slept_at = current_time_secs();
+    TorrentReader(TorrentReader&&) = delete;
+    TorrentReader(TorrentReader const&) = delete;
+    TorrentReader& operator=(TorrentReader&&) = delete;
+    TorrentReader& operator=(TorrentReader const&) = delete;
+
+    ~TorrentReader()
+    {
+        close_file();
+    }
 
-    auto const& metainfo = verify_mediator.metainfo();
-    while (!abort_flag && piece < metainfo.piece_count())
+    // Read the torrent's next `len` bytes into `setme`.
+    // @return false if any of them couldn't be read
+    [[nodiscard]] bool read(std::byte* setme, uint64_t len)
     {
-        auto const file_length = metainfo.file_size(file_index);
+        auto ok = true;
 
-        /* if we're starting a new file... */
-        if (file_pos == 0 && fd == TR_BAD_SYS_FILE && file_index != prev_file_index)
+        while (len > 0U && file_index_ < metainfo_.file_count())
         {
-            auto const found = verify_mediator.find_file(file_index);
-            fd = !found ? TR_BAD_SYS_FILE : tr_sys_file_open(found->c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0);
-            prev_file_index = file_index;
+            auto const file_size = metainfo_.file_size(file_index_);
+
+            // if we're finishing a file...
+            if (file_pos_ >= file_size)
+            {
+                close_file();
+                ++file_index_;
+                file_pos_ = 0U;
+                continue;
+            }
+
+            // if we're starting a new file...
+            if (!is_open_)
+            {
+                auto const found = mediator_.find_file(file_index_);
+                fd_ = !found ? TR_BAD_SYS_FILE : tr_sys_file_open(found->c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0);
+                is_open_ = true;
+            }
+
+            auto const n_wanted = std::min(len, file_size - file_pos_);
+            if (!read_from_file(setme, n_wanted))
+            {
+                ok = false;
+            }
+
+            setme += n_wanted;
+            len -= n_wanted;
+            file_pos_ += n_wanted;
         }
 
-        /* figure out how much we can read this pass */
-        uint64_t left_in_piece = metainfo.piece_size(piece) - piece_pos;
-        uint64_t left_in_file = file_length - file_pos;
-        uint64_t bytes_this_pass = std::min(left_in_file, left_in_piece);
-        bytes_this_pass = std::min(bytes_this_pass, uint64_t(std::size(buffer)));
+        return ok && len == 0U;
+    }
+
+private:
+    [[nodiscard]] bool read_from_file(std::byte* setme, uint64_t len) const
+    {
+        if (fd_ == TR_BAD_SYS_FILE)
+        {
+            return false;
+        }
 
-        /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+        auto pos = uint64_t{};
+        while (pos < len)
         {
-            auto num_read = uint64_t{};
-            if (tr_sys_file_read_at(fd, std::data(buffer), bytes_this_pass, file_pos, &num_read) && num_read > 0)
+            auto n_read = uint64_t{};
+            if (!tr_sys_file_read_at(fd_, setme + pos, len - pos, file_pos_ + pos, &n_read) || n_read == 0U)
             {
-                bytes_this_pass = num_read;
-                sha->add(std::data(buffer), bytes_this_pass);
-                tr_sys_file_advise(fd, file_pos, bytes_this_pass, TR_SYS_FILE_ADVICE_DONT_NEED);
+                break;
             }
+
+            pos += n_read;
+        }
+
+        if (pos > 0U)
+        {
+            tr_sys_file_advise(fd_, file_pos_, pos, TR_SYS_FILE_ADVICE_DONT_NEED);
+        }
+
+        return pos == len;
+    }
+
+    void close_file()
+    {
+        if (fd_ != TR_BAD_SYS_FILE)
+        {
+            tr_sys_file_close(fd_);
+            fd_ = TR_BAD_SYS_FILE;
+        }
+
+        is_open_ = false;
+    }
+
+    tr_verify_worker::Mediator const& mediator_;
+    tr_torrent_metainfo const& metainfo_;
+
+    tr_sys_file_t fd_ = TR_BAD_SYS_FILE;
+    bool is_open_ = false;
+    tr_file_index_t file_index_ = 0U;
+    uint64_t file_pos_ = 0U;
+};
+
+// Threads that hash the pieces in a torrent's chunks.
+// With no threads, chunks are hashed as soon as they're pushed.
+class HashWorkers
+{
+public:
+    HashWorkers(tr_torrent_metainfo const& metainfo, size_t n_threads)
+        : metainfo_{ metainfo }
+    {
+        threads_.reserve(n_threads);
+        for (size_t i = 0; i < n_threads; ++i)
+        {
+            threads_.emplace_back(&HashWorkers::thread_func, this);
+        }
+    }
+
+    HashWorkers(HashWorkers&&) = delete;
+    HashWorkers(HashWorkers const&) = delete;
+    HashWorkers& operator=(HashWorkers&&) = delete;
+    HashWorkers& operator=(HashWorkers const&) = delete;
+
+    ~HashWorkers()
+    {
+        {
+            auto const lock = std::lock_guard{ mutex_ };
+            stopping_ = true;
+        }
+
+        todo_cv_.notify_all();
+
+        for (auto& thread : threads_)
+        {
+            thread.join();
         }
+    }
 
-        /* move our offsets */
-        left_in_piece -= bytes_this_pass;
-        left_in_file -= bytes_this_pass;
-        piece_pos += bytes_this_pass;
-        file_pos += bytes_this_pass;
+    // `chunk` must stay valid until it's been hashed or `this` is destroyed
+    void push(Chunk* chunk)
+    {
+        if (std::empty(threads_))
+        {
+            hash(*chunk);
+            chunk->hashed = true;
+            return;
+        }
 
-        /* if we're finishing a piece... */
-        if (left_in_piece == 0)
         {
-            auto const has_piece = sha->finish() == metainfo.piece_hash(piece);
-            verify_mediator.on_piece_checked(piece, has_piece);
+            auto const lock = std::lock_guard{ mutex_ };
+            todo_.push_back(chunk);
+        }
+
+        todo_cv_.notify_one();
+    }
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (auto const now = current_time_secs(); last_slept_at != now)
+    [[nodiscard]] bool is_hashed(Chunk const& chunk) const
+    {
+        auto const lock = std::lock_guard{ mutex_ };
+        return chunk.hashed;
+    }
+
+    void wait(Chunk const& chunk) const
+    {
+        auto lock = std::unique_lock{ mutex_ };
+        hashed_cv_.wait(lock, [&chunk]() { return chunk.hashed; });
+    }
+
+private:
+    void thread_func()
+    {
+        auto lock = std::unique_lock{ mutex_ };
+
+        for (;;)
+        {
+            todo_cv_.wait(lock, [this]() { return stopping_ || !std::empty(todo_); });
+
+            if (stopping_)
             {
-                last_slept_at = now;
-                std::this_thread::sleep_for(SleepPerSecondDuringVerify);
+                return;
             }
 
-            sha->clear();
-            ++piece;
-            piece_pos = 0;
+            auto* const chunk = todo_.front();
+            todo_.pop_front();
+
+            lock.unlock();
+            hash(*chunk);
+            lock.lock();
+
+            chunk->hashed = true;
+            hashed_cv_.notify_all();
         }
+    }
 
-        /* if we're finishing a file... */
-        if (left_in_file == 0)
+    void hash(Chunk& chunk) const
+    {
+        // hash all the pieces that were read in one go,
+        // so that a multi-buffer SHA-1 kernel can do several at once
+        auto messages = std::vector<tr_sha1_message>{};
+        auto pieces = std::vector<tr_piece_index_t>{};
+        messages.reserve(chunk.end_piece - chunk.begin_piece);
+        pieces.reserve(chunk.end_piece - chunk.begin_piece);
+
+        auto const* walk = std::data(chunk.buf);
+        for (auto piece = chunk.begin_piece; piece < chunk.end_piece; ++piece)
         {
-            if (fd != TR_BAD_SYS_FILE)
+            auto const piece_size = metainfo_.piece_size(piece);
+
+            if (chunk.was_read[piece - chunk.begin_piece])
             {
-                tr_sys_file_close(fd);
-                fd = TR_BAD_SYS_FILE;
+                messages.push_back({ walk, piece_size });
+                pieces.push_back(piece);
             }
 
-            ++file_index;
-            file_pos = 0;
+            walk += piece_size;
+        }
+
+        auto digests = std::vector<tr_sha1_digest_t>(std::size(messages));
+        tr_sha1_digest_many(std::data(messages), std::size(messages), std::data(digests));
+
+        for (size_t i = 0, n = std::size(pieces); i < n; ++i)
+        {
+            chunk.has_piece[pieces[i] - chunk.begin_piece] = digests[i] == metainfo_.piece_hash(pieces[i]);
         }
     }
 
-    /* cleanup */
-    if (fd != TR_BAD_SYS_FILE)
+    tr_torrent_metainfo const& metainfo_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable todo_cv_;
+    mutable std::condition_variable hashed_cv_;
+    std::deque<Chunk*> todo_;
+    bool stopping_ = false;
+
+    std::vector<std::thread> threads_;
+};
+
+// Read the pieces in [begin_piece, piece_count) that fit into one chunk.
+void read_chunk(TorrentReader& reader, tr_torrent_metainfo const& metainfo, tr_piece_index_t begin_piece, Chunk& chunk)
+{
+    auto const piece_count = metainfo.piece_count();
+
+    // always take at least one piece, even if it's bigger than ChunkSize
+    auto end_piece = begin_piece + 1U;
+    auto n_bytes = uint64_t{ metainfo.piece_size(begin_piece) };
+    while (end_piece < piece_count && n_bytes + metainfo.piece_size(end_piece) <= ChunkSize)
     {
-        tr_sys_file_close(fd);
+        n_bytes += metainfo.piece_size(end_piece);
+        ++end_piece;
     }
 
-    verify_mediator.on_verify_done(abort_flag);
+    auto const n_pieces = end_piece - begin_piece;
+    chunk.begin_piece = begin_piece;
+    chunk.end_piece = end_piece;
+    chunk.buf.resize(n_bytes);
+    chunk.was_read.assign(n_pieces, false);
+    chunk.has_piece.assign(n_pieces, false);
+    chunk.hashed = false;
+
+    auto* walk = std::data(chunk.buf);
+    for (auto piece = begin_piece; piece < end_piece; ++piece)
+    {
+        auto const piece_size = metainfo.piece_size(piece);
+        chunk.was_read[piece - begin_piece] = reader.read(walk, piece_size);
+        walk += piece_size;
+    }
 }
+} // namespace verify_helpers
+} // namespace
 
-void tr_verify_worker::verify_thread_func()
+void tr_verify_worker::verify_torrent(Mediator& verify_mediator, std::atomic<bool> const& abort_flag, size_t n_hash_threads)
 {
-    for (;;)
+    using namespace verify_helpers;
+
+    verify_mediator.on_verify_started();
+
     {
+        auto const& metainfo = verify_mediator.metainfo();
+        auto const piece_count = metainfo.piece_count();
+
+        // Chunks that are being read or hashed, in piece order.
+        // There's one for each hash thread plus one for the reader
+        // so that reading the next chunk overlaps with hashing.
+        auto const max_in_flight = n_hash_threads + 1U;
+        auto in_flight = std::deque<std::unique_ptr<Chunk>>{};
+        auto spare = std::unique_ptr<Chunk>{};
+
+        auto reader = TorrentReader{ verify_mediator };
+        auto hash_workers = HashWorkers{ metainfo, n_hash_threads };
+
+        // report the oldest chunk's pieces and keep it for reuse
+        auto const pop_front = [&]()
         {
-            auto const lock = std::lock_guard{ verify_mutex_ };
+            auto chunk = std::move(in_flight.front());
+            in_flight.pop_front();
 
-            if (stop_current_)
+            hash_workers.wait(*chunk);
+            if (!abort_flag)
             {
-                stop_current_ = false;
-                stop_current_cv_.notify_one();
+                verify_mediator.on_pieces_checked(chunk->begin_piece, chunk->has_piece);
             }
 
-            if (std::empty(todo_))
+            spare = std::move(chunk);
+        };
+
+        for (tr_piece_index_t piece = 0U; !abort_flag && piece < piece_count;)
+        {
+            while (!std::empty(in_flight) &&
+                   (std::size(in_flight) >= max_in_flight || hash_workers.is_hashed(*in_flight.front())))
             {
-                current_node_.reset();
-                verify_thread_id_.reset();
-                return;
+                pop_front();
             }
 
-            current_node_ = std::move(todo_.extract(std::begin(todo_)).value());
+            auto chunk = spare ? std::move(spare) : std::make_unique<Chunk>();
+            read_chunk(reader, metainfo, piece, *chunk);
+            piece = chunk->end_piece;
+
+            hash_workers.push(chunk.get());
+            in_flight.push_back(std::move(chunk));
+        }
+
+        while (!abort_flag && !std::empty(in_flight))
+        {
+            pop_front();
+        }
+
+        // `hash_workers` is destroyed before `in_flight`,
+        // so it's safe to leave unhashed chunks there when aborting
+    }
+
+    verify_mediator.on_verify_done(abort_flag);
+}
+
+void tr_verify_worker::start_verifies()
+{
+    reap_done();
+
+    auto const is_running = [](Active const& active)
+    {
+        return !active.done;
+    };
+
+    while (static_cast<size_t>(std::count_if(std::begin(active_), std::end(active_), is_running)) < MaxConcurrentVerifies)
+    {
+        // find the first queued torrent whose device isn't already being read.
+        // If its device is unknown, its thread looks it up and checks again.
+        auto const iter = std::find_if(
+            std::begin(todo_),
+            std::end(todo_),
+            [this](Node const& node) { return !node.device_ || !is_device_busy(*node.device_, nullptr); });
+        if (iter == std::end(todo_))
+        {
+            return;
+        }
+
+        auto& active = active_.emplace_back(std::move(todo_.extract(iter).value()));
+        active.thread = std::thread(&tr_verify_worker::verify_thread_func, this, std::ref(active));
+    }
+}
+
+bool tr_verify_worker::is_device_busy(std::string const& device, Active const* self) const
+{
+    return std::any_of(
+        std::begin(active_),
+        std::end(active_),
+        [&device, self](Active const& active)
+        { return &active != self && !active.done && active.node.device_ && *active.node.device_ == device; });
+}
+
+void tr_verify_worker::reap_done()
+{
+    auto const self = std::this_thread::get_id();
+
+    for (auto iter = std::begin(active_); iter != std::end(active_);)
+    {
+        // A finished thread doesn't touch verify_mutex_ again after
+        // setting `done`, so it's safe to join it while holding the lock.
+        if (iter->done && iter->thread.get_id() != self)
+        {
+            iter->thread.join();
+            iter = active_.erase(iter);
+        }
+        else
+        {
+            ++iter;
         }
+    }
+}
+
+void tr_verify_worker::verify_thread_func(Active& active)
+{
+    if (!active.node.device_)
+    {
+        // this may hit the filesystem, so do it before taking the lock
+        auto device = active.node.mediator_->device();
+
+        auto const lock = std::lock_guard{ verify_mutex_ };
 
-        verify_torrent(*current_node_->mediator_, stop_current_);
+        active.node.device_ = std::move(device);
+
+        if (active.abort || is_device_busy(*active.node.device_, &active))
+        {
+            if (active.abort)
+            {
+                active.node.mediator_->on_verify_done(true /*aborted*/);
+            }
+            else // wait in the queue for the device like everyone else
+            {
+                todo_.insert(std::move(active.node));
+            }
+
+            active.done = true;
+            active_done_cv_.notify_all();
+            start_verifies();
+            return;
+        }
     }
+
+    verify_torrent(*active.node.mediator_, active.abort, n_hash_threads_);
+
+    auto const lock = std::lock_guard{ verify_mutex_ };
+
+    active.done = true;
+    active_done_cv_.notify_all();
+
+    start_verifies();
 }
 
 void tr_verify_worker::add(std::unique_ptr<Mediator> mediator, tr_priority_t priority)
@@ -159,22 +489,32 @@ void tr_verify_worker::add(std::unique_ptr<Mediator> mediator, tr_priority_t pri
     mediator->on_verify_queued();
     todo_.emplace(std::move(mediator), priority);
 
-    if (!verify_thread_id_)
-    {
-        auto thread = std::thread(&tr_verify_worker::verify_thread_func, this);
-        verify_thread_id_ = thread.get_id();
-        thread.detach();
-    }
+    start_verifies();
 }
 
 void tr_verify_worker::remove(tr_sha1_digest_t const& info_hash)
 {
     auto lock = std::unique_lock(verify_mutex_);
 
-    if (current_node_ && current_node_->matches(info_hash))
+    auto const is_running = [this, &info_hash]()
+    {
+        return std::any_of(
+            std::begin(active_),
+            std::end(active_),
+            [&info_hash](Active const& active) { return !active.done && active.node.matches(info_hash); });
+    };
+
+    if (is_running())
     {
-        stop_current_ = true;
-        stop_current_cv_.wait(lock, [this]() { return !stop_current_; });
+        for (auto& active : active_)
+        {
+            if (!active.done && active.node.matches(info_hash))
+            {
+                active.abort = true;
+            }
+        }
+
+        active_done_cv_.wait(lock, [&is_running]() { return !is_running(); });
     }
     else if (auto const iter = std::find_if(
                  std::begin(todo_),
@@ -185,20 +525,43 @@ void tr_verify_worker::remove(tr_sha1_digest_t const& info_hash)
         iter->mediator_->on_verify_done(true /*aborted*/);
         todo_.erase(iter);
     }
+
+    // the torrent's verify thread, if any, is finished by now
+    reap_done();
 }
 
 tr_verify_worker::~tr_verify_worker()
 {
+    auto lock = std::unique_lock{ verify_mutex_ };
+
+    todo_.clear();
+
+    for (auto& active : active_)
     {
-        auto const lock = std::lock_guard{ verify_mutex_ };
-        stop_current_ = true;
-        todo_.clear();
+        active.abort = true;
     }
 
-    while (verify_thread_id_.has_value())
+    active_done_cv_.wait(
+        lock,
+        [this]() { return std::all_of(std::begin(active_), std::end(active_), [](Active const& active) { return active.done; }); });
+    reap_done();
+}
+
+std::string tr_verify_worker::Mediator::device() const
+{
+    // Torrents on different devices can be verified in parallel.
+    // Files that don't exist yet are skipped; if none do, the torrent
+    // shares the "unknown device" slot with any others like it.
+    auto const& metainfo = this->metainfo();
+    for (tr_file_index_t file = 0U, n_files = metainfo.file_count(); file < n_files; ++file)
     {
-        std::this_thread::sleep_for(20ms);
+        if (auto const found = find_file(file); found)
+        {
+            return tr_sys_path_get_device(*found);
+        }
     }
+
+    return {};
 }
 
 int tr_verify_worker::Node::compare(Node const& that) const noexcept
@@ -11,6 +11,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstddef> // size_t
 #include <cstdint>
 #include <functional>
 #include <list>
@@ -18,10 +19,17 @@
 #include <mutex>
 #include <optional>
 #include <set>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "libtransmission/torrent-metainfo.h"
 
+// Checks torrents' local data against their piece hashes.
+//
+// Each torrent is read front-to-back by one thread while a few others
+// hash the pieces it's already read. Torrents on different devices are
+// verified at the same time, since they don't compete for the same disk.
 class tr_verify_worker
 {
 public:
@@ -33,9 +41,15 @@ public:
         [[nodiscard]] virtual tr_torrent_metainfo const& metainfo() const = 0;
         [[nodiscard]] virtual std::optional<std::string> find_file(tr_file_index_t file_index) const = 0;
 
+        // where the torrent's data is, or empty if unknown.
+        // Called from a verify thread, since it may touch the filesystem.
+        [[nodiscard]] virtual std::string device() const;
+
         virtual void on_verify_queued() = 0;
         virtual void on_verify_started() = 0;
-        virtual void on_piece_checked(tr_piece_index_t piece, bool has_piece) = 0;
+        // called from a verify thread, in piece order, for each run of
+        // pieces [begin_piece, begin_piece + std::size(has_pieces))
+        virtual void on_pieces_checked(tr_piece_index_t begin_piece, std::vector<bool> has_pieces) = 0;
         virtual void on_verify_done(bool aborted) = 0;
     };
 
@@ -45,6 +59,17 @@ public:
 
     void remove(tr_sha1_digest_t const& info_hash);
 
+    // How many threads hash each torrent's pieces.
+    // If zero, the pieces are hashed by the thread that reads them.
+    // Takes effect the next time a torrent starts verifying.
+    void set_hash_thread_count(size_t n_threads) noexcept
+    {
+        n_hash_threads_ = n_threads;
+    }
+
+    // the most torrents to verify at once, even if they're all on different devices
+    static auto constexpr MaxConcurrentVerifies = size_t{ 4U };
+
 private:
     struct Node
     {
@@ -67,20 +92,55 @@ private:
         }
 
         std::unique_ptr<Mediator> mediator_;
+
+        // where the torrent's data is, or empty if unknown.
+        // Looked up by the node's verify thread; nullopt until then.
+        std::optional<std::string> device_;
+
         tr_priority_t priority_;
     };
 
-    static void verify_torrent(Mediator& verify_mediator, std::atomic<bool> const& abort_flag);
+    // a torrent that's being verified right now
+    struct Active
+    {
+        explicit Active(Node&& node_in) noexcept
+            : node{ std::move(node_in) }
+        {
+        }
+
+        Node node;
+        std::atomic<bool> abort = false;
+
+        // set by `thread` when it's finished with `node`.
+        // verify_mutex_ must be locked.
+        bool done = false;
+
+        std::thread thread;
+    };
+
+    static void verify_torrent(Mediator& verify_mediator, std::atomic<bool> const& abort_flag, size_t n_hash_threads);
+
+    // Start verifying queued torrents whose devices aren't busy,
+    // or whose devices haven't been looked up yet.
+    // verify_mutex_ must be locked.
+    void start_verifies();
+
+    // @return true if a running verify, other than `self`, is reading `device`.
+    // verify_mutex_ must be locked.
+    [[nodiscard]] bool is_device_busy(std::string const& device, Active const* self) const;
+
+    // Join and forget finished verifies, except the calling thread's own.
+    // verify_mutex_ must be locked.
+    void reap_done();
 
-    void verify_thread_func();
+    void verify_thread_func(Active& active);
 
     std::mutex verify_mutex_;
 
     std::set<Node> todo_;
-    std::optional<Node> current_node_;
+    std::list<Active> active_;
 
-    std::optional<std::thread::id> verify_thread_id_;
+    std::condition_variable active_done_cv_;
 
-    std::atomic<bool> stop_current_ = false;
-    std::condition_variable stop_current_cv_;
+    std::atomic<size_t> n_hash_threads_ = 2U;
 };
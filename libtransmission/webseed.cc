@@ -354,8 +354,9 @@ public:
 
     void write_block_func()
     {
-        if (auto const* const tor = tr_torrentFindFromId(session_, tor_id_); tor != nullptr)
+        if (auto* const tor = tr_torrentFindFromId(session_, tor_id_); tor != nullptr)
         {
+            tor->on_block_data(block_, std::data(*data_));
             session_->cache->write_block(tor_id_, block_, std::move(data_));
             webseed_->publish(tr_peer_event::GotBlock(tor->block_info(), block_));
         }
@@ -0,0 +1,301 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <cstddef> // size_t
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility> // std::move, std::swap
+#include <vector>
+
+#include "libtransmission/file.h"
+#include "libtransmission/session-thread.h"
+#include "libtransmission/tr-assert.h"
+#include "libtransmission/worker-pool.h"
+
+namespace
+{
+[[nodiscard]] int first_error(tr_worker_pool::Ops const& ops) noexcept
+{
+    for (auto const& op : ops)
+    {
+        if (op.err != 0)
+        {
+            return op.err;
+        }
+    }
+
+    return 0;
+}
+} // namespace
+
+tr_worker_pool::tr_worker_pool(tr_session_thread& session_thread, size_t n_threads)
+    : session_thread_{ session_thread }
+{
+    start_threads(n_threads);
+}
+
+tr_worker_pool::~tr_worker_pool()
+{
+    stop_threads();
+
+    // drop any undelivered callbacks rather than running them here:
+    // the objects they point to may already be gone.
+    auto const lock = std::lock_guard{ completions_->mutex };
+    completions_->done.clear();
+}
+
+void tr_worker_pool::submit(Work&& work, Done&& done, tr_torrent_id_t tor_id)
+{
+    if (std::empty(threads_))
+    {
+        auto const err = work();
+
+        if (done)
+        {
+            done(err);
+        }
+
+        return;
+    }
+
+    push_job(Job{ std::move(work), {}, std::move(done), tor_id });
+}
+
+void tr_worker_pool::submit(std::shared_ptr<Ops> ops, Done&& done, tr_torrent_id_t tor_id)
+{
+    if (std::empty(threads_))
+    {
+        auto jobs = std::vector<Job>{};
+        jobs.push_back(Job{ {}, std::move(ops), {} });
+        run_batch(jobs);
+
+        if (done)
+        {
+            done(first_error(*jobs.front().ops));
+        }
+
+        return;
+    }
+
+    push_job(Job{ {}, std::move(ops), std::move(done), tor_id });
+}
+
+void tr_worker_pool::push_job(Job&& job)
+{
+    {
+        auto const lock = std::lock_guard{ queue_mutex_ };
+        if (job.tor_id != tr_torrent_id_t{})
+        {
+            ++n_pending_by_torrent_[job.tor_id];
+        }
+        queue_.push_back(std::move(job));
+    }
+
+    queue_cv_.notify_one();
+}
+
+void tr_worker_pool::wait_idle()
+{
+    auto lock = std::unique_lock{ queue_mutex_ };
+    idle_cv_.wait(lock, [this]() { return std::empty(queue_) && n_running_ == 0U; });
+}
+
+void tr_worker_pool::wait_idle(tr_torrent_id_t tor_id)
+{
+    auto lock = std::unique_lock{ queue_mutex_ };
+    idle_cv_.wait(lock, [this, tor_id]() { return n_pending_by_torrent_.count(tor_id) == 0U; });
+}
+
+size_t tr_worker_pool::pending() const
+{
+    auto const lock = std::lock_guard{ queue_mutex_ };
+    return std::size(queue_) + n_running_;
+}
+
+void tr_worker_pool::set_thread_count(size_t n_threads)
+{
+    if (n_threads == thread_count())
+    {
+        return;
+    }
+
+    stop_threads();
+
+    if (session_thread_.am_in_session_thread())
+    {
+        completions_->deliver();
+    }
+
+    start_threads(n_threads);
+}
+
+void tr_worker_pool::start_threads(size_t n_threads)
+{
+    TR_ASSERT(std::empty(threads_));
+
+    stopping_ = false;
+    threads_.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        threads_.emplace_back(&tr_worker_pool::worker_thread_func, this);
+    }
+}
+
+void tr_worker_pool::stop_threads()
+{
+    if (std::empty(threads_))
+    {
+        return;
+    }
+
+    // let the workers finish everything that's already been queued
+    wait_idle();
+
+    {
+        auto const lock = std::lock_guard{ queue_mutex_ };
+        stopping_ = true;
+    }
+
+    queue_cv_.notify_all();
+
+    for (auto& thread : threads_)
+    {
+        thread.join();
+    }
+
+    threads_.clear();
+}
+
+void tr_worker_pool::worker_thread_func()
+{
+    auto lock = std::unique_lock{ queue_mutex_ };
+
+    for (;;)
+    {
+        queue_cv_.wait(lock, [this]() { return stopping_ || !std::empty(queue_); });
+
+        if (std::empty(queue_))
+        {
+            TR_ASSERT(stopping_);
+            return;
+        }
+
+        auto jobs = std::vector<Job>{};
+        jobs.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+
+        // gather up any other batchable jobs that are waiting
+        if (jobs.front().ops)
+        {
+            auto n_ops = std::size(*jobs.front().ops);
+            while (!std::empty(queue_) && queue_.front().ops && n_ops + std::size(*queue_.front().ops) <= MaxBatchOps)
+            {
+                n_ops += std::size(*queue_.front().ops);
+                jobs.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+        }
+
+        n_running_ += std::size(jobs);
+        lock.unlock();
+
+        if (jobs.front().ops)
+        {
+            run_batch(jobs);
+        }
+
+        for (auto& job : jobs)
+        {
+            auto const err = job.ops ? first_error(*job.ops) : job.work();
+            if (job.done)
+            {
+                on_job_done(std::move(job.done), err);
+            }
+        }
+
+        lock.lock();
+        n_running_ -= std::size(jobs);
+        auto notify = std::empty(queue_) && n_running_ == 0U;
+        for (auto const& job : jobs)
+        {
+            if (auto const iter = n_pending_by_torrent_.find(job.tor_id); iter != std::end(n_pending_by_torrent_))
+            {
+                if (--iter->second == 0U)
+                {
+                    n_pending_by_torrent_.erase(iter);
+                    notify = true;
+                }
+            }
+        }
+
+        if (notify)
+        {
+            idle_cv_.notify_all();
+        }
+    }
+}
+
+void tr_worker_pool::run_batch(std::vector<Job>& jobs)
+{
+    if (std::size(jobs) == 1U)
+    {
+        auto& ops = *jobs.front().ops;
+        tr_sys_file_io_batch(std::data(ops), std::size(ops));
+        return;
+    }
+
+    auto batch = Ops{};
+    for (auto const& job : jobs)
+    {
+        batch.insert(std::end(batch), std::begin(*job.ops), std::end(*job.ops));
+    }
+
+    tr_sys_file_io_batch(std::data(batch), std::size(batch));
+
+    auto walk = std::begin(batch);
+    for (auto& job : jobs)
+    {
+        for (auto& op : *job.ops)
+        {
+            op.err = walk->err;
+            ++walk;
+        }
+    }
+}
+
+void tr_worker_pool::on_job_done(Done&& done, int err)
+{
+    auto lock = std::unique_lock{ completions_->mutex };
+    completions_->done.emplace_back(std::move(done), err);
+
+    // batch the callbacks so that a burst of finished jobs
+    // only costs the session thread a single wakeup
+    if (completions_->deliver_scheduled)
+    {
+        return;
+    }
+
+    completions_->deliver_scheduled = true;
+    lock.unlock();
+
+    session_thread_.run([completions = completions_]() { completions->deliver(); });
+}
+
+void tr_worker_pool::Completions::deliver()
+{
+    auto todo = std::vector<std::pair<Done, int>>{};
+
+    {
+        auto const lock = std::lock_guard{ mutex };
+        std::swap(todo, done);
+        deliver_scheduled = false;
+    }
+
+    for (auto& [func, err] : todo)
+    {
+        func(err);
+    }
+}
@@ -0,0 +1,134 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility> // std::pair
+#include <vector>
+
+#include "libtransmission/transmission.h" // tr_torrent_id_t
+
+#include "libtransmission/file.h" // tr_sys_file_io_op
+
+class tr_session_thread;
+
+// A pool of worker threads for work that would otherwise stall the
+// session thread, e.g. blocking disk reads and writes or the math for
+// encrypted handshakes. The session has one pool for each kind of work
+// so that neither can starve the other.
+//
+// Each job has two parts: `work`, which is run in a worker thread and
+// returns 0 on success or an errno on failure; and `done`, which gets
+// that return value and is always run in the session thread.
+//
+// Jobs can also be a list of reads and writes. Those are handed to
+// tr_sys_file_io_batch() together with any other such jobs waiting in
+// the queue, so that they can reach the kernel in a single syscall.
+//
+// Jobs can be tagged with the torrent that they belong to, so that
+// wait_idle() can wait for that torrent's jobs without also waiting
+// behind everyone else's.
+//
+// If the pool has no threads, jobs are run synchronously in submit().
+class tr_worker_pool
+{
+public:
+    using Work = std::function<int()>;
+    using Done = std::function<void(int)>;
+    using Ops = std::vector<tr_sys_file_io_op>;
+
+    tr_worker_pool(tr_session_thread& session_thread, size_t n_threads);
+    ~tr_worker_pool();
+
+    tr_worker_pool(tr_worker_pool&&) = delete;
+    tr_worker_pool(tr_worker_pool const&) = delete;
+    tr_worker_pool& operator=(tr_worker_pool&&) = delete;
+    tr_worker_pool& operator=(tr_worker_pool const&) = delete;
+
+    void submit(Work&& work, Done&& done = {}, tr_torrent_id_t tor_id = {});
+
+    // `ops` are run with tr_sys_file_io_batch(), and `done` is called
+    // with the first error, if any. The ops' buffers and handles must
+    // stay valid until then.
+    void submit(std::shared_ptr<Ops> ops, Done&& done, tr_torrent_id_t tor_id = {});
+
+    // Block until every submitted job's `work` has finished.
+    // Their `done` callbacks are still run later in the session thread.
+    void wait_idle();
+
+    // Like wait_idle(), but only waits for the jobs tagged with `tor_id`.
+    void wait_idle(tr_torrent_id_t tor_id);
+
+    // Changing the thread count waits for all submitted work to finish.
+    // When called in the session thread, the pending `done` callbacks
+    // are run before this returns. Setting it to zero is how the pool
+    // is shut down.
+    void set_thread_count(size_t n_threads);
+
+    [[nodiscard]] size_t thread_count() const noexcept
+    {
+        return std::size(threads_);
+    }
+
+    // @return how many jobs are queued or running
+    [[nodiscard]] size_t pending() const;
+
+private:
+    struct Job
+    {
+        Work work;
+        std::shared_ptr<Ops> ops;
+        Done done;
+        tr_torrent_id_t tor_id = {};
+    };
+
+    // how many ops to gather from the queue into one batch
+    static auto constexpr MaxBatchOps = size_t{ 64U };
+
+    // Finished jobs waiting for their `done` callbacks to be run.
+    // This is shared with the callbacks that we post to the session
+    // thread so that they're harmless if they outlive the pool.
+    struct Completions
+    {
+        void deliver();
+
+        std::mutex mutex;
+        std::vector<std::pair<Done, int>> done;
+        bool deliver_scheduled = false;
+    };
+
+    void worker_thread_func();
+    void run_batch(std::vector<Job>& jobs);
+    void start_threads(size_t n_threads);
+    void stop_threads();
+    void on_job_done(Done&& done, int err);
+    void push_job(Job&& job);
+
+    tr_session_thread& session_thread_;
+
+    std::shared_ptr<Completions> const completions_ = std::make_shared<Completions>();
+
+    mutable std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<Job> queue_;
+    size_t n_running_ = 0U;
+    std::map<tr_torrent_id_t, size_t> n_pending_by_torrent_;
+    bool stopping_ = false;
+
+    std::vector<std::thread> threads_;
+};
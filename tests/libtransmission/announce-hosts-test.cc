@@ -0,0 +1,154 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+#include <libtransmission/announce-hosts.h>
+#include <libtransmission/interned-string.h>
+
+#include "gtest/gtest.h"
+
+class AnnounceHostsTest : public ::testing::Test
+{
+protected:
+    tr_interned_string const host_{ "tracker.example.com:80" };
+    tr_announce_hosts hosts_;
+
+    // start `n` requests at `started_msec` and finish them all at `done_msec`
+    void roundTrip(size_t n, uint64_t started_msec, uint64_t done_msec, bool succeeded)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            ASSERT_TRUE(hosts_.try_start_request(host_, started_msec));
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            hosts_.on_request_done(host_, started_msec, done_msec, succeeded);
+        }
+    }
+
+    [[nodiscard]] double window() const
+    {
+        auto const* const host = hosts_.get(host_);
+        return host != nullptr ? host->max_in_flight : 0.0;
+    }
+};
+
+TEST_F(AnnounceHostsTest, slowStartThenAdditiveIncrease)
+{
+    EXPECT_EQ(nullptr, hosts_.get(host_));
+
+    // slow start: each success adds a slot, so a full window doubles it
+    roundTrip(4, 1000, 1100, true);
+    EXPECT_DOUBLE_EQ(8.0, window());
+    roundTrip(8, 2000, 2100, true);
+    EXPECT_DOUBLE_EQ(16.0, window());
+
+    // a failure ends slow start
+    roundTrip(1, 3000, 3100, false);
+    EXPECT_DOUBLE_EQ(8.0, window());
+
+    // additive increase: a full window of successes adds about one slot
+    roundTrip(8, 4000, 4100, true);
+    EXPECT_NEAR(9.0, window(), 0.1);
+    roundTrip(8, 5000, 5100, true);
+    EXPECT_NEAR(10.0, window(), 0.2);
+}
+
+TEST_F(AnnounceHostsTest, failureHalvesWindowOncePerRoundTrip)
+{
+    roundTrip(4, 1000, 1100, true);
+    EXPECT_DOUBLE_EQ(8.0, window());
+
+    // several requests that were in flight together only back off once
+    roundTrip(3, 2000, 2500, false);
+    EXPECT_DOUBLE_EQ(4.0, window());
+
+    // but a request started after the backoff can back off again
+    roundTrip(1, 2600, 2700, false);
+    EXPECT_DOUBLE_EQ(2.0, window());
+
+    // and the window never closes entirely
+    for (uint64_t now = 3000; now < 4000; now += 100)
+    {
+        roundTrip(1, now, now + 50, false);
+    }
+    EXPECT_DOUBLE_EQ(1.0, window());
+}
+
+TEST_F(AnnounceHostsTest, slowResponseHalvesWindow)
+{
+    roundTrip(4, 1000, 1100, true);
+    EXPECT_DOUBLE_EQ(8.0, window());
+
+    // slower than the latency floor and SlowLatencyFactor times the fastest response
+    auto const slow_msec = static_cast<uint64_t>(tr_announce_hosts::SlowLatencyFloorMsec) + 1U;
+    roundTrip(1, 2000, 2000 + slow_msec, true);
+    EXPECT_DOUBLE_EQ(4.0, window());
+}
+
+TEST_F(AnnounceHostsTest, windowIsCapped)
+{
+    auto n_slots = static_cast<size_t>(tr_announce_hosts::InitialRequestsPerHost);
+    for (uint64_t now = 1000; now < 100000; now += 1000)
+    {
+        roundTrip(n_slots, now, now + 100, true);
+        n_slots = static_cast<size_t>(window());
+    }
+
+    EXPECT_DOUBLE_EQ(tr_announce_hosts::MaxRequestsPerHost, window());
+}
+
+TEST_F(AnnounceHostsTest, queueDrainsWhenASlotFrees)
+{
+    auto constexpr Now = uint64_t{ 1000 };
+
+    for (size_t i = 0; i < static_cast<size_t>(tr_announce_hosts::InitialRequestsPerHost); ++i)
+    {
+        EXPECT_TRUE(hosts_.try_start_request(host_, Now));
+    }
+
+    // the host is full, so more requests are held back and counted
+    EXPECT_FALSE(hosts_.try_start_request(host_, Now));
+    EXPECT_FALSE(hosts_.try_start_request(host_, Now));
+    EXPECT_EQ(2U, hosts_.get(host_)->queue_depth);
+    EXPECT_EQ(4U, hosts_.get(host_)->in_flight);
+
+    // a response frees a slot for the next one
+    hosts_.on_request_done(host_, Now, Now + 100, true);
+    EXPECT_EQ(3U, hosts_.get(host_)->in_flight);
+    EXPECT_TRUE(hosts_.try_start_request(host_, Now + 100));
+    EXPECT_EQ(4U, hosts_.get(host_)->in_flight);
+
+    hosts_.clear_queue_depths();
+    EXPECT_EQ(0U, hosts_.get(host_)->queue_depth);
+}
+
+TEST_F(AnnounceHostsTest, pruneForgetsIdleHosts)
+{
+    auto const busy = tr_interned_string{ "busy.example.com:443" };
+
+    // a host with a request in flight is kept no matter how long it's been
+    EXPECT_TRUE(hosts_.try_start_request(busy, 1000));
+    roundTrip(4, 1000, 1100, true);
+    EXPECT_EQ(2U, hosts_.size());
+    hosts_.prune(1000 + 10 * tr_announce_hosts::IdleMsec);
+    EXPECT_NE(nullptr, hosts_.get(busy));
+    EXPECT_EQ(nullptr, hosts_.get(host_));
+    EXPECT_EQ(1U, hosts_.size());
+
+    // an idle host is kept until it's been idle for IdleMsec
+    roundTrip(4, 2000, 2100, true);
+    hosts_.prune(2100 + tr_announce_hosts::IdleMsec - 1U);
+    EXPECT_NE(nullptr, hosts_.get(host_));
+    hosts_.prune(2100 + tr_announce_hosts::IdleMsec);
+    EXPECT_EQ(nullptr, hosts_.get(host_));
+
+    // and when it comes back, it starts over at the default window
+    roundTrip(1, 2000 + 2 * tr_announce_hosts::IdleMsec, 2100 + 2 * tr_announce_hosts::IdleMsec, false);
+    EXPECT_DOUBLE_EQ(tr_announce_hosts::InitialRequestsPerHost / 2, window());
+}
@@ -0,0 +1,127 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <ctime> // time_t
+#include <vector>
+
+#include <libtransmission/announce-queue.h>
+
+#include "gtest/gtest.h"
+
+using AnnounceQueueTest = ::testing::Test;
+using Key = tr_announce_queue::Key;
+
+namespace
+{
+
+auto takeDue(tr_announce_queue& queue, time_t now)
+{
+    auto ret = std::vector<Key>{};
+    queue.take_due(now, ret);
+    return ret;
+}
+
+} // namespace
+
+TEST_F(AnnounceQueueTest, takesOnlyDueKeysSoonestFirst)
+{
+    auto const a = Key{ 1, 0, false };
+    auto const b = Key{ 2, 0, false };
+    auto const c = Key{ 3, 0, true };
+    auto const d = Key{ 4, 1, true };
+
+    auto queue = tr_announce_queue{};
+    queue.schedule(c, 300);
+    queue.schedule(a, 100);
+    queue.schedule(d, 400);
+    queue.schedule(b, 200);
+    EXPECT_EQ(4U, std::size(queue));
+
+    EXPECT_TRUE(std::empty(takeDue(queue, 99)));
+    EXPECT_EQ((std::vector<Key>{ a, b, c }), takeDue(queue, 300));
+    EXPECT_EQ(0, queue.when(a));
+    EXPECT_EQ(400, queue.when(d));
+    EXPECT_EQ(1U, std::size(queue));
+
+    EXPECT_EQ((std::vector<Key>{ d }), takeDue(queue, 1000));
+    EXPECT_EQ(0U, std::size(queue));
+}
+
+TEST_F(AnnounceQueueTest, rescheduleEarlierSupersedesOldEntry)
+{
+    auto const key = Key{ 1, 0, false };
+
+    auto queue = tr_announce_queue{};
+    queue.schedule(key, 100);
+    queue.schedule(key, 50);
+    EXPECT_EQ(50, queue.when(key));
+    EXPECT_EQ(2U, std::size(queue));
+
+    EXPECT_EQ((std::vector<Key>{ key }), takeDue(queue, 60));
+
+    // the stale entry at 100 is dropped rather than returned again
+    EXPECT_TRUE(std::empty(takeDue(queue, 200)));
+    EXPECT_EQ(0U, std::size(queue));
+}
+
+TEST_F(AnnounceQueueTest, rescheduleLaterSupersedesOldEntry)
+{
+    auto const key = Key{ 1, 0, true };
+
+    auto queue = tr_announce_queue{};
+    queue.schedule(key, 50);
+    queue.schedule(key, 100);
+    EXPECT_EQ(100, queue.when(key));
+
+    EXPECT_TRUE(std::empty(takeDue(queue, 60)));
+    EXPECT_EQ(1U, std::size(queue));
+    EXPECT_EQ((std::vector<Key>{ key }), takeDue(queue, 100));
+}
+
+TEST_F(AnnounceQueueTest, sameTimeIsNotQueuedTwice)
+{
+    auto const key = Key{ 1, 0, false };
+
+    auto queue = tr_announce_queue{};
+    queue.schedule(key, 100);
+    queue.schedule(key, 100);
+    EXPECT_EQ(1U, std::size(queue));
+    EXPECT_EQ((std::vector<Key>{ key }), takeDue(queue, 100));
+
+    // once taken, the key can be queued again for the same time
+    queue.schedule(key, 100);
+    EXPECT_EQ((std::vector<Key>{ key }), takeDue(queue, 100));
+}
+
+TEST_F(AnnounceQueueTest, zeroIsNotScheduled)
+{
+    auto const key = Key{ 1, 0, false };
+
+    auto queue = tr_announce_queue{};
+    queue.schedule(key, 0);
+    EXPECT_EQ(0U, std::size(queue));
+    EXPECT_EQ(0, queue.when(key));
+
+    // and it doesn't unschedule a pending entry either
+    queue.schedule(key, 100);
+    queue.schedule(key, 0);
+    EXPECT_EQ(100, queue.when(key));
+}
+
+TEST_F(AnnounceQueueTest, announceAndScrapeAreQueuedSeparately)
+{
+    auto const announce = Key{ 1, 2, false };
+    auto const scrape = Key{ 1, 2, true };
+
+    auto queue = tr_announce_queue{};
+    queue.schedule(announce, 100);
+    queue.schedule(scrape, 200);
+    EXPECT_EQ(100, queue.when(announce));
+    EXPECT_EQ(200, queue.when(scrape));
+
+    // rescheduling one doesn't make the other stale
+    queue.schedule(scrape, 50);
+    EXPECT_EQ((std::vector<Key>{ scrape, announce }), takeDue(queue, 1000));
+}
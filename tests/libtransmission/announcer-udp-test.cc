@@ -13,6 +13,7 @@
 #include <deque>
 #include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <tuple>
 #include <utility>
@@ -83,6 +84,11 @@ protected:
             return {};
         }
 
+        [[nodiscard]] std::string_view config_dir() const override
+        {
+            return config_dir_;
+        }
+
         struct Sent
         {
             Sent() = default;
@@ -101,6 +107,8 @@ protected:
 
         std::deque<Sent> sent_;
 
+        std::string config_dir_;
+
         std::unique_ptr<event_base, void (*)(event_base*)> const event_base_;
     };
 
@@ -185,6 +193,27 @@ protected:
         return std::make_pair(transaction_id, info_hashes);
     }
 
+    [[nodiscard]] static bool sendScrapeResponse(
+        tr_announcer_udp& announcer,
+        uint32_t transaction_id,
+        tr_scrape_response_row const* rows,
+        size_t n_rows)
+    {
+        auto buf = MessageBuffer{};
+        buf.add_uint32(ScrapeAction);
+        buf.add_uint32(transaction_id);
+        for (size_t i = 0; i < n_rows; ++i)
+        {
+            buf.add_uint32(rows[i].seeders.value_or(-1));
+            buf.add_uint32(rows[i].downloads.value_or(-1));
+            buf.add_uint32(rows[i].leechers.value_or(-1));
+        }
+        auto const response_size = std::size(buf);
+        auto arr = std::array<uint8_t, 1024>{};
+        buf.to_buf(std::data(arr), response_size);
+        return announcer.handle_message(std::data(arr), response_size);
+    }
+
     [[nodiscard]] static auto waitForAnnouncerToSendMessage(MockMediator& mediator)
     {
         libtransmission::test::waitFor(mediator.eventBase(), [&mediator]() { return !std::empty(mediator.sent_); });
@@ -447,6 +476,149 @@ TEST_F(AnnouncerUdpTest, canMultiScrape)
     expectEqual(expected_response, *response);
 }
 
+TEST_F(AnnouncerUdpTest, packsScrapesToTheSameTrackerIntoOneDatagram)
+{
+    auto mediator = MockMediator{};
+    auto announcer = tr_announcer_udp::create(mediator);
+    auto upkeep_timer = createUpkeepTimer(mediator, announcer);
+
+    // two scrapes to the same tracker, e.g. with different passkeys
+    auto [request_a, expected_a] = buildSimpleScrapeRequestAndResponse();
+    auto [request_b, expected_b] = buildSimpleScrapeRequestAndResponse();
+    request_b.scrape_url = "https://127.0.0.1/scrape?passkey=fnord"sv;
+    expected_b.scrape_url = request_b.scrape_url;
+    expected_b.rows[0].seeders = 4;
+    expected_b.rows[0].leechers = 5;
+    expected_b.rows[0].downloads = 6;
+
+    auto response_a = std::optional<tr_scrape_response>{};
+    auto response_b = std::optional<tr_scrape_response>{};
+    announcer->scrape(request_a, [&response_a](tr_scrape_response const& resp) { response_a = resp; });
+    announcer->scrape(request_b, [&response_b](tr_scrape_response const& resp) { response_b = resp; });
+
+    // Announcer will request a connection. Verify and grant the request
+    auto connect_transaction_id = parseConnectionRequest(waitForAnnouncerToSendMessage(mediator));
+    auto const connection_id = sendConnectionResponse(*announcer, connect_transaction_id);
+
+    // Both scrapes should have been sent in a single datagram
+    auto const [scrape_transaction_id, info_hashes] = parseScrapeRequest(
+        waitForAnnouncerToSendMessage(mediator),
+        connection_id);
+    EXPECT_TRUE(std::empty(mediator.sent_));
+    auto const expected_info_hashes = std::vector<tr_sha1_digest_t>{ request_a.info_hash[0], request_b.info_hash[0] };
+    EXPECT_EQ(expected_info_hashes, info_hashes);
+
+    // Have the tracker respond to the request
+    auto const rows = std::array<tr_scrape_response_row, 2>{ expected_a.rows[0], expected_b.rows[0] };
+    EXPECT_TRUE(sendScrapeResponse(*announcer, scrape_transaction_id, std::data(rows), std::size(rows)));
+
+    // Confirm that each scrape got its own part of the response
+    EXPECT_TRUE(response_a.has_value());
+    EXPECT_TRUE(response_b.has_value());
+    assert(response_a.has_value() && response_b.has_value());
+    expectEqual(expected_a, *response_a);
+    expectEqual(expected_b, *response_b);
+}
+
+TEST_F(AnnouncerUdpTest, splitsScrapesThatDontFitInOneDatagram)
+{
+    auto mediator = MockMediator{};
+    auto announcer = tr_announcer_udp::create(mediator);
+    auto upkeep_timer = createUpkeepTimer(mediator, announcer);
+
+    // two full multiscrapes. That's more than BEP 15 allows in one datagram.
+    auto expected = std::array<tr_scrape_response, 2>{};
+    for (size_t i = 0; i < std::size(expected); ++i)
+    {
+        auto& response = expected[i];
+        response.did_connect = true;
+        response.did_timeout = false;
+        response.scrape_url = DefaultScrapeUrl;
+        response.row_count = TR_MULTISCRAPE_MAX;
+        for (int row = 0; row < response.row_count; ++row)
+        {
+            auto const n = static_cast<int64_t>(i * 1000U + row);
+            response.rows[row] = { tr_rand_obj<tr_sha1_digest_t>(), n, n + 1, n + 2, std::nullopt };
+        }
+    }
+
+    auto responses = std::array<std::optional<tr_scrape_response>, 2>{};
+    for (size_t i = 0; i < std::size(expected); ++i)
+    {
+        announcer->scrape(
+            buildScrapeRequestFromResponse(expected[i]),
+            [&responses, i](tr_scrape_response const& resp) { responses[i] = resp; });
+    }
+
+    // Announcer will request a connection. Verify and grant the request
+    auto connect_transaction_id = parseConnectionRequest(waitForAnnouncerToSendMessage(mediator));
+    auto const connection_id = sendConnectionResponse(*announcer, connect_transaction_id);
+
+    // The info hashes should be split across two datagrams, the first one full
+    libtransmission::test::waitFor(mediator.eventBase(), [&mediator]() { return std::size(mediator.sent_) >= 2U; });
+    EXPECT_EQ(2U, std::size(mediator.sent_));
+    auto const [transaction_id_1, info_hashes_1] = parseScrapeRequest(mediator.sent_[0].buf_, connection_id);
+    auto const [transaction_id_2, info_hashes_2] = parseScrapeRequest(mediator.sent_[1].buf_, connection_id);
+    EXPECT_EQ(74U, std::size(info_hashes_1));
+    EXPECT_EQ(2U * TR_MULTISCRAPE_MAX - 74U, std::size(info_hashes_2));
+
+    auto all_rows = std::vector<tr_scrape_response_row>{};
+    for (auto const& response : expected)
+    {
+        all_rows.insert(std::end(all_rows), std::begin(response.rows), std::begin(response.rows) + response.row_count);
+    }
+
+    auto sent_info_hashes = info_hashes_1;
+    sent_info_hashes.insert(std::end(sent_info_hashes), std::begin(info_hashes_2), std::end(info_hashes_2));
+    ASSERT_EQ(std::size(all_rows), std::size(sent_info_hashes));
+    for (size_t i = 0; i < std::size(all_rows); ++i)
+    {
+        EXPECT_EQ(all_rows[i].info_hash, sent_info_hashes[i]);
+    }
+
+    // Answer the second datagram first. The second scrape is in both,
+    // so neither scrape is finished until the first datagram is answered too.
+    auto const n_rows_1 = std::size(info_hashes_1);
+    EXPECT_TRUE(sendScrapeResponse(*announcer, transaction_id_2, std::data(all_rows) + n_rows_1, std::size(info_hashes_2)));
+    EXPECT_FALSE(responses[0].has_value());
+    EXPECT_FALSE(responses[1].has_value());
+
+    EXPECT_TRUE(sendScrapeResponse(*announcer, transaction_id_1, std::data(all_rows), n_rows_1));
+    for (size_t i = 0; i < std::size(expected); ++i)
+    {
+        EXPECT_TRUE(responses[i].has_value());
+        assert(responses[i].has_value());
+        expectEqual(expected[i], *responses[i]);
+    }
+}
+
+TEST_F(AnnouncerUdpTest, reusesConnectionIdAfterRestart)
+{
+    auto const sandbox = libtransmission::test::Sandbox{};
+    auto mediator = MockMediator{};
+    mediator.config_dir_ = sandbox.path();
+    auto announcer = tr_announcer_udp::create(mediator);
+    auto upkeep_timer = createUpkeepTimer(mediator, announcer);
+
+    // connect to the tracker and scrape
+    auto [request, expected_response] = buildSimpleScrapeRequestAndResponse();
+    announcer->scrape(request, [](tr_scrape_response const& /*response*/) {});
+    auto connect_transaction_id = parseConnectionRequest(waitForAnnouncerToSendMessage(mediator));
+    auto const connection_id = sendConnectionResponse(*announcer, connect_transaction_id);
+    auto [scrape_transaction_id, info_hashes] = parseScrapeRequest(waitForAnnouncerToSendMessage(mediator), connection_id);
+    expectEqual(request, info_hashes);
+
+    // restart the announcer
+    announcer.reset();
+    announcer = tr_announcer_udp::create(mediator);
+
+    // Since the connection ID hasn't expired, the new announcer
+    // should skip the `connect` step, going straight to the scrape.
+    announcer->scrape(request, [](tr_scrape_response const& /*response*/) {});
+    std::tie(scrape_transaction_id, info_hashes) = parseScrapeRequest(waitForAnnouncerToSendMessage(mediator), connection_id);
+    expectEqual(request, info_hashes);
+}
+
 TEST_F(AnnouncerUdpTest, canHandleScrapeError)
 {
     // build the expected response
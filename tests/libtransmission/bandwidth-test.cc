@@ -0,0 +1,350 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef> // size_t, std::byte
+#include <cstdint> // uint64_t
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include <event2/util.h>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/bandwidth.h>
+#include <libtransmission/net.h>
+#include <libtransmission/peer-io.h>
+#include <libtransmission/peer-socket.h>
+#include <libtransmission/session.h>
+#include <libtransmission/utils.h>
+
+#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+#ifdef _WIN32
+#define LOCAL_SOCKETPAIR_AF AF_INET
+#else
+#define LOCAL_SOCKETPAIR_AF AF_UNIX
+#endif
+
+namespace libtransmission::test
+{
+
+class BandwidthTest : public SessionTest
+{
+protected:
+    // A peer-io with `n_bytes` of piece data queued up,
+    // and the other end of its socket to see what it sent
+    struct Peer
+    {
+        std::shared_ptr<tr_peerIo> io;
+        evutil_socket_t remote = TR_BAD_SOCKET;
+    };
+
+    Peer makePeer(tr_bandwidth& parent, size_t n_bytes)
+    {
+        auto sockpair = std::array<evutil_socket_t, 2>{ TR_BAD_SOCKET, TR_BAD_SOCKET };
+        EXPECT_EQ(0, evutil_socketpair(LOCAL_SOCKETPAIR_AF, SOCK_STREAM, 0, std::data(sockpair))) << tr_strerror(errno);
+        EXPECT_EQ(0, evutil_make_socket_nonblocking(sockpair[1]));
+
+        auto peer = Peer{};
+        peer.io = tr_peerIo::new_incoming(session_, &parent, tr_peer_socket(session_, PeerSockAddr, sockpair[0]));
+        peer.remote = sockpair[1];
+        remotes_.push_back(peer.remote);
+
+        if (n_bytes > 0U)
+        {
+            auto const payload = std::vector<std::byte>(n_bytes);
+            peer.io->write_bytes(std::data(payload), std::size(payload), true /*is_piece_data*/);
+        }
+
+        return peer;
+    }
+
+    // @return how many bytes the peers have sent since the last call
+    static size_t drain(std::vector<Peer> const& peers)
+    {
+        auto n_total = size_t{};
+
+        for (auto const& peer : peers)
+        {
+            auto buf = std::array<char, 65536>{};
+            for (;;)
+            {
+                auto const n_read = recv(peer.remote, std::data(buf), std::size(buf), 0);
+                if (n_read <= 0)
+                {
+                    break;
+                }
+
+                n_total += static_cast<size_t>(n_read);
+            }
+        }
+
+        return n_total;
+    }
+
+    void runInSessionThread(std::function<void()> func)
+    {
+        auto done = std::atomic<bool>{};
+        session_->runInSessionThread(
+            [&func, &done]()
+            {
+                func();
+                done = true;
+            });
+        EXPECT_TRUE(waitFor([&done]() { return done.load(); }, 5000));
+    }
+
+    void TearDown() override
+    {
+        for (auto const sock : remotes_)
+        {
+            evutil_closesocket(sock);
+        }
+
+        SessionTest::TearDown();
+    }
+
+    // A limited root: it holds a quarter second's worth of bytes
+    // in its bucket, so the first wake() can move this many.
+    static auto constexpr RootBurst = size_t{ 480000U };
+    static auto constexpr RootSpeed = tr_bytes_per_second_t{ RootBurst * 4U };
+
+    static void limit(tr_bandwidth& bandwidth, tr_direction dir, tr_bytes_per_second_t speed)
+    {
+        bandwidth.set_desired_speed_bytes_per_second(dir, speed);
+        bandwidth.set_limited(dir, true);
+    }
+
+private:
+    tr_socket_address const PeerSockAddr{ *tr_address::from_string("127.0.0.1"sv), tr_port::from_host(8080) };
+
+    std::vector<evutil_socket_t> remotes_;
+};
+
+TEST_F(BandwidthTest, classesShareByWeight)
+{
+    runInSessionThread(
+        [this]()
+        {
+            auto root = tr_bandwidth{};
+            limit(root, TR_UP, RootSpeed);
+
+            auto light = tr_bandwidth{ &root };
+            light.set_weight(1U);
+            auto heavy = tr_bandwidth{ &root };
+            heavy.set_weight(3U);
+
+            // more than enough data for both classes to use the whole burst
+            auto light_peers = std::vector<Peer>{};
+            auto heavy_peers = std::vector<Peer>{};
+            for (int i = 0; i < 8; ++i)
+            {
+                light_peers.push_back(makePeer(light, 100000U));
+                heavy_peers.push_back(makePeer(heavy, 100000U));
+            }
+
+            root.wake(tr_time_msec());
+
+            auto const n_light = drain(light_peers);
+            auto const n_heavy = drain(heavy_peers);
+
+            // together they use the root's burst...
+            EXPECT_GE(n_light + n_heavy, RootBurst * 95U / 100U);
+            EXPECT_LE(n_light + n_heavy, RootBurst * 105U / 100U);
+
+            // ...and split it 3:1, give or take a round
+            EXPECT_GT(n_light, 0U);
+            auto const ratio = static_cast<double>(n_heavy) / static_cast<double>(n_light);
+            EXPECT_GT(ratio, 2.5);
+            EXPECT_LT(ratio, 3.5);
+        });
+}
+
+TEST_F(BandwidthTest, classBelowGuaranteeGoesFirst)
+{
+    runInSessionThread(
+        [this]()
+        {
+            auto root = tr_bandwidth{};
+            limit(root, TR_UP, RootSpeed);
+
+            // the guaranteed class has a tiny weight,
+            // but it hasn't reached its guaranteed speed yet
+            auto guaranteed = tr_bandwidth{ &root };
+            guaranteed.set_weight(1U);
+            guaranteed.set_guaranteed_speed_bytes_per_second(TR_UP, RootSpeed / 2U);
+            auto heavy = tr_bandwidth{ &root };
+            heavy.set_weight(tr_bandwidth::MaxWeight);
+
+            static auto constexpr GuaranteedBytes = size_t{ 200000U };
+            auto guaranteed_peers = std::vector<Peer>{};
+            guaranteed_peers.push_back(makePeer(guaranteed, GuaranteedBytes / 2U));
+            guaranteed_peers.push_back(makePeer(guaranteed, GuaranteedBytes / 2U));
+            auto heavy_peers = std::vector<Peer>{};
+            for (int i = 0; i < 8; ++i)
+            {
+                heavy_peers.push_back(makePeer(heavy, 100000U));
+            }
+
+            root.wake(tr_time_msec());
+
+            // the guaranteed class sends everything it has
+            // before the heavy class gets the rest
+            EXPECT_EQ(GuaranteedBytes, drain(guaranteed_peers));
+            auto const n_heavy = drain(heavy_peers);
+            EXPECT_GE(n_heavy, (RootBurst - GuaranteedBytes) * 95U / 100U);
+            EXPECT_LE(n_heavy, (RootBurst - GuaranteedBytes) * 105U / 100U);
+        });
+}
+
+TEST_F(BandwidthTest, idleClassGivesUpItsShare)
+{
+    runInSessionThread(
+        [this]()
+        {
+            auto root = tr_bandwidth{};
+            limit(root, TR_UP, RootSpeed);
+
+            // `idle` would get 3/4 of the bandwidth, but only has a little to send
+            auto idle = tr_bandwidth{ &root };
+            idle.set_weight(3U);
+            auto busy = tr_bandwidth{ &root };
+            busy.set_weight(1U);
+
+            static auto constexpr IdleBytes = size_t{ 6000U };
+            auto idle_peers = std::vector<Peer>{};
+            idle_peers.push_back(makePeer(idle, IdleBytes));
+            auto busy_peers = std::vector<Peer>{};
+            for (int i = 0; i < 8; ++i)
+            {
+                busy_peers.push_back(makePeer(busy, 100000U));
+            }
+
+            root.wake(tr_time_msec());
+
+            // the busy class gets the rest of the burst, not just its 1/4
+            EXPECT_EQ(IdleBytes, drain(idle_peers));
+            auto const n_busy = drain(busy_peers);
+            EXPECT_GE(n_busy, (RootBurst - IdleBytes) * 95U / 100U);
+            EXPECT_LE(n_busy, (RootBurst - IdleBytes) * 105U / 100U);
+        });
+}
+
+TEST_F(BandwidthTest, refillIsCappedAtBurst)
+{
+    static auto constexpr Speed = tr_bytes_per_second_t{ 100000U };
+    static auto constexpr Burst = size_t{ Speed / 4U }; // a quarter second's worth
+
+    auto bandwidth = tr_bandwidth{};
+    limit(bandwidth, TR_UP, Speed);
+
+    // a new bucket starts out full, but no fuller
+    EXPECT_EQ(Burst, bandwidth.clamp(TR_UP, Burst * 10U));
+
+    // spend it all
+    bandwidth.notify_bandwidth_consumed(TR_UP, Burst, true /*is_piece_data*/, tr_time_msec());
+    EXPECT_LT(bandwidth.clamp(TR_UP, Burst * 10U), Burst / 2U);
+
+    // idling for longer than the burst window doesn't save up more than a burst
+    std::this_thread::sleep_for(600ms);
+    EXPECT_EQ(Burst, bandwidth.clamp(TR_UP, Burst * 10U));
+
+    // non-piece data doesn't spend tokens
+    bandwidth.notify_bandwidth_consumed(TR_UP, Burst, false /*is_piece_data*/, tr_time_msec());
+    EXPECT_EQ(Burst, bandwidth.clamp(TR_UP, Burst * 10U));
+
+    // slow limits still get a usable burst
+    auto slow = tr_bandwidth{};
+    limit(slow, TR_UP, 1000U);
+    EXPECT_EQ(4096U, slow.clamp(TR_UP, 100000U));
+}
+
+TEST_F(BandwidthTest, throttledPeerWakesWhenTokensAllow)
+{
+    runInSessionThread(
+        [this]()
+        {
+            // 30 bytes per msec, so waiting for a 3000-byte increment takes 100 msec
+            static auto constexpr Speed = tr_bytes_per_second_t{ 30000U };
+            static auto constexpr ExpectedWaitMSec = uint64_t{ 100U };
+
+            auto root = tr_bandwidth{};
+            limit(root, TR_UP, Speed);
+
+            auto delays = std::vector<uint64_t>{};
+            root.set_wakeup_callback([&delays](uint64_t delay_msec) { delays.push_back(delay_msec); });
+
+            auto peer = makePeer(root, 0U);
+
+            // empty the bucket, then have the peer wait for it to refill
+            auto const now = tr_time_msec();
+            root.notify_bandwidth_consumed(TR_UP, root.clamp(TR_UP, Speed), true /*is_piece_data*/, now);
+            peer.io->bandwidth().wait_for_bandwidth(TR_UP);
+            EXPECT_EQ(1U, root.backlog(TR_UP));
+            ASSERT_EQ(1U, std::size(delays));
+            EXPECT_LE(delays.back(), ExpectedWaitMSec);
+            EXPECT_GE(delays.back(), ExpectedWaitMSec - 5U);
+            auto const wait_msec = delays.back();
+
+            // waking too early leaves the peer waiting, and asks to be woken again when it's due
+            root.wake(now + wait_msec / 2U);
+            EXPECT_EQ(1U, root.backlog(TR_UP));
+            ASSERT_EQ(2U, std::size(delays));
+            EXPECT_LT(delays.back(), wait_msec);
+            EXPECT_GT(delays.back(), 0U);
+
+            root.wake(now + wait_msec - 5U);
+            EXPECT_EQ(1U, root.backlog(TR_UP));
+
+            // once its tokens are there, it's woken
+            root.wake(now + wait_msec + 5U);
+            EXPECT_EQ(0U, root.backlog(TR_UP));
+        });
+}
+
+TEST_F(BandwidthTest, longRunRateConvergesToLimit)
+{
+    static auto constexpr Speed = tr_bytes_per_second_t{ 200000U };
+    static auto constexpr Burst = size_t{ Speed / 4U };
+
+    auto bandwidth = tr_bandwidth{};
+    limit(bandwidth, TR_UP, Speed);
+
+    // a greedy sender that sends whatever it's allowed to, every 10 msec
+    auto const begin = tr_time_msec();
+    auto n_sent = size_t{};
+    auto now = begin;
+    while (now - begin < 1500U)
+    {
+        auto const n_bytes = bandwidth.clamp(TR_UP, Speed);
+        bandwidth.notify_bandwidth_consumed(TR_UP, n_bytes, true /*is_piece_data*/, now);
+        n_sent += n_bytes;
+
+        std::this_thread::sleep_for(10ms);
+        now = tr_time_msec();
+    }
+
+    // after its first burst, it's held to the limit
+    auto const expected = static_cast<double>(Speed) * static_cast<double>(now - begin) / 1000.0;
+    auto const rate_sent = static_cast<double>(n_sent - Burst);
+    EXPECT_LE(rate_sent, expected * 1.05);
+    EXPECT_GE(rate_sent, expected * 0.9);
+}
+
+} // namespace libtransmission::test
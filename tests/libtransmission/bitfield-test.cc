@@ -506,3 +506,54 @@ TEST(Bitfield, intersects)
     EXPECT_TRUE(a.intersects(b));
     EXPECT_TRUE(b.intersects(a));
 }
+
+TEST(Bitfield, countIntersection)
+{
+    auto a = tr_bitfield{ 1000 };
+    auto b = tr_bitfield{ 1000 };
+
+    a.set_has_all();
+    b.set_has_none();
+    EXPECT_EQ(0U, a.count_intersection(b));
+    EXPECT_EQ(0U, b.count_intersection(a));
+
+    a.set_has_all();
+    b.set_has_all();
+    EXPECT_EQ(std::size(a), a.count_intersection(b));
+    EXPECT_EQ(std::size(a), b.count_intersection(a));
+
+    a.set_has_all();
+    b.set_has_none();
+    b.set_span(100U, 300U);
+    EXPECT_EQ(200U, a.count_intersection(b));
+    EXPECT_EQ(200U, b.count_intersection(a));
+
+    // check odd spans so that both the word-sized and byte-sized parts get used
+    for (size_t begin = 0; begin < 80U; begin += 7U)
+    {
+        for (size_t end = begin; end < std::size(a); end += 97U)
+        {
+            a.set_has_none();
+            b.set_has_none();
+            a.set_span(begin, end);
+            for (size_t i = 0; i < std::size(b); i += 3U)
+            {
+                b.set(i);
+            }
+
+            auto expected = size_t{};
+            for (size_t i = 0; i < std::size(a); ++i)
+            {
+                if (a.test(i) && b.test(i))
+                {
+                    ++expected;
+                }
+            }
+
+            EXPECT_EQ(expected, a.count_intersection(b));
+            EXPECT_EQ(expected, b.count_intersection(a));
+            EXPECT_EQ(expected != 0U, a.intersects(b));
+            EXPECT_EQ(expected != 0U, b.intersects(a));
+        }
+    }
+}
@@ -6,7 +6,9 @@
 #include <cstddef> // std::byte
 #include <cstdint> // uint16_t, uint32_t, uint64_t
 #include <memory>
+#include <string>
 #include <string_view>
+#include <utility>
 
 #include <libtransmission/transmission.h>
 
@@ -102,6 +104,111 @@ TEST_F(BufferTest, Numbers)
     }
 }
 
+TEST_F(BufferTest, pooledBufferReturnsMemoryWhenDrained)
+{
+    auto pool = libtransmission::BufferPool{};
+
+    {
+        auto buf = libtransmission::PooledBuffer{ pool };
+        EXPECT_EQ(0U, buf.capacity());
+        EXPECT_EQ(0U, pool.stats().bytes_in_use);
+
+        buf.add("Hello, "sv);
+        EXPECT_EQ(libtransmission::BufferPool::MinBlockSize, buf.capacity());
+        EXPECT_EQ(libtransmission::BufferPool::MinBlockSize, pool.stats().bytes_in_use);
+        EXPECT_EQ(1U, pool.stats().blocks_in_use);
+
+        // growing keeps the contents
+        auto const big = std::string(libtransmission::BufferPool::MinBlockSize * 3U, 'x');
+        buf.add(big);
+        EXPECT_EQ(libtransmission::BufferPool::MinBlockSize * 4U, buf.capacity());
+        EXPECT_EQ(std::size(big) + 7U, std::size(buf));
+        EXPECT_TRUE(buf.starts_with("Hello, xxx"sv));
+        EXPECT_EQ(1U, pool.stats().blocks_in_use);
+
+        // partial drains keep the block
+        buf.drain(7U);
+        EXPECT_EQ(big, buf.to_string());
+        EXPECT_NE(0U, buf.capacity());
+
+        // empty buffers hold nothing
+        buf.clear();
+        EXPECT_EQ(0U, buf.capacity());
+        EXPECT_EQ(0U, pool.stats().bytes_in_use);
+        EXPECT_EQ(0U, pool.stats().blocks_in_use);
+        // the old block was still held while the contents were moved to the new one
+        EXPECT_EQ(libtransmission::BufferPool::MinBlockSize * 5U, pool.stats().peak_bytes_in_use);
+    }
+
+    EXPECT_EQ(0U, pool.stats().bytes_in_use);
+    EXPECT_LT(0U, pool.stats().bytes_idle);
+}
+
+TEST_F(BufferTest, bufferPoolTrimFreesUnneededBlocks)
+{
+    static auto constexpr BlockSize = libtransmission::BufferPool::MinBlockSize;
+    auto pool = libtransmission::BufferPool{};
+
+    // two blocks of one size and one of another are used, then go idle
+    auto a = pool.acquire(BlockSize);
+    auto b = pool.acquire(BlockSize);
+    auto c = pool.acquire(BlockSize * 2U);
+    pool.release(std::move(a));
+    pool.release(std::move(b));
+    pool.release(std::move(c));
+    EXPECT_EQ(BlockSize * 4U, pool.stats().bytes_idle);
+
+    // they were all in use since the pool was made, so they're kept
+    pool.trim();
+    EXPECT_EQ(BlockSize * 4U, pool.stats().bytes_idle);
+
+    // one is reused before the next trim, and the rest are freed
+    a = pool.acquire(BlockSize);
+    pool.release(std::move(a));
+    pool.trim();
+    EXPECT_EQ(BlockSize, pool.stats().bytes_idle);
+
+    // the one that's left stays idle, so it goes too
+    pool.trim();
+    EXPECT_EQ(0U, pool.stats().bytes_idle);
+    EXPECT_EQ(0U, pool.stats().bytes_in_use);
+}
+
+TEST_F(BufferTest, bufferPoolReusesBlocks)
+{
+    static auto constexpr BlockSize = libtransmission::BufferPool::MinBlockSize;
+    auto pool = libtransmission::BufferPool{ BlockSize * 2U };
+
+    auto a = pool.acquire(100U);
+    auto const* const a_data = a.data.get();
+    EXPECT_EQ(BlockSize, a.size);
+    pool.release(std::move(a));
+    EXPECT_EQ(BlockSize, pool.stats().bytes_idle);
+
+    // the same size class gets the same block back
+    auto b = pool.acquire(BlockSize);
+    EXPECT_EQ(a_data, b.data.get());
+    EXPECT_EQ(0U, pool.stats().bytes_idle);
+
+    // idle memory is capped
+    auto c = pool.acquire(BlockSize + 1U);
+    EXPECT_EQ(BlockSize * 2U, c.size);
+    auto d = pool.acquire(1U);
+    EXPECT_EQ(BlockSize * 4U, pool.stats().bytes_in_use);
+    pool.release(std::move(b));
+    pool.release(std::move(c));
+    pool.release(std::move(d));
+    EXPECT_EQ(0U, pool.stats().bytes_in_use);
+    EXPECT_EQ(BlockSize * 2U, pool.stats().bytes_idle);
+
+    // oversized blocks aren't kept
+    auto const huge_size = libtransmission::BufferPool::MaxPooledBlockSize + 1U;
+    auto e = pool.acquire(huge_size);
+    EXPECT_EQ(huge_size, e.size);
+    pool.release(std::move(e));
+    EXPECT_EQ(BlockSize * 2U, pool.stats().bytes_idle);
+}
+
 #if 0
 TEST_F(BufferTest, NonBufferWriter)
 {
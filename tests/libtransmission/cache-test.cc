@@ -0,0 +1,384 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <memory>
+#include <string>
+#include <utility> // std::pair
+#include <vector>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/cache.h>
+#include <libtransmission/file.h>
+#include <libtransmission/session.h>
+#include <libtransmission/torrent.h>
+#include <libtransmission/worker-pool.h>
+
+#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+class CacheReadCacheTest : public ::testing::Test
+{
+protected:
+    using ReadCache = Cache::ReadCache;
+    using PieceKey = Cache::PieceKey;
+
+    static auto constexpr TorId = tr_torrent_id_t{ 1 };
+
+    [[nodiscard]] static Cache::SharedBlockData make_block()
+    {
+        return std::make_shared<Cache::BlockData>(tr_block_info::BlockSize);
+    }
+
+    // admit a piece by reading it twice, then fill it with `n_blocks` blocks
+    static void add_piece(ReadCache& cache, tr_piece_index_t piece, size_t n_blocks)
+    {
+        auto const key = PieceKey{ TorId, piece };
+        cache.admit(key);
+        EXPECT_TRUE(cache.admit(key));
+
+        for (size_t i = 0; i < n_blocks; ++i)
+        {
+            cache.add(key, piece * 100U + i, make_block());
+        }
+    }
+};
+
+TEST_F(CacheReadCacheTest, piecesAreAdmittedOnTheSecondRead)
+{
+    auto cache = ReadCache{};
+    auto const key = PieceKey{ TorId, 10U };
+
+    EXPECT_FALSE(cache.admit(key));
+    cache.add(key, 1000U, make_block());
+    EXPECT_FALSE(cache.contains(key, 1000U));
+    EXPECT_EQ(0U, cache.n_blocks());
+
+    EXPECT_TRUE(cache.admit(key));
+    cache.add(key, 1000U, make_block());
+    EXPECT_TRUE(cache.contains(key, 1000U));
+    EXPECT_EQ(1U, cache.n_blocks());
+
+    EXPECT_TRUE(cache.admit(key));
+}
+
+TEST_F(CacheReadCacheTest, scanDoesNotEvictHotPieces)
+{
+    auto cache = ReadCache{};
+    add_piece(cache, 1U, 4U);
+    add_piece(cache, 2U, 4U);
+
+    // a peer downloading the whole torrent reads each piece once
+    for (tr_piece_index_t piece = 100U; piece < 100U + ReadCache::MaxGhosts * 2U; ++piece)
+    {
+        EXPECT_FALSE(cache.admit({ TorId, piece }));
+    }
+
+    cache.trim(8U);
+    EXPECT_EQ(8U, cache.n_blocks());
+    EXPECT_TRUE(cache.contains({ TorId, 1U }, 100U));
+    EXPECT_TRUE(cache.contains({ TorId, 2U }, 200U));
+}
+
+TEST_F(CacheReadCacheTest, ghostListForgetsOldestPieces)
+{
+    auto cache = ReadCache{};
+    auto const oldest = PieceKey{ TorId, 0U };
+
+    EXPECT_FALSE(cache.admit(oldest));
+    for (tr_piece_index_t piece = 1U; piece <= ReadCache::MaxGhosts; ++piece)
+    {
+        EXPECT_FALSE(cache.admit({ TorId, piece }));
+    }
+
+    // `oldest` fell off the ghost list, so this is its first read again
+    EXPECT_FALSE(cache.admit(oldest));
+
+    // but the newest ones are still remembered
+    EXPECT_TRUE(cache.admit({ TorId, ReadCache::MaxGhosts }));
+}
+
+TEST_F(CacheReadCacheTest, promotedPieceDoesNotLeaveStaleGhost)
+{
+    auto cache = ReadCache{};
+    auto const key = PieceKey{ TorId, 0U };
+
+    // promote it, then drop it from the cache
+    EXPECT_FALSE(cache.admit(key));
+    EXPECT_TRUE(cache.admit(key));
+    cache.erase(TorId, 0U, 1U);
+
+    // read it once again, so it's a ghost again
+    EXPECT_FALSE(cache.admit(key));
+
+    // fill the rest of the ghost list
+    for (tr_piece_index_t piece = 1U; piece < ReadCache::MaxGhosts; ++piece)
+    {
+        EXPECT_FALSE(cache.admit({ TorId, piece }));
+    }
+
+    // its first ghost entry, which was promoted, mustn't push out the second one
+    EXPECT_TRUE(cache.admit(key));
+}
+
+TEST_F(CacheReadCacheTest, trimEvictsLeastRecentlyUsedPieces)
+{
+    auto cache = ReadCache{};
+    add_piece(cache, 1U, 2U);
+    add_piece(cache, 2U, 2U);
+    add_piece(cache, 3U, 2U);
+    EXPECT_EQ(6U, cache.n_blocks());
+
+    // reading from piece 1 makes piece 2 the least recently used
+    EXPECT_TRUE(cache.get({ TorId, 1U }, 100U));
+
+    cache.trim(4U);
+    EXPECT_EQ(4U, cache.n_blocks());
+    EXPECT_TRUE(cache.contains({ TorId, 1U }, 100U));
+    EXPECT_FALSE(cache.contains({ TorId, 2U }, 200U));
+    EXPECT_TRUE(cache.contains({ TorId, 3U }, 300U));
+    EXPECT_EQ((std::vector<tr_piece_index_t>{ 1U, 3U }), cache.hot_pieces(TorId, 10U));
+
+    cache.trim(0U);
+    EXPECT_EQ(0U, cache.n_blocks());
+    EXPECT_TRUE(cache.empty());
+}
+
+TEST_F(CacheReadCacheTest, trimCountsAndKeepsReadsInFlight)
+{
+    auto cache = ReadCache{};
+    add_piece(cache, 1U, 0U);
+    add_piece(cache, 2U, 2U);
+
+    // piece 1 is the least recently used, but it's being read
+    auto const key = PieceKey{ TorId, 1U };
+    cache.on_read_started(key);
+    cache.on_read_started(key);
+
+    // 2 blocks cached + 2 on their way
+    cache.trim(3U);
+    EXPECT_FALSE(cache.contains({ TorId, 2U }, 200U));
+    EXPECT_EQ(0U, cache.n_blocks());
+
+    cache.add(key, 100U, make_block());
+    cache.on_read_done(key);
+    cache.add(key, 101U, make_block());
+    cache.on_read_done(key);
+    EXPECT_EQ(2U, cache.n_blocks());
+
+    // now that its reads are done, it can be evicted
+    cache.trim(1U);
+    EXPECT_EQ(0U, cache.n_blocks());
+    EXPECT_FALSE(cache.contains(key, 100U));
+}
+
+TEST_F(CacheReadCacheTest, eraseDropsBlocksAndPieces)
+{
+    auto cache = ReadCache{};
+    add_piece(cache, 1U, 2U);
+    add_piece(cache, 2U, 2U);
+    add_piece(cache, 3U, 2U);
+
+    cache.erase({ TorId, 1U }, 100U);
+    EXPECT_FALSE(cache.contains({ TorId, 1U }, 100U));
+    EXPECT_TRUE(cache.contains({ TorId, 1U }, 101U));
+    EXPECT_EQ(5U, cache.n_blocks());
+
+    cache.erase(TorId, 2U, 4U);
+    EXPECT_EQ(1U, cache.n_blocks());
+    EXPECT_FALSE(cache.get({ TorId, 2U }, 200U));
+    EXPECT_EQ(std::vector<tr_piece_index_t>{ 1U }, cache.hot_pieces(TorId, 10U));
+    EXPECT_TRUE(cache.hot_pieces(TorId + 1, 10U).empty());
+}
+
+TEST_F(CacheReadCacheTest, emptyPiecesAreDropped)
+{
+    auto cache = ReadCache{};
+    auto const key = PieceKey{ TorId, 1U };
+
+    // the first read of a newly admitted piece fails
+    add_piece(cache, 1U, 0U);
+    cache.on_read_started(key);
+    cache.on_read_done(key);
+    EXPECT_TRUE(cache.empty());
+
+    // a write replaces its only block while another read is in flight...
+    add_piece(cache, 1U, 1U);
+    cache.on_read_started(key);
+    cache.erase(key, 100U);
+    EXPECT_FALSE(cache.empty());
+
+    // ...and that read fails too
+    cache.on_read_done(key);
+    EXPECT_TRUE(cache.empty());
+    EXPECT_EQ(0U, cache.n_blocks());
+
+    // a write replaces its only block with nothing in flight
+    add_piece(cache, 1U, 1U);
+    cache.erase(key, 100U);
+    EXPECT_TRUE(cache.empty());
+}
+
+// ---
+
+class CacheBlockRunsTest : public ::testing::Test
+{
+protected:
+    using BlockRuns = Cache::BlockRuns;
+    using Key = Cache::Key;
+
+    static auto constexpr TorId = tr_torrent_id_t{ 1 };
+
+    static void add(BlockRuns& runs, tr_block_index_t begin, tr_block_index_t end, tr_torrent_id_t tor_id = TorId)
+    {
+        for (auto block = begin; block < end; ++block)
+        {
+            runs.add({ tor_id, block });
+        }
+    }
+
+    [[nodiscard]] static std::pair<Key, size_t> make_run(tr_block_index_t begin, size_t len, tr_torrent_id_t tor_id = TorId)
+    {
+        return { Key{ tor_id, begin }, len };
+    }
+};
+
+TEST_F(CacheBlockRunsTest, adjacentBlocksAreMerged)
+{
+    auto runs = BlockRuns{};
+    EXPECT_TRUE(runs.empty());
+    EXPECT_FALSE(runs.biggest());
+
+    add(runs, 10U, 13U);
+    EXPECT_EQ(1U, runs.size());
+    EXPECT_EQ(make_run(10U, 3U), runs.biggest());
+
+    // a gap starts a new run
+    add(runs, 14U, 15U);
+    EXPECT_EQ(2U, runs.size());
+    EXPECT_EQ(make_run(10U, 3U), runs.biggest());
+
+    // filling the gap joins the runs on both sides
+    runs.add({ TorId, 13U });
+    EXPECT_EQ(1U, runs.size());
+    EXPECT_EQ(make_run(10U, 5U), runs.biggest());
+
+    // so does growing it at the front
+    runs.add({ TorId, 9U });
+    EXPECT_EQ(1U, runs.size());
+    EXPECT_EQ(make_run(9U, 6U), runs.biggest());
+}
+
+TEST_F(CacheBlockRunsTest, runsDoNotCrossTorrents)
+{
+    static auto constexpr OtherTorId = TorId + 1;
+
+    auto runs = BlockRuns{};
+    add(runs, 0U, 5U);
+    add(runs, 5U, 7U, OtherTorId);
+    EXPECT_EQ(2U, runs.size());
+    EXPECT_EQ(make_run(0U, 5U), runs.biggest());
+
+    add(runs, 7U, 11U, OtherTorId);
+    EXPECT_EQ(2U, runs.size());
+    EXPECT_EQ(make_run(5U, 6U, OtherTorId), runs.biggest());
+}
+
+TEST_F(CacheBlockRunsTest, eraseSplitsRuns)
+{
+    auto runs = BlockRuns{};
+    add(runs, 0U, 10U);
+    add(runs, 20U, 24U);
+
+    // take a bite out of the middle of the first run
+    runs.erase(TorId, 3U, 5U);
+    EXPECT_EQ(3U, runs.size());
+    EXPECT_EQ(make_run(5U, 5U), runs.biggest());
+
+    // a range that covers the end of one run and the start of another
+    runs.erase(TorId, 8U, 22U);
+    EXPECT_EQ(3U, runs.size());
+    EXPECT_EQ(make_run(5U, 3U), runs.biggest());
+
+    runs.erase(TorId, 5U, 8U);
+    EXPECT_EQ(2U, runs.size());
+    EXPECT_EQ(make_run(0U, 3U), runs.biggest());
+
+    // erasing what isn't there is harmless
+    runs.erase(TorId, 100U, 200U);
+    runs.erase(TorId + 1, 0U, 100U);
+    EXPECT_EQ(2U, runs.size());
+}
+
+TEST_F(CacheBlockRunsTest, flushingTheBiggestLeavesTheRest)
+{
+    auto runs = BlockRuns{};
+    add(runs, 0U, 2U);
+    add(runs, 10U, 18U);
+    add(runs, 30U, 34U);
+
+    // what Cache::flush_biggest() does
+    auto flushed = std::vector<std::pair<Key, size_t>>{};
+    while (auto const biggest = runs.biggest())
+    {
+        auto const& [key, len] = *biggest;
+        flushed.push_back(*biggest);
+        runs.erase(key.first, key.second, key.second + len);
+    }
+
+    auto const expected = std::vector<std::pair<Key, size_t>>{ make_run(10U, 8U), make_run(30U, 4U), make_run(0U, 2U) };
+    EXPECT_EQ(expected, flushed);
+    EXPECT_TRUE(runs.empty());
+}
+
+// ---
+
+using CacheTest = libtransmission::test::SessionTest;
+
+TEST_F(CacheTest, rewrittenBlockKeepsNewestData)
+{
+    auto* const tor = zeroTorrentInit(ZeroTorrentState::Complete);
+    EXPECT_NE(nullptr, tor);
+
+    // with no cache, each write goes straight to the disk workers,
+    // so several writes of the same block can be in flight at once
+    session_->disk_io().set_thread_count(4U);
+
+    static auto constexpr NWrites = 50;
+    auto done = std::atomic<bool>{};
+    session_->runInSessionThread(
+        [&]()
+        {
+            tr_sessionSetCacheLimit_MB(session_, 0U);
+
+            for (int i = 1; i <= NWrites; ++i)
+            {
+                auto buf = std::make_unique<Cache::BlockData>(tr_block_info::BlockSize);
+                std::fill_n(std::data(*buf), tr_block_info::BlockSize, static_cast<uint8_t>(i));
+                EXPECT_EQ(0, session_->cache->write_block(tor->id(), 0U, std::move(buf)));
+            }
+
+            EXPECT_EQ(0, session_->cache->flush_torrent(tor));
+            done = true;
+        });
+    EXPECT_TRUE(libtransmission::test::waitFor([&]() { return done.load(); }, 5000));
+
+    auto const found = tr_torrentFindFile(tor, 0);
+    auto const fd = tr_sys_file_open(found.c_str(), TR_SYS_FILE_READ, 0);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+    auto contents = std::array<uint8_t, tr_block_info::BlockSize>{};
+    EXPECT_TRUE(tr_sys_file_read(fd, std::data(contents), std::size(contents), nullptr));
+    tr_sys_file_close(fd);
+
+    auto const expected = static_cast<uint8_t>(NWrites);
+    EXPECT_TRUE(std::all_of(std::begin(contents), std::end(contents), [expected](uint8_t ch) { return ch == expected; }));
+
+    tr_torrentRemove(tor, false, nullptr, nullptr);
+}
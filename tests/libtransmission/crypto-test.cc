@@ -3,8 +3,10 @@
 // or any future license endorsed by Mnemosyne LLC.
 // License text can be found in the licenses/ folder.
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cstddef> // std::byte, size_t
 #include <cstdint> // uint8_t
 #include <cstring>
@@ -12,9 +14,14 @@
 #include <string>
 #include <string_view>
 #include <unordered_set>
+#include <vector>
+
+#include <math/wide_integer/uintwide_t.h>
 
 #include <libtransmission/peer-mse.h>
 #include <libtransmission/crypto-utils.h>
+#include <libtransmission/sha1.h>
+#include <libtransmission/tr-arc4.h>
 #include <libtransmission/tr-macros.h>
 #include <libtransmission/utils.h>
 
@@ -46,6 +53,89 @@ std::string toString(std::array<std::byte, N> const& array)
     return ostr.str();
 }
 
+// The generic big-number math that tr_message_stream_encryption::DH used
+// before it got its own fixed-modulus exponentiation. Kept as a reference.
+namespace wi
+{
+using DH = tr_message_stream_encryption::DH;
+using key_t = math::wide_integer::uintwide_t<DH::KeySize * 8U>;
+using private_key_t = math::wide_integer::uintwide_t<DH::PrivateKeySize * 8U>;
+
+template<typename UIntWide, size_t N>
+auto import_bits(std::array<std::byte, N> const& bigend_bin)
+{
+    auto ret = UIntWide{};
+    for (auto const walk : bigend_bin)
+    {
+        ret <<= 8;
+        ret += static_cast<uint8_t>(walk);
+    }
+    return ret;
+}
+
+auto export_bits(key_t i)
+{
+    auto ret = DH::key_bigend_t{};
+    for (auto walk = std::rbegin(ret), end = std::rend(ret); walk != end; ++walk)
+    {
+        *walk = std::byte(static_cast<uint8_t>(i & 0xFF));
+        i >>= 8;
+    }
+    return ret;
+}
+
+auto powm(DH::key_bigend_t const& base, DH::private_key_bigend_t const& exponent)
+{
+    auto const prime = key_t{
+        "0xFFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245E485B576625E7EC6F44C42E9A63A36210000000000090563"
+    };
+    return export_bits(math::wide_integer::powm(import_bits<key_t>(base), import_bits<private_key_t>(exponent), prime));
+}
+
+auto generator()
+{
+    auto ret = DH::key_bigend_t{};
+    ret.back() = std::byte{ 2 };
+    return ret;
+}
+} // namespace wi
+
+// The byte-at-a-time RC4 that tr_arc4 used before it got a block keystream.
+// Kept as a reference.
+class RefArc4
+{
+public:
+    RefArc4(void const* key, size_t key_length)
+    {
+        for (size_t i = 0; i < 256; ++i)
+        {
+            s_[i] = static_cast<uint8_t>(i);
+        }
+
+        for (size_t i = 0, j = 0; i < 256; ++i)
+        {
+            j = static_cast<uint8_t>(j + s_[i] + static_cast<uint8_t const*>(key)[i % key_length]);
+            std::swap(s_[i], s_[j]);
+        }
+    }
+
+    void process(uint8_t const* src, size_t n_bytes, uint8_t* tgt)
+    {
+        for (size_t k = 0; k != n_bytes; ++k)
+        {
+            i_ += 1;
+            j_ += s_[i_];
+            std::swap(s_[i_], s_[j_]);
+            tgt[k] = src[k] ^ s_[static_cast<uint8_t>(s_[i_] + s_[j_])];
+        }
+    }
+
+private:
+    std::array<uint8_t, 256> s_ = {};
+    uint8_t i_ = 0;
+    uint8_t j_ = 0;
+};
+
 } // namespace
 
 TEST(Crypto, DH)
@@ -96,6 +186,185 @@ TEST(Crypto, encryptDecrypt)
     EXPECT_EQ(Input2, std::data(decrypted2)) << "Input2 " << Input2 << " decrypted2 " << std::data(decrypted2);
 }
 
+TEST(Crypto, DHMatchesGenericMath)
+{
+    using DH = tr_message_stream_encryption::DH;
+
+    auto private_keys = std::vector<DH::private_key_bigend_t>{};
+    private_keys.emplace_back(); // all zeroes
+    private_keys.emplace_back().fill(std::byte{ 0xFF });
+    for (size_t i = 0; i < 16U; ++i)
+    {
+        private_keys.emplace_back(DH::randomPrivateKey());
+    }
+
+    auto peer_public_keys = std::vector<DH::key_bigend_t>{};
+    peer_public_keys.emplace_back(); // all zeroes
+    peer_public_keys.emplace_back().fill(std::byte{ 0xFF }); // bigger than the prime
+    for (size_t i = 0; i < 4U; ++i)
+    {
+        peer_public_keys.emplace_back(tr_rand_obj<DH::key_bigend_t>());
+    }
+
+    for (auto const& private_key : private_keys)
+    {
+        auto dh = DH{ private_key };
+        EXPECT_EQ(toString(wi::powm(wi::generator(), private_key)), toString(dh.publicKey()));
+
+        for (auto const& peer_public_key : peer_public_keys)
+        {
+            dh.setPeerPublicKey(peer_public_key);
+            EXPECT_EQ(toString(wi::powm(peer_public_key, private_key)), toString(dh.secret()));
+        }
+    }
+}
+
+// Not a test, but a benchmark. Run it with --gtest_also_run_disabled_tests
+TEST(Crypto, DISABLED_DHBenchmark)
+{
+    using DH = tr_message_stream_encryption::DH;
+    using Clock = std::chrono::steady_clock;
+    static auto constexpr Iterations = size_t{ 1000U };
+
+    auto private_keys = std::vector<DH::private_key_bigend_t>{};
+    for (size_t i = 0; i < Iterations; ++i)
+    {
+        private_keys.emplace_back(DH::randomPrivateKey());
+    }
+    auto const peer_public_key = DH{}.publicKey();
+
+    auto const report = [](std::string_view name, Clock::time_point begin)
+    {
+        auto const elapsed = std::chrono::duration<double, std::micro>(Clock::now() - begin);
+        std::cout << name << ": " << elapsed.count() / Iterations << " usec" << std::endl;
+    };
+
+    auto generic = std::vector<DH::key_bigend_t>{};
+    auto fast = std::vector<DH::key_bigend_t>{};
+    generic.reserve(Iterations);
+    fast.reserve(Iterations);
+
+    auto begin = Clock::now();
+    for (auto const& private_key : private_keys)
+    {
+        generic.emplace_back(wi::powm(wi::generator(), private_key));
+    }
+    report("public key, generic math"sv, begin);
+
+    begin = Clock::now();
+    for (auto const& private_key : private_keys)
+    {
+        fast.emplace_back(DH{ private_key }.publicKey());
+    }
+    report("public key, DH"sv, begin);
+    EXPECT_EQ(generic, fast);
+
+    generic.clear();
+    fast.clear();
+
+    begin = Clock::now();
+    for (auto const& private_key : private_keys)
+    {
+        generic.emplace_back(wi::powm(peer_public_key, private_key));
+    }
+    report("secret, generic math"sv, begin);
+
+    begin = Clock::now();
+    for (auto const& private_key : private_keys)
+    {
+        auto dh = DH{ private_key };
+        dh.setPeerPublicKey(peer_public_key);
+        fast.emplace_back(dh.secret());
+    }
+    report("secret, DH"sv, begin);
+    EXPECT_EQ(generic, fast);
+}
+
+TEST(Crypto, arc4)
+{
+    // https://en.wikipedia.org/wiki/RC4#Test_vectors
+    auto const test = [](std::string_view key, std::string_view plaintext, std::vector<uint8_t> const& expected)
+    {
+        auto arc4 = tr_arc4{ std::data(key), std::size(key) };
+        auto ciphertext = std::vector<uint8_t>(std::size(plaintext));
+        arc4.process(reinterpret_cast<uint8_t const*>(std::data(plaintext)), std::size(plaintext), std::data(ciphertext));
+        EXPECT_EQ(expected, ciphertext) << key;
+    };
+
+    test("Key"sv, "Plaintext"sv, { 0xBB, 0xF3, 0x16, 0xE8, 0xD9, 0x40, 0xAF, 0x0A, 0xD3 });
+    test("Wiki"sv, "pedia"sv, { 0x10, 0x21, 0xBF, 0x04, 0x20 });
+    test("Secret"sv,
+         "Attack at dawn"sv,
+         { 0x45, 0xA0, 0x1F, 0x64, 0x5F, 0xC3, 0x5B, 0x38, 0x35, 0x52, 0x54, 0x4B, 0x9B, 0xF5 });
+}
+
+TEST(Crypto, arc4MatchesReference)
+{
+    auto constexpr Key = "0123456789abcdef0123"sv;
+
+    auto input = std::vector<uint8_t>(100000U);
+    tr_rand_buffer(std::data(input), std::size(input));
+
+    auto expected = std::vector<uint8_t>(std::size(input));
+    auto ref = RefArc4{ std::data(Key), std::size(Key) };
+    auto discarded = std::array<uint8_t, 1024>{};
+    ref.process(std::data(discarded), std::size(discarded), std::data(discarded));
+    ref.process(std::data(input), std::size(input), std::data(expected));
+
+    // in uneven pieces that straddle the keystream blocks, both in place and not
+    for (auto const in_place : { false, true })
+    {
+        auto arc4 = tr_arc4{ std::data(Key), std::size(Key) };
+        arc4.discard(std::size(discarded));
+
+        auto actual = in_place ? input : std::vector<uint8_t>(std::size(input));
+        auto const* const src = in_place ? std::data(actual) : std::data(input);
+        for (size_t pos = 0, len = 1; pos < std::size(input); pos += len, len = len * 3U + 1U)
+        {
+            len = std::min(len, std::size(input) - pos);
+            arc4.process(src + pos, len, std::data(actual) + pos);
+        }
+
+        EXPECT_EQ(expected, actual);
+    }
+}
+
+TEST(Crypto, DISABLED_Arc4Benchmark)
+{
+    using Clock = std::chrono::steady_clock;
+    static auto constexpr Key = "0123456789abcdef0123"sv;
+    static auto constexpr Iterations = size_t{ 256U };
+
+    auto buf = std::vector<uint8_t>(1024U * 1024U);
+    tr_rand_buffer(std::data(buf), std::size(buf));
+
+    auto const run = [&buf](std::string_view name, size_t chunk_size, auto& arc4)
+    {
+        auto const begin = Clock::now();
+        for (size_t i = 0; i < Iterations; ++i)
+        {
+            for (size_t pos = 0; pos < std::size(buf); pos += chunk_size)
+            {
+                auto const len = std::min(chunk_size, std::size(buf) - pos);
+                arc4.process(std::data(buf) + pos, len, std::data(buf) + pos);
+            }
+        }
+
+        auto const elapsed = std::chrono::duration<double>(Clock::now() - begin);
+        std::cout << name << ", " << chunk_size << " byte chunks: " << Iterations / elapsed.count() << " MiB/s" << std::endl;
+    };
+
+    // a whole block, and a message header
+    for (auto const chunk_size : { size_t{ 16384U }, size_t{ 17U } })
+    {
+        auto ref = RefArc4{ std::data(Key), std::size(Key) };
+        run("byte at a time"sv, chunk_size, ref);
+
+        auto arc4 = tr_arc4{ std::data(Key), std::size(Key) };
+        run("tr_arc4"sv, chunk_size, arc4);
+    }
+}
+
 TEST(Crypto, sha1)
 {
     auto hash1 = tr_sha1::digest("test"sv);
@@ -129,6 +398,84 @@ TEST(Crypto, sha1)
     EXPECT_EQ("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"sv, tr_sha1_to_string(hash5));
 }
 
+TEST(Crypto, sha1Kernels)
+{
+    auto const old_kernel = tr_sha1_get_kernel();
+
+    // lengths around the block and padding boundaries
+    auto buf = std::vector<uint8_t>(1024U);
+    tr_rand_buffer(std::data(buf), std::size(buf));
+    auto lengths = std::vector<size_t>{ 0U, 1U, 55U, 56U, 63U, 64U, 65U, 119U, 120U, 128U, 1000U, std::size(buf) };
+
+    for (auto const kernel : { tr_sha1_kernel::Generic, tr_sha1_kernel::ShaNi, tr_sha1_kernel::Avx2 })
+    {
+        if (!tr_sha1_set_kernel(kernel))
+        {
+            continue;
+        }
+
+        for (auto const len : lengths)
+        {
+            auto lib = tr_sha1::create_library();
+            lib->add(std::data(buf), len);
+            auto const expected = lib->finish();
+
+            // all at once
+            auto builtin = tr_sha1_create_builtin();
+            builtin->add(std::data(buf), len);
+            EXPECT_EQ(expected, builtin->finish()) << tr_sha1_kernel_name(kernel) << ' ' << len;
+
+            // in uneven pieces, reusing the same context
+            for (size_t pos = 0; pos < len; pos += 7U)
+            {
+                builtin->add(std::data(buf) + pos, std::min(size_t{ 7U }, len - pos));
+            }
+            EXPECT_EQ(expected, builtin->finish()) << tr_sha1_kernel_name(kernel) << ' ' << len;
+        }
+    }
+
+    tr_sha1_set_kernel(old_kernel);
+}
+
+TEST(Crypto, sha1DigestMany)
+{
+    auto const old_kernel = tr_sha1_get_kernel();
+
+    // eleven "pieces" of the same size and a short last piece,
+    // so the multi-buffer kernel gets a full batch, a partial one, and a leftover
+    static auto constexpr PieceSize = size_t{ 1000U };
+    auto buf = std::vector<uint8_t>(PieceSize * 11U + 123U);
+    tr_rand_buffer(std::data(buf), std::size(buf));
+
+    auto messages = std::vector<tr_sha1_message>{};
+    for (size_t pos = 0; pos < std::size(buf); pos += PieceSize)
+    {
+        messages.push_back({ std::data(buf) + pos, std::min(PieceSize, std::size(buf) - pos) });
+    }
+
+    auto expected = std::vector<tr_sha1_digest_t>{};
+    for (auto const& message : messages)
+    {
+        auto sha = tr_sha1::create_library();
+        sha->add(message.data, message.size);
+        expected.push_back(sha->finish());
+    }
+
+    for (auto const kernel : { tr_sha1_kernel::Generic, tr_sha1_kernel::ShaNi, tr_sha1_kernel::Avx2 })
+    {
+        if (!tr_sha1_set_kernel(kernel))
+        {
+            continue;
+        }
+
+        auto digests = std::vector<tr_sha1_digest_t>(std::size(messages));
+        tr_sha1_digest_many(std::data(messages), std::size(messages), std::data(digests));
+        EXPECT_EQ(expected, digests) << tr_sha1_kernel_name(kernel);
+    }
+
+    tr_sha1_set_kernel(old_kernel);
+}
+
 TEST(Crypto, ssha1)
 {
     struct LocalTest
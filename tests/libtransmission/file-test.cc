@@ -3,8 +3,10 @@
 // or any future license endorsed by Mnemosyne LLC.
 // License text can be found in the licenses/ folder.
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cerrno>
 #include <cstdint> // uint64_t
 #include <cstdio> // stderr
 #include <cstring>
@@ -14,6 +16,7 @@
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #ifndef _WIN32
 #include <sys/stat.h>
@@ -25,6 +28,7 @@
 #include <fmt/core.h>
 
 #include <libtransmission/error.h>
+#include <libtransmission/file-io-uring.h>
 #include <libtransmission/file.h>
 #include <libtransmission/tr-macros.h>
 #include <libtransmission/tr-strbuf.h>
@@ -1222,6 +1226,246 @@ TEST_F(FileTest, fileTruncate)
     tr_sys_path_remove(path);
 }
 
+TEST_F(FileTest, fileIoBatch)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path = tr_pathbuf{ test_dir, "/a"sv };
+    auto fd = tr_sys_file_open(path, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+
+    // the result must be the same regardless of which backend gets used
+    for (auto const backend : { TR_SYS_FILE_IO_BACKEND_SYNC, TR_SYS_FILE_IO_BACKEND_IO_URING })
+    {
+        tr_sys_file_io_set_backend(backend);
+
+        static auto constexpr NBufs = size_t{ 100U };
+        static auto constexpr BufSize = size_t{ 1000U };
+        auto bufs = std::vector<std::array<uint8_t, BufSize>>(NBufs);
+        auto ops = std::vector<tr_sys_file_io_op>(NBufs);
+        for (size_t i = 0; i < NBufs; ++i)
+        {
+            bufs[i].fill(static_cast<uint8_t>(i));
+            ops[i].handle = fd;
+            ops[i].buffer = std::data(bufs[i]);
+            ops[i].size = BufSize;
+            ops[i].offset = i * BufSize;
+            ops[i].is_write = true;
+        }
+
+        // write the buffers
+        tr_sys_file_io_batch(std::data(ops), std::size(ops));
+        for (auto const& op : ops)
+        {
+            EXPECT_EQ(0, op.err);
+        }
+        auto info = tr_sys_path_get_info(path);
+        EXPECT_TRUE(info.has_value());
+        assert(info.has_value());
+        EXPECT_EQ(NBufs * BufSize, info->size);
+
+        // read them back
+        for (auto& buf : bufs)
+        {
+            buf.fill(0xFF);
+        }
+        for (auto& op : ops)
+        {
+            op.is_write = false;
+        }
+        tr_sys_file_io_batch(std::data(ops), std::size(ops));
+        for (size_t i = 0; i < NBufs; ++i)
+        {
+            EXPECT_EQ(0, ops[i].err);
+            EXPECT_EQ(BufSize, static_cast<size_t>(std::count(std::begin(bufs[i]), std::end(bufs[i]), static_cast<uint8_t>(i))));
+        }
+    }
+
+    tr_sys_file_io_set_backend(TR_SYS_FILE_IO_BACKEND_SYNC);
+    tr_sys_file_close(fd);
+    tr_sys_path_remove(path);
+}
+
+TEST_F(FileTest, fileIoBatchFailsReadsPastEndOfFile)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path = tr_pathbuf{ test_dir, "/a"sv };
+    auto fd = tr_sys_file_open(path, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+
+    static auto constexpr FileSize = size_t{ 1000U };
+    auto contents = std::array<uint8_t, FileSize>{};
+    contents.fill(0x55);
+    EXPECT_TRUE(tr_sys_file_write_at(fd, std::data(contents), std::size(contents), 0U, nullptr));
+
+    for (auto const backend : { TR_SYS_FILE_IO_BACKEND_SYNC, TR_SYS_FILE_IO_BACKEND_IO_URING })
+    {
+        tr_sys_file_io_set_backend(backend);
+
+        auto bufs = std::array<std::array<uint8_t, FileSize>, 3U>{};
+        auto ops = std::array<tr_sys_file_io_op, 3U>{};
+        for (size_t i = 0; i < std::size(ops); ++i)
+        {
+            ops[i].handle = fd;
+            ops[i].buffer = std::data(bufs[i]);
+            ops[i].size = FileSize;
+        }
+        ops[1].offset = FileSize / 2U; // runs off the end
+        ops[2].offset = FileSize * 2U; // starts past the end
+
+        tr_sys_file_io_batch(std::data(ops), std::size(ops));
+        EXPECT_EQ(0, ops[0].err);
+        EXPECT_EQ(contents, bufs[0]);
+        EXPECT_EQ(EIO, ops[1].err);
+        EXPECT_EQ(EIO, ops[2].err);
+    }
+
+    tr_sys_file_io_set_backend(TR_SYS_FILE_IO_BACKEND_SYNC);
+    tr_sys_file_close(fd);
+    tr_sys_path_remove(path);
+}
+
+TEST_F(FileTest, fileIoBatchIoUring)
+{
+    if (!tr_sys_file_io_set_backend(TR_SYS_FILE_IO_BACKEND_IO_URING))
+    {
+        GTEST_SKIP() << "io_uring isn't available";
+    }
+
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path = tr_pathbuf{ test_dir, "/a"sv };
+    auto fd = tr_sys_file_open(path, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+
+    // more ops than fit in the ring at once
+    static auto constexpr NBufs = size_t{ 300U };
+    static auto constexpr BufSize = size_t{ 4096U };
+    auto bufs = std::vector<std::array<uint8_t, BufSize>>(NBufs);
+    auto ops = std::vector<tr_sys_file_io_op>(NBufs);
+    for (size_t i = 0; i < NBufs; ++i)
+    {
+        bufs[i].fill(static_cast<uint8_t>(i));
+        ops[i].handle = fd;
+        ops[i].buffer = std::data(bufs[i]);
+        ops[i].size = BufSize;
+        ops[i].offset = (NBufs - 1U - i) * BufSize;
+        ops[i].is_write = true;
+    }
+
+    tr_sys_file_io_batch(std::data(ops), std::size(ops));
+    for (auto const& op : ops)
+    {
+        EXPECT_EQ(0, op.err);
+    }
+    auto const info = tr_sys_path_get_info(path);
+    EXPECT_TRUE(info.has_value());
+    EXPECT_EQ(NBufs * BufSize, info.value_or(tr_sys_path_info{}).size);
+
+    // read them back, this time mixed with writes
+    for (size_t i = 0; i < NBufs; ++i)
+    {
+        ops[i].is_write = i % 2U != 0U;
+        if (!ops[i].is_write)
+        {
+            bufs[i].fill(0xFF);
+        }
+    }
+    tr_sys_file_io_batch(std::data(ops), std::size(ops));
+    for (size_t i = 0; i < NBufs; ++i)
+    {
+        EXPECT_EQ(0, ops[i].err);
+        EXPECT_EQ(BufSize, static_cast<size_t>(std::count(std::begin(bufs[i]), std::end(bufs[i]), static_cast<uint8_t>(i))));
+    }
+
+    tr_sys_file_io_set_backend(TR_SYS_FILE_IO_BACKEND_SYNC);
+    tr_sys_file_close(fd);
+    tr_sys_path_remove(path);
+}
+
+#ifndef _WIN32
+TEST_F(FileTest, fileIoBatchIoUringFailsWithOpsInFlight)
+{
+    // Submits without waiting, then fails the first wait that
+    // follows, so that it fails while the ops are in flight.
+    struct FailingApi final : public libtransmission::IoUringAPI
+    {
+        long enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) override
+        {
+            if (!failed_ && to_submit > 0U)
+            {
+                submitted_ = true;
+                return IoUringAPI::enter(ring_fd, to_submit, 0U, 0U);
+            }
+
+            if (!failed_ && submitted_)
+            {
+                failed_ = true;
+                errno = EBADF;
+                return -1;
+            }
+
+            return IoUringAPI::enter(ring_fd, to_submit, min_complete, flags);
+        }
+
+        bool submitted_ = false;
+        bool failed_ = false;
+    };
+
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path = tr_pathbuf{ test_dir, "/a"sv };
+    auto fd = tr_sys_file_open(path, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+
+    static auto constexpr NBufs = size_t{ 200U };
+    static auto constexpr BufSize = size_t{ 65536U };
+    auto bufs = std::vector<std::array<uint8_t, BufSize>>(NBufs);
+    auto ops = std::vector<tr_sys_file_io_op>(NBufs);
+    for (size_t i = 0; i < NBufs; ++i)
+    {
+        bufs[i].fill(static_cast<uint8_t>(i));
+        ops[i].handle = fd;
+        ops[i].buffer = std::data(bufs[i]);
+        ops[i].size = BufSize;
+        ops[i].offset = i * BufSize;
+        ops[i].is_write = true;
+    }
+
+    // The in-flight ops are cancelled and reaped, then redone with pwrite().
+    auto failing_api = FailingApi{};
+    if (!libtransmission::io_uring_batch(failing_api, std::data(ops), std::size(ops)))
+    {
+        tr_sys_file_close(fd);
+        GTEST_SKIP() << "io_uring isn't available";
+    }
+
+    EXPECT_TRUE(failing_api.failed_);
+    for (auto const& op : ops)
+    {
+        EXPECT_EQ(0, op.err);
+    }
+
+    // read them back in a working ring
+    for (size_t i = 0; i < NBufs; ++i)
+    {
+        bufs[i].fill(0xFF);
+        ops[i].is_write = false;
+    }
+    auto api = libtransmission::IoUringAPI{};
+    EXPECT_TRUE(libtransmission::io_uring_batch(api, std::data(ops), std::size(ops)));
+    for (size_t i = 0; i < NBufs; ++i)
+    {
+        EXPECT_EQ(0, ops[i].err);
+        EXPECT_EQ(BufSize, static_cast<size_t>(std::count(std::begin(bufs[i]), std::end(bufs[i]), static_cast<uint8_t>(i))));
+    }
+
+    tr_sys_file_close(fd);
+    tr_sys_path_remove(path);
+}
+#endif
+
 TEST_F(FileTest, filePreallocate)
 {
     auto const test_dir = createTestDir(currentTestName());
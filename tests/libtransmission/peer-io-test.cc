@@ -0,0 +1,303 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef> // size_t, std::byte
+#include <cstdint> // uint8_t, SIZE_MAX
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include <event2/util.h>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/bandwidth.h>
+#include <libtransmission/error.h>
+#include <libtransmission/net.h>
+#include <libtransmission/peer-io.h>
+#include <libtransmission/peer-mse.h>
+#include <libtransmission/peer-socket.h>
+#include <libtransmission/session.h>
+#include <libtransmission/utils.h>
+
+#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+#ifdef _WIN32
+#define LOCAL_SOCKETPAIR_AF AF_INET
+#else
+#define LOCAL_SOCKETPAIR_AF AF_UNIX
+#endif
+
+namespace libtransmission::test
+{
+
+class PeerIoTest : public SessionTest
+{
+protected:
+    using Bytes = std::vector<std::byte>;
+
+    // big enough that it won't fit in the socket buffers in one go
+    static auto constexpr BlockSize = size_t{ 1024U * 1024U };
+
+    // A socket pair with small buffers, so that big writes come up short.
+    // The first socket is ours to write to; the second one is closed in TearDown().
+    std::pair<evutil_socket_t, evutil_socket_t> makeSocketPair()
+    {
+        auto sockpair = std::array<evutil_socket_t, 2>{ TR_BAD_SOCKET, TR_BAD_SOCKET };
+        EXPECT_EQ(0, evutil_socketpair(LOCAL_SOCKETPAIR_AF, SOCK_STREAM, 0, std::data(sockpair))) << tr_strerror(errno);
+
+        static auto constexpr BufSize = int{ 16 * 1024 };
+        for (auto const sock : sockpair)
+        {
+            EXPECT_EQ(0, evutil_make_socket_nonblocking(sock));
+            setsockopt(sock, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char const*>(&BufSize), sizeof(BufSize));
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char const*>(&BufSize), sizeof(BufSize));
+        }
+
+        remotes_.push_back(sockpair[1]);
+        return { sockpair[0], sockpair[1] };
+    }
+
+    // @return a TCP peer-io and the other end of its socket
+    std::pair<std::shared_ptr<tr_peerIo>, evutil_socket_t> makeIo(tr_bandwidth& parent)
+    {
+        auto const [local, remote] = makeSocketPair();
+        return { tr_peerIo::new_incoming(session_, &parent, tr_peer_socket{ session_, PeerSockAddr, local }), remote };
+    }
+
+    [[nodiscard]] static Bytes makePayload(size_t n_bytes, uint8_t seed)
+    {
+        auto ret = Bytes(n_bytes);
+        for (size_t i = 0; i < n_bytes; ++i)
+        {
+            ret[i] = static_cast<std::byte>((i * 7U + seed) & 0xFFU);
+        }
+        return ret;
+    }
+
+    [[nodiscard]] static Bytes concat(std::vector<Bytes const*> const& parts)
+    {
+        auto ret = Bytes{};
+        for (auto const* const part : parts)
+        {
+            ret.insert(std::end(ret), std::begin(*part), std::end(*part));
+        }
+        return ret;
+    }
+
+    // read whatever has arrived at `sock`
+    static void drain(evutil_socket_t sock, Bytes& setme)
+    {
+        auto buf = std::array<char, 65536>{};
+        for (;;)
+        {
+            auto const n_read = recv(sock, std::data(buf), std::size(buf), 0);
+            if (n_read <= 0)
+            {
+                break;
+            }
+
+            auto const* const begin = reinterpret_cast<std::byte const*>(std::data(buf));
+            setme.insert(std::end(setme), begin, begin + n_read);
+        }
+    }
+
+    // Flush `io` and read from `remote` until `n_bytes` have arrived.
+    // @return what arrived and how many flushes it took
+    static std::pair<Bytes, size_t> flushAll(tr_peerIo& io, evutil_socket_t remote, size_t n_bytes, Bytes got = {})
+    {
+        auto n_flushes = size_t{};
+        while (std::size(got) < n_bytes && n_flushes < 100000U)
+        {
+            io.flush(TR_UP, SIZE_MAX);
+            ++n_flushes;
+            drain(remote, got);
+        }
+
+        // nothing more should arrive
+        io.flush(TR_UP, SIZE_MAX);
+        drain(remote, got);
+
+        return { std::move(got), n_flushes };
+    }
+
+    void runInSessionThread(std::function<void()> func)
+    {
+        auto done = std::atomic<bool>{};
+        session_->runInSessionThread(
+            [&func, &done]()
+            {
+                func();
+                done = true;
+            });
+        EXPECT_TRUE(waitFor([&done]() { return done.load(); }, 10000));
+    }
+
+    void TearDown() override
+    {
+        for (auto const sock : remotes_)
+        {
+            evutil_closesocket(sock);
+        }
+
+        SessionTest::TearDown();
+    }
+
+    tr_socket_address const PeerSockAddr{ *tr_address::from_string("127.0.0.1"sv), tr_port::from_host(8080) };
+
+private:
+    std::vector<evutil_socket_t> remotes_;
+};
+
+TEST_F(PeerIoTest, gatherWriteStopsInMiddleOfSpan)
+{
+    auto const [local, remote] = makeSocketPair();
+    auto const sock = tr_peer_socket{ session_, PeerSockAddr, local };
+
+    auto const head = makePayload(100U, 1U);
+    auto const body = makePayload(BlockSize, 2U);
+    auto const tail = makePayload(100U, 3U);
+    auto const spans = std::array<tr_peer_socket::ConstSpan, 3>{ {
+        { std::data(head), std::size(head) },
+        { std::data(body), std::size(body) },
+        { std::data(tail), std::size(tail) },
+    } };
+
+    tr_error* error = nullptr;
+    auto const n_written = sock.try_write(std::data(spans), std::size(spans), &error);
+    EXPECT_EQ(nullptr, error) << error->message;
+    tr_error_clear(&error);
+
+    // the socket filled up partway through the second span...
+    EXPECT_GT(n_written, std::size(head));
+    EXPECT_LT(n_written, std::size(head) + std::size(body));
+
+    // ...and what was sent is the start of the spans, in order
+    auto got = Bytes{};
+    drain(remote, got);
+    auto expected = concat({ &head, &body, &tail });
+    expected.resize(n_written);
+    EXPECT_EQ(expected, got);
+}
+
+TEST_F(PeerIoTest, shortWritesResumeInMiddleOfSpan)
+{
+    runInSessionThread(
+        [this]()
+        {
+            auto parent = tr_bandwidth{};
+            auto const [io, remote] = makeIo(parent);
+
+            // protocol messages in the write buffer, interleaved with shared blocks
+            auto const head1 = makePayload(13U, 1U);
+            auto const block1 = std::make_shared<Bytes const>(makePayload(BlockSize, 2U));
+            auto const head2 = makePayload(13U, 3U);
+            auto const block2 = std::make_shared<Bytes const>(makePayload(BlockSize, 4U));
+            auto const tail = makePayload(5U, 5U);
+
+            io->write_bytes(std::data(head1), std::size(head1), false);
+            io->write_shared({ block1, std::data(*block1) }, std::size(*block1), true);
+            io->write_bytes(std::data(head2), std::size(head2), false);
+            io->write_shared({ block2, std::data(*block2) }, std::size(*block2), true);
+            io->write_bytes(std::data(tail), std::size(tail), false);
+
+            auto const expected = concat({ &head1, block1.get(), &head2, block2.get(), &tail });
+            auto const [got, n_flushes] = flushAll(*io, remote, std::size(expected));
+
+            // it took several short writes, but everything arrived once and in order
+            EXPECT_GT(n_flushes, 2U);
+            EXPECT_EQ(expected, got);
+        });
+}
+
+TEST_F(PeerIoTest, sharedBlockOutlivesCallerAfterPartialSend)
+{
+    runInSessionThread(
+        [this]()
+        {
+            auto parent = tr_bandwidth{};
+            auto const [io, remote] = makeIo(parent);
+
+            auto const head = makePayload(13U, 1U);
+            auto weak = std::weak_ptr<Bytes const>{};
+            {
+                auto block = std::make_shared<Bytes const>(makePayload(BlockSize, 2U));
+                weak = block;
+
+                io->write_bytes(std::data(head), std::size(head), false);
+                io->write_shared({ block, std::data(*block) }, std::size(*block), true);
+            }
+
+            // the caller has let go of the block, e.g. it was evicted from
+            // the cache, so the io's reference is what keeps it alive...
+            EXPECT_FALSE(weak.expired());
+
+            // ...through a partial send...
+            auto const n_written = io->flush(TR_UP, SIZE_MAX);
+            EXPECT_GT(n_written, std::size(head));
+            EXPECT_LT(n_written, std::size(head) + BlockSize);
+            EXPECT_FALSE(weak.expired());
+
+            // ...until the last of it is written
+            auto first = Bytes{};
+            drain(remote, first);
+            auto const block = makePayload(BlockSize, 2U);
+            auto const expected = concat({ &head, &block });
+            auto const [got, n_flushes] = flushAll(*io, remote, std::size(expected), std::move(first));
+            EXPECT_EQ(expected, got);
+            EXPECT_TRUE(weak.expired());
+        });
+}
+
+TEST_F(PeerIoTest, sharedBlockIsCopiedWhenGatherWritesArentAvailable)
+{
+    runInSessionThread(
+        [this]()
+        {
+            auto parent = tr_bandwidth{};
+            auto const [io, remote] = makeIo(parent);
+
+            // shared blocks can't be encrypted in place
+            auto local_dh = tr_message_stream_encryption::DH{};
+            auto remote_dh = tr_message_stream_encryption::DH{};
+            local_dh.setPeerPublicKey(remote_dh.publicKey());
+            remote_dh.setPeerPublicKey(local_dh.publicKey());
+            auto const info_hash = tr_sha1_digest_t{};
+            io->encrypt_init(true /*is_incoming*/, local_dh, info_hash);
+
+            auto weak = std::weak_ptr<Bytes const>{};
+            {
+                auto block = std::make_shared<Bytes const>(makePayload(BlockSize, 2U));
+                weak = block;
+                io->write_shared({ block, std::data(*block) }, std::size(*block), true);
+            }
+
+            // so it was copied, and the io didn't keep a reference
+            EXPECT_TRUE(weak.expired());
+
+            auto [got, n_flushes] = flushAll(*io, remote, BlockSize);
+            EXPECT_GT(n_flushes, 1U);
+
+            auto filter = tr_message_stream_encryption::Filter{};
+            filter.decrypt_init(false /*is_incoming*/, remote_dh, info_hash);
+            filter.decrypt(std::data(got), std::size(got), std::data(got));
+            EXPECT_EQ(makePayload(BlockSize, 2U), got);
+        });
+}
+
+} // namespace libtransmission::test
@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <ctime> // time_t
+#include <utility>
 #include <vector>
 
 #include <libtransmission/transmission.h> // tr_block_index_t
@@ -189,3 +190,35 @@ TEST_F(PeerMgrActiveRequestsTest, sentBefore)
     EXPECT_EQ(block_a1, items[0].first);
     EXPECT_EQ(peer_a_, items[0].second);
 }
+
+TEST_F(PeerMgrActiveRequestsTest, sentBeforeIsOldestFirst)
+{
+    // setup: add the requests out of order and to different peers
+    auto requests = ActiveRequests{};
+    EXPECT_TRUE(requests.add(tr_block_index_t{ 10 }, peer_a_, 500));
+    EXPECT_TRUE(requests.add(tr_block_index_t{ 20 }, peer_b_, 300));
+    EXPECT_TRUE(requests.add(tr_block_index_t{ 30 }, peer_c_, 400));
+    EXPECT_TRUE(requests.add(tr_block_index_t{ 20 }, peer_a_, 600));
+    EXPECT_EQ(4U, requests.size());
+
+    auto expected = std::vector<std::pair<tr_block_index_t, tr_peer*>>{
+        { tr_block_index_t{ 20 }, peer_b_ },
+        { tr_block_index_t{ 30 }, peer_c_ },
+        { tr_block_index_t{ 10 }, peer_a_ },
+    };
+    EXPECT_EQ(expected, requests.sentBefore(600));
+
+    // test that removed requests aren't returned
+    EXPECT_TRUE(requests.remove(tr_block_index_t{ 20 }, peer_b_));
+    expected.erase(std::begin(expected));
+    EXPECT_EQ(expected, requests.sentBefore(600));
+
+    // test that requests re-added after a removal are ordered correctly
+    auto removed = requests.remove(peer_a_);
+    std::sort(std::begin(removed), std::end(removed));
+    EXPECT_EQ((std::vector<tr_block_index_t>{ 10, 20 }), removed);
+    EXPECT_TRUE(requests.add(tr_block_index_t{ 40 }, peer_b_, 350));
+    expected = { { tr_block_index_t{ 40 }, peer_b_ }, { tr_block_index_t{ 30 }, peer_c_ } };
+    EXPECT_EQ(expected, requests.sentBefore(1000));
+    EXPECT_EQ(2U, requests.size());
+}
@@ -0,0 +1,145 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include <cstdint> // uint16_t, uint64_t
+#include <ctime> // time_t
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <libtransmission/net.h>
+#include <libtransmission/peer-mgr-candidates.h>
+
+#include "gtest/gtest.h"
+
+class PeerMgrCandidatesTest : public ::testing::Test
+{
+protected:
+    [[nodiscard]] static tr_socket_address makeAddr(uint16_t port)
+    {
+        return { tr_address::from_string("10.0.0.1").value_or(tr_address{}), tr_port::from_host(port) };
+    }
+
+    // pop the ready candidates in order
+    [[nodiscard]] static std::vector<tr_socket_address> popAllReady(CandidateIndex& index)
+    {
+        auto ret = std::vector<tr_socket_address>{};
+        while (auto const best = index.best_ready())
+        {
+            ret.emplace_back(best->second);
+            index.erase(best->second);
+        }
+        return ret;
+    }
+
+    tr_socket_address const a_ = makeAddr(1000);
+    tr_socket_address const b_ = makeAddr(2000);
+    tr_socket_address const c_ = makeAddr(3000);
+};
+
+TEST_F(PeerMgrCandidatesTest, readyCandidatesAreOrderedByScore)
+{
+    auto index = CandidateIndex{};
+    EXPECT_FALSE(index.best_ready());
+
+    index.set_ready(b_, 200);
+    index.set_ready(c_, 300);
+    index.set_ready(a_, 100);
+    EXPECT_EQ(3U, index.count_ready());
+    EXPECT_EQ(0U, index.count_waiting());
+    EXPECT_EQ(std::make_pair(uint64_t{ 100 }, a_), index.best_ready());
+
+    EXPECT_EQ((std::vector<tr_socket_address>{ a_, b_, c_ }), popAllReady(index));
+    EXPECT_EQ(0U, index.count_ready());
+}
+
+TEST_F(PeerMgrCandidatesTest, equalScoresAreOrderedByAddress)
+{
+    auto index = CandidateIndex{};
+    index.set_ready(c_, 100);
+    index.set_ready(a_, 100);
+    index.set_ready(b_, 100);
+
+    EXPECT_EQ((std::vector<tr_socket_address>{ a_, b_, c_ }), popAllReady(index));
+}
+
+TEST_F(PeerMgrCandidatesTest, rescoringMovesTheCandidate)
+{
+    auto index = CandidateIndex{};
+    index.set_ready(a_, 100);
+    index.set_ready(b_, 200);
+
+    // e.g. a failed connection attempt makes `a` a worse candidate
+    index.set_ready(a_, 300);
+    EXPECT_EQ(2U, index.count_ready());
+    EXPECT_EQ(uint64_t{ 300 }, index.ready_score(a_));
+    EXPECT_EQ((std::vector<tr_socket_address>{ b_, a_ }), popAllReady(index));
+}
+
+TEST_F(PeerMgrCandidatesTest, candidatesMoveBetweenReadyAndWaiting)
+{
+    auto index = CandidateIndex{};
+    index.set_ready(a_, 100);
+    index.set_ready(b_, 200);
+
+    // e.g. we connect to `a`, so it isn't a candidate until the connection ends
+    index.set_waiting(a_, time_t{ 5000 });
+    EXPECT_EQ(1U, index.count_ready());
+    EXPECT_EQ(1U, index.count_waiting());
+    EXPECT_TRUE(index.contains(a_));
+    EXPECT_FALSE(index.ready_score(a_));
+    EXPECT_EQ(b_, index.best_ready()->second);
+
+    // the connection ends, so it's ready again
+    index.set_ready(a_, 100);
+    EXPECT_EQ(2U, index.count_ready());
+    EXPECT_EQ(0U, index.count_waiting());
+    EXPECT_EQ(a_, index.best_ready()->second);
+}
+
+TEST_F(PeerMgrCandidatesTest, waitingCandidatesComeDueInOrder)
+{
+    auto index = CandidateIndex{};
+    index.set_waiting(b_, time_t{ 200 });
+    index.set_waiting(a_, time_t{ 100 });
+    index.set_waiting(c_, time_t{ 300 });
+
+    EXPECT_FALSE(index.next_due(time_t{ 99 }));
+    EXPECT_EQ(a_, index.next_due(time_t{ 100 }));
+    EXPECT_EQ(a_, index.next_due(time_t{ 250 }));
+
+    // the caller requeues what's due, e.g. as ready
+    index.set_ready(a_, 1);
+    EXPECT_EQ(b_, index.next_due(time_t{ 250 }));
+    index.set_waiting(b_, time_t{ 400 });
+    EXPECT_FALSE(index.next_due(time_t{ 250 }));
+    EXPECT_EQ(c_, index.next_due(time_t{ 400 }));
+}
+
+TEST_F(PeerMgrCandidatesTest, eraseRemovesFromEitherQueue)
+{
+    auto index = CandidateIndex{};
+    index.set_ready(a_, 100);
+    index.set_waiting(b_, time_t{ 100 });
+
+    index.erase(a_);
+    index.erase(b_);
+    index.erase(c_); // not queued; no-op
+
+    EXPECT_FALSE(index.contains(a_));
+    EXPECT_FALSE(index.contains(b_));
+    EXPECT_EQ(0U, index.count_ready());
+    EXPECT_EQ(0U, index.count_waiting());
+    EXPECT_FALSE(index.best_ready());
+    EXPECT_FALSE(index.next_due(time_t{ 1000 }));
+
+    index.set_ready(a_, 100);
+    index.set_waiting(b_, time_t{ 100 });
+    index.clear();
+    EXPECT_FALSE(index.contains(a_));
+    EXPECT_FALSE(index.contains(b_));
+}
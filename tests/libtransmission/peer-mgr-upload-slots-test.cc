@@ -0,0 +1,100 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include <cstddef> // size_t
+#include <numeric> // std::accumulate
+#include <vector>
+
+#include <libtransmission/peer-mgr-upload-slots.h>
+
+#include "gtest/gtest.h"
+
+using PeerMgrUploadSlotsTest = ::testing::Test;
+using Shares = std::vector<size_t>;
+
+TEST_F(PeerMgrUploadSlotsTest, keepsSlotsForOptimisticUnchokes)
+{
+    // an eighth of the pool...
+    auto pool = UploadSlotPool{ 40U, 0U };
+    EXPECT_EQ(5U, pool.optimistic_slots());
+    EXPECT_EQ(35U, pool.free());
+
+    // ...but at least one
+    pool = UploadSlotPool{ 4U, 0U };
+    EXPECT_EQ(1U, pool.optimistic_slots());
+    EXPECT_EQ(3U, pool.free());
+
+    // and unexpired optimistic unchokes keep theirs
+    pool = UploadSlotPool{ 40U, 7U };
+    EXPECT_EQ(7U, pool.optimistic_slots());
+    EXPECT_EQ(33U, pool.free());
+
+    // even if they crowd out the regular ones
+    pool = UploadSlotPool{ 4U, 6U };
+    EXPECT_EQ(6U, pool.optimistic_slots());
+    EXPECT_EQ(0U, pool.free());
+}
+
+TEST_F(PeerMgrUploadSlotsTest, sharesAreEvenAndCapped)
+{
+    auto const pool = UploadSlotPool{ 40U, 0U };
+    EXPECT_EQ(35U, pool.free());
+
+    EXPECT_EQ((Shares{ 7U, 7U, 7U, 7U, 7U }), pool.fair_shares(5U, 100U, 0U));
+    EXPECT_EQ((Shares{ 4U, 4U, 4U, 4U, 4U }), pool.fair_shares(5U, 4U, 0U));
+    EXPECT_TRUE(std::empty(pool.fair_shares(0U, 4U, 0U)));
+}
+
+TEST_F(PeerMgrUploadSlotsTest, remainderIsHandedOutInTurn)
+{
+    auto const pool = UploadSlotPool{ 11U, 0U };
+    EXPECT_EQ(10U, pool.free());
+
+    EXPECT_EQ((Shares{ 3U, 3U, 2U, 2U }), pool.fair_shares(4U, 100U, 0U));
+    EXPECT_EQ((Shares{ 2U, 3U, 3U, 2U }), pool.fair_shares(4U, 100U, 1U));
+    EXPECT_EQ((Shares{ 3U, 2U, 2U, 3U }), pool.fair_shares(4U, 100U, 3U));
+}
+
+TEST_F(PeerMgrUploadSlotsTest, moreTorrentsThanSlots)
+{
+    auto const pool = UploadSlotPool{ 4U, 0U };
+    EXPECT_EQ(3U, pool.free());
+
+    // the slots aren't all lost to rounding down
+    auto const shares = pool.fair_shares(5U, 100U, 4U);
+    EXPECT_EQ((Shares{ 1U, 1U, 0U, 0U, 1U }), shares);
+    EXPECT_EQ(pool.free(), std::accumulate(std::begin(shares), std::end(shares), size_t{}));
+
+    // and every torrent gets a turn
+    auto turns = Shares(5U);
+    for (size_t first = 0; first < 5U; ++first)
+    {
+        auto const these = pool.fair_shares(5U, 100U, first);
+        for (size_t i = 0; i < 5U; ++i)
+        {
+            turns[i] += these[i];
+        }
+    }
+    EXPECT_EQ((Shares{ 3U, 3U, 3U, 3U, 3U }), turns);
+}
+
+TEST_F(PeerMgrUploadSlotsTest, unusedSlotsGoToOptimisticUnchokes)
+{
+    // 40 slots: 5 optimistic, 2 of which are held
+    auto pool = UploadSlotPool{ 40U, 2U };
+    EXPECT_EQ(35U, pool.free());
+    EXPECT_EQ(3U + 35U, pool.optimistic_free());
+
+    pool.take(30U);
+    EXPECT_EQ(5U, pool.free());
+    EXPECT_EQ(8U, pool.optimistic_free());
+
+    // taking more than is free doesn't underflow
+    pool.take(10U);
+    EXPECT_EQ(0U, pool.free());
+    EXPECT_EQ(3U, pool.optimistic_free());
+}
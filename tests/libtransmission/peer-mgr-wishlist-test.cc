@@ -6,6 +6,7 @@
 #include <cstddef> // size_t
 #include <map>
 #include <set>
+#include <vector>
 
 #define LIBTRANSMISSION_PEER_MODULE
 
@@ -19,17 +20,22 @@
 class PeerMgrWishlistTest : public ::testing::Test
 {
 protected:
+    static auto constexpr PeerHasAllPieces = [](tr_piece_index_t) { return true; };
+    static auto constexpr ClientHasNoActiveRequests = [](tr_block_index_t) { return false; };
+
     struct MockMediator : public Wishlist::Mediator
     {
         mutable std::map<tr_block_index_t, size_t> active_request_count_;
         mutable std::map<tr_piece_index_t, size_t> missing_block_count_;
         mutable std::map<tr_piece_index_t, tr_block_span_t> block_span_;
         mutable std::map<tr_piece_index_t, tr_priority_t> piece_priority_;
+        mutable std::map<tr_piece_index_t, size_t> piece_replication_;
         mutable std::set<tr_block_index_t> can_request_block_;
         mutable std::set<tr_piece_index_t> can_request_piece_;
         tr_piece_index_t piece_count_ = 0;
         bool is_endgame_ = false;
         bool is_sequential_download_ = false;
+        tr_piece_selection piece_selection_ = TR_PIECE_SELECTION_RAREST_FIRST;
 
         [[nodiscard]] bool clientCanRequestBlock(tr_block_index_t block) const final
         {
@@ -61,6 +67,11 @@ protected:
             return missing_block_count_[piece];
         }
 
+        [[nodiscard]] size_t replication(tr_piece_index_t piece) const final
+        {
+            return piece_replication_[piece];
+        }
+
         [[nodiscard]] tr_block_span_t blockSpan(tr_piece_index_t piece) const final
         {
             return block_span_[piece];
@@ -75,6 +86,11 @@ protected:
         {
             return piece_priority_[piece];
         }
+
+        [[nodiscard]] tr_piece_selection pieceSelection() const final
+        {
+            return piece_selection_;
+        }
     };
 };
 
@@ -99,7 +115,7 @@ TEST_F(PeerMgrWishlistTest, doesNotRequestPiecesThatCannotBeRequested)
     }
 
     // we should only get the first piece back
-    auto spans = Wishlist{ mediator }.next(1000);
+    auto spans = Wishlist{ mediator }.next(1000, PeerHasAllPieces, ClientHasNoActiveRequests);
     ASSERT_EQ(1U, std::size(spans));
     EXPECT_EQ(mediator.block_span_[0].begin, spans[0].begin);
     EXPECT_EQ(mediator.block_span_[0].end, spans[0].end);
@@ -132,7 +148,7 @@ TEST_F(PeerMgrWishlistTest, doesNotRequestBlocksThatCannotBeRequested)
 
     // even if we ask wishlist for more blocks than exist,
     // it should omit blocks 1-10 from the return set
-    auto spans = Wishlist{ mediator }.next(1000);
+    auto spans = Wishlist{ mediator }.next(1000, PeerHasAllPieces, ClientHasNoActiveRequests);
     auto requested = tr_bitfield(250);
     for (auto const& span : spans)
     {
@@ -169,7 +185,7 @@ TEST_F(PeerMgrWishlistTest, doesNotRequestTooManyBlocks)
     // but we only ask for 10 blocks,
     // so that's how many we should get back
     auto const n_wanted = 10U;
-    auto const spans = Wishlist{ mediator }.next(n_wanted);
+    auto const spans = Wishlist{ mediator }.next(n_wanted, PeerHasAllPieces, ClientHasNoActiveRequests);
     auto n_got = size_t{};
     for (auto const& span : spans)
     {
@@ -213,7 +229,7 @@ TEST_F(PeerMgrWishlistTest, prefersHighPriorityPieces)
     for (int run = 0; run < num_runs; ++run)
     {
         auto const n_wanted = 10U;
-        auto spans = Wishlist{ mediator }.next(n_wanted);
+        auto spans = Wishlist{ mediator }.next(n_wanted, PeerHasAllPieces, ClientHasNoActiveRequests);
         auto n_got = size_t{};
         for (auto const& span : spans)
         {
@@ -259,7 +275,7 @@ TEST_F(PeerMgrWishlistTest, onlyRequestsDupesDuringEndgame)
 
     // even if we ask wishlist to list more blocks than exist,
     // those first 150 should be omitted from the return list
-    auto spans = Wishlist{ mediator }.next(1000);
+    auto spans = Wishlist{ mediator }.next(1000, PeerHasAllPieces, ClientHasNoActiveRequests);
     auto requested = tr_bitfield(300);
     for (auto const& span : spans)
     {
@@ -272,7 +288,7 @@ TEST_F(PeerMgrWishlistTest, onlyRequestsDupesDuringEndgame)
     // BUT during endgame it's OK to request dupes,
     // so then we _should_ see the first 150 in the list
     mediator.is_endgame_ = true;
-    spans = Wishlist{ mediator }.next(1000);
+    spans = Wishlist{ mediator }.next(1000, PeerHasAllPieces, ClientHasNoActiveRequests);
     requested = tr_bitfield(300);
     for (auto const& span : spans)
     {
@@ -322,7 +338,7 @@ TEST_F(PeerMgrWishlistTest, prefersNearlyCompletePieces)
     auto const num_runs = 1000;
     for (int run = 0; run < num_runs; ++run)
     {
-        auto const ranges = Wishlist{ mediator }.next(10);
+        auto const ranges = Wishlist{ mediator }.next(10, PeerHasAllPieces, ClientHasNoActiveRequests);
         auto requested = tr_bitfield(300);
         for (auto const& range : ranges)
         {
@@ -338,7 +354,7 @@ TEST_F(PeerMgrWishlistTest, prefersNearlyCompletePieces)
     // those blocks should be next in line.
     for (int run = 0; run < num_runs; ++run)
     {
-        auto const ranges = Wishlist{ mediator }.next(20);
+        auto const ranges = Wishlist{ mediator }.next(20, PeerHasAllPieces, ClientHasNoActiveRequests);
         auto requested = tr_bitfield(300);
         for (auto const& range : ranges)
         {
@@ -350,3 +366,247 @@ TEST_F(PeerMgrWishlistTest, prefersNearlyCompletePieces)
         EXPECT_EQ(0U, requested.count(200, 300));
     }
 }
+
+TEST_F(PeerMgrWishlistTest, prefersRarestPieces)
+{
+    auto mediator = MockMediator{};
+
+    // setup: three pieces, all missing
+    mediator.piece_count_ = 3;
+    mediator.missing_block_count_[0] = 100;
+    mediator.missing_block_count_[1] = 100;
+    mediator.missing_block_count_[2] = 100;
+    mediator.block_span_[0] = { 0, 100 };
+    mediator.block_span_[1] = { 100, 200 };
+    mediator.block_span_[2] = { 200, 300 };
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 3; ++i)
+    {
+        mediator.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        mediator.can_request_block_.insert(i);
+    }
+
+    // but the third piece is the rarest, then the first
+    mediator.piece_replication_[0] = 3;
+    mediator.piece_replication_[1] = 7;
+    mediator.piece_replication_[2] = 1;
+
+    // wishlist should pick the rarest piece's blocks first,
+    // then the next-rarest. Test several times to shake out randomness.
+    auto const num_runs = 1000;
+    for (int run = 0; run < num_runs; ++run)
+    {
+        auto const spans = Wishlist{ mediator }.next(150, PeerHasAllPieces, ClientHasNoActiveRequests);
+        auto requested = tr_bitfield(300);
+        for (auto const& span : spans)
+        {
+            requested.set_span(span.begin, span.end);
+        }
+        EXPECT_EQ(150U, requested.count());
+        EXPECT_EQ(50U, requested.count(0, 100));
+        EXPECT_EQ(0U, requested.count(100, 200));
+        EXPECT_EQ(100U, requested.count(200, 300));
+    }
+
+    // rarity doesn't matter if the user wants a sequential download
+    mediator.piece_selection_ = TR_PIECE_SELECTION_SEQUENTIAL;
+    auto const spans = Wishlist{ mediator }.next(150, PeerHasAllPieces, ClientHasNoActiveRequests);
+    auto requested = tr_bitfield(300);
+    for (auto const& span : spans)
+    {
+        requested.set_span(span.begin, span.end);
+    }
+    EXPECT_EQ(150U, requested.count());
+    EXPECT_EQ(100U, requested.count(0, 100));
+    EXPECT_EQ(50U, requested.count(100, 200));
+    EXPECT_EQ(0U, requested.count(200, 300));
+}
+
+TEST_F(PeerMgrWishlistTest, updatesWhenPiecesChange)
+{
+    auto mediator = MockMediator{};
+
+    // setup: three pieces, all missing
+    mediator.piece_count_ = 3;
+    mediator.missing_block_count_[0] = 100;
+    mediator.missing_block_count_[1] = 100;
+    mediator.missing_block_count_[2] = 100;
+    mediator.block_span_[0] = { 0, 100 };
+    mediator.block_span_[1] = { 100, 200 };
+    mediator.block_span_[2] = { 200, 300 };
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 3; ++i)
+    {
+        mediator.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        mediator.can_request_block_.insert(i);
+    }
+
+    // and the first piece is the rarest
+    mediator.piece_replication_[0] = 1;
+    mediator.piece_replication_[1] = 2;
+    mediator.piece_replication_[2] = 2;
+
+    auto wishlist = Wishlist{ mediator };
+    auto get_requested = [&wishlist](size_t n_wanted)
+    {
+        auto requested = tr_bitfield(300);
+        for (auto const& span : wishlist.next(n_wanted, PeerHasAllPieces, ClientHasNoActiveRequests))
+        {
+            requested.set_span(span.begin, span.end);
+        }
+        return requested;
+    };
+
+    auto requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(0, 100));
+
+    // we got most of the last piece, so now it should be first in line
+    for (tr_block_index_t block = 200; block < 290; ++block)
+    {
+        mediator.can_request_block_.erase(block);
+    }
+    mediator.missing_block_count_[2] = 10;
+    wishlist.on_piece_changed(2);
+    requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(290, 300));
+
+    // and when it's done, the rarest piece is first again
+    for (tr_block_index_t block = 290; block < 300; ++block)
+    {
+        mediator.can_request_block_.erase(block);
+    }
+    mediator.missing_block_count_[2] = 0;
+    wishlist.on_piece_changed(2);
+    requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(0, 100));
+
+    // a peer joined that has the first piece but not the second
+    mediator.piece_replication_[0] = 3;
+    wishlist.on_replication_changed();
+    requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(100, 200));
+
+    // the user doesn't want the second piece anymore
+    mediator.can_request_piece_.erase(1);
+    wishlist.reset();
+    requested = get_requested(1000);
+    EXPECT_EQ(100U, requested.count());
+    EXPECT_EQ(100U, requested.count(0, 100));
+}
+
+TEST_F(PeerMgrWishlistTest, skipsPiecesThatAreAlreadyRequested)
+{
+    auto mediator = MockMediator{};
+
+    // setup: two pieces, all missing
+    mediator.piece_count_ = 2;
+    mediator.missing_block_count_[0] = 100;
+    mediator.missing_block_count_[1] = 100;
+    mediator.block_span_[0] = { 0, 100 };
+    mediator.block_span_[1] = { 100, 200 };
+    mediator.is_sequential_download_ = true;
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 2; ++i)
+    {
+        mediator.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 200; ++i)
+    {
+        mediator.can_request_block_.insert(i);
+    }
+
+    auto wishlist = Wishlist{ mediator };
+    auto get_requested = [&wishlist](size_t n_wanted)
+    {
+        auto requested = tr_bitfield(200);
+        for (auto const& span : wishlist.next(n_wanted, PeerHasAllPieces, ClientHasNoActiveRequests))
+        {
+            requested.set_span(span.begin, span.end);
+        }
+        return requested;
+    };
+
+    // we've already asked other peers for all of the first piece
+    for (tr_block_index_t block = 0; block < 100; ++block)
+    {
+        mediator.active_request_count_[block] = 1;
+    }
+    auto requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(100, 200));
+
+    // ask again now that the wishlist knows the first piece is fully requested
+    requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(100, 200));
+
+    // some of those requests were cancelled, so they can be requested again
+    for (tr_block_index_t block = 50; block < 60; ++block)
+    {
+        mediator.active_request_count_[block] = 0;
+    }
+    wishlist.on_requests_changed(0);
+    requested = get_requested(10);
+    EXPECT_EQ(10U, requested.count(50, 60));
+}
+
+TEST_F(PeerMgrWishlistTest, prefersPreferredPieces)
+{
+    auto mediator = MockMediator{};
+
+    // setup: three pieces, all missing
+    mediator.piece_count_ = 3;
+    mediator.missing_block_count_[0] = 100;
+    mediator.missing_block_count_[1] = 100;
+    mediator.missing_block_count_[2] = 100;
+    mediator.block_span_[0] = { 0, 100 };
+    mediator.block_span_[1] = { 100, 200 };
+    mediator.block_span_[2] = { 200, 300 };
+    mediator.is_sequential_download_ = true;
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 3; ++i)
+    {
+        mediator.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        mediator.can_request_block_.insert(i);
+    }
+
+    auto wishlist = Wishlist{ mediator };
+    auto get_requested = [&wishlist](size_t n_wanted, std::vector<tr_piece_index_t> const& preferred, bool preferred_only)
+    {
+        auto requested = tr_bitfield(300);
+        for (auto const& span : wishlist.next(n_wanted, PeerHasAllPieces, ClientHasNoActiveRequests, preferred, preferred_only))
+        {
+            requested.set_span(span.begin, span.end);
+        }
+        return requested;
+    };
+
+    // the peer suggested the last piece, so that should be requested first
+    auto requested = get_requested(150, { 2 }, false);
+    EXPECT_EQ(150U, requested.count());
+    EXPECT_EQ(100U, requested.count(200, 300));
+    EXPECT_EQ(50U, requested.count(0, 100));
+
+    // if only the preferred pieces can be requested, e.g. Allowed Fast
+    // pieces while the peer is choking us, then nothing else should be
+    requested = get_requested(150, { 1 }, true);
+    EXPECT_EQ(100U, requested.count());
+    EXPECT_EQ(100U, requested.count(100, 200));
+
+    // pieces that we don't want are ignored
+    mediator.can_request_piece_.erase(1);
+    wishlist.on_piece_changed(1);
+    requested = get_requested(150, { 1 }, true);
+    EXPECT_EQ(0U, requested.count());
+}
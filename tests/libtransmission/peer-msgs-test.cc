@@ -3,13 +3,88 @@
 // or any future license endorsed by Mnemosyne LLC.
 // License text can be found in the licenses/ folder.
 
-#include <cstring>
+#include <cstddef> // std::byte
+#include <cstdint> // uint64_t
+#include <vector>
 
 #include <libtransmission/transmission.h>
+
+#include <libtransmission/net.h>
 #include <libtransmission/peer-msgs.h>
 
 #include "gtest/gtest.h"
 
-TEST(PeerMsgs, placeholder)
+TEST(PeerMsgs, allowedFastSet)
+{
+    // the example from http://bittorrent.org/beps/bep_0006.html
+    auto const addr = tr_address::from_string("80.4.4.200");
+    ASSERT_TRUE(addr);
+    auto info_hash = tr_sha1_digest_t{};
+    info_hash.fill(std::byte{ 0xAA });
+    auto constexpr PieceCount = tr_piece_index_t{ 1313 };
+
+    auto expected = std::vector<tr_piece_index_t>{ 1059, 431, 808, 1217, 287, 376, 1188 };
+    EXPECT_EQ(expected, tr_generateAllowedSet(*addr, info_hash, PieceCount, 7U));
+
+    expected = std::vector<tr_piece_index_t>{ 1059, 431, 808, 1217, 287, 376, 1188, 353, 508 };
+    EXPECT_EQ(expected, tr_generateAllowedSet(*addr, info_hash, PieceCount, 9U));
+
+    // the low byte of the address doesn't matter
+    auto const neighbor = tr_address::from_string("80.4.4.1");
+    ASSERT_TRUE(neighbor);
+    EXPECT_EQ(expected, tr_generateAllowedSet(*neighbor, info_hash, PieceCount, 9U));
+
+    // the set can't have more pieces than the torrent does
+    EXPECT_EQ(3U, std::size(tr_generateAllowedSet(*addr, info_hash, 3U, 9U)));
+
+    // BEP 6 doesn't define the set for IPv6
+    auto const addr6 = tr_address::from_string("2001:db8::1");
+    ASSERT_TRUE(addr6);
+    EXPECT_TRUE(std::empty(tr_generateAllowedSet(*addr6, info_hash, PieceCount, 9U)));
+}
+
+TEST(PeerMsgs, requestPipelineDepth)
 {
+    static auto constexpr MaxDepth = size_t{ 250U };
+    static auto constexpr MiB = tr_bytes_per_second_t{ 1024U * 1024U };
+    auto pipeline = tr_request_pipeline{};
+
+    // nothing's known about the peer yet
+    EXPECT_FALSE(pipeline.min_rtt_msec());
+    EXPECT_EQ(tr_request_pipeline::InitialDepth, pipeline.depth(10U * MiB, MaxDepth, 0U));
+    EXPECT_EQ(10U, pipeline.depth(10U * MiB, 10U, 0U));
+
+    // a round trip of 100 msec
+    auto now = uint64_t{ 1000U };
+    pipeline.on_request_sent(1U, now);
+    now += 100U;
+    pipeline.on_block_received(1U, now);
+    EXPECT_EQ(100U, pipeline.min_rtt_msec());
+
+    // 10 MiB/s * 100 msec = 1 MiB in flight, so twice that is 128 blocks
+    EXPECT_EQ(128U, pipeline.depth(10U * MiB, MaxDepth, now));
+    EXPECT_EQ(100U, pipeline.depth(10U * MiB, 100U, now));
+    EXPECT_EQ(MaxDepth, pipeline.depth(100U * MiB, MaxDepth, now));
+
+    // slow peers don't get to sit on many blocks
+    EXPECT_EQ(tr_request_pipeline::MinDepth, pipeline.depth(10U * 1024U, MaxDepth, now));
+
+    // a request that waited in line behind others doesn't change the RTT
+    pipeline.on_request_sent(2U, now);
+    now += 500U;
+    pipeline.on_block_received(2U, now);
+    EXPECT_EQ(100U, pipeline.min_rtt_msec());
+
+    // blocks that we didn't ask for are ignored
+    pipeline.on_block_received(3U, now);
+    EXPECT_EQ(100U, pipeline.min_rtt_msec());
+
+    // when the RTT gets old, drain the pipeline to measure it again
+    now += tr_request_pipeline::MinRttLifetimeMsec;
+    EXPECT_EQ(tr_request_pipeline::MinDepth, pipeline.depth(10U * MiB, MaxDepth, now));
+    pipeline.on_request_sent(4U, now);
+    now += 200U;
+    pipeline.on_block_received(4U, now);
+    EXPECT_EQ(200U, pipeline.min_rtt_msec());
+    EXPECT_EQ(256U, pipeline.depth(10U * MiB, 1000U, now));
 }
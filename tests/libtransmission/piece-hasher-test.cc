@@ -0,0 +1,259 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <algorithm>
+#include <cstdint> // uint8_t
+#include <functional>
+#include <set>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/block-info.h>
+#include <libtransmission/crypto-utils.h>
+#include <libtransmission/piece-hasher.h>
+
+#include "gtest/gtest.h"
+
+class PieceHasherTest : public ::testing::Test
+{
+protected:
+    // pieces that aren't a multiple of the block size, so some blocks span two pieces
+    static auto constexpr PieceSize = uint32_t{ tr_block_info::BlockSize * 3U / 2U };
+    static auto constexpr PieceCount = uint32_t{ 4U };
+
+    struct MockMediator final : public tr_piece_hasher::Mediator
+    {
+        tr_block_info block_info_;
+        std::vector<uint8_t> contents_;
+        std::set<tr_block_index_t> have_;
+        size_t n_reads_ = 0U;
+        bool fail_reads_ = false;
+
+        // if set, reads finish in finish_reads() instead of right away,
+        // like reads that have to go to disk
+        bool defer_reads_ = false;
+        std::vector<std::function<void()>> deferred_;
+
+        explicit MockMediator(uint32_t piece_size = PieceSize)
+            : block_info_{ uint64_t{ piece_size } * PieceCount, piece_size }
+            , contents_(block_info_.total_size())
+        {
+            tr_rand_buffer(std::data(contents_), std::size(contents_));
+        }
+
+        [[nodiscard]] tr_block_info const& block_info() const override
+        {
+            return block_info_;
+        }
+
+        [[nodiscard]] bool has_block(tr_block_index_t block) const override
+        {
+            return have_.count(block) != 0U;
+        }
+
+        void read_block(tr_block_index_t block, std::function<void(uint8_t const* data)>&& on_done) override
+        {
+            ++n_reads_;
+            auto read = [this, block, on_done = std::move(on_done)]()
+            {
+                on_done(fail_reads_ ? nullptr : block_data(block));
+            };
+
+            if (defer_reads_)
+            {
+                deferred_.emplace_back(std::move(read));
+            }
+            else
+            {
+                read();
+            }
+        }
+
+        void finish_reads()
+        {
+            // reads that finish may start new ones
+            while (!std::empty(deferred_))
+            {
+                auto reads = std::move(deferred_);
+                deferred_.clear();
+                for (auto const& read : reads)
+                {
+                    read();
+                }
+            }
+        }
+
+        [[nodiscard]] uint8_t const* block_data(tr_block_index_t block) const
+        {
+            return std::data(contents_) + block_info_.block_loc(block).byte;
+        }
+
+        [[nodiscard]] tr_sha1_digest_t piece_hash(tr_piece_index_t piece) const
+        {
+            auto const [begin, end] = block_info_.byte_span_for_piece(piece);
+            auto const sv = std::string_view{ reinterpret_cast<char const*>(std::data(contents_)) + begin, end - begin };
+            return tr_sha1::digest(sv);
+        }
+    };
+
+    // what the torrent does when a block arrives
+    void got_block(tr_block_index_t block)
+    {
+        hasher_.add_block(block, mediator_.block_data(block));
+        mediator_.have_.insert(block);
+    }
+
+    MockMediator mediator_;
+    tr_piece_hasher hasher_{ mediator_ };
+};
+
+TEST_F(PieceHasherTest, hashesInOrderWithoutReading)
+{
+    for (tr_block_index_t block = 0; block < mediator_.block_info().block_count(); ++block)
+    {
+        got_block(block);
+    }
+
+    for (tr_piece_index_t piece = 0; piece < PieceCount; ++piece)
+    {
+        auto const digest = hasher_.finish(piece);
+        ASSERT_TRUE(digest);
+        EXPECT_EQ(mediator_.piece_hash(piece), *digest);
+    }
+
+    EXPECT_EQ(0U, mediator_.n_reads_);
+    EXPECT_EQ(0U, hasher_.size());
+}
+
+TEST_F(PieceHasherTest, readsBackOutOfOrderBlocks)
+{
+    auto const [begin, end] = mediator_.block_info().block_span_for_piece(0);
+    ASSERT_EQ(2U, end - begin);
+
+    got_block(begin + 1);
+    got_block(begin);
+
+    auto const digest = hasher_.finish(0);
+    ASSERT_TRUE(digest);
+    EXPECT_EQ(mediator_.piece_hash(0), *digest);
+    EXPECT_EQ(1U, mediator_.n_reads_);
+}
+
+TEST_F(PieceHasherTest, incompletePieceHasNoDigest)
+{
+    got_block(0);
+    EXPECT_EQ(1U, hasher_.size());
+
+    EXPECT_FALSE(hasher_.finish(0));
+    EXPECT_EQ(0U, hasher_.size());
+
+    // a piece we know nothing about has no digest either
+    EXPECT_FALSE(hasher_.finish(1));
+}
+
+TEST_F(PieceHasherTest, failedReadForgetsPiece)
+{
+    auto const [begin, end] = mediator_.block_info().block_span_for_piece(0);
+
+    got_block(begin + 1);
+    mediator_.fail_reads_ = true;
+    got_block(begin);
+
+    EXPECT_FALSE(hasher_.finish(0));
+}
+
+TEST_F(PieceHasherTest, eraseForgetsPiece)
+{
+    auto const [begin, end] = mediator_.block_info().block_span_for_piece(0);
+
+    got_block(begin);
+    got_block(begin + 1);
+    hasher_.erase(0);
+
+    EXPECT_FALSE(hasher_.finish(0));
+}
+
+TEST_F(PieceHasherTest, waitsForReadFromDisk)
+{
+    auto const [begin, end] = mediator_.block_info().block_span_for_piece(0);
+
+    got_block(begin + 1);
+    mediator_.defer_reads_ = true;
+    got_block(begin);
+
+    // the read hasn't finished, so neither has the hash...
+    EXPECT_EQ(1U, mediator_.n_reads_);
+    EXPECT_EQ(1U, std::size(mediator_.deferred_));
+
+    // ...until it does
+    mediator_.finish_reads();
+    auto const digest = hasher_.finish(0);
+    ASSERT_TRUE(digest);
+    EXPECT_EQ(mediator_.piece_hash(0), *digest);
+}
+
+TEST_F(PieceHasherTest, blocksThatArriveDuringReadAreReadBack)
+{
+    auto mediator = MockMediator{ tr_block_info::BlockSize * 3U };
+    auto hasher = tr_piece_hasher{ mediator };
+    auto const got_block = [&](tr_block_index_t block)
+    {
+        hasher.add_block(block, mediator.block_data(block));
+        mediator.have_.insert(block);
+    };
+
+    // the second block is being read when the third one arrives...
+    mediator.defer_reads_ = true;
+    got_block(1U);
+    got_block(0U);
+    EXPECT_EQ(1U, std::size(mediator.deferred_));
+    got_block(2U);
+    EXPECT_EQ(1U, std::size(mediator.deferred_));
+
+    // ...so it's read back too
+    mediator.finish_reads();
+    EXPECT_EQ(2U, mediator.n_reads_);
+    auto const digest = hasher.finish(0);
+    ASSERT_TRUE(digest);
+    EXPECT_EQ(mediator.piece_hash(0), *digest);
+}
+
+TEST_F(PieceHasherTest, pieceFinishedDuringReadHasNoDigest)
+{
+    auto const [begin, end] = mediator_.block_info().block_span_for_piece(0);
+
+    got_block(begin + 1);
+    mediator_.defer_reads_ = true;
+    got_block(begin);
+
+    // the piece is checked before the read finishes, so it has to be read back in full
+    EXPECT_FALSE(hasher_.finish(0));
+
+    // and if the piece is hashed again, the late read doesn't get mixed into it
+    hasher_.add_block(begin, mediator_.block_data(begin));
+    EXPECT_EQ(2U, std::size(mediator_.deferred_));
+    mediator_.finish_reads();
+    auto const digest = hasher_.finish(0);
+    ASSERT_TRUE(digest);
+    EXPECT_EQ(mediator_.piece_hash(0), *digest);
+}
+
+TEST_F(PieceHasherTest, failedReadFromDiskForgetsPiece)
+{
+    auto const [begin, end] = mediator_.block_info().block_span_for_piece(0);
+
+    got_block(begin + 1);
+    mediator_.defer_reads_ = true;
+    mediator_.fail_reads_ = true;
+    got_block(begin);
+    auto const n_pieces = hasher_.size();
+
+    mediator_.finish_reads();
+    EXPECT_EQ(n_pieces - 1U, hasher_.size());
+    EXPECT_FALSE(hasher_.finish(0));
+}
@@ -9,11 +9,14 @@
 #include <cstdint> // int64_t
 #include <iterator> // std::inserter
 #include <set>
+#include <string>
 #include <string_view>
 #include <vector>
 
 #include <libtransmission/transmission.h>
+#include <libtransmission/bandwidth.h>
 #include <libtransmission/rpcimpl.h>
+#include <libtransmission/session.h>
 #include <libtransmission/variant.h>
 
 #include "gtest/gtest.h"
@@ -183,4 +186,45 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr, nullptr);
 }
 
+TEST_F(RpcTest, groupSetRejectsOutOfRangeValues)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        std::swap(*static_cast<tr_variant*>(setme), *response);
+    };
+
+    auto const group_set = [this, &rpc_response_func](tr_quark key, int64_t value)
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 2);
+        tr_variantDictAddStrView(&request, TR_KEY_method, "group-set");
+        auto* const args = tr_variantDictAddDict(&request, TR_KEY_arguments, 2);
+        tr_variantDictAddStrView(args, TR_KEY_name, "group");
+        tr_variantDictAddInt(args, key, value);
+
+        tr_variant response;
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+
+        auto result = std::string_view{};
+        EXPECT_TRUE(tr_variantDictFindStrView(&response, TR_KEY_result, &result));
+        return std::string{ result };
+    };
+
+    EXPECT_EQ("success", group_set(TR_KEY_weight, 5));
+    EXPECT_EQ("success", group_set(TR_KEY_guaranteed_speed_up, 10));
+    EXPECT_EQ("success", group_set(TR_KEY_guaranteed_speed_down, 0));
+
+    EXPECT_NE("success", group_set(TR_KEY_weight, 0));
+    EXPECT_NE("success", group_set(TR_KEY_weight, -1));
+    EXPECT_NE("success", group_set(TR_KEY_weight, int64_t{ tr_bandwidth::MaxWeight } + 1));
+    EXPECT_NE("success", group_set(TR_KEY_guaranteed_speed_up, -1));
+    EXPECT_NE("success", group_set(TR_KEY_guaranteed_speed_down, -10));
+
+    // rejected requests don't change anything
+    auto const& group = session_->getBandwidthGroup("group");
+    EXPECT_EQ(5U, group.weight());
+    EXPECT_EQ(tr_toSpeedBytes(10U), group.get_guaranteed_speed_bytes_per_second(TR_UP));
+    EXPECT_EQ(0U, group.get_guaranteed_speed_bytes_per_second(TR_DOWN));
+}
+
 } // namespace libtransmission::test
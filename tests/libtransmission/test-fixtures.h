@@ -505,6 +505,15 @@ protected:
 
     tr_session* session_ = nullptr;
 
+    using UdpAPI = tr_session::tr_udp_core::API;
+
+    // A UDP core of its own, whose syscalls go through `api`.
+    // Create and destroy it in the session thread.
+    [[nodiscard]] auto makeUdpCore(tr_port udp_port, UdpAPI& api)
+    {
+        return std::make_unique<tr_session::tr_udp_core>(*session_, udp_port, api);
+    }
+
     tr_variant* settings()
     {
         if (!settings_)
@@ -0,0 +1,120 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef> // size_t
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <event2/util.h>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/net.h>
+#include <libtransmission/session.h>
+
+#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using UdpTest = libtransmission::test::SessionTest;
+
+TEST_F(UdpTest, partialSendsAreRetried)
+{
+    // the kernel takes one message per sendmmsg() call
+    struct OneAtATimeApi final : public UdpAPI
+    {
+        int sendmmsg(tr_socket_t sock, mmsghdr* msgs, unsigned int n_msgs, int flags) override
+        {
+            return UdpAPI::sendmmsg(sock, msgs, std::min(n_msgs, 1U), flags);
+        }
+    };
+
+    // a socket bound to a free loopback port
+    struct BoundSocket
+    {
+        tr_socket_t sock;
+        sockaddr_storage ss;
+        socklen_t sslen;
+    };
+    auto const make_socket = []()
+    {
+        auto const sock = socket(AF_INET, SOCK_DGRAM, 0);
+        EXPECT_NE(TR_BAD_SOCKET, sock);
+        auto const loopback = *tr_address::from_string("127.0.0.1");
+        auto [ss, sslen] = tr_socket_address::to_sockaddr(loopback, tr_port{});
+        EXPECT_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&ss), sslen));
+        EXPECT_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&ss), &sslen));
+        return BoundSocket{ sock, ss, sslen };
+    };
+
+    // a socket for the core to send to
+    auto const dest = make_socket();
+    evutil_make_socket_nonblocking(dest.sock);
+
+    // a free port for the core to send from
+    auto const unused = make_socket();
+    auto const core_port = tr_socket_address::from_sockaddr(reinterpret_cast<sockaddr const*>(&unused.ss))->port();
+    tr_net_close_socket(unused.sock);
+
+    // different sizes, so they aren't merged into one GSO message
+    auto const payloads = std::vector<std::string>{ std::string(10U, 'a'), std::string(20U, 'b'), std::string(30U, 'c') };
+
+    auto api = OneAtATimeApi{};
+    auto has_socket = false;
+    auto done = std::atomic<bool>{};
+    session_->runInSessionThread(
+        [&]()
+        {
+            auto core = makeUdpCore(core_port, api);
+            has_socket = core->socket4() != TR_BAD_SOCKET;
+
+            for (auto const& payload : payloads)
+            {
+                core->sendto(std::data(payload), std::size(payload), reinterpret_cast<sockaddr const*>(&dest.ss), dest.sslen);
+            }
+
+            // a partial send doesn't set errno, so it may hold anything
+            errno = EINVAL;
+            core->flush();
+
+            core.reset();
+            done = true;
+        });
+    EXPECT_TRUE(libtransmission::test::waitFor([&]() { return done.load(); }, 5000));
+
+    if (!has_socket)
+    {
+        tr_net_close_socket(dest.sock);
+        GTEST_SKIP() << "couldn't bind an IPv4 UDP socket";
+    }
+
+    // all of them arrive, in order
+    auto received = std::vector<std::string>{};
+    EXPECT_TRUE(libtransmission::test::waitFor(
+        [&]()
+        {
+            auto buf = std::array<char, 64U>{};
+            if (auto const n = recv(dest.sock, std::data(buf), std::size(buf), 0); n > 0)
+            {
+                received.emplace_back(std::data(buf), static_cast<size_t>(n));
+            }
+
+            return std::size(received) == std::size(payloads);
+        },
+        5000));
+    EXPECT_EQ(payloads, received);
+
+    tr_net_close_socket(dest.sock);
+}
@@ -0,0 +1,519 @@
+// This file Copyright (C) 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef> // size_t, std::byte
+#include <cstdint> // uint32_t, uint64_t
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/crypto-utils.h>
+#include <libtransmission/file.h>
+#include <libtransmission/makemeta.h>
+#include <libtransmission/torrent-metainfo.h>
+#include <libtransmission/tr-strbuf.h>
+#include <libtransmission/verify.h>
+
+#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission::test
+{
+
+class VerifyTest : public SandboxedTest
+{
+protected:
+    ~VerifyTest() override
+    {
+        // stop its threads before the state they report to goes away
+        worker_.reset();
+    }
+
+    // what a torrent's verify reported
+    struct Result
+    {
+        std::vector<bool> has_piece;
+        tr_piece_index_t n_checked = 0U;
+        bool in_order = true;
+        bool started = false;
+        std::optional<bool> aborted;
+        std::thread::id device_thread;
+    };
+
+    class Mediator final : public tr_verify_worker::Mediator
+    {
+    public:
+        Mediator(VerifyTest& test, size_t idx, tr_torrent_metainfo metainfo, std::optional<std::string> device)
+            : test_{ test }
+            , idx_{ idx }
+            , metainfo_{ std::move(metainfo) }
+            , device_{ std::move(device) }
+        {
+        }
+
+        [[nodiscard]] tr_torrent_metainfo const& metainfo() const override
+        {
+            return metainfo_;
+        }
+
+        [[nodiscard]] std::optional<std::string> find_file(tr_file_index_t file_index) const override
+        {
+            auto filename = tr_pathbuf{ test_.sandboxDir(), '/', metainfo_.file_subpath(file_index) };
+            if (!tr_sys_path_exists(filename))
+            {
+                return {};
+            }
+
+            return std::string{ filename.sv() };
+        }
+
+        [[nodiscard]] std::string device() const override
+        {
+            {
+                auto const lock = std::lock_guard{ test_.mutex_ };
+                test_.results_[idx_].device_thread = std::this_thread::get_id();
+            }
+
+            return device_ ? *device_ : tr_verify_worker::Mediator::device();
+        }
+
+        void on_verify_queued() override
+        {
+        }
+
+        void on_verify_started() override
+        {
+            auto const lock = std::lock_guard{ test_.mutex_ };
+            test_.results_[idx_].started = true;
+            test_.max_running_ = std::max(test_.max_running_, ++test_.n_running_);
+        }
+
+        void on_pieces_checked(tr_piece_index_t begin_piece, std::vector<bool> has_pieces) override
+        {
+            test_.hold();
+
+            auto const lock = std::lock_guard{ test_.mutex_ };
+            auto& result = test_.results_[idx_];
+            result.in_order = result.in_order && begin_piece == result.n_checked;
+            for (size_t i = 0, n = std::size(has_pieces); i < n; ++i)
+            {
+                result.has_piece[begin_piece + i] = has_pieces[i];
+            }
+            result.n_checked = begin_piece + std::size(has_pieces);
+        }
+
+        void on_verify_done(bool aborted) override
+        {
+            auto const lock = std::lock_guard{ test_.mutex_ };
+            auto& result = test_.results_[idx_];
+            if (result.started)
+            {
+                --test_.n_running_;
+            }
+            result.aborted = aborted;
+            test_.cv_.notify_all();
+        }
+
+    private:
+        VerifyTest& test_;
+        size_t const idx_;
+        tr_torrent_metainfo const metainfo_;
+        std::optional<std::string> const device_;
+    };
+
+    // Write `file_sizes` worth of random data into a torrent named `name`.
+    // @return the data, one vector per file
+    std::vector<std::vector<std::byte>> makeFiles(std::string_view name, std::vector<size_t> const& file_sizes) const
+    {
+        auto contents = std::vector<std::vector<std::byte>>{};
+
+        for (size_t i = 0, n = std::size(file_sizes); i < n; ++i)
+        {
+            auto& payload = contents.emplace_back(file_sizes[i]);
+            tr_rand_buffer(std::data(payload), std::size(payload));
+            createFileWithContents(filename(name, i), std::data(payload), std::size(payload));
+        }
+
+        return contents;
+    }
+
+    [[nodiscard]] std::string filename(std::string_view name, size_t file_index) const
+    {
+        return fmt::format("{:s}/{:s}/file{:d}", sandboxDir(), name, file_index);
+    }
+
+    [[nodiscard]] tr_torrent_metainfo makeMetainfo(std::string_view name, uint32_t piece_size) const
+    {
+        auto builder = tr_metainfo_builder{ tr_pathbuf{ sandboxDir(), '/', name } };
+        EXPECT_TRUE(builder.set_piece_size(piece_size));
+        EXPECT_EQ(nullptr, builder.make_checksums().get());
+
+        auto metainfo = tr_torrent_metainfo{};
+        EXPECT_TRUE(metainfo.parse_benc(builder.benc()));
+        return metainfo;
+    }
+
+    // @return the index of the torrent's entry in `results_`
+    size_t add(tr_torrent_metainfo metainfo, std::optional<std::string> device = {}, tr_priority_t priority = TR_PRI_NORMAL)
+    {
+        auto idx = size_t{};
+
+        {
+            auto const lock = std::lock_guard{ mutex_ };
+            idx = std::size(results_);
+            results_.emplace_back().has_piece.resize(metainfo.piece_count());
+        }
+
+        worker_->add(std::make_unique<Mediator>(*this, idx, std::move(metainfo), std::move(device)), priority);
+        return idx;
+    }
+
+    Result waitForResult(size_t idx)
+    {
+        auto lock = std::unique_lock{ mutex_ };
+        EXPECT_TRUE(cv_.wait_for(lock, 30s, [this, idx]() { return results_[idx].aborted.has_value(); }));
+        return results_[idx];
+    }
+
+    [[nodiscard]] Result currentResult(size_t idx) const
+    {
+        auto const lock = std::lock_guard{ mutex_ };
+        return results_[idx];
+    }
+
+    [[nodiscard]] size_t nRunning() const
+    {
+        auto const lock = std::lock_guard{ mutex_ };
+        return n_running_;
+    }
+
+    [[nodiscard]] size_t maxRunning() const
+    {
+        auto const lock = std::lock_guard{ mutex_ };
+        return max_running_;
+    }
+
+    // While closed, verify threads block when they report pieces.
+    void setGateOpen(bool is_open)
+    {
+        {
+            auto const lock = std::lock_guard{ mutex_ };
+            gate_open_ = is_open;
+        }
+
+        cv_.notify_all();
+    }
+
+    [[nodiscard]] size_t nHeld() const
+    {
+        auto const lock = std::lock_guard{ mutex_ };
+        return n_held_;
+    }
+
+    void hold()
+    {
+        auto lock = std::unique_lock{ mutex_ };
+        ++n_held_;
+        cv_.notify_all();
+        cv_.wait(lock, [this]() { return gate_open_; });
+        --n_held_;
+    }
+
+    std::unique_ptr<tr_verify_worker> worker_ = std::make_unique<tr_verify_worker>();
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Result> results_;
+    size_t n_running_ = 0U;
+    size_t max_running_ = 0U;
+    size_t n_held_ = 0U;
+    bool gate_open_ = true;
+};
+
+TEST_F(VerifyTest, goodPiecesPass)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+
+    // files that don't line up with piece boundaries
+    makeFiles("good", { 10000U, 50000U, 123457U });
+    auto const metainfo = makeMetainfo("good", PieceSize);
+
+    for (auto const n_hash_threads : { 0U, 1U, 4U })
+    {
+        worker_->set_hash_thread_count(n_hash_threads);
+
+        auto const result = waitForResult(add(metainfo));
+        EXPECT_FALSE(*result.aborted);
+        EXPECT_TRUE(result.in_order);
+        EXPECT_EQ(metainfo.piece_count(), result.n_checked);
+        EXPECT_EQ(std::vector<bool>(metainfo.piece_count(), true), result.has_piece) << "n_hash_threads " << n_hash_threads;
+    }
+}
+
+TEST_F(VerifyTest, corruptPiecesFail)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+    static auto constexpr BadPiece = tr_piece_index_t{ 3U };
+
+    auto contents = makeFiles("corrupt", { PieceSize * 8U + 1U });
+    auto const metainfo = makeMetainfo("corrupt", PieceSize);
+
+    auto& payload = contents.front();
+    payload[BadPiece * PieceSize + 10U] ^= std::byte{ 0xFF };
+    createFileWithContents(filename("corrupt", 0U), std::data(payload), std::size(payload));
+
+    for (auto const n_hash_threads : { 0U, 2U })
+    {
+        worker_->set_hash_thread_count(n_hash_threads);
+
+        auto expected = std::vector<bool>(metainfo.piece_count(), true);
+        expected[BadPiece] = false;
+
+        auto const result = waitForResult(add(metainfo));
+        EXPECT_FALSE(*result.aborted);
+        EXPECT_EQ(expected, result.has_piece) << "n_hash_threads " << n_hash_threads;
+    }
+}
+
+TEST_F(VerifyTest, piecesSpanningChunks)
+{
+    // Pieces are read in chunks of about 4 MiB, and a piece that's bigger
+    // than that gets a chunk to itself. Break the pieces on either side of
+    // the first chunk boundary, and have pieces straddle the two files.
+    static auto constexpr ChunkSize = uint32_t{ 4U * 1024U * 1024U };
+
+    for (auto const piece_size : { uint32_t{ 1024U * 1024U }, uint32_t{ 8U * 1024U * 1024U } })
+    {
+        auto const name = fmt::format("spanning-{:d}", piece_size);
+        auto const file_size = size_t{ 17U * 1024U * 1024U + 1234U };
+        auto contents = makeFiles(name, { file_size / 2U, file_size - file_size / 2U });
+        auto const metainfo = makeMetainfo(name, piece_size);
+        auto const n_pieces = metainfo.piece_count();
+
+        auto expected = std::vector<bool>(n_pieces, true);
+        auto const pieces_per_chunk = std::max(uint32_t{ 1U }, ChunkSize / piece_size);
+        for (auto const piece : { pieces_per_chunk - 1U, pieces_per_chunk })
+        {
+            // both pieces start in the first file
+            auto& payload = contents.front();
+            payload[size_t{ piece } * piece_size] ^= std::byte{ 0xFF };
+            expected[piece] = false;
+        }
+        createFileWithContents(filename(name, 0U), std::data(contents.front()), std::size(contents.front()));
+
+        auto const result = waitForResult(add(metainfo));
+        EXPECT_FALSE(*result.aborted);
+        EXPECT_TRUE(result.in_order);
+        EXPECT_EQ(n_pieces, result.n_checked);
+        EXPECT_EQ(expected, result.has_piece) << "piece_size " << piece_size;
+    }
+}
+
+TEST_F(VerifyTest, unreadableFilesFail)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+
+    // each file is a whole number of pieces long
+    auto contents = makeFiles("unreadable", { PieceSize * 2U, PieceSize * 2U, PieceSize * 2U, PieceSize * 3U, PieceSize });
+    auto const metainfo = makeMetainfo("unreadable", PieceSize);
+    ASSERT_EQ(10U, metainfo.piece_count());
+
+    // file1 is missing
+    EXPECT_TRUE(tr_sys_path_remove(filename("unreadable", 1U)));
+
+    // file2 is a directory
+    EXPECT_TRUE(tr_sys_path_remove(filename("unreadable", 2U)));
+    EXPECT_TRUE(tr_sys_dir_create(filename("unreadable", 2U), 0, 0700));
+
+    // file3 is truncated halfway through its second piece
+    createFileWithContents(filename("unreadable", 3U), std::data(contents[3]), PieceSize + PieceSize / 2U);
+
+    auto const expected = std::vector<bool>{ true, true, false, false, false, false, true, false, false, true };
+    for (auto const n_hash_threads : { 0U, 2U })
+    {
+        worker_->set_hash_thread_count(n_hash_threads);
+
+        auto const result = waitForResult(add(metainfo));
+        EXPECT_FALSE(*result.aborted);
+        EXPECT_EQ(expected, result.has_piece) << "n_hash_threads " << n_hash_threads;
+    }
+}
+
+TEST_F(VerifyTest, abortInMiddleOfChunk)
+{
+    static auto constexpr PieceSize = uint32_t{ 256U * 1024U };
+
+    // several chunks' worth of pieces
+    makeFiles("abort", { 13U * 1024U * 1024U });
+    auto const metainfo = makeMetainfo("abort", PieceSize);
+
+    // stop the verify thread while it's reporting its first chunk
+    setGateOpen(false);
+    auto const idx = add(metainfo);
+    ASSERT_TRUE(waitFor([this]() { return nHeld() == 1U; }, 5000));
+
+    auto remover = std::thread{ [this, &metainfo]() { worker_->remove(metainfo.info_hash()); } };
+
+    // give remove() time to flag the abort before letting the thread go
+    std::this_thread::sleep_for(100ms);
+    EXPECT_FALSE(currentResult(idx).aborted);
+    setGateOpen(true);
+    remover.join();
+
+    // remove() doesn't return until the verify thread is done
+    auto const after = currentResult(idx);
+    ASSERT_TRUE(after.aborted);
+    EXPECT_TRUE(*after.aborted);
+    EXPECT_TRUE(after.in_order);
+    EXPECT_LT(after.n_checked, metainfo.piece_count());
+}
+
+TEST_F(VerifyTest, removeQueuedTorrent)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+
+    makeFiles("first", { PieceSize * 4U });
+    makeFiles("second", { PieceSize * 4U });
+    auto const first = makeMetainfo("first", PieceSize);
+    auto const second = makeMetainfo("second", PieceSize);
+
+    // both on the same device, so `second` waits for `first`
+    setGateOpen(false);
+    auto const first_idx = add(first, "disk"s);
+    ASSERT_TRUE(waitFor([this]() { return nHeld() == 1U; }, 5000));
+    auto const second_idx = add(second, "disk"s);
+
+    worker_->remove(second.info_hash());
+    auto const second_result = currentResult(second_idx);
+    EXPECT_FALSE(second_result.started);
+    ASSERT_TRUE(second_result.aborted);
+    EXPECT_TRUE(*second_result.aborted);
+
+    setGateOpen(true);
+    auto const first_result = waitForResult(first_idx);
+    EXPECT_FALSE(*first_result.aborted);
+    EXPECT_EQ(std::vector<bool>(first.piece_count(), true), first_result.has_piece);
+}
+
+TEST_F(VerifyTest, deviceIsLookedUpInVerifyThread)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+
+    makeFiles("device-lookup", { PieceSize * 2U });
+
+    // looking up the device may touch the filesystem, so add() doesn't do it
+    auto const idx = add(makeMetainfo("device-lookup", PieceSize));
+    auto const result = waitForResult(idx);
+    EXPECT_FALSE(*result.aborted);
+    EXPECT_NE(std::thread::id{}, result.device_thread);
+    EXPECT_NE(std::this_thread::get_id(), result.device_thread);
+}
+
+TEST_F(VerifyTest, sameDeviceVerifiesOneAtATime)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+    static auto constexpr NumTorrents = size_t{ 3U };
+
+    setGateOpen(false);
+
+    auto indices = std::vector<size_t>{};
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto const name = fmt::format("same-device-{:d}", i);
+        makeFiles(name, { PieceSize * (i + 1U) });
+        indices.push_back(add(makeMetainfo(name, PieceSize), "disk"s));
+    }
+
+    ASSERT_TRUE(waitFor([this]() { return nHeld() == 1U; }, 5000));
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(1U, nRunning());
+
+    setGateOpen(true);
+    for (auto const idx : indices)
+    {
+        auto const result = waitForResult(idx);
+        EXPECT_FALSE(*result.aborted);
+    }
+
+    EXPECT_EQ(1U, maxRunning());
+}
+
+TEST_F(VerifyTest, differentDevicesVerifyInParallel)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+    static auto constexpr NumTorrents = tr_verify_worker::MaxConcurrentVerifies + 2U;
+
+    setGateOpen(false);
+
+    auto indices = std::vector<size_t>{};
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto const name = fmt::format("other-device-{:d}", i);
+        makeFiles(name, { PieceSize * (i + 1U) });
+        indices.push_back(add(makeMetainfo(name, PieceSize), fmt::format("disk{:d}", i)));
+    }
+
+    // no more than MaxConcurrentVerifies at once, even on different devices
+    ASSERT_TRUE(waitFor([this]() { return nHeld() == tr_verify_worker::MaxConcurrentVerifies; }, 5000));
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(tr_verify_worker::MaxConcurrentVerifies, nRunning());
+
+    setGateOpen(true);
+    for (auto const idx : indices)
+    {
+        auto const result = waitForResult(idx);
+        EXPECT_FALSE(*result.aborted);
+        EXPECT_EQ(std::vector<bool>(std::size(result.has_piece), true), result.has_piece);
+    }
+
+    EXPECT_EQ(tr_verify_worker::MaxConcurrentVerifies, maxRunning());
+}
+
+TEST_F(VerifyTest, destructorWaitsForVerifies)
+{
+    static auto constexpr PieceSize = uint32_t{ 16U * 1024U };
+    static auto constexpr NumTorrents = size_t{ 3U };
+
+    setGateOpen(false);
+
+    auto indices = std::vector<size_t>{};
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto const name = fmt::format("destructor-{:d}", i);
+        makeFiles(name, { PieceSize * 2U });
+        indices.push_back(add(makeMetainfo(name, PieceSize), fmt::format("disk{:d}", i)));
+    }
+
+    ASSERT_TRUE(waitFor([this]() { return nHeld() == NumTorrents; }, 5000));
+
+    auto destroyer = std::thread{ [this]() { worker_.reset(); } };
+    std::this_thread::sleep_for(100ms);
+    setGateOpen(true);
+    destroyer.join();
+
+    // every verify thread has finished by the time the worker is gone
+    for (auto const idx : indices)
+    {
+        EXPECT_TRUE(currentResult(idx).aborted.has_value());
+    }
+    EXPECT_EQ(0U, nRunning());
+}
+
+} // namespace libtransmission::test
@@ -0,0 +1,196 @@
+// This file Copyright © 2023 Mnemosyne LLC.
+// It may be used under GPLv2 (SPDX: GPL-2.0-only), GPLv3 (SPDX: GPL-3.0-only),
+// or any future license endorsed by Mnemosyne LLC.
+// License text can be found in the licenses/ folder.
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <libtransmission/transmission.h>
+
+#include <libtransmission/file.h>
+#include <libtransmission/session.h>
+#include <libtransmission/tr-strbuf.h>
+#include <libtransmission/worker-pool.h>
+
+#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using WorkerPoolTest = libtransmission::test::SessionTest;
+
+TEST_F(WorkerPoolTest, runsWorkInWorkerThreads)
+{
+    auto& disk_io = session_->disk_io();
+    disk_io.set_thread_count(2U);
+    EXPECT_EQ(2U, disk_io.thread_count());
+
+    auto session_thread_id = std::atomic<std::thread::id>{};
+    session_->runInSessionThread([&]() { session_thread_id = std::this_thread::get_id(); });
+    EXPECT_TRUE(libtransmission::test::waitFor([&]() { return session_thread_id.load() != std::thread::id{}; }, 5000));
+
+    auto const main_thread_id = std::this_thread::get_id();
+    auto n_work_in_worker_thread = std::atomic<size_t>{};
+    auto n_done_in_session_thread = std::atomic<size_t>{};
+    auto n_done = std::atomic<size_t>{};
+
+    static auto constexpr NJobs = size_t{ 100U };
+    for (size_t i = 0; i < NJobs; ++i)
+    {
+        disk_io.submit(
+            [&]()
+            {
+                if (auto const id = std::this_thread::get_id(); id != main_thread_id && id != session_thread_id.load())
+                {
+                    ++n_work_in_worker_thread;
+                }
+                return 0;
+            },
+            [&](int err)
+            {
+                EXPECT_EQ(0, err);
+                if (std::this_thread::get_id() == session_thread_id.load())
+                {
+                    ++n_done_in_session_thread;
+                }
+                ++n_done;
+            });
+    }
+
+    disk_io.wait_idle();
+    EXPECT_EQ(0U, disk_io.pending());
+    EXPECT_TRUE(libtransmission::test::waitFor([&]() { return n_done == NJobs; }, 5000));
+    EXPECT_EQ(NJobs, n_work_in_worker_thread);
+    EXPECT_EQ(NJobs, n_done_in_session_thread);
+}
+
+TEST_F(WorkerPoolTest, waitIdleForOneTorrentDoesNotWaitForOthers)
+{
+    auto& disk_io = session_->disk_io();
+    disk_io.set_thread_count(2U);
+
+    static auto constexpr BusyTorrent = tr_torrent_id_t{ 1 };
+    static auto constexpr OtherTorrent = tr_torrent_id_t{ 2 };
+
+    auto release = std::atomic<bool>{};
+    auto busy_done = std::atomic<bool>{};
+    disk_io.submit(
+        [&]()
+        {
+            while (!release)
+            {
+                std::this_thread::yield();
+            }
+            busy_done = true;
+            return 0;
+        },
+        {},
+        BusyTorrent);
+
+    auto other_done = std::atomic<bool>{};
+    disk_io.submit(
+        [&]()
+        {
+            other_done = true;
+            return 0;
+        },
+        {},
+        OtherTorrent);
+
+    disk_io.wait_idle(OtherTorrent);
+    EXPECT_TRUE(other_done);
+    EXPECT_FALSE(busy_done);
+
+    release = true;
+    disk_io.wait_idle(BusyTorrent);
+    EXPECT_TRUE(busy_done);
+}
+
+TEST_F(WorkerPoolTest, passesErrorsToDone)
+{
+    auto& disk_io = session_->disk_io();
+    disk_io.set_thread_count(1U);
+
+    auto result = std::atomic<int>{};
+    auto done = std::atomic<bool>{};
+    disk_io.submit(
+        []() { return ENOSPC; },
+        [&](int err)
+        {
+            result = err;
+            done = true;
+        });
+
+    EXPECT_TRUE(libtransmission::test::waitFor([&]() { return done.load(); }, 5000));
+    EXPECT_EQ(ENOSPC, result);
+}
+
+TEST_F(WorkerPoolTest, runsOps)
+{
+    auto& disk_io = session_->disk_io();
+    disk_io.set_thread_count(2U);
+
+    auto const path = tr_pathbuf{ sandboxDir(), "/test-file" };
+    auto const fd = tr_sys_file_open(path, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+
+    static auto constexpr NJobs = size_t{ 50U };
+    static auto constexpr BufSize = size_t{ 512U };
+    auto bufs = std::vector<std::array<uint8_t, BufSize>>(NJobs);
+    auto n_done = std::atomic<size_t>{};
+    for (size_t i = 0; i < NJobs; ++i)
+    {
+        bufs[i].fill(static_cast<uint8_t>(i));
+
+        auto ops = std::make_shared<tr_worker_pool::Ops>(1U);
+        auto& op = ops->front();
+        op.handle = fd;
+        op.buffer = std::data(bufs[i]);
+        op.size = BufSize;
+        op.offset = i * BufSize;
+        op.is_write = true;
+
+        disk_io.submit(
+            std::move(ops),
+            [&](int err)
+            {
+                EXPECT_EQ(0, err);
+                ++n_done;
+            });
+    }
+
+    EXPECT_TRUE(libtransmission::test::waitFor([&]() { return n_done == NJobs; }, 5000));
+
+    auto const info = tr_sys_path_get_info(path);
+    EXPECT_TRUE(info.has_value());
+    EXPECT_EQ(NJobs * BufSize, info.value_or(tr_sys_path_info{}).size);
+
+    tr_sys_file_close(fd);
+}
+
+TEST_F(WorkerPoolTest, zeroThreadsRunsInline)
+{
+    auto& disk_io = session_->disk_io();
+    disk_io.set_thread_count(0U);
+    EXPECT_EQ(0U, disk_io.thread_count());
+
+    auto const main_thread_id = std::this_thread::get_id();
+    auto work_thread_id = std::thread::id{};
+    auto result = int{};
+    disk_io.submit(
+        [&]()
+        {
+            work_thread_id = std::this_thread::get_id();
+            return EIO;
+        },
+        [&](int err) { result = err; });
+
+    EXPECT_EQ(main_thread_id, work_thread_id);
+    EXPECT_EQ(EIO, result);
+}